@@ -1,14 +1,21 @@
 #include "app.h"
 
-App::App(int width, int height, bool debug)
+App::App(int width, int height, bool debug, uint32_t msaaSamples, int windowCount, bool parallelStartup, const std::string& devicePreference)
 {
-	build_glfw_window(width, height, debug);
+	window = build_glfw_window(width, height, debug);
 
-	graphicsEngine = new Engine(width, height, window, appName, debug);
+	graphicsEngine = new Engine(width, height, window, appName, debug, msaaSamples, parallelStartup, devicePreference);
+
+	for (int ii = 1; ii < windowCount; ii++)
+	{
+		GLFWwindow* extraWindow = build_glfw_window(width, height, debug);
+		extraWindows.push_back(extraWindow);
+		extraHandles.push_back(extraWindow ? graphicsEngine->attach_window(extraWindow) : UINT32_MAX);
+	}
 }
 
 
-void App::build_glfw_window(int width, int height, bool debugMode)
+GLFWwindow* App::build_glfw_window(int width, int height, bool debugMode)
 {
 	// initialize glfw
 	glfwInit();
@@ -20,7 +27,8 @@ void App::build_glfw_window(int width, int height, bool debugMode)
 	glfwWindowHint(GLFW_RESIZABLE, GLFW_FALSE);
 
 	// width, height, title, monitor, another window that want to share resources with
-	if (window = glfwCreateWindow(width, height, appName, nullptr, nullptr))
+	GLFWwindow* window = glfwCreateWindow(width, height, appName, nullptr, nullptr);
+	if (window)
 	{
 		if (debugMode)
 		{
@@ -34,17 +42,74 @@ void App::build_glfw_window(int width, int height, bool debugMode)
 			std::cout << "GLFW Window creation failed :/\n";
 		}
 	}
+
+	return window;
 }
 
 
 void App::run()
 {
+	// GLFW wants events on the main thread, so the simulation stays here and rendering gets its own thread
+	std::atomic<bool> running{ true };
+	std::thread renderThread([this, &running]()
+		{
+			while (running)
+			{
+				graphicsEngine->render();
+			}
+		});
+
 	while (!glfwWindowShouldClose(window))
 	{
 		glfwPollEvents();
-		graphicsEngine->render();
+
+		// The surface outlives the detach by a frame, so the window is only hidden
+		for (size_t ii = 0; ii < extraWindows.size(); ii++)
+		{
+			if (extraHandles[ii] != UINT32_MAX && glfwWindowShouldClose(extraWindows[ii]))
+			{
+				graphicsEngine->detach_window(extraHandles[ii]);
+				extraHandles[ii] = UINT32_MAX;
+				glfwHideWindow(extraWindows[ii]);
+			}
+		}
+
+		graphicsEngine->simulate();
 		calculateFrameRate();
 	}
+
+	running = false;
+	renderThread.join();
+}
+
+
+void App::benchmark_async_compute()
+{
+	graphicsEngine->benchmark_async_compute();
+}
+
+
+void App::benchmark_depth_prepass()
+{
+	graphicsEngine->benchmark_depth_prepass();
+}
+
+
+void App::benchmark_transient_aliasing()
+{
+	graphicsEngine->benchmark_transient_aliasing();
+}
+
+
+void App::benchmark_render_thread()
+{
+	graphicsEngine->benchmark_render_thread();
+}
+
+
+void App::benchmark_draw_dispatch()
+{
+	graphicsEngine->benchmark_draw_dispatch();
 }
 
 
@@ -55,6 +120,11 @@ void App::calculateFrameRate()
 
 	if (delta >= 1)
 	{
+		// Counted on the render thread, this loop only simulates
+		uint64_t renderedFrames = graphicsEngine->fresh_frames();
+		numFrames = static_cast<int>(renderedFrames - lastRenderedFrames);
+		lastRenderedFrames = renderedFrames;
+
 		int framerate{ std::max(1, int(numFrames / delta)) };
 
 		std::stringstream title;
@@ -62,15 +132,13 @@ void App::calculateFrameRate()
 		glfwSetWindowTitle(window, title.str().c_str());
 
 		lastTime = currentTime;
-		numFrames = -1; // Will be incremented right after this if block
 		frameTime = float(1000.0 / framerate); // seconds per frame * 1000 to get ms
 	}
-
-	numFrames++;
 }
 
 
 App::~App()
 {
+	// The engine destroys the surfaces, then glfwTerminate takes every window with it
 	delete graphicsEngine;
 }
\ No newline at end of file
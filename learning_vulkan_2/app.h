@@ -10,18 +10,37 @@ private:
 	Engine* graphicsEngine;
 	GLFWwindow* window;
 
+	// windows past the first and their engine handles, closed ones are hidden until glfwTerminate
+	std::vector<GLFWwindow*> extraWindows;
+	std::vector<uint32_t> extraHandles;
+
 	double lastTime, currentTime;
 	int numFrames;
+	uint64_t lastRenderedFrames = 0;
 	float frameTime;
 
 	const char* appName = "Hridiza's Vulkan App";
 
-	void build_glfw_window(int width, int height, bool debugMode);
+	GLFWwindow* build_glfw_window(int width, int height, bool debugMode);
 
 	void calculateFrameRate();
 
 public:
-	App(int width, int height, bool debug);
+	App(int width, int height, bool debug, uint32_t msaaSamples = 4, int windowCount = 1, bool parallelStartup = true,
+		const std::string& devicePreference = "");
 	~App();
 	void run();
+
+	// Runs the engine's async compute benchmark instead of the render loop
+	void benchmark_async_compute();
+
+	// Runs the engine's depth prepass benchmark instead of the render loop
+	void benchmark_depth_prepass();
+	void benchmark_transient_aliasing();
+
+	// Runs the engine's render thread benchmark instead of the render loop
+	void benchmark_render_thread();
+
+	// Runs the engine's draw dispatch benchmark instead of the render loop
+	void benchmark_draw_dispatch();
 };
\ No newline at end of file
@@ -0,0 +1,177 @@
+#pragma once
+
+#include "config.h"
+#include "memory.h"
+#include "startup_profiler.h"
+#include "result.h"
+
+
+namespace vkUtil
+{
+	// Render target that only lives inside render passes, e.g. the MSAA color target or the depth buffer
+	struct Attachment
+	{
+		vk::Image image{ nullptr };
+		vk::DeviceMemory memory{ nullptr };
+		vk::ImageView view{ nullptr };
+		vk::Format format;
+		vk::SampleCountFlagBits samples = vk::SampleCountFlagBits::e1;
+
+		// on tilers lazily allocated memory is never backed if the attachment stays in tile memory
+		bool lazilyAllocated = false;
+	};
+
+	struct attachmentInput
+	{
+		vk::Device logicalDevice;
+		const DeviceContext* deviceContext;
+		vk::Format format;
+		vk::Extent2D extent;
+		vk::SampleCountFlagBits samples;
+		vk::ImageUsageFlags usage;
+		vk::ImageAspectFlags aspect;
+	};
+
+
+	// Highest sample count the device can render color and depth to, not above the requested one
+	inline vk::SampleCountFlagBits choose_sample_count(const DeviceContext& deviceContext, uint32_t requested, bool debug)
+	{
+		const vk::PhysicalDeviceLimits& limits = deviceContext.limits();
+		vk::SampleCountFlags supported = limits.framebufferColorSampleCounts & limits.framebufferDepthSampleCounts;
+
+		vk::SampleCountFlagBits chosen = vk::SampleCountFlagBits::e1;
+		for (vk::SampleCountFlagBits samples : { vk::SampleCountFlagBits::e2, vk::SampleCountFlagBits::e4,
+			vk::SampleCountFlagBits::e8, vk::SampleCountFlagBits::e16, vk::SampleCountFlagBits::e32, vk::SampleCountFlagBits::e64 })
+		{
+			if (static_cast<uint32_t>(samples) <= requested && (supported & samples))
+			{
+				chosen = samples;
+			}
+		}
+
+		if (debug)
+		{
+			std::cout << "Requested " << requested << "x MSAA, using " << static_cast<uint32_t>(chosen) << "x\n";
+		}
+
+		return chosen;
+	}
+
+
+	// Reversed-Z wants a float depth buffer, precision is spread evenly over distance that way.
+	// Returns eUndefined if the device has no float depth attachments.
+	inline vk::Format choose_depth_format(const DeviceContext& deviceContext, bool debug)
+	{
+		for (vk::Format format : { vk::Format::eD32Sfloat, vk::Format::eD32SfloatS8Uint })
+		{
+			vk::FormatProperties properties = deviceContext.format_properties(format);
+			if (properties.optimalTilingFeatures & vk::FormatFeatureFlagBits::eDepthStencilAttachment)
+			{
+				if (debug)
+				{
+					std::cout << "Depth buffer format: " << vk::to_string(format) << "\n";
+				}
+				return format;
+			}
+		}
+
+		if (debug)
+		{
+			std::cout << "Device has no float depth format :/" << std::endl;
+		}
+		return vk::Format::eUndefined;
+	}
+
+
+	// The image is transient: it is cleared on load and dropped on store, so it never needs to reach memory
+	inline Attachment create_attachment(attachmentInput input, bool debug)
+	{
+		StartupProfiler::Scope timer("create_attachment");
+
+		Attachment attachment;
+		attachment.format = input.format;
+		attachment.samples = input.samples;
+
+		vk::ImageCreateInfo imageInfo = {};
+		imageInfo.imageType = vk::ImageType::e2D;
+		imageInfo.format = input.format;
+		imageInfo.extent = vk::Extent3D(input.extent.width, input.extent.height, 1);
+		imageInfo.mipLevels = 1;
+		imageInfo.arrayLayers = 1;
+		imageInfo.samples = input.samples;
+		imageInfo.tiling = vk::ImageTiling::eOptimal;
+		imageInfo.usage = input.usage | vk::ImageUsageFlagBits::eTransientAttachment;
+		imageInfo.sharingMode = vk::SharingMode::eExclusive;
+		imageInfo.initialLayout = vk::ImageLayout::eUndefined;
+
+		auto failed = [&]()
+		{
+			if (debug)
+			{
+				std::cout << "Failed to create attachment :/" << std::endl;
+			}
+			return attachment;
+		};
+
+		Expected<vk::Image> image = vk_call([&]() { return input.logicalDevice.createImage(imageInfo); });
+		if (!image)
+		{
+			return failed();
+		}
+		attachment.image = image.value();
+
+		// Desktop GPUs usually have no lazily allocated memory, plain device local memory does the same job there
+		vk::MemoryRequirements memoryRequirements = input.logicalDevice.getImageMemoryRequirements(attachment.image);
+		uint32_t memoryType = findMemoryTypeIndex(*input.deviceContext, memoryRequirements.memoryTypeBits,
+			vk::MemoryPropertyFlagBits::eDeviceLocal | vk::MemoryPropertyFlagBits::eLazilyAllocated);
+		attachment.lazilyAllocated = memoryType != UINT32_MAX;
+		if (!attachment.lazilyAllocated)
+		{
+			memoryType = findMemoryTypeIndex(*input.deviceContext, memoryRequirements.memoryTypeBits, vk::MemoryPropertyFlagBits::eDeviceLocal);
+		}
+
+		vk::MemoryAllocateInfo allocInfo = {};
+		allocInfo.allocationSize = memoryRequirements.size;
+		allocInfo.memoryTypeIndex = memoryType;
+		Expected<vk::DeviceMemory> memory = vk_call([&]() { return input.logicalDevice.allocateMemory(allocInfo); });
+		if (!memory)
+		{
+			return failed();
+		}
+		attachment.memory = memory.value();
+
+		if (!vk_call([&]() { return input.logicalDevice.bindImageMemory(attachment.image, attachment.memory, 0); }))
+		{
+			return failed();
+		}
+
+		vk::ImageViewCreateInfo viewInfo = {};
+		viewInfo.image = attachment.image;
+		viewInfo.viewType = vk::ImageViewType::e2D;
+		viewInfo.format = input.format;
+		viewInfo.subresourceRange = vk::ImageSubresourceRange(input.aspect, 0, 1, 0, 1);
+		Expected<vk::ImageView> view = vk_call([&]() { return input.logicalDevice.createImageView(viewInfo); });
+		if (!view)
+		{
+			return failed();
+		}
+		attachment.view = view.value();
+
+		if (debug)
+		{
+			std::cout << "Created " << static_cast<uint32_t>(input.samples) << "x attachment of " << input.extent.width << "x" << input.extent.height
+				<< (attachment.lazilyAllocated ? " in lazily allocated memory\n" : " in device local memory\n");
+		}
+
+		return attachment;
+	}
+
+
+	inline void destroy_attachment(vk::Device device, Attachment& attachment)
+	{
+		device.destroyImageView(attachment.view);
+		device.destroyImage(attachment.image);
+		device.freeMemory(attachment.memory);
+		attachment = Attachment();
+	}
+}
\ No newline at end of file
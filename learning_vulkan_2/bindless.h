@@ -0,0 +1,283 @@
+#pragma once
+
+#include "config.h"
+#include "device_context.h"
+#include "result.h"
+
+#include <algorithm>
+
+namespace vkUtil
+{
+	// Binding of each resource array in the bindless set, shaders declare the same numbers
+	constexpr uint32_t BINDLESS_TEXTURE_BINDING = 0;
+	constexpr uint32_t BINDLESS_STORAGE_BUFFER_BINDING = 1;
+	constexpr uint32_t BINDLESS_STORAGE_IMAGE_BINDING = 2;
+
+	// Upper bounds, clamped to the device's update-after-bind limits
+	constexpr uint32_t BINDLESS_MAX_TEXTURES = 16384;
+	constexpr uint32_t BINDLESS_MAX_STORAGE_BUFFERS = 4096;
+	constexpr uint32_t BINDLESS_MAX_STORAGE_IMAGES = 1024;
+
+	// Returned when a resource can't be added
+	constexpr uint32_t BINDLESS_INVALID_INDEX = UINT32_MAX;
+
+
+	// One descriptor set holding a large update-after-bind array per resource type.
+	// It is bound once per command buffer, draws pick their resources by index (material ID,
+	// object ID) in the shaders, so no per-draw binding is needed and draws can be batched.
+	// Slots are written as resources are added and only reused once the frames that could
+	// still read them have retired.
+	class BindlessHeap
+	{
+	public:
+		void init(vk::Device device, const DeviceContext& deviceContext, bool debug)
+		{
+			this->device = device;
+			this->debug = debug;
+
+			const vk::PhysicalDeviceVulkan12Properties& limits = deviceContext.vulkan12_properties();
+
+			// Leave a little room for any ordinary sets bound next to this one
+			// Combined image samplers count against both the sampler and the sampled image limits
+			uint32_t textureLimit = std::min({ limits.maxDescriptorSetUpdateAfterBindSampledImages, limits.maxPerStageDescriptorUpdateAfterBindSampledImages,
+				limits.maxDescriptorSetUpdateAfterBindSamplers, limits.maxPerStageDescriptorUpdateAfterBindSamplers });
+			uint32_t bufferLimit = std::min(limits.maxDescriptorSetUpdateAfterBindStorageBuffers, limits.maxPerStageDescriptorUpdateAfterBindStorageBuffers);
+			uint32_t imageLimit = std::min(limits.maxDescriptorSetUpdateAfterBindStorageImages, limits.maxPerStageDescriptorUpdateAfterBindStorageImages);
+
+			arrays[BINDLESS_TEXTURE_BINDING].capacity = std::min(BINDLESS_MAX_TEXTURES, textureLimit - std::min(textureLimit, 16u));
+			arrays[BINDLESS_STORAGE_BUFFER_BINDING].capacity = std::min(BINDLESS_MAX_STORAGE_BUFFERS, bufferLimit - std::min(bufferLimit, 16u));
+			arrays[BINDLESS_STORAGE_IMAGE_BINDING].capacity = std::min(BINDLESS_MAX_STORAGE_IMAGES, imageLimit - std::min(imageLimit, 16u));
+
+			arrays[BINDLESS_TEXTURE_BINDING].type = vk::DescriptorType::eCombinedImageSampler;
+			arrays[BINDLESS_STORAGE_BUFFER_BINDING].type = vk::DescriptorType::eStorageBuffer;
+			arrays[BINDLESS_STORAGE_IMAGE_BINDING].type = vk::DescriptorType::eStorageImage;
+
+
+			// Layout
+			std::array<vk::DescriptorSetLayoutBinding, 3> bindings;
+			std::array<vk::DescriptorBindingFlags, 3> bindingFlags;
+			std::array<vk::DescriptorPoolSize, 3> poolSizes;
+
+			for (uint32_t ii = 0; ii < 3; ii++)
+			{
+				bindings[ii] = vk::DescriptorSetLayoutBinding(ii, arrays[ii].type, arrays[ii].capacity,
+					vk::ShaderStageFlagBits::eAllGraphics | vk::ShaderStageFlagBits::eCompute);
+
+				// Partially bound: empty slots are fine as long as shaders don't read them
+				// Update unused while pending: new slots can be written while a frame using others is in flight
+				bindingFlags[ii] = vk::DescriptorBindingFlagBits::ePartiallyBound
+					| vk::DescriptorBindingFlagBits::eUpdateAfterBind
+					| vk::DescriptorBindingFlagBits::eUpdateUnusedWhilePending;
+
+				poolSizes[ii] = vk::DescriptorPoolSize(arrays[ii].type, arrays[ii].capacity);
+			}
+
+			vk::DescriptorSetLayoutBindingFlagsCreateInfo bindingFlagsInfo = {};
+			bindingFlagsInfo.bindingCount = static_cast<uint32_t>(bindingFlags.size());
+			bindingFlagsInfo.pBindingFlags = bindingFlags.data();
+
+			vk::DescriptorSetLayoutCreateInfo layoutInfo = {};
+			layoutInfo.pNext = &bindingFlagsInfo;
+			layoutInfo.flags = vk::DescriptorSetLayoutCreateFlagBits::eUpdateAfterBindPool;
+			layoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
+			layoutInfo.pBindings = bindings.data();
+
+
+			// Pool and the one set
+			vk::DescriptorPoolCreateInfo poolInfo = {};
+			poolInfo.flags = vk::DescriptorPoolCreateFlagBits::eUpdateAfterBind;
+			poolInfo.maxSets = 1;
+			poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
+			poolInfo.pPoolSizes = poolSizes.data();
+
+			auto failed = [&]()
+			{
+				if (debug)
+				{
+					std::cout << "Failed to create the bindless descriptor set :/" << std::endl;
+				}
+			};
+
+			Expected<vk::DescriptorSetLayout> createdLayout = vk_call([&]() { return device.createDescriptorSetLayout(layoutInfo); });
+			if (!createdLayout)
+			{
+				return failed();
+			}
+			setLayout = createdLayout.value();
+
+			Expected<vk::DescriptorPool> createdPool = vk_call([&]() { return device.createDescriptorPool(poolInfo); });
+			if (!createdPool)
+			{
+				return failed();
+			}
+			pool = createdPool.value();
+
+			Expected<std::vector<vk::DescriptorSet>> sets = vk_call([&]() { return device.allocateDescriptorSets(vk::DescriptorSetAllocateInfo(pool, 1, &setLayout)); });
+			if (!sets)
+			{
+				return failed();
+			}
+			set = sets.value()[0];
+
+			if (debug)
+			{
+				std::cout << "Bindless set: " << arrays[BINDLESS_TEXTURE_BINDING].capacity << " textures, "
+					<< arrays[BINDLESS_STORAGE_BUFFER_BINDING].capacity << " storage buffers, "
+					<< arrays[BINDLESS_STORAGE_IMAGE_BINDING].capacity << " storage images\n";
+			}
+		}
+
+
+		vk::DescriptorSetLayout layout() const
+		{
+			return setLayout;
+		}
+
+
+		// Once per command buffer, before the draws or dispatches that index into it
+		void bind(vk::CommandBuffer commandBuffer, vk::PipelineBindPoint bindPoint, vk::PipelineLayout pipelineLayout, uint32_t setIndex) const
+		{
+			commandBuffer.bindDescriptorSets(bindPoint, pipelineLayout, setIndex, 1, &set, 0, nullptr);
+		}
+
+
+		uint32_t add_texture(vk::ImageView view, vk::Sampler sampler, vk::ImageLayout layout = vk::ImageLayout::eShaderReadOnlyOptimal)
+		{
+			uint32_t index = take_slot(BINDLESS_TEXTURE_BINDING);
+			if (index != BINDLESS_INVALID_INDEX)
+			{
+				update_texture(index, view, sampler, layout);
+			}
+			return index;
+		}
+
+
+		uint32_t add_storage_buffer(vk::Buffer buffer, vk::DeviceSize offset = 0, vk::DeviceSize range = VK_WHOLE_SIZE)
+		{
+			uint32_t index = take_slot(BINDLESS_STORAGE_BUFFER_BINDING);
+			if (index != BINDLESS_INVALID_INDEX)
+			{
+				update_storage_buffer(index, buffer, offset, range);
+			}
+			return index;
+		}
+
+
+		uint32_t add_storage_image(vk::ImageView view)
+		{
+			uint32_t index = take_slot(BINDLESS_STORAGE_IMAGE_BINDING);
+			if (index != BINDLESS_INVALID_INDEX)
+			{
+				vk::DescriptorImageInfo imageInfo(nullptr, view, vk::ImageLayout::eGeneral);
+				write(BINDLESS_STORAGE_IMAGE_BINDING, index, &imageInfo, nullptr);
+			}
+			return index;
+		}
+
+
+		// Points an existing slot somewhere else, e.g. after a buffer was reallocated.
+		// Only while no frame in flight reads the slot.
+		void update_texture(uint32_t index, vk::ImageView view, vk::Sampler sampler, vk::ImageLayout layout = vk::ImageLayout::eShaderReadOnlyOptimal)
+		{
+			vk::DescriptorImageInfo imageInfo(sampler, view, layout);
+			write(BINDLESS_TEXTURE_BINDING, index, &imageInfo, nullptr);
+		}
+
+
+		void update_storage_buffer(uint32_t index, vk::Buffer buffer, vk::DeviceSize offset = 0, vk::DeviceSize range = VK_WHOLE_SIZE)
+		{
+			vk::DescriptorBufferInfo bufferInfo(buffer, offset, range);
+			write(BINDLESS_STORAGE_BUFFER_BINDING, index, nullptr, &bufferInfo);
+		}
+
+
+		// The slot stays valid until collect() runs after the current frame has retired
+		void remove(uint32_t binding, uint32_t index)
+		{
+			arrays[binding].retired.push_back(index);
+		}
+
+
+		// Call once per frame, after the frame's fence wait
+		void collect()
+		{
+			for (ResourceArray& array : arrays)
+			{
+				array.freeSlots.insert(array.freeSlots.end(), array.retired.begin(), array.retired.end());
+				array.retired.clear();
+			}
+		}
+
+
+		void destroy()
+		{
+			// Never initialized
+			if (!device)
+			{
+				return;
+			}
+
+			// Frees the set with it
+			device.destroyDescriptorPool(pool);
+			device.destroyDescriptorSetLayout(setLayout);
+		}
+
+	private:
+		struct ResourceArray
+		{
+			vk::DescriptorType type;
+			uint32_t capacity = 0;
+			uint32_t used = 0;
+			std::vector<uint32_t> freeSlots;
+			std::vector<uint32_t> retired;
+		};
+
+		vk::Device device;
+		bool debug;
+
+		vk::DescriptorSetLayout setLayout{ nullptr };
+		vk::DescriptorPool pool{ nullptr };
+		vk::DescriptorSet set{ nullptr };
+
+		std::array<ResourceArray, 3> arrays;
+
+
+		uint32_t take_slot(uint32_t binding)
+		{
+			ResourceArray& array = arrays[binding];
+
+			if (!array.freeSlots.empty())
+			{
+				uint32_t index = array.freeSlots.back();
+				array.freeSlots.pop_back();
+				return index;
+			}
+
+			if (array.used < array.capacity)
+			{
+				return array.used++;
+			}
+
+			if (debug)
+			{
+				std::cout << "Bindless array " << binding << " is full :/" << std::endl;
+			}
+			return BINDLESS_INVALID_INDEX;
+		}
+
+
+		void write(uint32_t binding, uint32_t index, const vk::DescriptorImageInfo* imageInfo, const vk::DescriptorBufferInfo* bufferInfo)
+		{
+			vk::WriteDescriptorSet descriptorWrite = {};
+			descriptorWrite.dstSet = set;
+			descriptorWrite.dstBinding = binding;
+			descriptorWrite.dstArrayElement = index;
+			descriptorWrite.descriptorCount = 1;
+			descriptorWrite.descriptorType = arrays[binding].type;
+			descriptorWrite.pImageInfo = imageInfo;
+			descriptorWrite.pBufferInfo = bufferInfo;
+
+			device.updateDescriptorSets(1, &descriptorWrite, 0, nullptr);
+		}
+	};
+}
\ No newline at end of file
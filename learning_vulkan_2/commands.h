@@ -1,7 +1,9 @@
 #pragma once
 
 #include "config.h"
-#include "queue_families.h"
+#include "device_context.h"
+#include "startup_profiler.h"
+#include "result.h"
 
 namespace vkInit
 {
@@ -9,23 +11,24 @@ namespace vkInit
 	{
 		vk::Device device;
 		vk::CommandPool commandPool;
-		std::vector<vkUtil::SwapchainFrame>& frames;
 	};
 
 
-	vk::CommandPool make_command_pool(vk::Device device, vk::PhysicalDevice physicalDevice, vk::SurfaceKHR surface, bool debug)
+	vk::CommandPool make_command_pool(vk::Device device, const vkUtil::DeviceContext& deviceContext, bool debug)
 	{
-		vkUtil::QueueFamilyIndices queueFamilyIndices = vkUtil::findQueueFamilies(physicalDevice, surface, debug);
+		const vkUtil::QueueFamilyIndices& queueFamilyIndices = deviceContext.queue_families();
 
 		vk::CommandPoolCreateInfo poolInfo = {};
 		poolInfo.flags = vk::CommandPoolCreateFlags() | vk::CommandPoolCreateFlagBits::eResetCommandBuffer;
 		poolInfo.queueFamilyIndex = queueFamilyIndices.graphicsFamily.value();
 
-		try
-		{
-			return device.createCommandPool(poolInfo);
-		}
-		catch (vk::SystemError err)
+		vkUtil::Expected<vk::CommandPool> commandPool = vkUtil::vk_call([&]()
+			{
+				vkUtil::StartupProfiler::Scope driverTimer("vkCreateCommandPool", vkUtil::StartupProfiler::Category::eDriver);
+				return device.createCommandPool(poolInfo);
+			});
+
+		if (!commandPool)
 		{
 			if (debug)
 			{
@@ -34,49 +37,22 @@ namespace vkInit
 
 			return nullptr;
 		}
+
+		return commandPool.value();
 	}
 
 
-	vk::CommandBuffer make_command_buffers(commandBufferInputChunk inputChunk, bool debug)
+	vk::CommandBuffer make_command_buffer(commandBufferInputChunk inputChunk, bool debug)
 	{
 		vk::CommandBufferAllocateInfo allocInfo = {};
 		allocInfo.commandPool = inputChunk.commandPool;
 		allocInfo.level = vk::CommandBufferLevel::ePrimary;
 		allocInfo.commandBufferCount = 1;
 
-		for (int ii = 0; ii < inputChunk.frames.size(); ii++)
-		{
-			try
-			{
-				inputChunk.frames[ii].commandBuffer = inputChunk.device.allocateCommandBuffers(allocInfo)[0];
-
-				if (debug)
-				{
-					std::cout << "Allocated command buffer for frame " << ii << std::endl;
-				}
-			}
-			catch (vk::SystemError err)
-			{
-				if (debug)
-				{
-					std::cout << "Failed to allocate command buffer for frame " << ii << std::endl;
-				}
-			}
-		}
-
-
-		try
-		{
-			vk::CommandBuffer commandBuffer = inputChunk.device.allocateCommandBuffers(allocInfo)[0];
-
-			if (debug)
-			{
-				std::cout << "Allocated main command buffer" << std::endl;
-			}
+		// One frame is in flight and records every window, so one command buffer is enough
+		vkUtil::Expected<std::vector<vk::CommandBuffer>> commandBuffers = vkUtil::vk_call([&]() { return inputChunk.device.allocateCommandBuffers(allocInfo); });
 
-			return commandBuffer;
-		}
-		catch (vk::SystemError err)
+		if (!commandBuffers)
 		{
 			if (debug)
 			{
@@ -85,5 +61,12 @@ namespace vkInit
 
 			return nullptr;
 		}
+
+		if (debug)
+		{
+			std::cout << "Allocated main command buffer" << std::endl;
+		}
+
+		return commandBuffers.value()[0];
 	}
 }
\ No newline at end of file
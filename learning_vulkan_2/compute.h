@@ -0,0 +1,301 @@
+#pragma once
+
+#include "config.h"
+#include "result.h"
+
+#include <deque>
+#include <functional>
+#include <mutex>
+
+namespace vkUtil
+{
+	struct computeSchedulerInput
+	{
+		vk::Device logicalDevice;
+		vk::Queue graphicsQueue;
+		vk::Queue computeQueue;
+		// held for every submit, the compute queue may be the transfer or the graphics queue
+		std::mutex* computeQueueMutex;
+		uint32_t graphicsFamily;
+		uint32_t computeFamily;
+	};
+
+	// Identifies a scheduled piece of compute work, 0 is never a valid job
+	using ComputeJob = uint64_t;
+
+
+	// Runs compute work (culling, particles, post-processing, simulation) on the async compute queue,
+	// so it overlaps whatever the graphics queue is doing. Every job signals its own semaphore,
+	// graphics submissions that need a job's results consume() it to wait on that semaphore.
+	// Without a separate compute queue jobs go to the graphics queue, same API, no overlap.
+	// Resources written by jobs and read by graphics should be created with sharing_families()
+	// (concurrent sharing) so no ownership transfers are needed.
+	class ComputeScheduler
+	{
+	public:
+		void init(computeSchedulerInput input, bool debug)
+		{
+			this->input = input;
+			this->debug = debug;
+
+			vk::CommandPoolCreateInfo poolInfo = {};
+			poolInfo.flags = vk::CommandPoolCreateFlagBits::eTransient | vk::CommandPoolCreateFlagBits::eResetCommandBuffer;
+			poolInfo.queueFamilyIndex = input.computeFamily;
+
+			Expected<vk::CommandPool> pool = vk_call([&]() { return input.logicalDevice.createCommandPool(poolInfo); });
+			if (!pool)
+			{
+				if (debug)
+				{
+					std::cout << "Failed to create compute Command Pool :/" << std::endl;
+				}
+				return;
+			}
+			commandPool = pool.value();
+
+			if (debug)
+			{
+				std::cout << (is_async() ? "Compute runs on its own queue\n" : "No async compute queue, compute shares the graphics queue\n");
+			}
+		}
+
+
+		bool is_async() const
+		{
+			return input.computeQueue != input.graphicsQueue;
+		}
+
+
+		// Queue family indices for VK_SHARING_MODE_CONCURRENT resources used by both queues
+		std::vector<uint32_t> sharing_families() const
+		{
+			if (input.computeFamily == input.graphicsFamily)
+			{
+				return { input.graphicsFamily };
+			}
+
+			return { input.graphicsFamily, input.computeFamily };
+		}
+
+
+		// Records the job with record() and submits it straight away.
+		// If the job reads something graphics produced, pass the semaphore graphics signalled for it.
+		ComputeJob schedule(const std::function<void(vk::CommandBuffer)>& record,
+			vk::Semaphore waitSemaphore = nullptr, vk::PipelineStageFlags waitStage = vk::PipelineStageFlagBits::eComputeShader)
+		{
+			Job job;
+			job.id = nextJob++;
+
+			vk::CommandBufferAllocateInfo allocInfo = {};
+			allocInfo.commandPool = commandPool;
+			allocInfo.level = vk::CommandBufferLevel::ePrimary;
+			allocInfo.commandBufferCount = 1;
+
+			Expected<std::vector<vk::CommandBuffer>> commandBuffers = vk_call([&]() { return input.logicalDevice.allocateCommandBuffers(allocInfo); });
+			Expected<vk::Fence> fence = vk_call([&]() { return input.logicalDevice.createFence(vk::FenceCreateInfo()); });
+			Expected<vk::Semaphore> semaphore = take_semaphore();
+			job.commandBuffer = commandBuffers ? commandBuffers.value()[0] : nullptr;
+			job.fence = fence.value_or(nullptr);
+			job.semaphore = semaphore.value_or(nullptr);
+
+			if (!commandBuffers || !fence || !semaphore)
+			{
+				if (debug)
+				{
+					std::cout << "Failed to create compute job :/" << std::endl;
+				}
+				release(job);
+				return 0;
+			}
+
+			vk::CommandBufferBeginInfo beginInfo = {};
+			beginInfo.flags = vk::CommandBufferUsageFlagBits::eOneTimeSubmit;
+			Expected<void> recorded = vk_call([&]() { return job.commandBuffer.begin(beginInfo); });
+
+			if (recorded)
+			{
+				record(job.commandBuffer);
+				recorded = vk_call([&]() { return job.commandBuffer.end(); });
+			}
+
+			vk::SubmitInfo submitInfo = {};
+			if (waitSemaphore)
+			{
+				submitInfo.waitSemaphoreCount = 1;
+				submitInfo.pWaitSemaphores = &waitSemaphore;
+				submitInfo.pWaitDstStageMask = &waitStage;
+			}
+			submitInfo.commandBufferCount = 1;
+			submitInfo.pCommandBuffers = &job.commandBuffer;
+			submitInfo.signalSemaphoreCount = 1;
+			submitInfo.pSignalSemaphores = &job.semaphore;
+
+			// A job that never ran must not be consumed, nothing would ever signal its semaphore
+			Expected<void> submitted = recorded;
+			if (recorded)
+			{
+				std::lock_guard<std::mutex> lock(*input.computeQueueMutex);
+				submitted = vk_call([&]() { return input.computeQueue.submit(submitInfo, job.fence); });
+			}
+			if (!submitted)
+			{
+				if (debug)
+				{
+					std::cout << "Failed to submit compute job :/" << std::endl;
+				}
+				release(job);
+				return 0;
+			}
+
+			jobs.push_back(job);
+			return job.id;
+		}
+
+
+		// Makes the next graphics submission wait for the job, at stage.
+		// Consume a job in the frame that scheduled it, each job can be consumed once.
+		void consume(ComputeJob id, vk::PipelineStageFlags stage,
+			std::vector<vk::Semaphore>& waitSemaphores, std::vector<vk::PipelineStageFlags>& waitStages)
+		{
+			Job* job = find_job(id);
+			if (!job || job->consumed)
+			{
+				return;
+			}
+
+			waitSemaphores.push_back(job->semaphore);
+			waitStages.push_back(stage);
+			job->consumed = true;
+		}
+
+
+		// Blocks the calling thread until the job has finished, fails if the device was lost
+		Expected<void> wait(ComputeJob id)
+		{
+			Job* job = find_job(id);
+			if (!job)
+			{
+				return Expected<void>();
+			}
+
+			return vk_call([&]() { return input.logicalDevice.waitForFences(1, &job->fence, VK_TRUE, UINT64_MAX); });
+		}
+
+
+		// Call once per frame, after the frame's fence wait.
+		// Finished jobs give back their command buffers. A consumed job's semaphore was waited on by a
+		// finished frame and can be signalled again, an unconsumed one is still signalled and is destroyed.
+		void collect()
+		{
+			for (auto job = jobs.begin(); job != jobs.end();)
+			{
+				// eNotReady still counts as a successful call, only eSuccess means signalled
+				if (vk_call([&]() { return input.logicalDevice.getFenceStatus(job->fence); }).result() != vk::Result::eSuccess)
+				{
+					job++;
+					continue;
+				}
+
+				if (job->consumed)
+				{
+					freeSemaphores.push_back(job->semaphore);
+				}
+				else
+				{
+					input.logicalDevice.destroySemaphore(job->semaphore);
+				}
+
+				input.logicalDevice.freeCommandBuffers(commandPool, 1, &job->commandBuffer);
+				input.logicalDevice.destroyFence(job->fence);
+				job = jobs.erase(job);
+			}
+		}
+
+
+		void destroy()
+		{
+			if (!commandPool)
+			{
+				return;
+			}
+
+			// Caller has waited for the device to go idle
+			for (Job& job : jobs)
+			{
+				input.logicalDevice.destroySemaphore(job.semaphore);
+				input.logicalDevice.destroyFence(job.fence);
+			}
+			jobs.clear();
+
+			for (vk::Semaphore semaphore : freeSemaphores)
+			{
+				input.logicalDevice.destroySemaphore(semaphore);
+			}
+			freeSemaphores.clear();
+
+			input.logicalDevice.destroyCommandPool(commandPool);
+			commandPool = nullptr;
+		}
+
+	private:
+		struct Job
+		{
+			ComputeJob id;
+			vk::CommandBuffer commandBuffer;
+			vk::Fence fence;
+			vk::Semaphore semaphore;
+			bool consumed = false;
+		};
+
+		computeSchedulerInput input;
+		bool debug;
+
+		vk::CommandPool commandPool{ nullptr };
+		std::deque<Job> jobs;
+		std::vector<vk::Semaphore> freeSemaphores;
+
+		ComputeJob nextJob = 1;
+
+
+		Job* find_job(ComputeJob id)
+		{
+			for (Job& job : jobs)
+			{
+				if (job.id == id)
+				{
+					return &job;
+				}
+			}
+
+			return nullptr;
+		}
+
+
+		Expected<vk::Semaphore> take_semaphore()
+		{
+			if (freeSemaphores.empty())
+			{
+				return vk_call([&]() { return input.logicalDevice.createSemaphore(vk::SemaphoreCreateInfo()); });
+			}
+
+			vk::Semaphore semaphore = freeSemaphores.back();
+			freeSemaphores.pop_back();
+			return semaphore;
+		}
+
+
+		// A job that failed before its submission, whatever it got is given back
+		void release(const Job& job)
+		{
+			if (job.commandBuffer)
+			{
+				input.logicalDevice.freeCommandBuffers(commandPool, 1, &job.commandBuffer);
+			}
+			input.logicalDevice.destroyFence(job.fence);
+			if (job.semaphore)
+			{
+				freeSemaphores.push_back(job.semaphore);
+			}
+		}
+	};
+}
\ No newline at end of file
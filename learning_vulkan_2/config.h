@@ -1,5 +1,16 @@
 #pragma once
 
+// vulkan.hpp calls go through VULKAN_HPP_DEFAULT_DISPATCHER instead of the loader's exported functions.
+// make_instance fills in the global and instance functions, create_logical_device loads every device
+// function with vkGetDeviceProcAddr, so recording calls go straight to the driver (or the first layer).
+#define VULKAN_HPP_DISPATCH_LOADER_DYNAMIC 1
+
+// With VULKAN_HPP_NO_EXCEPTIONS (the LEARNING_VULKAN_NO_EXCEPTIONS CMake option) vulkan.hpp returns
+// vk::Result and vk::ResultValue instead of throwing, and vkUtil::vk_call turns either into a vkUtil::Expected.
+// vulkan.hpp asserts on error codes in that mode by default, they are handled by the caller here.
+#ifdef VULKAN_HPP_NO_EXCEPTIONS
+#define VULKAN_HPP_ASSERT_ON_RESULT(condition)
+#endif
 #include <vulkan/vulkan.hpp>
 #include <GLFW/glfw3.h>
 
@@ -9,4 +20,5 @@
 #include <string>
 #include <optional>
 #include <fstream>
-#include <sstream>
\ No newline at end of file
+#include <sstream>
+#include <cstring>
\ No newline at end of file
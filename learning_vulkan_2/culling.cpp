@@ -0,0 +1,501 @@
+#include "culling.h"
+
+#include <chrono>
+#include <cmath>
+#include <random>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define CULLING_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+// MSVC lets us use any intrinsic anywhere, gcc/clang need the target enabled per function
+#if defined(_MSC_VER)
+#define CULLING_TARGET(isa)
+#else
+#define CULLING_TARGET(isa) __attribute__((target(isa)))
+#endif
+
+
+namespace vkUtil
+{
+	void BoundingVolumes::clear()
+	{
+		resize(0);
+	}
+
+
+	void BoundingVolumes::resize(size_t count)
+	{
+		for (std::vector<float>* component : { &centerX, &centerY, &centerZ, &radius, &minX, &minY, &minZ, &maxX, &maxY, &maxZ })
+		{
+			component->resize(count);
+		}
+	}
+
+
+	uint32_t BoundingVolumes::add(const float center[3], float sphereRadius, const float aabbMin[3], const float aabbMax[3])
+	{
+		uint32_t idx = static_cast<uint32_t>(size());
+
+		resize(idx + 1);
+		set(idx, center, sphereRadius, aabbMin, aabbMax);
+
+		return idx;
+	}
+
+
+	void BoundingVolumes::set(uint32_t idx, const float center[3], float sphereRadius, const float aabbMin[3], const float aabbMax[3])
+	{
+		centerX[idx] = center[0];
+		centerY[idx] = center[1];
+		centerZ[idx] = center[2];
+		radius[idx] = sphereRadius;
+
+		minX[idx] = aabbMin[0];
+		minY[idx] = aabbMin[1];
+		minZ[idx] = aabbMin[2];
+
+		maxX[idx] = aabbMax[0];
+		maxY[idx] = aabbMax[1];
+		maxZ[idx] = aabbMax[2];
+	}
+
+
+	Frustum extractFrustum(const float viewProjection[16])
+	{
+		// Gribb/Hartmann: every plane is a sum or difference of two rows of the matrix
+		// row ii of a column major matrix is m[ii], m[4 + ii], m[8 + ii], m[12 + ii]
+		// w row +/- row ii
+		auto combine = [&](int ii, float sign) -> Plane
+		{
+			return {
+				viewProjection[3] + sign * viewProjection[ii],
+				viewProjection[7] + sign * viewProjection[4 + ii],
+				viewProjection[11] + sign * viewProjection[8 + ii],
+				viewProjection[15] + sign * viewProjection[12 + ii]
+			};
+		};
+
+		Frustum frustum;
+		frustum.planes[0] = combine(0, 1.0f);  // left:   w + x >= 0
+		frustum.planes[1] = combine(0, -1.0f); // right:  w - x >= 0
+		frustum.planes[2] = combine(1, 1.0f);  // bottom: w + y >= 0
+		frustum.planes[3] = combine(1, -1.0f); // top:    w - y >= 0
+		frustum.planes[5] = combine(2, -1.0f); // far:    w - z >= 0
+
+		// near: z >= 0 (Vulkan clip space), with reversed-Z the two depth planes swap but bound the same volume
+		frustum.planes[4] = { viewProjection[2], viewProjection[6], viewProjection[10], viewProjection[14] };
+
+		// Normalize so that plane distances are in world units (needed for the sphere test)
+		for (Plane& plane : frustum.planes)
+		{
+			float length = std::sqrt(plane.normalX * plane.normalX + plane.normalY * plane.normalY + plane.normalZ * plane.normalZ);
+
+			if (length > 0.0f)
+			{
+				plane.normalX /= length;
+				plane.normalY /= length;
+				plane.normalZ /= length;
+				plane.distance /= length;
+			}
+		}
+
+		return frustum;
+	}
+
+
+	CullingKernel selectCullingKernel()
+	{
+#if defined(CULLING_X86)
+#if defined(_MSC_VER)
+		int info[4];
+		__cpuid(info, 0);
+		int maxLeaf = info[0];
+
+		__cpuid(info, 1);
+		bool sse41 = (info[2] & (1 << 19)) != 0;
+		bool osxsave = (info[2] & (1 << 27)) != 0;
+		bool avx = (info[2] & (1 << 28)) != 0;
+
+		bool avx2 = false;
+		if (maxLeaf >= 7)
+		{
+			__cpuidex(info, 7, 0);
+			avx2 = (info[1] & (1 << 5)) != 0;
+		}
+
+		// The OS also has to save the ymm registers on a context switch
+		bool ymmEnabled = osxsave && avx && ((_xgetbv(0) & 0x6) == 0x6);
+
+		if (avx2 && ymmEnabled)
+		{
+			return CullingKernel::eAVX2;
+		}
+
+		if (sse41)
+		{
+			return CullingKernel::eSSE41;
+		}
+#else
+		__builtin_cpu_init();
+
+		if (__builtin_cpu_supports("avx2"))
+		{
+			return CullingKernel::eAVX2;
+		}
+
+		if (__builtin_cpu_supports("sse4.1"))
+		{
+			return CullingKernel::eSSE41;
+		}
+#endif
+#endif
+
+		return CullingKernel::eScalar;
+	}
+
+
+	const char* cullingKernelName(CullingKernel kernel)
+	{
+		switch (kernel)
+		{
+		case (CullingKernel::eAVX2):
+			return "AVX2";
+
+		case (CullingKernel::eSSE41):
+			return "SSE4.1";
+
+		default:
+			return "scalar";
+		}
+	}
+
+
+	// For a box, the corner furthest along the plane normal (the "positive vertex")
+	// is the only one that has to be tested.
+	// The plane is the same for every object in a batch, so picking min or max is done once per plane
+	struct AabbPlaneInputs
+	{
+		const float* x;
+		const float* y;
+		const float* z;
+	};
+
+	static AabbPlaneInputs positive_vertex(const BoundingVolumes& volumes, const Plane& plane)
+	{
+		return {
+			plane.normalX >= 0.0f ? volumes.maxX.data() : volumes.minX.data(),
+			plane.normalY >= 0.0f ? volumes.maxY.data() : volumes.minY.data(),
+			plane.normalZ >= 0.0f ? volumes.maxZ.data() : volumes.minZ.data()
+		};
+	}
+
+
+	static size_t cull_scalar(
+		const BoundingVolumes& volumes, const Frustum& frustum, CullingVolume volume,
+		size_t first, size_t last, uint32_t* visible, size_t count
+	)
+	{
+		AabbPlaneInputs corners[6];
+		for (int p = 0; p < 6; p++)
+		{
+			corners[p] = positive_vertex(volumes, frustum.planes[p]);
+		}
+
+		for (size_t ii = first; ii < last; ii++)
+		{
+			bool inside = true;
+
+			for (int p = 0; p < 6 && inside; p++)
+			{
+				const Plane& plane = frustum.planes[p];
+
+				if (volume == CullingVolume::eSphere)
+				{
+					float distance = plane.normalX * volumes.centerX[ii]
+						+ plane.normalY * volumes.centerY[ii]
+						+ plane.normalZ * volumes.centerZ[ii]
+						+ plane.distance;
+
+					inside = distance >= -volumes.radius[ii];
+				}
+				else
+				{
+					float distance = plane.normalX * corners[p].x[ii]
+						+ plane.normalY * corners[p].y[ii]
+						+ plane.normalZ * corners[p].z[ii]
+						+ plane.distance;
+
+					inside = distance >= 0.0f;
+				}
+			}
+
+			// Branchless append
+			visible[count] = static_cast<uint32_t>(ii);
+			count += inside ? 1 : 0;
+		}
+
+		return count;
+	}
+
+
+#if defined(CULLING_X86)
+	// Appends base + every set bit of mask
+	static inline size_t append_mask(uint32_t* visible, size_t count, uint32_t base, int mask)
+	{
+		while (mask)
+		{
+#if defined(_MSC_VER)
+			unsigned long bit;
+			_BitScanForward(&bit, static_cast<unsigned long>(mask));
+#else
+			int bit = __builtin_ctz(static_cast<unsigned int>(mask));
+#endif
+			visible[count++] = base + static_cast<uint32_t>(bit);
+			mask &= mask - 1;
+		}
+
+		return count;
+	}
+
+
+	CULLING_TARGET("sse4.1")
+	static size_t cull_sse41(
+		const BoundingVolumes& volumes, const Frustum& frustum, CullingVolume volume,
+		size_t n, uint32_t* visible
+	)
+	{
+		AabbPlaneInputs corners[6];
+		for (int p = 0; p < 6; p++)
+		{
+			corners[p] = positive_vertex(volumes, frustum.planes[p]);
+		}
+
+		size_t count = 0;
+		size_t batched = n & ~size_t(3);
+
+		for (size_t ii = 0; ii < batched; ii += 4)
+		{
+			__m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+
+			for (int p = 0; p < 6; p++)
+			{
+				const Plane& plane = frustum.planes[p];
+				__m128 distance;
+				__m128 threshold;
+
+				if (volume == CullingVolume::eSphere)
+				{
+					distance = _mm_mul_ps(_mm_set1_ps(plane.normalX), _mm_loadu_ps(&volumes.centerX[ii]));
+					distance = _mm_add_ps(distance, _mm_mul_ps(_mm_set1_ps(plane.normalY), _mm_loadu_ps(&volumes.centerY[ii])));
+					distance = _mm_add_ps(distance, _mm_mul_ps(_mm_set1_ps(plane.normalZ), _mm_loadu_ps(&volumes.centerZ[ii])));
+					threshold = _mm_sub_ps(_mm_setzero_ps(), _mm_loadu_ps(&volumes.radius[ii]));
+				}
+				else
+				{
+					distance = _mm_mul_ps(_mm_set1_ps(plane.normalX), _mm_loadu_ps(corners[p].x + ii));
+					distance = _mm_add_ps(distance, _mm_mul_ps(_mm_set1_ps(plane.normalY), _mm_loadu_ps(corners[p].y + ii)));
+					distance = _mm_add_ps(distance, _mm_mul_ps(_mm_set1_ps(plane.normalZ), _mm_loadu_ps(corners[p].z + ii)));
+					threshold = _mm_setzero_ps();
+				}
+
+				distance = _mm_add_ps(distance, _mm_set1_ps(plane.distance));
+				inside = _mm_and_ps(inside, _mm_cmpge_ps(distance, threshold));
+
+				// Whole batch is outside, skip the remaining planes
+				__m128i insideBits = _mm_castps_si128(inside);
+				if (_mm_testz_si128(insideBits, insideBits))
+				{
+					break;
+				}
+			}
+
+			count = append_mask(visible, count, static_cast<uint32_t>(ii), _mm_movemask_ps(inside));
+		}
+
+		return cull_scalar(volumes, frustum, volume, batched, n, visible, count);
+	}
+
+
+	CULLING_TARGET("avx2")
+	static size_t cull_avx2(
+		const BoundingVolumes& volumes, const Frustum& frustum, CullingVolume volume,
+		size_t n, uint32_t* visible
+	)
+	{
+		AabbPlaneInputs corners[6];
+		for (int p = 0; p < 6; p++)
+		{
+			corners[p] = positive_vertex(volumes, frustum.planes[p]);
+		}
+
+		size_t count = 0;
+		size_t batched = n & ~size_t(7);
+
+		for (size_t ii = 0; ii < batched; ii += 8)
+		{
+			__m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+
+			for (int p = 0; p < 6; p++)
+			{
+				const Plane& plane = frustum.planes[p];
+				__m256 distance;
+				__m256 threshold;
+
+				if (volume == CullingVolume::eSphere)
+				{
+					distance = _mm256_mul_ps(_mm256_set1_ps(plane.normalX), _mm256_loadu_ps(&volumes.centerX[ii]));
+					distance = _mm256_add_ps(distance, _mm256_mul_ps(_mm256_set1_ps(plane.normalY), _mm256_loadu_ps(&volumes.centerY[ii])));
+					distance = _mm256_add_ps(distance, _mm256_mul_ps(_mm256_set1_ps(plane.normalZ), _mm256_loadu_ps(&volumes.centerZ[ii])));
+					threshold = _mm256_sub_ps(_mm256_setzero_ps(), _mm256_loadu_ps(&volumes.radius[ii]));
+				}
+				else
+				{
+					distance = _mm256_mul_ps(_mm256_set1_ps(plane.normalX), _mm256_loadu_ps(corners[p].x + ii));
+					distance = _mm256_add_ps(distance, _mm256_mul_ps(_mm256_set1_ps(plane.normalY), _mm256_loadu_ps(corners[p].y + ii)));
+					distance = _mm256_add_ps(distance, _mm256_mul_ps(_mm256_set1_ps(plane.normalZ), _mm256_loadu_ps(corners[p].z + ii)));
+					threshold = _mm256_setzero_ps();
+				}
+
+				distance = _mm256_add_ps(distance, _mm256_set1_ps(plane.distance));
+				inside = _mm256_and_ps(inside, _mm256_cmp_ps(distance, threshold, _CMP_GE_OQ));
+
+				// Whole batch is outside, skip the remaining planes
+				if (_mm256_testz_ps(inside, inside))
+				{
+					break;
+				}
+			}
+
+			count = append_mask(visible, count, static_cast<uint32_t>(ii), _mm256_movemask_ps(inside));
+		}
+
+		return cull_scalar(volumes, frustum, volume, batched, n, visible, count);
+	}
+#endif
+
+
+	void cullObjects(
+		const BoundingVolumes& volumes,
+		const Frustum& frustum,
+		CullingVolume volume,
+		CullingKernel kernel,
+		std::vector<uint32_t>& visible
+	)
+	{
+		size_t n = volumes.size();
+
+		// Worst case everything is visible.
+		// Only grows the first time, after that the vector keeps its storage between frames
+		visible.resize(n);
+
+		size_t count = 0;
+
+		switch (kernel)
+		{
+#if defined(CULLING_X86)
+		case (CullingKernel::eAVX2):
+			count = cull_avx2(volumes, frustum, volume, n, visible.data());
+			break;
+
+		case (CullingKernel::eSSE41):
+			count = cull_sse41(volumes, frustum, volume, n, visible.data());
+			break;
+#endif
+
+		default:
+			count = cull_scalar(volumes, frustum, volume, 0, n, visible.data(), 0);
+		}
+
+		visible.resize(count);
+	}
+
+
+	void benchmarkCulling()
+	{
+		// Camera at the origin looking down -z, 60 degree vertical fov
+		float nearPlane = 0.1f;
+		float farPlane = 150.0f;
+		float f = 1.0f / std::tan(0.5f * 1.0471976f);
+		float aspect = 16.0f / 9.0f;
+
+		float projection[16] = {};
+		projection[0] = f / aspect;
+		projection[5] = f;
+		projection[10] = farPlane / (nearPlane - farPlane);
+		projection[11] = -1.0f;
+		projection[14] = nearPlane * farPlane / (nearPlane - farPlane);
+
+		Frustum frustum = extractFrustum(projection);
+
+		std::vector<CullingKernel> kernels = { CullingKernel::eScalar };
+		CullingKernel best = selectCullingKernel();
+
+		if (best == CullingKernel::eSSE41 || best == CullingKernel::eAVX2)
+		{
+			kernels.push_back(CullingKernel::eSSE41);
+		}
+		if (best == CullingKernel::eAVX2)
+		{
+			kernels.push_back(CullingKernel::eAVX2);
+		}
+
+		std::mt19937 rng(1234);
+		std::uniform_real_distribution<float> position(-100.0f, 100.0f);
+		std::uniform_real_distribution<float> size(0.1f, 2.0f);
+
+		std::cout << "Frustum culling benchmark\n";
+
+		for (size_t objectCount : { size_t(10000), size_t(100000), size_t(1000000) })
+		{
+			BoundingVolumes volumes;
+			volumes.resize(objectCount);
+
+			for (uint32_t ii = 0; ii < objectCount; ii++)
+			{
+				float center[3] = { position(rng), position(rng), position(rng) };
+				float halfExtent = size(rng);
+				float aabbMin[3] = { center[0] - halfExtent, center[1] - halfExtent, center[2] - halfExtent };
+				float aabbMax[3] = { center[0] + halfExtent, center[1] + halfExtent, center[2] + halfExtent };
+
+				volumes.set(ii, center, halfExtent * 1.7320508f, aabbMin, aabbMax);
+			}
+
+			// Roughly the same amount of work (~50M object tests) per size
+			size_t iterations = std::max(size_t(1), size_t(50000000) / objectCount);
+
+			for (CullingVolume volume : { CullingVolume::eSphere, CullingVolume::eAabb })
+			{
+				for (CullingKernel kernel : kernels)
+				{
+					std::vector<uint32_t> visible;
+
+					// warm up
+					cullObjects(volumes, frustum, volume, kernel, visible);
+
+					auto start = std::chrono::high_resolution_clock::now();
+
+					for (size_t ii = 0; ii < iterations; ii++)
+					{
+						cullObjects(volumes, frustum, volume, kernel, visible);
+					}
+
+					auto end = std::chrono::high_resolution_clock::now();
+					double nanoseconds = std::chrono::duration<double, std::nano>(end - start).count();
+
+					std::cout << "\t" << objectCount << " objects, "
+						<< (volume == CullingVolume::eSphere ? "sphere" : "aabb") << ", "
+						<< cullingKernelName(kernel) << ": "
+						<< (double(objectCount) * iterations / nanoseconds) << " objects/ns ("
+						<< visible.size() << " visible)\n";
+				}
+			}
+		}
+	}
+}
\ No newline at end of file
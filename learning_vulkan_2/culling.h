@@ -0,0 +1,82 @@
+#pragma once
+
+#include "config.h"
+
+namespace vkUtil
+{
+	// Plane in the form dot(normal, p) + distance = 0, normal pointing into the frustum
+	struct Plane
+	{
+		float normalX, normalY, normalZ, distance;
+	};
+
+	struct Frustum
+	{
+		// left, right, bottom, top, near, far
+		Plane planes[6];
+	};
+
+
+	// Bounding volumes stored as structure-of-arrays,
+	// so the SIMD kernels can load 4/8 objects' worth of one component at a time
+	struct BoundingVolumes
+	{
+		// Bounding spheres
+		std::vector<float> centerX, centerY, centerZ, radius;
+
+		// Axis aligned bounding boxes
+		std::vector<float> minX, minY, minZ;
+		std::vector<float> maxX, maxY, maxZ;
+
+		size_t size() const
+		{
+			return radius.size();
+		}
+
+		void clear();
+
+		void resize(size_t count);
+
+		// Returns the index of the new object
+		uint32_t add(const float center[3], float sphereRadius, const float aabbMin[3], const float aabbMax[3]);
+
+		void set(uint32_t idx, const float center[3], float sphereRadius, const float aabbMin[3], const float aabbMax[3]);
+	};
+
+
+	enum class CullingVolume
+	{
+		eSphere,
+		eAabb
+	};
+
+	enum class CullingKernel
+	{
+		eScalar,
+		eSSE41,
+		eAVX2
+	};
+
+
+	// Extracts the six frustum planes from a column major view-projection matrix
+	// (Vulkan clip space, depth in [0, 1])
+	Frustum extractFrustum(const float viewProjection[16]);
+
+	// Picks the widest kernel the running CPU supports
+	CullingKernel selectCullingKernel();
+
+	const char* cullingKernelName(CullingKernel kernel);
+
+	// Writes the indices of every object that intersects the frustum into visible
+	// visible is resized to the number of visible objects
+	void cullObjects(
+		const BoundingVolumes& volumes,
+		const Frustum& frustum,
+		CullingVolume volume,
+		CullingKernel kernel,
+		std::vector<uint32_t>& visible
+	);
+
+	// Reports objects culled per nanosecond for every supported kernel at 10K, 100K and 1M objects
+	void benchmarkCulling();
+}
\ No newline at end of file
@@ -0,0 +1,118 @@
+#pragma once
+
+#include "config.h"
+
+#include <functional>
+#include <deque>
+
+
+namespace vkUtil
+{
+	// Destroys handles once the GPU work that may still use them has completed, so nothing has to wait for the
+	// device to go idle to free a resource. Work is counted in frames: the engine calls next_frame() after each
+	// submission and collect() with the last frame its fence wait guarantees finished.
+	// Anything counted by a monotonic value works the same way, a timeline semaphore's for instance.
+	class DeletionQueue
+	{
+	public:
+		void init(vk::Device device, bool debug)
+		{
+			this->device = device;
+			this->debug = debug;
+		}
+
+		// Frame being recorded, handles retired now may be used by it
+		uint64_t frame() const
+		{
+			return currentFrame;
+		}
+
+		void next_frame()
+		{
+			currentFrame++;
+		}
+
+		// Destroyed once the current frame completes
+		template <typename Handle>
+		void retire(Handle handle)
+		{
+			retire(handle, currentFrame);
+		}
+
+		// Destroyed once the work numbered lastUse completes
+		template <typename Handle>
+		void retire(Handle handle, uint64_t lastUse)
+		{
+			if (handle)
+			{
+				pending.push_back({ lastUse, [handle](vk::Device device) { device.destroy(handle); } });
+			}
+		}
+
+		void retire(vk::DeviceMemory memory, uint64_t lastUse)
+		{
+			if (memory)
+			{
+				pending.push_back({ lastUse, [memory](vk::Device device) { device.freeMemory(memory); } });
+			}
+		}
+
+		// For objects made of several handles, destroy gets the device once the current frame completes
+		void defer(std::function<void(vk::Device)> destroy)
+		{
+			pending.push_back({ currentFrame, destroy });
+		}
+
+		// Destroys everything whose last use is at or before completed
+		void collect(uint64_t completed)
+		{
+			size_t destroyed = 0;
+
+			for (std::deque<Retired>::iterator it = pending.begin(); it != pending.end();)
+			{
+				if (it->lastUse <= completed)
+				{
+					it->destroy(device);
+					it = pending.erase(it);
+					destroyed++;
+				}
+				else
+				{
+					it++;
+				}
+			}
+
+			if (debug && destroyed > 0)
+			{
+				std::cout << "Destroyed " << destroyed << " retired handles, " << pending.size() << " still in use\n";
+			}
+		}
+
+		size_t pending_count() const
+		{
+			return pending.size();
+		}
+
+		// Caller has waited for the device to go idle
+		void destroy()
+		{
+			for (Retired& retired : pending)
+			{
+				retired.destroy(device);
+			}
+			pending.clear();
+		}
+
+	private:
+		struct Retired
+		{
+			uint64_t lastUse;
+			std::function<void(vk::Device)> destroy;
+		};
+
+		vk::Device device{ nullptr };
+		bool debug = false;
+		uint64_t currentFrame = 1;
+		std::deque<Retired> pending;
+	};
+}
\ No newline at end of file
@@ -0,0 +1,260 @@
+#pragma once
+
+#include "config.h"
+#include "result.h"
+
+#include <algorithm>
+
+namespace vkInit
+{
+	struct descriptorSetLayoutData
+	{
+		std::vector<vk::DescriptorSetLayoutBinding> bindings;
+		vk::DescriptorSetLayoutCreateFlags flags;
+	};
+
+
+	inline vk::DescriptorSetLayout make_descriptor_set_layout(vk::Device device, const descriptorSetLayoutData& data, bool debug)
+	{
+		vk::DescriptorSetLayoutCreateInfo layoutInfo = {};
+		layoutInfo.flags = data.flags;
+		layoutInfo.bindingCount = static_cast<uint32_t>(data.bindings.size());
+		layoutInfo.pBindings = data.bindings.data();
+
+		vkUtil::Expected<vk::DescriptorSetLayout> layout = vkUtil::vk_call([&]() { return device.createDescriptorSetLayout(layoutInfo); });
+		if (!layout)
+		{
+			if (debug)
+			{
+				std::cout << "Failed to create descriptor set layout :/" << std::endl;
+			}
+			return nullptr;
+		}
+
+		return layout.value();
+	}
+}
+
+
+namespace vkUtil
+{
+	// Descriptors of one type per set a pool is sized for
+	struct DescriptorPoolRatio
+	{
+		vk::DescriptorType type;
+		float ratio;
+	};
+
+	// Roughly what a material set and a per-draw set need between them
+	inline const std::vector<DescriptorPoolRatio> DEFAULT_DESCRIPTOR_RATIOS =
+	{
+		{ vk::DescriptorType::eUniformBuffer, 2.0f },
+		{ vk::DescriptorType::eUniformBufferDynamic, 1.0f },
+		{ vk::DescriptorType::eStorageBuffer, 1.0f },
+		{ vk::DescriptorType::eCombinedImageSampler, 4.0f },
+		{ vk::DescriptorType::eStorageImage, 1.0f }
+	};
+
+
+	// A growable chain of descriptor pools. Sets are only ever allocated, never freed one by one:
+	// reset() hands every pool back at once with vkResetDescriptorPool, so the pools never fragment.
+	// When the current pool runs dry the next one is taken, each new pool is bigger than the last.
+	class DescriptorAllocator
+	{
+	public:
+		void init(vk::Device device, uint32_t initialSets, const std::vector<DescriptorPoolRatio>& ratios, bool debug)
+		{
+			this->device = device;
+			this->ratios = ratios;
+			this->setsPerPool = initialSets;
+			this->debug = debug;
+		}
+
+
+		vk::DescriptorSet allocate(vk::DescriptorSetLayout layout)
+		{
+			if (!currentPool)
+			{
+				currentPool = next_pool();
+				if (!currentPool)
+				{
+					return nullptr;
+				}
+			}
+
+			vk::DescriptorSetAllocateInfo allocInfo = {};
+			allocInfo.descriptorPool = currentPool;
+			allocInfo.descriptorSetCount = 1;
+			allocInfo.pSetLayouts = &layout;
+
+			Expected<std::vector<vk::DescriptorSet>> sets = vk_call([&]() { return device.allocateDescriptorSets(allocInfo); });
+			if (sets)
+			{
+				return sets.value()[0];
+			}
+
+			// A full pool is expected, anything else is a real failure
+			if (sets.result() != vk::Result::eErrorOutOfPoolMemory && sets.result() != vk::Result::eErrorFragmentedPool)
+			{
+				if (debug)
+				{
+					std::cout << "Failed to allocate descriptor set :/" << std::endl;
+				}
+				return nullptr;
+			}
+
+			// This pool is full, move on to a fresh one and try once more
+			currentPool = next_pool();
+			if (!currentPool)
+			{
+				return nullptr;
+			}
+			allocInfo.descriptorPool = currentPool;
+
+			sets = vk_call([&]() { return device.allocateDescriptorSets(allocInfo); });
+			if (!sets)
+			{
+				if (debug)
+				{
+					std::cout << "Failed to allocate descriptor set from a fresh pool :/" << std::endl;
+				}
+				return nullptr;
+			}
+
+			return sets.value()[0];
+		}
+
+
+		// Every set allocated so far becomes invalid, only call once the GPU is done with them
+		void reset()
+		{
+			for (vk::DescriptorPool pool : fullPools)
+			{
+				device.resetDescriptorPool(pool);
+				readyPools.push_back(pool);
+			}
+			fullPools.clear();
+
+			if (currentPool)
+			{
+				device.resetDescriptorPool(currentPool);
+				readyPools.push_back(currentPool);
+				currentPool = nullptr;
+			}
+		}
+
+
+		void destroy()
+		{
+			reset();
+
+			for (vk::DescriptorPool pool : readyPools)
+			{
+				device.destroyDescriptorPool(pool);
+			}
+			readyPools.clear();
+		}
+
+	private:
+		vk::Device device;
+		std::vector<DescriptorPoolRatio> ratios;
+		uint32_t setsPerPool;
+		bool debug;
+
+		vk::DescriptorPool currentPool{ nullptr };
+		std::vector<vk::DescriptorPool> fullPools;
+		std::vector<vk::DescriptorPool> readyPools;
+
+		// Growth stops here, after that the chain just gets longer
+		static constexpr uint32_t MAX_SETS_PER_POOL = 4096;
+
+
+		// nullptr if a new pool was needed and couldn't be made
+		vk::DescriptorPool next_pool()
+		{
+			if (currentPool)
+			{
+				fullPools.push_back(currentPool);
+			}
+
+			if (!readyPools.empty())
+			{
+				vk::DescriptorPool pool = readyPools.back();
+				readyPools.pop_back();
+				return pool;
+			}
+
+			std::vector<vk::DescriptorPoolSize> poolSizes;
+			for (const DescriptorPoolRatio& ratio : ratios)
+			{
+				poolSizes.push_back(vk::DescriptorPoolSize(ratio.type, std::max(1u, static_cast<uint32_t>(ratio.ratio * setsPerPool))));
+			}
+
+			// No eFreeDescriptorSet flag, sets are only released by resetting the whole pool
+			vk::DescriptorPoolCreateInfo poolInfo = {};
+			poolInfo.flags = vk::DescriptorPoolCreateFlags();
+			poolInfo.maxSets = setsPerPool;
+			poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
+			poolInfo.pPoolSizes = poolSizes.data();
+
+			Expected<vk::DescriptorPool> pool = vk_call([&]() { return device.createDescriptorPool(poolInfo); });
+			if (!pool)
+			{
+				if (debug)
+				{
+					std::cout << "Failed to create descriptor pool :/" << std::endl;
+				}
+				return nullptr;
+			}
+
+			setsPerPool = std::min(MAX_SETS_PER_POOL, setsPerPool + setsPerPool / 2);
+
+			return pool.value();
+		}
+	};
+
+
+	// One allocator per frame in flight. begin_frame() resets the frame's chain once its fence
+	// has signalled, so per-frame and per-draw sets cost an allocation and nothing else.
+	// Long-lived sets (materials, anything that outlives a frame) belong in a separate DescriptorAllocator.
+	class FrameDescriptorAllocator
+	{
+	public:
+		void init(vk::Device device, uint32_t framesInFlight, uint32_t initialSets, const std::vector<DescriptorPoolRatio>& ratios, bool debug)
+		{
+			frames.resize(framesInFlight);
+
+			for (DescriptorAllocator& frame : frames)
+			{
+				frame.init(device, initialSets, ratios, debug);
+			}
+		}
+
+
+		// Call after waiting on the fence of the frame that last used this slot
+		void begin_frame(uint32_t frameIndex)
+		{
+			currentFrame = frameIndex;
+			frames[currentFrame].reset();
+		}
+
+
+		vk::DescriptorSet allocate(vk::DescriptorSetLayout layout)
+		{
+			return frames[currentFrame].allocate(layout);
+		}
+
+
+		void destroy()
+		{
+			for (DescriptorAllocator& frame : frames)
+			{
+				frame.destroy();
+			}
+			frames.clear();
+		}
+
+	private:
+		std::vector<DescriptorAllocator> frames;
+		uint32_t currentFrame = 0;
+	};
@@ -2,7 +2,16 @@
 
 #include "config.h"
 #include "logging.h"
+#include "startup_profiler.h"
 #include "queue_families.h"
+#include "device_context.h"
+#include "result.h"
+
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <cstdlib>
+#include <iomanip>
 
 namespace vkInit
 {
@@ -23,7 +32,8 @@ namespace vkInit
 
 
 		// Check which extensions the device can support
-		for (vk::ExtensionProperties& extension : device.enumerateDeviceExtensionProperties())
+		std::vector<vk::ExtensionProperties> supportedExtensions = vkUtil::vk_call([&]() { return device.enumerateDeviceExtensionProperties(); }).value_or({});
+		for (vk::ExtensionProperties& extension : supportedExtensions)
 		{
 			if (debug)
 			{
@@ -39,7 +49,57 @@ namespace vkInit
 	}
 
 
-	bool isSuitable(const vk::PhysicalDevice& device, const bool debug)
+	// Bindless resources need Vulkan 1.2 with these descriptor indexing features.
+	// The device is used at the lower of its version and the instance's apiVersion.
+	bool checkBindlessSupport(const vk::PhysicalDevice& device, uint32_t apiVersion, const bool debug)
+	{
+		if (std::min(device.getProperties().apiVersion, apiVersion) < VK_API_VERSION_1_2)
+		{
+			if (debug)
+			{
+				std::cout << "Device or instance does not support Vulkan 1.2!\n";
+			}
+			return false;
+		}
+
+		vk::StructureChain<vk::PhysicalDeviceFeatures2, vk::PhysicalDeviceVulkan12Features> features =
+			device.getFeatures2<vk::PhysicalDeviceFeatures2, vk::PhysicalDeviceVulkan12Features>();
+		const vk::PhysicalDeviceVulkan12Features& indexing = features.get<vk::PhysicalDeviceVulkan12Features>();
+
+		bool supported = indexing.descriptorIndexing
+			&& indexing.runtimeDescriptorArray
+			&& indexing.descriptorBindingPartiallyBound
+			&& indexing.descriptorBindingUpdateUnusedWhilePending
+			&& indexing.descriptorBindingSampledImageUpdateAfterBind
+			&& indexing.descriptorBindingStorageBufferUpdateAfterBind
+			&& indexing.descriptorBindingStorageImageUpdateAfterBind
+			&& indexing.shaderSampledImageArrayNonUniformIndexing
+			&& indexing.shaderStorageBufferArrayNonUniformIndexing;
+
+		if (debug)
+		{
+			std::cout << (supported ? "Device supports bindless descriptors!\n" : "Device does not support bindless descriptors!\n");
+		}
+
+		return supported;
+	}
+
+
+	// The render graph records its barriers with synchronization2 when the device has it, core in Vulkan 1.3
+	bool checkSynchronization2Support(const vk::PhysicalDevice& device, uint32_t apiVersion)
+	{
+		if (std::min(device.getProperties().apiVersion, apiVersion) < VK_API_VERSION_1_3)
+		{
+			return false;
+		}
+
+		vk::StructureChain<vk::PhysicalDeviceFeatures2, vk::PhysicalDeviceVulkan13Features> features =
+			device.getFeatures2<vk::PhysicalDeviceFeatures2, vk::PhysicalDeviceVulkan13Features>();
+		return features.get<vk::PhysicalDeviceVulkan13Features>().synchronization2;
+	}
+
+
+	bool isSuitable(const vk::PhysicalDevice& device, uint32_t apiVersion, const bool debug)
 	{
 		if (debug)
 		{
@@ -82,12 +142,206 @@ namespace vkInit
 			return false;
 		}
 
+		if (!checkBindlessSupport(device, apiVersion, debug))
+		{
+			return false;
+		}
+
 		return true;
 	}
 
 
-	vk::PhysicalDevice choose_physical_device(vk::Instance& instance, bool debug)
+	// A device that passed isSuitable, scored for picking the fastest one
+	struct DeviceCandidate
+	{
+		vk::PhysicalDevice device;
+		uint32_t index;
+		vk::PhysicalDeviceProperties properties;
+		std::array<uint8_t, VK_UUID_SIZE> uuid = {};
+		vk::DeviceSize deviceLocalMemory = 0;
+		int64_t score = 0;
+
+		// Why it scored what it did, or why it can't be used
+		std::string rationale;
+		bool suitable = false;
+	};
+
+
+	const char* device_type_name(vk::PhysicalDeviceType type)
+	{
+		switch (type)
+		{
+		case vk::PhysicalDeviceType::eDiscreteGpu:
+			return "discrete";
+		case vk::PhysicalDeviceType::eIntegratedGpu:
+			return "integrated";
+		case vk::PhysicalDeviceType::eVirtualGpu:
+			return "virtual";
+		case vk::PhysicalDeviceType::eCpu:
+			return "cpu";
+		default:
+			return "other";
+		}
+	}
+
+
+	std::string uuid_string(const std::array<uint8_t, VK_UUID_SIZE>& uuid)
 	{
+		std::stringstream text;
+		text << std::hex << std::setfill('0');
+		for (uint8_t byte : uuid)
+		{
+			text << std::setw(2) << static_cast<uint32_t>(byte);
+		}
+		return text.str();
+	}
+
+
+	// Type decides first: discrete over integrated over virtual over anything else, with CPU implementations last.
+	// Within a type the biggest device local heap wins, then the optional features the engine makes use of,
+	// then the newest API version. Each term is capped below the one before it, so the order never flips.
+	DeviceCandidate score_physical_device(vk::PhysicalDevice device, uint32_t index, vk::SurfaceKHR surface, uint32_t apiVersion, bool debug)
+	{
+		DeviceCandidate candidate;
+		candidate.device = device;
+		candidate.index = index;
+		candidate.properties = device.getProperties();
+
+		// deviceUUID is core in Vulkan 1.1
+		if (std::min(candidate.properties.apiVersion, apiVersion) >= VK_API_VERSION_1_1)
+		{
+			vk::StructureChain<vk::PhysicalDeviceProperties2, vk::PhysicalDeviceIDProperties> properties =
+				device.getProperties2<vk::PhysicalDeviceProperties2, vk::PhysicalDeviceIDProperties>();
+			const vk::PhysicalDeviceIDProperties& id = properties.get<vk::PhysicalDeviceIDProperties>();
+			std::copy(id.deviceUUID.begin(), id.deviceUUID.end(), candidate.uuid.begin());
+		}
+
+		vk::PhysicalDeviceMemoryProperties memory = device.getMemoryProperties();
+		for (uint32_t heap = 0; heap < memory.memoryHeapCount; heap++)
+		{
+			if (memory.memoryHeaps[heap].flags & vk::MemoryHeapFlagBits::eDeviceLocal)
+			{
+				candidate.deviceLocalMemory = std::max(candidate.deviceLocalMemory, memory.memoryHeaps[heap].size);
+			}
+		}
+
+		std::stringstream rationale;
+		rationale << device_type_name(candidate.properties.deviceType) << ", " << candidate.deviceLocalMemory / (1024 * 1024)
+			<< " MiB device local, Vulkan " << VK_API_VERSION_MAJOR(candidate.properties.apiVersion) << "."
+			<< VK_API_VERSION_MINOR(candidate.properties.apiVersion);
+
+		// Required: the swapchain extension and bindless descriptors, and presenting to the window
+		if (!isSuitable(device, apiVersion, debug))
+		{
+			candidate.rationale = rationale.str() + ", lacks the swapchain extension or bindless descriptors";
+			return candidate;
+		}
+
+		if (surface && !vkUtil::findQueueFamilies(device, surface, false).presentFamily.has_value())
+		{
+			candidate.rationale = rationale.str() + ", can't present to the window";
+			return candidate;
+		}
+
+		candidate.suitable = true;
+
+		switch (candidate.properties.deviceType)
+		{
+		case vk::PhysicalDeviceType::eDiscreteGpu:
+			candidate.score += 4000000;
+			break;
+		case vk::PhysicalDeviceType::eIntegratedGpu:
+			candidate.score += 3000000;
+			break;
+		case vk::PhysicalDeviceType::eVirtualGpu:
+			candidate.score += 2000000;
+			break;
+		case vk::PhysicalDeviceType::eCpu:
+			break;
+		default:
+			candidate.score += 1000000;
+		}
+
+		// 100 points per 256 MiB, up to 1 TiB
+		candidate.score += std::min<int64_t>(candidate.deviceLocalMemory / (256 * 1024 * 1024), 4096) * 100;
+
+		// Optional features, 10 points each
+		vk::PhysicalDeviceFeatures features = device.getFeatures();
+		std::vector<const char*> extras;
+		if (features.multiDrawIndirect && features.drawIndirectFirstInstance)
+		{
+			extras.push_back("indirect draws");
+		}
+		if (features.pipelineStatisticsQuery)
+		{
+			extras.push_back("pipeline statistics");
+		}
+		if (checkSynchronization2Support(device, apiVersion))
+		{
+			extras.push_back("synchronization2");
+		}
+		if (checkDeviceExtensionSupport(device, { VK_EXT_MEMORY_BUDGET_EXTENSION_NAME }, false))
+		{
+			extras.push_back("memory budget");
+		}
+		candidate.score += static_cast<int64_t>(extras.size()) * 10;
+
+		candidate.score += std::min<uint32_t>(VK_API_VERSION_MINOR(candidate.properties.apiVersion), 9);
+
+		for (const char* extra : extras)
+		{
+			rationale << ", " << extra;
+		}
+		rationale << ", score " << candidate.score;
+		candidate.rationale = rationale.str();
+
+		return candidate;
+	}
+
+
+	// preference is an index ("1"), a UUID (32 hex digits, dashes allowed) or part of the device name, case insensitive.
+	// A number only counts as an index if there is a device with that index, otherwise it is looked for in the names ("4090").
+	bool matches_device_preference(const DeviceCandidate& candidate, size_t candidateCount, const std::string& preference)
+	{
+		if (preference.empty())
+		{
+			return false;
+		}
+
+		// Short enough not to be a UUID that happens to be all digits
+		if (preference.size() < 10 && std::all_of(preference.begin(), preference.end(), [](char c) { return std::isdigit(static_cast<unsigned char>(c)); }))
+		{
+			uint32_t index = static_cast<uint32_t>(std::stoul(preference));
+			if (index < candidateCount)
+			{
+				return index == candidate.index;
+			}
+		}
+
+		auto lower = [](std::string text)
+		{
+			std::transform(text.begin(), text.end(), text.begin(), [](char c) { return static_cast<char>(std::tolower(static_cast<unsigned char>(c))); });
+			return text;
+		};
+
+		std::string uuid = lower(preference);
+		uuid.erase(std::remove(uuid.begin(), uuid.end(), '-'), uuid.end());
+		if (uuid == uuid_string(candidate.uuid))
+		{
+			return true;
+		}
+
+		return lower(std::string(candidate.properties.deviceName.data())).find(lower(preference)) != std::string::npos;
+	}
+
+
+	// Picks the highest scoring suitable device, the first one enumerated on a tie.
+	// preference, or the LEARNING_VULKAN_DEVICE environment variable without it, overrides the scores
+	// if it matches a suitable device (see matches_device_preference).
+	vk::PhysicalDevice choose_physical_device(vk::Instance& instance, vk::SurfaceKHR surface, uint32_t apiVersion, std::string preference, bool debug)
+	{
+		vkUtil::StartupProfiler::Scope timer("choose_physical_device");
+
 		// Physical devices are neither created nor destroyed. Merely chosen.
 		
 		if (debug)
@@ -97,63 +351,143 @@ namespace vkInit
 
 
 		// Get available devices
-		std::vector<vk::PhysicalDevice> availableDevices = instance.enumeratePhysicalDevices();
+		std::vector<vk::PhysicalDevice> availableDevices = vkUtil::vk_call([&]() { return instance.enumeratePhysicalDevices(); }).value_or({});
 		
 		if (debug)
 		{
 			std::cout << "There are " << availableDevices.size() << " physical device(s) available on this system\n";
 		}
 
-		vk::PhysicalDevice chosenDevice = nullptr;
+		std::vector<DeviceCandidate> candidates;
+		for (uint32_t index = 0; index < availableDevices.size(); index++)
+		{
+			if (debug)
+			{
+				log_device_properties(availableDevices[index]);
+			}
+
+			candidates.push_back(score_physical_device(availableDevices[index], index, surface, apiVersion, debug));
+		}
+
+		std::string source = "--device";
+		if (preference.empty())
+		{
+			const char* environment = std::getenv("LEARNING_VULKAN_DEVICE");
+			preference = environment ? environment : "";
+			source = "LEARNING_VULKAN_DEVICE";
+		}
 
-		// Check if any device is suitable
-		for (vk::PhysicalDevice device : availableDevices)
+		const DeviceCandidate* chosen = nullptr;
+		std::string reason;
+		for (const DeviceCandidate& candidate : candidates)
 		{
+			if (!matches_device_preference(candidate, candidates.size(), preference))
+			{
+				continue;
+			}
+
+			if (candidate.suitable)
+			{
+				chosen = &candidate;
+				reason = "matches " + source + " \"" + preference + "\"";
+				break;
+			}
+
 			if (debug)
 			{
-				log_device_properties(device);
+				std::cout << "Device " << candidate.index << " matches " << source << " \"" << preference << "\" but can't be used\n";
+			}
+		}
+
+		if (!preference.empty() && !chosen && debug)
+		{
+			std::cout << "No usable device matches " << source << " \"" << preference << "\", going by score\n";
+		}
+
+		if (!chosen)
+		{
+			for (const DeviceCandidate& candidate : candidates)
+			{
+				if (candidate.suitable && (!chosen || candidate.score > chosen->score))
+				{
+					chosen = &candidate;
+					reason = "highest score";
+				}
+			}
+		}
+
+		if (debug)
+		{
+			std::cout << "Physical devices:\n";
+			for (const DeviceCandidate& candidate : candidates)
+			{
+				std::cout << "\t[" << candidate.index << "] " << candidate.properties.deviceName << " (" << uuid_string(candidate.uuid) << "): "
+					<< candidate.rationale << "\n";
 			}
 
-			if (isSuitable(device, debug))
+			if (chosen)
 			{
-				chosenDevice = device;
+				std::cout << "Picked [" << chosen->index << "] " << chosen->properties.deviceName << ", " << reason << "\n";
+			}
+			else
+			{
+				std::cout << "No physical device can run the engine :/\n";
 			}
 		}
 
-		return chosenDevice;
+		return chosen ? chosen->device : nullptr;
 	}
 
 
-	vk::Device create_logical_device(vk::PhysicalDevice physicalDevice, vk::SurfaceKHR surface, bool debug)
+	vk::Device create_logical_device(const vkUtil::DeviceContext& deviceContext, bool debug)
 	{
-		vkUtil::QueueFamilyIndices indices = vkUtil::findQueueFamilies(physicalDevice, surface, debug);
+		vkUtil::StartupProfiler::Scope timer("create_logical_device");
+
+		const vkUtil::QueueFamilyIndices& indices = deviceContext.queue_families();
 
-		// Get unique indices for queue families
+		// Get unique indices for queue families, and how many queues each one needs
+		// The transfer and compute queues may be extra queues of the graphics family
 		std::vector<uint32_t> uniqueIndices;
-		uniqueIndices.push_back(indices.graphicsFamily.value());
+		std::vector<uint32_t> queueCounts;
 
-		if (indices.graphicsFamily.value() != indices.presentFamily.value())
+		auto request_queue = [&](uint32_t familyIdx, uint32_t queueIdx)
 		{
-			uniqueIndices.push_back(indices.presentFamily.value());
-		}
+			for (size_t ii = 0; ii < uniqueIndices.size(); ii++)
+			{
+				if (uniqueIndices[ii] == familyIdx)
+				{
+					queueCounts[ii] = std::max(queueCounts[ii], queueIdx + 1);
+					return;
+				}
+			}
+
+			uniqueIndices.push_back(familyIdx);
+			queueCounts.push_back(queueIdx + 1);
+		};
+
+		request_queue(indices.graphicsFamily.value(), 0);
+		request_queue(indices.presentFamily.value(), 0);
+		request_queue(indices.transferFamily.value(), indices.transferQueueIndex);
+		request_queue(indices.computeFamily.value(), indices.computeQueueIndex);
 
 		// Queue priority determines how GPU allocates its resources towards different queues
 		// in the same queue family
 		// 0.0 = lowest, 1.0 = highest
-		float queuePriority = 1.0f;
+		// Uploads and compute sharing a family with rendering get the lower priority
+		float queuePriorities[] = { 1.0f, 0.5f, 0.5f };
 
 		// Queue info
 		// flags, queue family index, queue count, pQueuePriorities
 		std::vector<vk::DeviceQueueCreateInfo> queueCreateInfo;
 
-		for (uint32_t queueFamilyIdx : uniqueIndices)
+		for (size_t ii = 0; ii < uniqueIndices.size(); ii++)
 		{
 			queueCreateInfo.push_back(
 				vk::DeviceQueueCreateInfo(
 					vk::DeviceQueueCreateFlags(),
-					queueFamilyIdx,
-					1,
-					&queuePriority
+					uniqueIndices[ii],
+					queueCounts[ii],
+					queuePriorities
 				)
 			);
 		}
@@ -164,12 +498,57 @@ namespace vkInit
 			VK_KHR_SWAPCHAIN_EXTENSION_NAME
 		};
 
+		// Optional: lets texture streaming size itself to what the driver says we can use
+		if (deviceContext.supports_extension(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME))
+		{
+			deviceExtensions.push_back(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+		}
+
 
 
 		// Device features
 		// We can enable features in this if we want
 		// e.g., deviceFeatures.samplerAnisotropy = true
-		vk::PhysicalDeviceFeatures deviceFeatures = vk::PhysicalDeviceFeatures();
+		// Core features go in deviceFeatures.features, Vulkan 1.2 ones are chained behind it
+		const vk::PhysicalDeviceFeatures& supportedCore = deviceContext.supported_features();
+
+		vk::PhysicalDeviceFeatures2 deviceFeatures = vk::PhysicalDeviceFeatures2();
+
+		// One indirect draw for many objects, each with its own firstInstance (object index)
+		deviceFeatures.features.multiDrawIndirect = supportedCore.multiDrawIndirect;
+		deviceFeatures.features.drawIndirectFirstInstance = supportedCore.drawIndirectFirstInstance;
+
+		// Shader invocation counts, to measure what the depth prepass saves
+		deviceFeatures.features.pipelineStatisticsQuery = supportedCore.pipelineStatisticsQuery;
+
+		// The compute mip downsampler writes formats it doesn't know at compile time
+		deviceFeatures.features.shaderStorageImageWriteWithoutFormat = supportedCore.shaderStorageImageWriteWithoutFormat;
+
+		// Block compressed textures, the KTX2 loader checks the formats themselves with getFormatProperties
+		deviceFeatures.features.textureCompressionBC = supportedCore.textureCompressionBC;
+		deviceFeatures.features.textureCompressionETC2 = supportedCore.textureCompressionETC2;
+		deviceFeatures.features.textureCompressionASTC_LDR = supportedCore.textureCompressionASTC_LDR;
+
+		// Descriptor indexing for bindless resources, checked in isSuitable
+		vk::PhysicalDeviceVulkan12Features vulkan12Features = vk::PhysicalDeviceVulkan12Features();
+		vulkan12Features.descriptorIndexing = VK_TRUE;
+		vulkan12Features.runtimeDescriptorArray = VK_TRUE;
+		vulkan12Features.descriptorBindingPartiallyBound = VK_TRUE;
+		vulkan12Features.descriptorBindingUpdateUnusedWhilePending = VK_TRUE;
+		vulkan12Features.descriptorBindingSampledImageUpdateAfterBind = VK_TRUE;
+		vulkan12Features.descriptorBindingStorageBufferUpdateAfterBind = VK_TRUE;
+		vulkan12Features.descriptorBindingStorageImageUpdateAfterBind = VK_TRUE;
+		vulkan12Features.shaderSampledImageArrayNonUniformIndexing = VK_TRUE;
+		vulkan12Features.shaderStorageBufferArrayNonUniformIndexing = VK_TRUE;
+		deviceFeatures.pNext = &vulkan12Features;
+
+		// Optional, the render graph falls back to the original barriers
+		vk::PhysicalDeviceVulkan13Features vulkan13Features = vk::PhysicalDeviceVulkan13Features();
+		if (deviceContext.supports_synchronization2())
+		{
+			vulkan13Features.synchronization2 = VK_TRUE;
+			vulkan12Features.pNext = &vulkan13Features;
+		}
 
 
 		// Enabled layers
@@ -190,45 +569,55 @@ namespace vkInit
 			enabledLayers.size(),
 			enabledLayers.data(),
 			deviceExtensions.size(), deviceExtensions.data(),
-			&deviceFeatures
+			nullptr
 		);
 
+		// With features in a pNext chain pEnabledFeatures has to stay null
+		deviceInfo.pNext = &deviceFeatures;
 
-		// Create the device
-		try
-		{
-			vk::Device device = physicalDevice.createDevice(deviceInfo);
 
-			if (debug)
+		// Create the device
+		vkUtil::Expected<vk::Device> device = vkUtil::vk_call([&]()
 			{
-				std::cout << "Logical device created!\n";
-			}
-			
-			return device;
-		}
-		catch (vk::SystemError err)
+				vkUtil::StartupProfiler::Scope driverTimer("vkCreateDevice", vkUtil::StartupProfiler::Category::eDriver);
+				return deviceContext.physical_device().createDevice(deviceInfo);
+			});
+
+		if (!device)
 		{
 			if (debug)
 			{
 				std::cout << "Logical device creation failed.\n";
-
-				return nullptr;
 			}
+
+			return nullptr;
+		}
+
+		// Device functions straight from vkGetDeviceProcAddr, skipping the loader's lookup on every call.
+		// The engine makes one device, so the default dispatcher is that device's table.
+		VULKAN_HPP_DEFAULT_DISPATCHER.init(device.value());
+
+		if (debug)
+		{
+			std::cout << "Logical device created!\n";
 		}
 
-		return nullptr;
+		return device.value();
 	}
 
 
-	std::array<vk::Queue, 2> get_queue(vk::PhysicalDevice physicalDevice, vk::Device device, vk::SurfaceKHR surface, bool debug)
+	// graphics, present, transfer, compute
+	std::array<vk::Queue, 4> get_queue(const vkUtil::DeviceContext& deviceContext, vk::Device device)
 	{
-		vkUtil::QueueFamilyIndices indices = vkUtil::findQueueFamilies(physicalDevice, surface, debug);
+		const vkUtil::QueueFamilyIndices& indices = deviceContext.queue_families();
 
 		// queue family index, queue index
 		return
 		{
 			device.getQueue(indices.graphicsFamily.value(), 0),
-			device.getQueue(indices.presentFamily.value(), 0)
+			device.getQueue(indices.presentFamily.value(), 0),
+			device.getQueue(indices.transferFamily.value(), indices.transferQueueIndex),
+			device.getQueue(indices.computeFamily.value(), indices.computeQueueIndex)
 		};
 	}
 }
\ No newline at end of file
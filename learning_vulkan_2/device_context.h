@@ -0,0 +1,161 @@
+#pragma once
+
+#include "config.h"
+#include "queue_families.h"
+#include "result.h"
+
+#include <algorithm>
+#include <mutex>
+#include <unordered_map>
+
+
+namespace vkUtil
+{
+	// Everything the engine asks about its physical device, queried once after the device is picked.
+	// Subsystems read it from here instead of asking the driver again on every init and every resource.
+	// Only format properties are filled in lazily, there are too many formats to query them all up front.
+	// Read only once init() returns apart from the format table, which has its own mutex, so threads can share it.
+	class DeviceContext
+	{
+	public:
+		// The surface decides the present family, every other window has to present from it too.
+		// instanceVersion is the apiVersion the instance was created with.
+		void init(vk::PhysicalDevice physicalDevice, vk::SurfaceKHR surface, uint32_t instanceVersion, bool debug)
+		{
+			this->physicalDevice = physicalDevice;
+
+			queueFamilies = findQueueFamilies(physicalDevice, surface, debug);
+
+			vk::StructureChain<vk::PhysicalDeviceProperties2, vk::PhysicalDeviceVulkan12Properties> properties =
+				physicalDevice.getProperties2<vk::PhysicalDeviceProperties2, vk::PhysicalDeviceVulkan12Properties>();
+			this->properties = properties.get<vk::PhysicalDeviceProperties2>().properties;
+			apiVersion = std::min(this->properties.apiVersion, instanceVersion);
+			vulkan12Properties = properties.get<vk::PhysicalDeviceVulkan12Properties>();
+			vulkan12Properties.pNext = nullptr;
+
+			features = physicalDevice.getFeatures();
+			memoryProperties = physicalDevice.getMemoryProperties();
+
+			// Core in Vulkan 1.3, the render graph falls back to the original barriers without it.
+			// A 1.3 device under a 1.2 instance is a 1.2 device, vkCmdPipelineBarrier2 isn't there to load.
+			synchronization2 = false;
+			if (apiVersion >= VK_API_VERSION_1_3)
+			{
+				vk::StructureChain<vk::PhysicalDeviceFeatures2, vk::PhysicalDeviceVulkan13Features> features13 =
+					physicalDevice.getFeatures2<vk::PhysicalDeviceFeatures2, vk::PhysicalDeviceVulkan13Features>();
+				synchronization2 = features13.get<vk::PhysicalDeviceVulkan13Features>().synchronization2;
+			}
+
+			std::vector<vk::ExtensionProperties> supportedExtensions = vk_call([&]() { return physicalDevice.enumerateDeviceExtensionProperties(); }).value_or({});
+			for (const vk::ExtensionProperties& extension : supportedExtensions)
+			{
+				extensions.insert(std::string(extension.extensionName.data()));
+			}
+
+			std::lock_guard<std::mutex> lock(formatMutex);
+			formatProperties.clear();
+		}
+
+		vk::PhysicalDevice physical_device() const
+		{
+			return physicalDevice;
+		}
+
+		const QueueFamilyIndices& queue_families() const
+		{
+			return queueFamilies;
+		}
+
+		const vk::PhysicalDeviceProperties& device_properties() const
+		{
+			return properties;
+		}
+
+		// The version the device is used at, the lower of its own and the instance's
+		uint32_t api_version() const
+		{
+			return apiVersion;
+		}
+
+		const vk::PhysicalDeviceLimits& limits() const
+		{
+			return properties.limits;
+		}
+
+		// Descriptor indexing limits, the bindless heap sizes itself with them
+		const vk::PhysicalDeviceVulkan12Properties& vulkan12_properties() const
+		{
+			return vulkan12Properties;
+		}
+
+		// Supported core features, the device enables the ones the engine uses whenever they are supported
+		const vk::PhysicalDeviceFeatures& supported_features() const
+		{
+			return features;
+		}
+
+		bool supports_synchronization2() const
+		{
+			return synchronization2;
+		}
+
+		bool supports_extension(const char* name) const
+		{
+			return extensions.count(name) > 0;
+		}
+
+		const vk::PhysicalDeviceMemoryProperties& memory_properties() const
+		{
+			return memoryProperties;
+		}
+
+		// Returns UINT32_MAX if no memory type has all the requested properties
+		uint32_t find_memory_type(uint32_t supportedMemoryIndices, vk::MemoryPropertyFlags requestedProperties) const
+		{
+			for (uint32_t ii = 0; ii < memoryProperties.memoryTypeCount; ii++)
+			{
+				// bit ii of supportedMemoryIndices is set if memory type ii can back the resource
+				bool supported{ static_cast<bool>(supportedMemoryIndices & (1 << ii)) };
+
+				bool sufficient{ (memoryProperties.memoryTypes[ii].propertyFlags & requestedProperties) == requestedProperties };
+
+				if (supported && sufficient)
+				{
+					return ii;
+				}
+			}
+
+			return UINT32_MAX;
+		}
+
+		// Asks the driver the first time a format comes up, any thread may call it
+		vk::FormatProperties format_properties(vk::Format format) const
+		{
+			std::lock_guard<std::mutex> lock(formatMutex);
+
+			std::unordered_map<VkFormat, vk::FormatProperties>::iterator cached = formatProperties.find(static_cast<VkFormat>(format));
+			if (cached != formatProperties.end())
+			{
+				return cached->second;
+			}
+
+			vk::FormatProperties properties = physicalDevice.getFormatProperties(format);
+			formatProperties[static_cast<VkFormat>(format)] = properties;
+			return properties;
+		}
+
+	private:
+		vk::PhysicalDevice physicalDevice{ nullptr };
+		QueueFamilyIndices queueFamilies;
+		vk::PhysicalDeviceProperties properties;
+		uint32_t apiVersion = 0;
+		vk::PhysicalDeviceVulkan12Properties vulkan12Properties;
+		vk::PhysicalDeviceFeatures features;
+		vk::PhysicalDeviceMemoryProperties memoryProperties;
+		bool synchronization2 = false;
+		std::set<std::string> extensions;
+
+		mutable std::mutex formatMutex;
+		mutable std::unordered_map<VkFormat, vk::FormatProperties> formatProperties;
+	};
+}
\ No newline at end of file
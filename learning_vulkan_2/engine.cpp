@@ -7,46 +7,162 @@
 #include "device.h"
 #include "swapchain.h"
 #include "pipeline.h"
-#include "framebuffer.h"
 #include "commands.h"
 #include "sync.h"
 
+#include <chrono>
+#include <filesystem>
+#include <thread>
 
-Engine::Engine(int width, int height, GLFWwindow* window, const char* appName, bool debugMode)
+// Storage for VULKAN_HPP_DEFAULT_DISPATCHER, see config.h
+VULKAN_HPP_DEFAULT_DISPATCH_LOADER_DYNAMIC_STORAGE
+
+// Identity view-projection until we have a camera, with z flipped for reversed-Z:
+// z = 0 is the near plane (depth 1) and z = 1 the far plane (depth 0)
+static const float IDENTITY_VIEW_PROJECTION[16] = {
+	1.0f, 0.0f, 0.0f, 0.0f,
+	0.0f, 1.0f, 0.0f, 0.0f,
+	0.0f, 0.0f, -1.0f, 0.0f,
+	0.0f, 0.0f, 1.0f, 1.0f
+};
+
+
+Engine::Engine(int width, int height, GLFWwindow* window, const char* appName, bool debugMode, uint32_t msaaSamples, bool parallelStartup,
+	const std::string& devicePreference)
 {
+	// Everything until the first present is timed
+	vkUtil::startup_profiler().begin();
+
 	this->width = width;
 	this->height = height;
-	this->window = window;
 	this->debugMode = debugMode;
 	this->appName = appName;
+	this->devicePreference = devicePreference;
+
+	vkUtil::WindowTarget primary;
+	primary.window = window;
+	windows.push_back(primary);
 
 	if (debugMode)
 	{
 		std::cout << "Creating our Graphics Engine\n";
 	}
 
-	make_instance();
-	make_device();
-	make_pipeline();
-	finalize_setup();
+	// Startup as tasks that wait only for what they use: shaders are read while the instance and device are created,
+	// and the swapchain, command pool, descriptors and pipelines are made side by side once the device exists
+	const std::string vertexFilepath = "../../../../learning_vulkan_2/shaders/vertex.spv";
+	const std::string fragmentFilepath = "../../../../learning_vulkan_2/shaders/fragment.spv";
+	const std::string computeFilepath = "../../../../learning_vulkan_2/shaders/downsample.spv";
+	std::vector<char> vertexCode, fragmentCode, computeCode;
+
+	TaskGraph startup;
+
+	TaskGraph::Task readVertex = startup.add("read vertex shader", [&]() { vertexCode = vkUtil::readFile(vertexFilepath, debugMode); });
+	TaskGraph::Task readFragment = startup.add("read fragment shader", [&]() { fragmentCode = vkUtil::readFile(fragmentFilepath, debugMode); });
+	TaskGraph::Task readCompute = startup.add("read downsample shader", [&]()
+		{
+			// Optional, textures just get fewer mips without it
+			if (std::filesystem::exists(computeFilepath))
+			{
+				computeCode = vkUtil::readFile(computeFilepath, debugMode);
+			}
+		});
+
+	TaskGraph::Task instanceTask = startup.add("instance", [this]() { make_instance(); });
+	TaskGraph::Task deviceTask = startup.add("device", [this]() { make_device(); }, { instanceTask });
+
+	// Everything the render pass is made for, the swapchain needn't exist to know its format
+	TaskGraph::Task formats = startup.add("formats", [this, msaaSamples]()
+		{
+			this->msaaSamples = vkUtil::choose_sample_count(deviceContext, msaaSamples, debugMode);
+			depthFormat = vkUtil::choose_depth_format(deviceContext, debugMode);
+			swapchainFormat = vkInit::choose_swapchain_surface_format(
+				vkUtil::vk_call([&]() { return physicalDevice.getSurfaceFormatsKHR(windows[0].surface); }).value_or({}), vk::Format::eUndefined).format;
+		}, { deviceTask });
+
+	// Every other window has to match the first one's format. Without it there is nothing to render to,
+	// the engine can't start and the task graph hands the error to the caller.
+	TaskGraph::Task swapchain = startup.add("swapchain", [this]()
+		{
+			make_swapchain(windows[0], width, height, nullptr);
+			if (!windows[0].swapchain)
+			{
+				throw std::runtime_error("Failed to create swapchain :/\n");
+			}
+		}, { formats });
+	startup.add("window targets", [this]() { make_window_targets(windows[0]); }, { swapchain });
+
+	startup.add("command pool", [this]() { make_commands(); }, { deviceTask });
+	TaskGraph::Task descriptors = startup.add("descriptors", [this]() { make_descriptors(); }, { deviceTask });
+
+	// One cache for every pipeline, whichever window it ends up drawing into
+	TaskGraph::Task cache = startup.add("pipeline cache", [this]()
+		{
+			// Pipelines are still made without one, only slower
+			vkUtil::Expected<vk::PipelineCache> created = vkUtil::vk_call([&]() { return device.createPipelineCache(vk::PipelineCacheCreateInfo()); });
+			if (!created)
+			{
+				if (debugMode)
+				{
+					std::cout << "Failed to create pipeline cache :/" << std::endl;
+				}
+				return;
+			}
+			pipelineCache = created.value();
+		}, { deviceTask });
+
+	startup.add("graphics pipelines", [&]() { make_pipeline(vertexFilepath, vertexCode, fragmentFilepath, fragmentCode); },
+		{ formats, descriptors, cache, readVertex, readFragment });
+	startup.add("mip downsampler", [&]() { make_mip_downsampler(computeFilepath, computeCode); },
+		{ cache, readCompute });
+
+	startup.add("resources", [this]() { finalize_setup(); }, { descriptors });
+
+	// No destructor runs for an engine whose constructor throws, so a failed task's half made engine is torn down here.
+	// run() has waited for every other task by the time it rethrows.
+	try
+	{
+		startup.run(parallelStartup ? &threadPool : nullptr);
+	}
+	catch (...)
+	{
+		destroy_everything();
+		throw;
+	}
+
+	for (const TaskGraph::Timing& timing : startup.timings())
+	{
+		vkUtil::startup_profiler().record(timing.name, vkUtil::StartupProfiler::Category::eTask, timing.start, timing.end, timing.thread);
+	}
+
+	if (debugMode)
+	{
+		std::cout << (parallelStartup ? "Parallel" : "Serial") << " startup of " << startup.size() << " tasks took "
+			<< vkUtil::startup_profiler().elapsed_ms() << " ms\n";
+	}
 }
 
 void Engine::make_instance()
 {
 	// Create Vulkan instance
-	instance = vkInit::make_instance(debugMode, appName);
-	
-	// Create dispatch loader to assist with debug messenger
-	dldi = vk::DispatchLoaderDynamic(instance, vkGetInstanceProcAddr);
+	apiVersion = vkInit::choose_api_version(debugMode);
+	instance = vkInit::make_instance(debugMode, appName, apiVersion);
 
-	// Create Debug messenger
+	// Create Debug messenger, make_instance loaded its functions into the default dispatcher
 	if (debugMode)
 	{
-		debugMessenger = vkInit::make_debug_messenger(instance, dldi);
+		debugMessenger = vkInit::make_debug_messenger(instance);
 	}
 
-	// Create surface
-	VkSurfaceKHR c_style_surface;
+	// Create the first window's surface, the device has to be able to present to it
+	windows[0].surface = make_surface(windows[0].window);
+}
+
+vk::SurfaceKHR Engine::make_surface(GLFWwindow* window)
+{
+	vkUtil::StartupProfiler::Scope driverTimer("glfwCreateWindowSurface", vkUtil::StartupProfiler::Category::eDriver);
+
+	VkSurfaceKHR c_style_surface = VK_NULL_HANDLE;
 	if (glfwCreateWindowSurface(instance, window, nullptr, &c_style_surface) != VK_SUCCESS)
 	{
 		if (debugMode)
@@ -59,199 +175,1907 @@ void Engine::make_instance()
 		std::cout << "Successfully abstracted the glfw surface for Vulkan.\n";
 	}
 
-	surface = c_style_surface;
+	return c_style_surface;
 }
 
 void Engine::make_device()
 {
 	// physical device
-	physicalDevice = vkInit::choose_physical_device(instance, debugMode);
+	physicalDevice = vkInit::choose_physical_device(instance, windows[0].surface, apiVersion, devicePreference, debugMode);
+
+	// Like a missing swapchain, the task graph hands it to the caller and the engine is torn down
+	if (!physicalDevice)
+	{
+		throw std::runtime_error("No physical device can run the engine :/\n");
+	}
+
+	// Everything below asks the context rather than the driver
+	deviceContext.init(physicalDevice, windows[0].surface, apiVersion, debugMode);
 
 	// logical device
-	device = vkInit::create_logical_device(physicalDevice, surface, debugMode);
+	device = vkInit::create_logical_device(deviceContext, debugMode);
+	if (!device)
+	{
+		throw std::runtime_error("Failed to create logical device :/\n");
+	}
 
 	// Queues
-	std::array<vk::Queue, 2> queues = vkInit::get_queue(physicalDevice, device, surface, debugMode);
+	std::array<vk::Queue, 4> queues = vkInit::get_queue(deviceContext, device);
 	graphicsQueue = queues[0];
 	presentQueue = queues[1];
-	
-	// Swapchain
-	vkInit::SwapchainBundle bundle = vkInit::create_swapchain(device, physicalDevice, surface, width, height, debugMode);
-	swapchain = bundle.swapchain;
-	swapchainFrames = bundle.frames;
-	swapchainFormat = bundle.format;
-	swapchainExtent = bundle.extent;
+	transferQueue = queues[2];
+	computeQueue = queues[3];
+	presentFamily = deviceContext.queue_families().presentFamily.value();
+
+	// Queues that turned out to be the same VkQueue share the first one's mutex
+	std::array<std::mutex*, 4> mutexes;
+	for (size_t ii = 0; ii < queues.size(); ii++)
+	{
+		mutexes[ii] = &queueMutexes[ii];
+		for (size_t jj = 0; jj < ii; jj++)
+		{
+			if (queues[jj] == queues[ii])
+			{
+				mutexes[ii] = mutexes[jj];
+				break;
+			}
+		}
+	}
+	graphicsQueueMutex = mutexes[0];
+	presentQueueMutex = mutexes[1];
+	transferQueueMutex = mutexes[2];
+	computeQueueMutex = mutexes[3];
+}
+
+void Engine::make_swapchain(vkUtil::WindowTarget& target, int width, int height, vk::SwapchainKHR oldSwapchain)
+{
+	vkInit::SwapchainBundle bundle = vkInit::create_swapchain(device, deviceContext, target.surface, width, height, swapchainFormat, oldSwapchain, debugMode);
+	target.swapchain = bundle.swapchain;
+	target.frames = bundle.frames;
+	target.format = bundle.format;
+	target.extent = bundle.extent;
+}
+
+void Engine::make_window_targets(vkUtil::WindowTarget& target)
+{
+	if (msaaSamples != vk::SampleCountFlagBits::e1)
+	{
+		vkUtil::attachmentInput attachmentInput;
+		attachmentInput.logicalDevice = device;
+		attachmentInput.deviceContext = &deviceContext;
+		attachmentInput.format = swapchainFormat;
+		attachmentInput.extent = target.extent;
+		attachmentInput.samples = msaaSamples;
+		attachmentInput.usage = vk::ImageUsageFlagBits::eColorAttachment;
+		attachmentInput.aspect = vk::ImageAspectFlagBits::eColor;
+		target.colorTarget = vkUtil::create_attachment(attachmentInput, debugMode);
+	}
+
+	vkUtil::attachmentInput depthInput;
+	depthInput.logicalDevice = device;
+	depthInput.deviceContext = &deviceContext;
+	depthInput.format = depthFormat;
+	depthInput.extent = target.extent;
+	depthInput.samples = msaaSamples;
+	depthInput.usage = vk::ImageUsageFlagBits::eDepthStencilAttachment;
+	depthInput.aspect = vk::ImageAspectFlagBits::eDepth;
+	target.depthTarget = vkUtil::create_attachment(depthInput, debugMode);
+
+	target.imageAvailable = vkInit::make_semaphore(device, debugMode);
+}
+
+void Engine::recreate_swapchain(vkUtil::WindowTarget& target)
+{
+	vkUtil::Expected<vk::SurfaceCapabilitiesKHR> capabilities = vkUtil::vk_call([&]() { return physicalDevice.getSurfaceCapabilitiesKHR(target.surface); });
+	if (!capabilities)
+	{
+		return;
+	}
+
+	// Minimized, there is nothing to present until it comes back. It stays out of date until then.
+	vk::Extent2D extent = capabilities.value().currentExtent;
+	if (extent.width == 0 || extent.height == 0)
+	{
+		return;
+	}
+
+	// The frame that used them has been waited on, its present may still be queued
+	vkUtil::WindowTarget old = target;
+	for (const vkUtil::SwapchainFrame& frame : old.frames)
+	{
+		renderGraph.forget_view(frame.imageView);
+	}
+	renderGraph.forget_view(old.colorTarget.view);
+	renderGraph.forget_view(old.depthTarget.view);
+
+	deletionQueue.defer([old](vk::Device device) mutable
+		{
+			device.destroySemaphore(old.imageAvailable);
+			vkUtil::destroy_attachment(device, old.colorTarget);
+			vkUtil::destroy_attachment(device, old.depthTarget);
+			for (const vkUtil::SwapchainFrame& frame : old.frames)
+			{
+				device.destroyImageView(frame.imageView);
+			}
+			device.destroySwapchainKHR(old.swapchain);
+		});
+
+	target.colorTarget = vkUtil::Attachment();
+	target.depthTarget = vkUtil::Attachment();
+	target.imageAvailable = nullptr;
+
+	// Only used where the surface lets the swapchain pick its size, glfwGetFramebufferSize is the main thread's
+	make_swapchain(target, old.extent.width, old.extent.height, old.swapchain);
+	if (!target.swapchain)
+	{
+		// The old swapchain was retired all the same, the next attempt starts from nothing
+		return;
+	}
+
+	make_window_targets(target);
+	target.outOfDate = false;
+}
+
+uint32_t Engine::attach_window(GLFWwindow* window)
+{
+	vkUtil::WindowTarget target;
+	target.window = window;
+	target.surface = make_surface(window);
+	if (!target.surface)
+	{
+		return UINT32_MAX;
+	}
+
+	// Every window presents through the one present queue
+	if (!vkUtil::vk_call([&]() { return physicalDevice.getSurfaceSupportKHR(presentFamily, target.surface); }).value_or(VK_FALSE))
+	{
+		if (debugMode)
+		{
+			std::cout << "The present queue can't present to this window :/" << std::endl;
+		}
+		instance.destroySurfaceKHR(target.surface);
+		return UINT32_MAX;
+	}
+
+	int framebufferWidth, framebufferHeight;
+	glfwGetFramebufferSize(window, &framebufferWidth, &framebufferHeight);
+
+	make_swapchain(target, framebufferWidth, framebufferHeight, nullptr);
+	if (!target.swapchain)
+	{
+		instance.destroySurfaceKHR(target.surface);
+		return UINT32_MAX;
+	}
+
+	if (target.format != swapchainFormat)
+	{
+		if (debugMode)
+		{
+			std::cout << "Window can't present " << vk::to_string(swapchainFormat) << ", the format the pipelines were made for :/" << std::endl;
+		}
+
+		// Its views are forgotten by the render graph the render thread is using
+		std::lock_guard<std::mutex> lock(windowsMutex);
+		destroy_window(target, false);
+		return UINT32_MAX;
+	}
+
+	make_window_targets(target);
+
+	std::lock_guard<std::mutex> lock(windowsMutex);
+
+	// Detached windows' handles are reused
+	for (uint32_t handle = 0; handle < windows.size(); handle++)
+	{
+		if (!windows[handle].window)
+		{
+			windows[handle] = target;
+			return handle;
+		}
+	}
+
+	windows.push_back(target);
+	return static_cast<uint32_t>(windows.size() - 1);
+}
+
+void Engine::detach_window(uint32_t handle)
+{
+	std::lock_guard<std::mutex> lock(windowsMutex);
+
+	if (handle >= windows.size() || !windows[handle].window)
+	{
+		return;
+	}
+
+	destroy_window(windows[handle], true);
+	windows[handle] = vkUtil::WindowTarget();
+}
+
+void Engine::destroy_window(vkUtil::WindowTarget& target, bool deferred)
+{
+	for (const vkUtil::SwapchainFrame& frame : target.frames)
+	{
+		renderGraph.forget_view(frame.imageView);
+	}
+	renderGraph.forget_view(target.colorTarget.view);
+	renderGraph.forget_view(target.depthTarget.view);
+
+	// The surface goes last, after the swapchain made from it
+	vk::Instance instance = this->instance;
+	auto release = [instance, target](vk::Device device) mutable
+	{
+		device.destroySemaphore(target.imageAvailable);
+		vkUtil::destroy_attachment(device, target.colorTarget);
+		vkUtil::destroy_attachment(device, target.depthTarget);
+		for (const vkUtil::SwapchainFrame& frame : target.frames)
+		{
+			device.destroyImageView(frame.imageView);
+		}
+		device.destroySwapchainKHR(target.swapchain);
+		instance.destroySurfaceKHR(target.surface);
+	};
+
+	// The frame in flight may still render into the window, and its present may still be queued
+	if (deferred)
+	{
+		deletionQueue.defer(release);
+	}
+	else
+	{
+		release(device);
+	}
+}
+
+void Engine::make_descriptors()
+{
+	// Descriptors
+	// inFlightFence only lets one frame be in flight, so there is one per-frame chain
+	frameDescriptors.init(device, 1, 256, vkUtil::DEFAULT_DESCRIPTOR_RATIOS, debugMode);
+	persistentDescriptors.init(device, 64, vkUtil::DEFAULT_DESCRIPTOR_RATIOS, debugMode);
+
+	// Everything the shaders read comes through the bindless set, the uniform ring and the push constants
+	bindless.init(device, deviceContext, debugMode);
+
+	vkUtil::uniformRingInput ringInput;
+	ringInput.logicalDevice = device;
+	ringInput.deviceContext = &deviceContext;
+	ringInput.framesInFlight = 1;
+	ringInput.frameSize = 1024 * 1024;
+	ringInput.maxBlockSize = 1024;
+	ringInput.descriptors = &persistentDescriptors;
+	uniformRing.init(ringInput, debugMode);
 }
 
-void Engine::make_pipeline()
+void Engine::make_pipeline(const std::string& vertexFilepath, const std::vector<char>& vertexCode,
+	const std::string& fragmentFilepath, const std::vector<char>& fragmentCode)
 {
 	vkInit::GraphicsPipelineInBundle specification = {};
 	specification.device = device;
-	specification.vertexFilepath = "../../../../learning_vulkan_2/shaders/vertex.spv";
-	specification.fragmentFilepath = "../../../../learning_vulkan_2/shaders/fragment.spv";
-	specification.swapchainExtent = swapchainExtent;
+	specification.vertexFilepath = vertexFilepath;
+	specification.vertexCode = vertexCode;
+	specification.fragmentFilepath = fragmentFilepath;
+	specification.fragmentCode = fragmentCode;
 	specification.swapchainImageFormat = swapchainFormat;
+	specification.depthFormat = depthFormat;
+	specification.samples = msaaSamples;
+	specification.pipelineCache = pipelineCache;
+
+	specification.setLayouts = { bindless.layout(), uniformRing.layout() };
+
+	drawConstants.stages = vk::ShaderStageFlagBits::eVertex;
+	specification.pushConstantRanges = { drawConstants.range() };
+	specification.maxPushConstantsSize = deviceContext.limits().maxPushConstantsSize;
 
 	vkInit::GraphicsPipelineOutBundle output = vkInit::make_graphics_pipeline(specification, debugMode);
 	layout = output.layout;
 	renderPass = output.renderpass;
 	pipeline = output.pipeline;
+
+	// Depth prepass variants
+	specification.layout = layout;
+	specification.renderpass = renderPass;
+	specification.depthPass = vkInit::DepthPass::eDepthOnly;
+	prepassPipeline = vkInit::make_graphics_pipeline(specification, debugMode).pipeline;
+	specification.depthPass = vkInit::DepthPass::eShadeAfterPrepass;
+	prepassShadePipeline = vkInit::make_graphics_pipeline(specification, debugMode).pipeline;
 }
 
-void Engine::finalize_setup()
+void Engine::make_commands()
 {
-	vkInit::framebufferInput framebufferInput;
-	framebufferInput.device = device;
-	framebufferInput.renderpass = renderPass;
-	framebufferInput.swapchainExtent = swapchainExtent;
-	
-	vkInit::make_framebuffers(framebufferInput, swapchainFrames, debugMode);
+	commandPool = vkInit::make_command_pool(device, deviceContext, debugMode);
 
-	commandPool = vkInit::make_command_pool(device, physicalDevice, surface, debugMode);
+	vkInit::commandBufferInputChunk commandBufferInput = { device, commandPool };
+	mainCommandBuffer = vkInit::make_command_buffer(commandBufferInput, debugMode);
 
-	vkInit::commandBufferInputChunk commandBufferInput = { device, commandPool, swapchainFrames };
-	mainCommandBuffer = vkInit::make_command_buffers(commandBufferInput, debugMode);
-
-	imageAvailable = vkInit::make_semaphore(device, debugMode);
 	renderFinished = vkInit::make_semaphore(device, debugMode);
 	inFlightFence = vkInit::make_fence(device, debugMode);
 }
 
-void Engine::record_draw_commands(vk::CommandBuffer commandBuffer, uint32_t imageIndex)
+void Engine::finalize_setup()
 {
-	vk::CommandBufferBeginInfo beginInfo = {};
+	deletionQueue.init(device, debugMode);
+	renderGraph.init(device, &deviceContext, &deletionQueue, debugMode);
 
-	try
-	{
-		commandBuffer.begin(beginInfo);
-	}
-	catch (vk::SystemError err)
+	statistics.init(device, deviceContext, debugMode);
+
+	// Uploads
+	const vkUtil::QueueFamilyIndices& queueFamilyIndices = deviceContext.queue_families();
+
+	vkUtil::uploaderInput uploaderInput;
+	uploaderInput.logicalDevice = device;
+	uploaderInput.deviceContext = &deviceContext;
+	uploaderInput.transferQueue = transferQueue;
+	uploaderInput.transferFamily = queueFamilyIndices.transferFamily.value();
+	uploaderInput.graphicsFamily = queueFamilyIndices.graphicsFamily.value();
+	uploaderInput.transferQueueMutex = transferQueueMutex;
+	uploader.init(uploaderInput, debugMode);
+
+	// Async compute
+	vkUtil::computeSchedulerInput computeInput;
+	computeInput.logicalDevice = device;
+	computeInput.graphicsQueue = graphicsQueue;
+	computeInput.computeQueue = computeQueue;
+	computeInput.computeQueueMutex = computeQueueMutex;
+	computeInput.graphicsFamily = queueFamilyIndices.graphicsFamily.value();
+	computeInput.computeFamily = queueFamilyIndices.computeFamily.value();
+	computeScheduler.init(computeInput, debugMode);
+
+	// Object and material tables, registered first so they land in the slots the shaders expect
+	vkUtil::BufferInputChunk bufferInput;
+	bufferInput.logicalDevice = device;
+	bufferInput.deviceContext = &deviceContext;
+	bufferInput.usage = vk::BufferUsageFlagBits::eStorageBuffer;
+
+	bufferInput.size = 1024 * sizeof(vkUtil::GpuObject);
+	objectBuffer = vkUtil::createMappedBuffer(bufferInput, debugMode);
+
+	bufferInput.size = vkUtil::MAX_MATERIALS * sizeof(vkUtil::GpuMaterial);
+	materialBuffer = vkUtil::createMappedBuffer(bufferInput, debugMode);
+
+	bool slotsMatch = bindless.add_storage_buffer(objectBuffer.buffer.buffer) == vkUtil::OBJECT_BUFFER_INDEX
+		&& bindless.add_storage_buffer(materialBuffer.buffer.buffer) == vkUtil::MATERIAL_BUFFER_INDEX;
+
+	if (!slotsMatch && debugMode)
 	{
-		if (debugMode)
-		{
-			std::cout << "Failed to begin recording command buffer :/" << std::endl;
-		}
+		std::cout << "Object and material buffers didn't get the bindless slots the shaders use :/" << std::endl;
 	}
 
-	vk::RenderPassBeginInfo renderPassInfo = {};
-	renderPassInfo.renderPass = renderPass;
-	renderPassInfo.framebuffer = swapchainFrames[imageIndex].frameBuffer;
-	renderPassInfo.renderArea.offset.x = 0;
-	renderPassInfo.renderArea.offset.y = 0;
-	renderPassInfo.renderArea.extent = swapchainExtent;
+	// Textures
+	textureSampler = vkTexture::make_sampler(device, vk::Filter::eLinear, debugMode);
 
-	vk::ClearValue clearColor = { std::array<float, 4>{0.2f, 0.1f, 0.9f, 1.0f} };
-	renderPassInfo.clearValueCount = 1;
-	renderPassInfo.pClearValues = &clearColor;
+	vkTexture::streamerInput streamerInput;
+	streamerInput.logicalDevice = device;
+	streamerInput.deviceContext = &deviceContext;
+	streamerInput.transferQueue = transferQueue;
+	streamerInput.transferQueueMutex = transferQueueMutex;
+	streamerInput.transferFamily = queueFamilyIndices.transferFamily.value();
+	streamerInput.graphicsFamily = queueFamilyIndices.graphicsFamily.value();
+	streamerInput.bindless = &bindless;
+	streamerInput.sampler = textureSampler;
+	streamerInput.deletionQueue = &deletionQueue;
+	streamerInput.memoryBudget = deviceContext.supports_extension(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+	textureStreamer.init(streamerInput, debugMode);
+
+	// Material 0 is what objects without a material get
+	float white[4] = { 1.0f, 1.0f, 1.0f, 1.0f };
+	create_material(white, vkUtil::NO_TEXTURE);
 
-	commandBuffer.beginRenderPass(&renderPassInfo, vk::SubpassContents::eInline);
+	// Indirect draws need multiDrawIndirect to draw more than one object per call,
+	// and drawIndirectFirstInstance to pass the object index in firstInstance
+	const vk::PhysicalDeviceFeatures& features = deviceContext.supported_features();
+	indirectDraws = features.multiDrawIndirect && features.drawIndirectFirstInstance;
 
-	commandBuffer.bindPipeline(vk::PipelineBindPoint::eGraphics, pipeline);
+	bufferInput.usage = vk::BufferUsageFlagBits::eIndirectBuffer;
+	bufferInput.size = 1024 * sizeof(vk::DrawIndirectCommand);
+	indirectBuffer = vkUtil::createMappedBuffer(bufferInput, debugMode);
 
-	commandBuffer.draw(3, 1, 0, 0);
+	if (debugMode)
+	{
+		std::cout << (indirectDraws ? "Drawing large batches of visible objects with one indirect draw\n" : "Drawing visible objects one draw at a time\n");
+	}
 
-	commandBuffer.endRenderPass();
+	// Frustum culling
+	cullingKernel = vkUtil::selectCullingKernel();
 
-	try
+	if (debugMode)
 	{
-		commandBuffer.end();
+		std::cout << "Using the " << vkUtil::cullingKernelName(cullingKernel) << " frustum culling kernel\n";
 	}
-	catch (vk::SystemError err)
+
+	// For now the only object is the hardcoded triangle, it has no mesh
+	float center[3] = { 0.0f, 0.0f, 0.0f };
+	float aabbMin[3] = { -0.5f, -0.5f, 0.0f };
+	float aabbMax[3] = { 0.5f, 0.5f, 0.0f };
+	NodeHandle triangle = scene.create_node();
+	scene.set_local_bounds(triangle, center, 0.71f, aabbMin, aabbMax);
+}
+
+void Engine::make_mip_downsampler(const std::string& computeFilepath, const std::vector<char>& computeCode)
+{
+	if (!deviceContext.supported_features().shaderStorageImageWriteWithoutFormat || computeCode.empty())
 	{
 		if (debugMode)
 		{
-			std::cout << "Failed to finish recording command buffer :/" << std::endl;
+			std::cout << "No compute mip downsampler, formats that can't be blitted get no mips\n";
 		}
+		return;
 	}
+
+	vkInit::descriptorSetLayoutData setLayoutData;
+	setLayoutData.bindings.push_back(vk::DescriptorSetLayoutBinding(0, vk::DescriptorType::eCombinedImageSampler, 1, vk::ShaderStageFlagBits::eCompute));
+	setLayoutData.bindings.push_back(vk::DescriptorSetLayoutBinding(1, vk::DescriptorType::eStorageImage, 1, vk::ShaderStageFlagBits::eCompute));
+	mipDownsampler.setLayout = vkInit::make_descriptor_set_layout(device, setLayoutData, debugMode);
+
+	mipDownsampler.sampler = vkTexture::make_sampler(device, vk::Filter::eNearest, debugMode);
+	mipDownsampler.constants.stages = vk::ShaderStageFlagBits::eCompute;
+
+	vkInit::ComputePipelineInBundle specification = {};
+	specification.device = device;
+	specification.computeFilepath = computeFilepath;
+	specification.computeCode = computeCode;
+	specification.setLayouts = { mipDownsampler.setLayout };
+	specification.pushConstantRanges = { mipDownsampler.constants.range() };
+	specification.maxPushConstantsSize = deviceContext.limits().maxPushConstantsSize;
+	specification.pipelineCache = pipelineCache;
+
+	vkInit::ComputePipelineOutBundle output = vkInit::make_compute_pipeline(specification, debugMode);
+	mipDownsampler.layout = output.layout;
+	mipDownsampler.pipeline = output.pipeline;
 }
 
-void Engine::render()
+uint32_t Engine::load_mesh(const char* filename)
 {
-	device.waitForFences(1, &inFlightFence, VK_TRUE, UINT64_MAX);
-	device.resetFences(1, &inFlightFence);
+	std::lock_guard<std::mutex> lock(resourcesMutex);
 
-	// Acquire next image
-	uint32_t imageIndex{ device.acquireNextImageKHR(swapchain, UINT64_MAX, imageAvailable, nullptr).value };
+	vkMesh::meshUploadInput uploadInput;
+	uploadInput.logicalDevice = device;
+	uploadInput.deviceContext = &deviceContext;
+	uploadInput.uploader = &uploader;
 
-	vk::CommandBuffer commandBuffer = swapchainFrames[imageIndex].commandBuffer;
+	vkMesh::MeshBuffers mesh = {};
+	if (!vkMesh::load_mesh(filename, uploadInput, mesh, debugMode))
+	{
+		return UINT32_MAX;
+	}
 
-	commandBuffer.reset();
+	meshes.push_back(mesh);
 
-	record_draw_commands(commandBuffer, imageIndex);
+	return static_cast<uint32_t>(meshes.size() - 1);
+}
 
-	vk::SubmitInfo submitInfo = {};
+uint32_t Engine::create_texture(const vkTexture::TextureData& data)
+{
+	std::lock_guard<std::mutex> lock(resourcesMutex);
 
-	vk::Semaphore waitSemaphores[] = { imageAvailable };
-	vk::PipelineStageFlags waitStages[] = { vk::PipelineStageFlagBits::eColorAttachmentOutput };
-	submitInfo.waitSemaphoreCount = 1;
-	submitInfo.pWaitSemaphores = waitSemaphores;
-	submitInfo.pWaitDstStageMask = waitStages;
-	submitInfo.commandBufferCount = 1;
-	submitInfo.pCommandBuffers = &commandBuffer;
+	vkTexture::textureUploadInput uploadInput;
+	uploadInput.logicalDevice = device;
+	uploadInput.deviceContext = &deviceContext;
+	uploadInput.uploader = &uploader;
+	uploadInput.computeMips = static_cast<bool>(mipDownsampler.pipeline);
 
-	vk::Semaphore signalSemaphores[] = { renderFinished };
-	submitInfo.signalSemaphoreCount = 1;
-	submitInfo.pSignalSemaphores = signalSemaphores;
+	vkTexture::Texture texture = {};
+	if (!vkTexture::create_texture(data, uploadInput, texture, debugMode))
+	{
+		return UINT32_MAX;
+	}
 
-	try
+	textureMemory += texture.memorySize;
+	if (debugMode)
 	{
-		graphicsQueue.submit(submitInfo, inFlightFence);
+		std::cout << "Textures now use " << textureMemory / (1024 * 1024) << " MiB\n";
 	}
-	catch (vk::SystemError err)
+
+	textures.push_back(texture);
+	pendingTextures.push_back(static_cast<uint32_t>(textures.size() - 1));
+
+	return static_cast<uint32_t>(textures.size() - 1);
+}
+
+uint32_t Engine::load_texture(const char* filename)
+{
+	std::shared_ptr<MappedFile> file = std::make_shared<MappedFile>();
+	if (!file->open(filename))
 	{
 		if (debugMode)
 		{
-			std::cout << "Failed to submit draw command buffer :/" << std::endl;
+			std::cout << "Failed to map \"" << filename << "\"" << std::endl;
+		}
+		return UINT32_MAX;
+	}
+
+	vkTexture::Ktx2Info info;
+	if (!vkTexture::read_ktx2(*file, info, debugMode))
+	{
+		return UINT32_MAX;
+	}
+
+	// Plain payloads are copied from the mapping into staging right away
+	if (!info.basis)
+	{
+		vkTexture::TextureData data;
+		if (!vkTexture::ktx2_texture_data(*file, info, deviceContext, data, debugMode))
+		{
+			return UINT32_MAX;
 		}
+
+		return create_texture(data);
+	}
+
+	// Basis payloads get a handle now and an image once a worker has transcoded them
+	vkTexture::TranscodeTarget target = vkTexture::choose_transcode_target(deviceContext, info.srgb, debugMode);
+	if (debugMode)
+	{
+		std::cout << "Transcoding \"" << filename << "\" to " << vk::to_string(vkTexture::transcode_format(target, info.srgb)) << "\n";
 	}
 
-	vk::PresentInfoKHR presentInfo = {};
-	presentInfo.waitSemaphoreCount = 1;
-	presentInfo.pWaitSemaphores = signalSemaphores;
-	vk::SwapchainKHR swapchains[] = { swapchain };
-	presentInfo.swapchainCount = 1;
-	presentInfo.pSwapchains = swapchains;
-	presentInfo.pImageIndices = &imageIndex;
+	std::lock_guard<std::mutex> lock(resourcesMutex);
+	textures.push_back(vkTexture::Texture());
+	uint32_t handle = static_cast<uint32_t>(textures.size() - 1);
+	transcodeQueue.submit(threadPool, handle, file, info, target, debugMode);
 
-	presentQueue.presentKHR(presentInfo);
+	return handle;
 }
 
-Engine::~Engine()
+uint32_t Engine::load_streamed_texture(const char* filename)
 {
-	device.waitIdle(); // wait until device is idle
+	std::shared_ptr<MappedFile> file = std::make_shared<MappedFile>();
+	if (!file->open(filename))
+	{
+		if (debugMode)
+		{
+			std::cout << "Failed to map \"" << filename << "\"" << std::endl;
+		}
+		return UINT32_MAX;
+	}
 
-	if (debugMode)
+	vkTexture::Ktx2Info info;
+	if (!vkTexture::read_ktx2(*file, info, debugMode))
 	{
-		std::cout << "Bye!\n";
+		return UINT32_MAX;
 	}
 
-	device.destroySemaphore(imageAvailable);
-	device.destroySemaphore(renderFinished);
-	device.destroyFence(inFlightFence);
+	std::lock_guard<std::mutex> lock(resourcesMutex);
 
-	device.destroyCommandPool(commandPool);
+	// The streamer's worker reads the tail, the texture becomes resident when it arrives
+	uint32_t streamedHandle = textureStreamer.add(file, info);
+	if (streamedHandle == UINT32_MAX)
+	{
+		return UINT32_MAX;
+	}
 
-	device.destroyPipeline(pipeline);
-	device.destroyPipelineLayout(layout);
-	device.destroyRenderPass(renderPass);
+	vkTexture::Texture texture = {};
+	texture.format = info.format;
+	texture.extent = vk::Extent2D(info.width, info.height);
+	texture.mipLevels = static_cast<uint32_t>(info.levels.size());
+	texture.streamedHandle = streamedHandle;
+
+	textures.push_back(texture);
+	streamedTextures.push_back(static_cast<uint32_t>(textures.size() - 1));
 
+	return static_cast<uint32_t>(textures.size() - 1);
+}
 
-	for (const auto& frame : swapchainFrames)
+void Engine::finish_transcodes()
+{
+	for (vkTexture::TranscodedTexture& transcoded : transcodeQueue.take_finished())
 	{
-		device.destroyImageView(frame.imageView);
-		device.destroyFramebuffer(frame.frameBuffer);
+		if (!transcoded.succeeded)
+		{
+			continue;
+		}
+
+		vkTexture::textureUploadInput uploadInput;
+		uploadInput.logicalDevice = device;
+		uploadInput.deviceContext = &deviceContext;
+		uploadInput.uploader = &uploader;
+		uploadInput.computeMips = static_cast<bool>(mipDownsampler.pipeline);
+
+		vkTexture::Texture& texture = textures[transcoded.handle];
+		if (vkTexture::create_texture(transcoded.data, uploadInput, texture, debugMode))
+		{
+			textureMemory += texture.memorySize;
+			pendingTextures.push_back(transcoded.handle);
+		}
 	}
+}
 
-	device.destroySwapchainKHR(swapchain);
-	device.destroy();
+vk::DeviceSize Engine::texture_memory() const
+{
+	std::lock_guard<std::mutex> lock(resourcesMutex);
+	return textureMemory + textureStreamer.resident_memory();
+}
 
-	instance.destroySurfaceKHR(surface);
-	if (debugMode)
+void Engine::make_textures_resident(vk::CommandBuffer commandBuffer)
+{
+	for (auto handle = pendingTextures.begin(); handle != pendingTextures.end();)
 	{
-		instance.destroyDebugUtilsMessengerEXT(debugMessenger, nullptr, dldi);
+		vkTexture::Texture& texture = textures[*handle];
+
+		// Only once the copy has finished, so the graphics queue never waits on the transfer queue
+		if (!uploader.is_complete(texture.uploadBatch))
+		{
+			handle++;
+			continue;
+		}
+
+		uploader.acquire(texture.uploadBatch, commandBuffer, frameWaitSemaphores, frameWaitStages);
+		vkTexture::record_mip_generation(commandBuffer, texture, device, mipDownsampler, frameDescriptors);
+
+		texture.bindlessIndex = bindless.add_texture(texture.view, textureSampler);
+		texture.resident = true;
+		assign_texture_to_materials(*handle);
+
+		handle = pendingTextures.erase(handle);
 	}
+}
 
-	instance.destroy();
+void Engine::assign_texture_to_materials(uint32_t texture)
+{
+	// The previous frame has retired, nothing is reading the material table
+	vkUtil::GpuMaterial* materials = static_cast<vkUtil::GpuMaterial*>(materialBuffer.data);
+	for (uint32_t material = 0; material < materialCount; material++)
+	{
+		if (materialTextures[material] == texture)
+		{
+			materials[material].albedoTexture = textures[texture].bindlessIndex;
+		}
+	}
+}
 
-	glfwTerminate();
+void Engine::update_streaming()
+{
+	for (uint32_t streamedHandle : textureStreamer.update(frameWaitSemaphores, frameWaitStages))
+	{
+		uint32_t handle = streamedTextures[streamedHandle];
+
+		// The slot stays the same from here on, finer levels are swapped in behind it
+		textures[handle].bindlessIndex = textureStreamer.bindless_index(streamedHandle);
+		textures[handle].resident = true;
+		assign_texture_to_materials(handle);
+	}
+}
+
+void Engine::request_texture_detail(const vkUtil::FrameSnapshot& frame)
+{
+	// Every window shows the same view, the tallest one needs the most detail
+	uint32_t viewportHeight = 0;
+	for (const vkUtil::WindowTarget& target : windows)
+	{
+		if (target.window)
+		{
+			viewportHeight = std::max(viewportHeight, target.extent.height);
+		}
+	}
+
+	const float* viewProjection = frame.viewProjection;
+	for (const vkUtil::SnapshotObject& object : frame.objects)
+	{
+		if (object.material >= materialCount || materialTextures[object.material] >= textures.size())
+		{
+			continue;
+		}
+
+		const vkTexture::Texture& texture = textures[materialTextures[object.material]];
+		if (texture.streamedHandle == UINT32_MAX)
+		{
+			continue;
+		}
+
+		// Clip space w of the bounding sphere's center, the sphere's diameter over w is roughly
+		// its size in normalised device coordinates, which span the viewport twice
+		float w = viewProjection[3] * object.center[0] + viewProjection[7] * object.center[1]
+			+ viewProjection[11] * object.center[2] + viewProjection[15];
+		float screenPixels = object.radius / std::max(w, 0.001f) * viewportHeight;
+
+		textureStreamer.request(texture.streamedHandle, screenPixels);
+	}
+}
+
+uint32_t Engine::create_material(const float baseColor[4], uint32_t albedoTexture)
+{
+	std::lock_guard<std::mutex> lock(resourcesMutex);
+
+	if (materialCount == vkUtil::MAX_MATERIALS)
+	{
+		if (debugMode)
+		{
+			std::cout << "Out of material slots :/" << std::endl;
+		}
+		return 0;
+	}
+
+	// New slots aren't read by frames already in flight, so no need to wait
+	vkUtil::GpuMaterial material = {};
+	memcpy(material.baseColor, baseColor, sizeof(material.baseColor));
+	material.albedoTexture = vkUtil::NO_TEXTURE;
+	if (albedoTexture < textures.size() && textures[albedoTexture].resident)
+	{
+		material.albedoTexture = textures[albedoTexture].bindlessIndex;
+	}
+	static_cast<vkUtil::GpuMaterial*>(materialBuffer.data)[materialCount] = material;
+	materialTextures.push_back(albedoTexture);
+
+	return materialCount++;
+}
+
+bool Engine::use_indirect_draws(const vkUtil::FrameSnapshot& frame) const
+{
+	return indirectDraws && frame.objects.size() >= INDIRECT_DRAW_THRESHOLD;
+}
+
+void Engine::write_object_data(const vkUtil::FrameSnapshot& frame)
+{
+	// Direct draws push everything they need
+	if (!use_indirect_draws(frame))
+	{
+		return;
+	}
+
+	// Grow to the next power of two, the previous frame has finished so the old buffers can go
+	vk::DeviceSize objectsNeeded = frame.objects.size() * sizeof(vkUtil::GpuObject);
+	if (objectsNeeded > objectBuffer.buffer.size)
+	{
+		vk::DeviceSize size = objectBuffer.buffer.size;
+		while (size < objectsNeeded)
+		{
+			size *= 2;
+		}
+
+		vkUtil::destroyMappedBuffer(device, objectBuffer);
+		vkUtil::BufferInputChunk bufferInput = { size, vk::BufferUsageFlagBits::eStorageBuffer, device, &deviceContext };
+		objectBuffer = vkUtil::createMappedBuffer(bufferInput, debugMode);
+		bindless.update_storage_buffer(vkUtil::OBJECT_BUFFER_INDEX, objectBuffer.buffer.buffer);
+	}
+
+	vk::DeviceSize commandsNeeded = frame.objects.size() * sizeof(vk::DrawIndirectCommand);
+	if (commandsNeeded > indirectBuffer.buffer.size)
+	{
+		vk::DeviceSize size = indirectBuffer.buffer.size;
+		while (size < commandsNeeded)
+		{
+			size *= 2;
+		}
+
+		vkUtil::destroyMappedBuffer(device, indirectBuffer);
+		vkUtil::BufferInputChunk bufferInput = { size, vk::BufferUsageFlagBits::eIndirectBuffer, device, &deviceContext };
+		indirectBuffer = vkUtil::createMappedBuffer(bufferInput, debugMode);
+	}
+
+	// Objects are stored in snapshot order, firstInstance carries the position to the shaders
+	vkUtil::GpuObject* objects = static_cast<vkUtil::GpuObject*>(objectBuffer.data);
+	vk::DrawIndirectCommand* commands = static_cast<vk::DrawIndirectCommand*>(indirectBuffer.data);
+
+	for (uint32_t ii = 0; ii < frame.objects.size(); ii++)
+	{
+		const vkUtil::SnapshotObject& object = frame.objects[ii];
+
+		memcpy(objects[ii].model, object.world.m, sizeof(objects[ii].model));
+		objects[ii].materialID = object.material < materialCount ? object.material : 0;
+
+		commands[ii] = vk::DrawIndirectCommand(3, 1, 0, ii);
+	}
+}
+
+void Engine::acquire_uploads(vk::CommandBuffer commandBuffer, const vkUtil::FrameSnapshot& frame)
+{
+	for (const vkUtil::SnapshotObject& object : frame.objects)
+	{
+		// acquire() ignores batches that were already acquired
+		if (object.mesh < meshes.size())
+		{
+			uploader.acquire(meshes[object.mesh].uploadBatch, commandBuffer, frameWaitSemaphores, frameWaitStages);
+		}
+	}
+}
+
+void Engine::benchmark_async_compute()
+{
+	const std::string computeFilepath = "../../../../learning_vulkan_2/shaders/busy.spv";
+	if (!std::filesystem::exists(computeFilepath))
+	{
+		std::cout << "The async compute benchmark needs shaders/busy.spv, run shader_compile.bat first\n";
+		return;
+	}
+
+	// Sized so either side alone keeps the GPU busy for a few milliseconds
+	const uint32_t invocations = 1024 * 1024;
+	const uint32_t iterations = 2048;
+	const uint32_t triangleInstances = 2000;
+	const int repetitions = 20;
+
+
+	// Compute side: an ALU loop writing one float per invocation
+	// Both queues use the buffer but nobody reads it back, so no ownership transfers
+	vkUtil::BufferInputChunk bufferInput;
+	bufferInput.size = invocations * sizeof(float);
+	bufferInput.usage = vk::BufferUsageFlagBits::eStorageBuffer;
+	bufferInput.logicalDevice = device;
+	bufferInput.deviceContext = &deviceContext;
+	bufferInput.memoryProperties = vk::MemoryPropertyFlagBits::eDeviceLocal;
+	vkUtil::Buffer results = vkUtil::createBuffer(bufferInput, debugMode);
+
+	vkInit::descriptorSetLayoutData setLayoutData;
+	setLayoutData.bindings.push_back(vk::DescriptorSetLayoutBinding(0, vk::DescriptorType::eStorageBuffer, 1, vk::ShaderStageFlagBits::eCompute));
+	vk::DescriptorSetLayout setLayout = vkInit::make_descriptor_set_layout(device, setLayoutData, debugMode);
+
+	vkUtil::DescriptorAllocator descriptors;
+	descriptors.init(device, 1, { { vk::DescriptorType::eStorageBuffer, 1.0f } }, debugMode);
+	vk::DescriptorSet descriptorSet = descriptors.allocate(setLayout);
+
+	vk::DescriptorBufferInfo bufferInfo(results.buffer, 0, VK_WHOLE_SIZE);
+	vk::WriteDescriptorSet write(descriptorSet, 0, 0, 1, vk::DescriptorType::eStorageBuffer, nullptr, &bufferInfo);
+	device.updateDescriptorSets(1, &write, 0, nullptr);
+
+	vkInit::ComputePipelineInBundle computeSpecification = {};
+	computeSpecification.device = device;
+	computeSpecification.computeFilepath = computeFilepath;
+	computeSpecification.setLayouts = { setLayout };
+	vkUtil::PushConstantBlock<uint32_t> iterationConstants;
+	iterationConstants.stages = vk::ShaderStageFlagBits::eCompute;
+	computeSpecification.pushConstantRanges = { iterationConstants.range() };
+	computeSpecification.maxPushConstantsSize = deviceContext.limits().maxPushConstantsSize;
+	computeSpecification.pipelineCache = pipelineCache;
+	vkInit::ComputePipelineOutBundle busy = vkInit::make_compute_pipeline(computeSpecification, debugMode);
+
+	auto record_compute = [&](vk::CommandBuffer commandBuffer)
+	{
+		commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute, busy.pipeline);
+		commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute, busy.layout, 0, 1, &descriptorSet, 0, nullptr);
+		iterationConstants.push(commandBuffer, busy.layout, iterations);
+		commandBuffer.dispatch(invocations / 64, 1, 1);
+	};
+
+
+	// Graphics side: the triangle, overdrawn many times into an offscreen image the size of the first window
+	// Made step by step below, cleanup copes with whatever was made before a failure
+	vk::Image target = nullptr;
+	vk::DeviceMemory targetMemory = nullptr;
+	vk::ImageView targetView = nullptr;
+	vk::RenderPass offscreenPass = nullptr;
+	vk::Framebuffer offscreenFramebuffer = nullptr;
+	std::vector<vk::CommandBuffer> commandBuffers;
+
+	auto cleanup = [&]()
+	{
+		if (!commandBuffers.empty())
+		{
+			device.freeCommandBuffers(commandPool, commandBuffers);
+		}
+		device.destroyFramebuffer(offscreenFramebuffer);
+		device.destroyRenderPass(offscreenPass);
+		device.destroyImageView(targetView);
+		device.destroyImage(target);
+		device.freeMemory(targetMemory);
+		device.destroyPipeline(busy.pipeline);
+		device.destroyPipelineLayout(busy.layout);
+		descriptors.destroy();
+		device.destroyDescriptorSetLayout(setLayout);
+		vkUtil::destroyBuffer(device, results);
+	};
+
+	auto failed = [&]()
+	{
+		std::cout << "Failed to set up the async compute benchmark :/\n";
+		cleanup();
+	};
+
+	if (!results.buffer || !busy.pipeline)
+	{
+		failed();
+		return;
+	}
+
+	const vkUtil::WindowTarget& primary = windows[0];
+	vk::ImageCreateInfo imageInfo = {};
+	imageInfo.imageType = vk::ImageType::e2D;
+	imageInfo.format = swapchainFormat;
+	imageInfo.extent = vk::Extent3D(primary.extent.width, primary.extent.height, 1);
+	imageInfo.mipLevels = 1;
+	imageInfo.arrayLayers = 1;
+	imageInfo.samples = vk::SampleCountFlagBits::e1;
+	imageInfo.tiling = vk::ImageTiling::eOptimal;
+	imageInfo.usage = vk::ImageUsageFlagBits::eColorAttachment;
+	imageInfo.sharingMode = vk::SharingMode::eExclusive;
+	imageInfo.initialLayout = vk::ImageLayout::eUndefined;
+	target = vkUtil::vk_call([&]() { return device.createImage(imageInfo); }).value_or(nullptr);
+	if (!target)
+	{
+		failed();
+		return;
+	}
+
+	vk::MemoryRequirements memoryRequirements = device.getImageMemoryRequirements(target);
+	vk::MemoryAllocateInfo allocInfo = {};
+	allocInfo.allocationSize = memoryRequirements.size;
+	allocInfo.memoryTypeIndex = vkUtil::findMemoryTypeIndex(deviceContext, memoryRequirements.memoryTypeBits, vk::MemoryPropertyFlagBits::eDeviceLocal);
+	targetMemory = vkUtil::vk_call([&]() { return device.allocateMemory(allocInfo); }).value_or(nullptr);
+	if (!targetMemory || !vkUtil::vk_call([&]() { return device.bindImageMemory(target, targetMemory, 0); }))
+	{
+		failed();
+		return;
+	}
+
+	vk::ImageViewCreateInfo viewInfo = {};
+	viewInfo.image = target;
+	viewInfo.viewType = vk::ImageViewType::e2D;
+	viewInfo.format = swapchainFormat;
+	viewInfo.subresourceRange = vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1);
+	targetView = vkUtil::vk_call([&]() { return device.createImageView(viewInfo); }).value_or(nullptr);
+
+	// Compatible with the pipeline's render pass, but the image is never presented.
+	// With MSAA the engine's color target is reused, the benchmark has the device to itself.
+	offscreenPass = vkInit::make_renderpass(device, swapchainFormat, depthFormat, msaaSamples,
+		vk::ImageLayout::eColorAttachmentOptimal, debugMode);
+	if (!targetView || !offscreenPass)
+	{
+		failed();
+		return;
+	}
+
+	std::vector<vk::ImageView> offscreenAttachments = { targetView };
+	if (primary.colorTarget.view)
+	{
+		offscreenAttachments.insert(offscreenAttachments.begin(), primary.colorTarget.view);
+	}
+	offscreenAttachments.push_back(primary.depthTarget.view);
+	vk::FramebufferCreateInfo framebufferInfo(vk::FramebufferCreateFlags(), offscreenPass, static_cast<uint32_t>(offscreenAttachments.size()),
+		offscreenAttachments.data(), primary.extent.width, primary.extent.height, 1);
+	offscreenFramebuffer = vkUtil::vk_call([&]() { return device.createFramebuffer(framebufferInfo); }).value_or(nullptr);
+
+
+	// Recorded once, resubmitted every repetition
+	vk::CommandBufferAllocateInfo commandBufferInfo(commandPool, vk::CommandBufferLevel::ePrimary, 2);
+	commandBuffers = vkUtil::vk_call([&]() { return device.allocateCommandBuffers(commandBufferInfo); }).value_or({});
+	if (!offscreenFramebuffer || commandBuffers.empty())
+	{
+		failed();
+		return;
+	}
+	vk::CommandBuffer graphicsWork = commandBuffers[0];
+	vk::CommandBuffer computeOnGraphics = commandBuffers[1];
+
+	if (!vkUtil::vk_call([&]() { return graphicsWork.begin(vk::CommandBufferBeginInfo()); }))
+	{
+		failed();
+		return;
+	}
+	std::vector<vk::ClearValue> clearValues(offscreenAttachments.size(), vk::ClearValue(std::array<float, 4>{0.0f, 0.0f, 0.0f, 1.0f}));
+	clearValues.back() = vk::ClearDepthStencilValue(0.0f, 0);
+	vk::RenderPassBeginInfo renderPassInfo(offscreenPass, offscreenFramebuffer, vk::Rect2D({ 0, 0 }, primary.extent),
+		static_cast<uint32_t>(clearValues.size()), clearValues.data());
+	graphicsWork.beginRenderPass(&renderPassInfo, vk::SubpassContents::eInline);
+	graphicsWork.bindPipeline(vk::PipelineBindPoint::eGraphics, pipeline);
+	bool bound = bind_benchmark_draw_state(graphicsWork);
+	graphicsWork.setViewport(0, vk::Viewport(0.0f, 0.0f, static_cast<float>(primary.extent.width), static_cast<float>(primary.extent.height), 0.0f, 1.0f));
+	graphicsWork.setScissor(0, vk::Rect2D({ 0, 0 }, primary.extent));
+	if (bound)
+	{
+		graphicsWork.draw(3, triangleInstances, 0, 0);
+	}
+	graphicsWork.endRenderPass();
+	if (!bound || !vkUtil::vk_call([&]() { return graphicsWork.end(); })
+		|| !vkUtil::vk_call([&]() { return computeOnGraphics.begin(vk::CommandBufferBeginInfo()); }))
+	{
+		failed();
+		return;
+	}
+	record_compute(computeOnGraphics);
+	if (!vkUtil::vk_call([&]() { return computeOnGraphics.end(); }))
+	{
+		failed();
+		return;
+	}
+
+	// Set when a submit or wait fails, the timings mean nothing after that
+	bool broken = false;
+
+	auto submit_on_graphics = [&](std::vector<vk::CommandBuffer> work)
+	{
+		vk::SubmitInfo submitInfo = {};
+		submitInfo.commandBufferCount = static_cast<uint32_t>(work.size());
+		submitInfo.pCommandBuffers = work.data();
+
+		std::lock_guard<std::mutex> lock(*graphicsQueueMutex);
+		if (!vkUtil::vk_call([&]() { return graphicsQueue.submit(submitInfo, nullptr); }))
+		{
+			broken = true;
+		}
+	};
+
+	auto wait_idle = [&]()
+	{
+		if (!vkUtil::vk_call([&]() { return device.waitIdle(); }))
+		{
+			broken = true;
+		}
+		computeScheduler.collect();
+	};
+
+	// Average milliseconds from submission to the device going idle, after one warm up run
+	auto time_ms = [&](const std::function<void()>& submit)
+	{
+		submit();
+		wait_idle();
+
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		for (int ii = 0; ii < repetitions && !broken; ii++)
+		{
+			submit();
+			wait_idle();
+		}
+		std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+
+		return elapsed.count() / repetitions;
+	};
+
+	double graphicsTime = time_ms([&]() { submit_on_graphics({ graphicsWork }); });
+	double computeTime = time_ms([&]() { submit_on_graphics({ computeOnGraphics }); });
+	double oneQueueTime = time_ms([&]() { submit_on_graphics({ graphicsWork, computeOnGraphics }); });
+	double twoQueueTime = time_ms([&]()
+		{
+			computeScheduler.schedule(record_compute);
+			submit_on_graphics({ graphicsWork });
+		});
+
+	if (broken)
+	{
+		std::cout << "The async compute benchmark failed to submit or wait for its work :/\n";
+		cleanup();
+		return;
+	}
+
+	std::cout << "Async compute benchmark, " << repetitions << " repetitions\n";
+	if (!computeScheduler.is_async())
+	{
+		std::cout << "\tno async compute queue on this device, both runs use the graphics queue\n";
+	}
+	std::cout << "\tgraphics alone: " << graphicsTime << " ms\n";
+	std::cout << "\tcompute alone:  " << computeTime << " ms\n";
+	std::cout << "\tone queue:      " << oneQueueTime << " ms\n";
+	std::cout << "\ttwo queues:     " << twoQueueTime << " ms ("
+		<< 100.0 * (oneQueueTime - twoQueueTime) / oneQueueTime << "% less than one queue)\n";
+
+
+	cleanup();
+}
+
+void Engine::set_depth_prepass(bool enabled)
+{
+	depthPrepass = enabled && prepassPipeline && prepassShadePipeline;
+}
+
+const vkUtil::FrameStatistics& Engine::last_frame_statistics() const
+{
+	return statistics.last_frame();
+}
+
+void Engine::benchmark_depth_prepass()
+{
+	if (!statistics.is_supported())
+	{
+		std::cout << "The depth prepass benchmark needs pipeline statistics queries\n";
+		return;
+	}
+
+	// Triangles stacked back to front, the worst order without a prepass: every layer gets shaded
+	const int layers = 32;
+	const int frames = 10;
+
+	float center[3] = { 0.0f, 0.0f, 0.0f };
+	float aabbMin[3] = { -0.5f, -0.5f, 0.0f };
+	float aabbMax[3] = { 0.5f, 0.5f, 0.0f };
+	for (int ii = 0; ii < layers; ii++)
+	{
+		float z = 1.0f - (ii + 0.5f) / layers;
+		NodeHandle layer = scene.create_node({}, Transform::translation(0.0f, 0.0f, z));
+		scene.set_local_bounds(layer, center, 0.71f, aabbMin, aabbMax);
+	}
+
+	// Set when the device can't be waited on, the queries never come back then
+	bool broken = false;
+
+	auto measure = [&](bool prepass)
+	{
+		set_depth_prepass(prepass);
+		for (int ii = 0; ii < frames; ii++)
+		{
+			simulate();
+			render();
+		}
+
+		if (!vkUtil::vk_call([&]() { return device.waitIdle(); }))
+		{
+			broken = true;
+		}
+		statistics.collect();
+		return statistics.last_frame();
+	};
+
+	vkUtil::FrameStatistics withoutPrepass = measure(false);
+	vkUtil::FrameStatistics withPrepass = measure(true);
+	set_depth_prepass(false);
+
+	if (broken)
+	{
+		std::cout << "The depth prepass benchmark failed to wait for its frames :/\n";
+		return;
+	}
+
+	std::cout << "Depth prepass benchmark, " << layers + 1 << " overlapping triangles\n";
+	std::cout << "\twithout prepass: " << withoutPrepass.vertexInvocations << " vertex, "
+		<< withoutPrepass.fragmentInvocations << " fragment shader invocations\n";
+	std::cout << "\twith prepass:    " << withPrepass.vertexInvocations << " vertex, "
+		<< withPrepass.fragmentInvocations << " fragment shader invocations\n";
+}
+
+void Engine::benchmark_transient_aliasing()
+{
+	// A deferred frame at 1080p: shadow map, g-buffer, lighting, bloom at half resolution, tonemapping
+	const vk::Extent2D full(1920, 1080);
+	const vk::Extent2D half(960, 540);
+	const vk::Extent2D shadowExtent(2048, 2048);
+	const vk::ClearValue clearColor = vk::ClearValue(std::array<float, 4>{0.0f, 0.0f, 0.0f, 1.0f});
+	const vk::ClearValue clearDepth = vk::ClearDepthStencilValue(0.0f, 0);
+
+	vkUtil::RenderGraph graph;
+	graph.init(device, &deviceContext, nullptr, debugMode);
+
+	vkUtil::transientImageInput depthInput;
+	depthInput.format = vk::Format::eD32Sfloat;
+	depthInput.extent = shadowExtent;
+	depthInput.aspect = vk::ImageAspectFlagBits::eDepth;
+	vkUtil::GraphResource shadowMap = graph.create_image("shadow map", depthInput);
+	depthInput.extent = full;
+	vkUtil::GraphResource sceneDepth = graph.create_image("scene depth", depthInput);
+
+	vkUtil::GraphResource albedo = graph.create_image("albedo", { vk::Format::eR8G8B8A8Unorm, full });
+	vkUtil::GraphResource normal = graph.create_image("normal", { vk::Format::eR16G16B16A16Sfloat, full });
+	vkUtil::GraphResource material = graph.create_image("material", { vk::Format::eR8G8B8A8Unorm, full });
+	vkUtil::GraphResource hdr = graph.create_image("hdr", { vk::Format::eR16G16B16A16Sfloat, full });
+	vkUtil::GraphResource bloom = graph.create_image("bloom", { vk::Format::eR16G16B16A16Sfloat, half });
+	vkUtil::GraphResource bloomBlurred = graph.create_image("bloom blurred", { vk::Format::eR16G16B16A16Sfloat, half });
+	vkUtil::GraphResource ldr = graph.create_image("ldr", { vk::Format::eR8G8B8A8Unorm, full });
+	vkUtil::GraphResource overlay = graph.create_image("debug overlay", { vk::Format::eR8G8B8A8Unorm, full });
+
+	// Only the memory is measured, the passes record nothing
+	auto nothing = [](vk::CommandBuffer) {};
+	graph.add_pass("shadow", nothing).depth(shadowMap, clearDepth);
+	graph.add_pass("gbuffer", nothing).color(albedo, clearColor).color(normal, clearColor).color(material, clearColor).depth(sceneDepth, clearDepth);
+	graph.add_pass("lighting", nothing).read(albedo, vkUtil::ResourceUse::eSampledFragment).read(normal, vkUtil::ResourceUse::eSampledFragment)
+		.read(material, vkUtil::ResourceUse::eSampledFragment).read(sceneDepth, vkUtil::ResourceUse::eSampledFragment)
+		.read(shadowMap, vkUtil::ResourceUse::eSampledFragment).color(hdr, clearColor);
+	graph.add_pass("bloom downsample", nothing).read(hdr, vkUtil::ResourceUse::eSampledFragment).color(bloom, clearColor);
+	graph.add_pass("bloom blur", nothing).read(bloom, vkUtil::ResourceUse::eSampledFragment).color(bloomBlurred, clearColor);
+	graph.add_pass("tonemap", nothing).read(hdr, vkUtil::ResourceUse::eSampledFragment).read(bloomBlurred, vkUtil::ResourceUse::eSampledFragment)
+		.color(ldr, clearColor).side_effects();
+	graph.add_pass("debug overlay", nothing).read(sceneDepth, vkUtil::ResourceUse::eSampledFragment).color(overlay, clearColor);
+	graph.compile();
+
+	// Run it once so the validation layers see the aliasing barriers
+	vk::CommandBufferAllocateInfo commandBufferInfo(commandPool, vk::CommandBufferLevel::ePrimary, 1);
+	vkUtil::Expected<std::vector<vk::CommandBuffer>> commandBuffers = vkUtil::vk_call([&]() { return device.allocateCommandBuffers(commandBufferInfo); });
+	if (!commandBuffers)
+	{
+		std::cout << "Failed to allocate the transient aliasing benchmark's command buffer :/\n";
+		graph.destroy();
+		return;
+	}
+	vk::CommandBuffer commandBuffer = commandBuffers.value()[0];
+	vkUtil::Expected<void> ran = vkUtil::vk_call([&]() { return commandBuffer.begin(vk::CommandBufferBeginInfo(vk::CommandBufferUsageFlagBits::eOneTimeSubmit)); });
+	if (ran)
+	{
+		graph.execute(commandBuffer);
+		ran = vkUtil::vk_call([&]() { return commandBuffer.end(); });
+	}
+
+	vk::SubmitInfo submitInfo = {};
+	submitInfo.commandBufferCount = 1;
+	submitInfo.pCommandBuffers = &commandBuffer;
+	if (ran)
+	{
+		std::lock_guard<std::mutex> lock(*graphicsQueueMutex);
+		ran = vkUtil::vk_call([&]() { return graphicsQueue.submit(submitInfo, nullptr); });
+	}
+	if (ran)
+	{
+		ran = vkUtil::vk_call([&]() { return device.waitIdle(); });
+	}
+
+	// The memory figures come from compiling the graph, they hold either way
+	if (!ran)
+	{
+		std::cout << "Failed to run the transient aliasing benchmark's graph :/\n";
+	}
+
+	double unaliased = graph.transient_memory_unaliased() / (1024.0 * 1024.0);
+	double aliased = graph.transient_memory_aliased() / (1024.0 * 1024.0);
+	std::cout << "Transient aliasing benchmark, 6 passes at " << full.width << "x" << full.height << ", " << graph.culled_passes() << " culled\n";
+	std::cout << "\twithout aliasing: " << unaliased << " MB\n";
+	std::cout << "\twith aliasing:    " << aliased << " MB (" << 100.0 * (unaliased - aliased) / unaliased << "% less)\n";
+
+	device.freeCommandBuffers(commandPool, commandBuffer);
+	graph.destroy();
+}
+
+void Engine::benchmark_render_thread()
+{
+	// A grid of small triangles, enough that culling and copying them out costs about as much as drawing them
+	const int side = 300;
+	const double seconds = 3.0;
+
+	float center[3] = { 0.0f, 0.0f, 0.0f };
+	float aabbMin[3] = { -0.5f, -0.5f, 0.0f };
+	float aabbMax[3] = { 0.5f, 0.5f, 0.0f };
+	const float scale = 1.0f / side;
+	for (int y = 0; y < side; y++)
+	{
+		for (int x = 0; x < side; x++)
+		{
+			Transform local = Transform::translation(-1.0f + (2.0f * x + 1.0f) * scale, -1.0f + (2.0f * y + 1.0f) * scale, 0.5f);
+			local.m[0] = scale;
+			local.m[5] = scale;
+			NodeHandle triangle = scene.create_node({}, local);
+			scene.set_local_bounds(triangle, center, 0.71f, aabbMin, aabbMax);
+		}
+	}
+
+	// Set when the device can't be waited on between runs
+	bool broken = false;
+
+	// Frames drawn from a new snapshot per second, drawing the same snapshot twice doesn't count
+	auto frames_per_second = [&](const std::function<void(const std::atomic<bool>&)>& run)
+	{
+		std::atomic<bool> running{ true };
+		uint64_t freshBefore = freshFrames;
+
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		std::thread timer([&]()
+			{
+				std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+				running = false;
+			});
+		run(running);
+		timer.join();
+		std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+		if (!vkUtil::vk_call([&]() { return device.waitIdle(); }))
+		{
+			broken = true;
+		}
+
+		return (freshFrames - freshBefore) / elapsed.count();
+	};
+
+	// Both on the main thread, one after the other
+	double serial = frames_per_second([&](const std::atomic<bool>& running)
+		{
+			while (running)
+			{
+				glfwPollEvents();
+				simulate();
+				render();
+			}
+		});
+
+	// Simulation on the main thread, recording and submission on a render thread
+	double threaded = frames_per_second([&](const std::atomic<bool>& running)
+		{
+			std::thread renderThread([&]()
+				{
+					while (running)
+					{
+						render();
+					}
+				});
+			while (running)
+			{
+				glfwPollEvents();
+				simulate();
+			}
+			renderThread.join();
+		});
+
+	if (broken)
+	{
+		std::cout << "The render thread benchmark failed to wait for its frames :/\n";
+		return;
+	}
+
+	std::cout << "Render thread benchmark, " << side * side << " objects, " << seconds << " s each\n";
+	std::cout << "\tone thread:  " << serial << " fps\n";
+	std::cout << "\ttwo threads: " << threaded << " fps (" << 100.0 * (threaded - serial) / serial << "% more)\n";
+	std::cout << "\tpresentation is FIFO, so neither goes past the refresh rate\n";
+}
+
+void Engine::benchmark_draw_dispatch()
+{
+	// Enough draws that one recording takes milliseconds, not microseconds
+	const uint32_t draws = 200000;
+	const int repetitions = 20;
+
+	// A secondary command buffer continues a render pass without a framebuffer, so the draws are valid
+	// without anything to draw into. It is only ever recorded, never submitted.
+	vk::CommandBufferAllocateInfo commandBufferInfo(commandPool, vk::CommandBufferLevel::eSecondary, 1);
+	vkUtil::Expected<std::vector<vk::CommandBuffer>> commandBuffers = vkUtil::vk_call([&]() { return device.allocateCommandBuffers(commandBufferInfo); });
+	if (!commandBuffers)
+	{
+		std::cout << "Failed to allocate the draw dispatch benchmark's command buffer :/\n";
+		return;
+	}
+	vk::CommandBuffer commandBuffer = commandBuffers.value()[0];
+
+	vk::CommandBufferInheritanceInfo inheritanceInfo(renderPass, 0, nullptr);
+	vk::CommandBufferBeginInfo beginInfo(vk::CommandBufferUsageFlagBits::eRenderPassContinue, &inheritanceInfo);
+
+	const vkUtil::WindowTarget& primary = windows[0];
+	vk::Viewport viewport(0.0f, 0.0f, static_cast<float>(primary.extent.width), static_cast<float>(primary.extent.height), 0.0f, 1.0f);
+	vk::Rect2D scissor({ 0, 0 }, primary.extent);
+
+	// Set when a recording can't be started, bound or finished
+	bool broken = false;
+
+	// Nanoseconds per draw of one recording, setup and vkEndCommandBuffer aren't timed
+	auto record = [&](bool trampoline)
+	{
+		if (!vkUtil::vk_call([&]() { return commandBuffer.reset(); })
+			|| !vkUtil::vk_call([&]() { return commandBuffer.begin(beginInfo); }))
+		{
+			broken = true;
+			return 0.0;
+		}
+		commandBuffer.bindPipeline(vk::PipelineBindPoint::eGraphics, pipeline);
+		if (!bind_benchmark_draw_state(commandBuffer))
+		{
+			broken = true;
+			return 0.0;
+		}
+		commandBuffer.setViewport(0, viewport);
+		commandBuffer.setScissor(0, scissor);
+
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		if (trampoline)
+		{
+			// The loader's exported vkCmdDraw finds the device's table through the command buffer on every call
+			VkCommandBuffer handle = static_cast<VkCommandBuffer>(commandBuffer);
+			for (uint32_t ii = 0; ii < draws; ii++)
+			{
+				vkCmdDraw(handle, 3, 1, 0, ii);
+			}
+		}
+		else
+		{
+			// What the engine records with, a pointer from vkGetDeviceProcAddr
+			for (uint32_t ii = 0; ii < draws; ii++)
+			{
+				commandBuffer.draw(3, 1, 0, ii);
+			}
+		}
+		std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+
+		if (!vkUtil::vk_call([&]() { return commandBuffer.end(); }))
+		{
+			broken = true;
+		}
+		return elapsed.count() / draws;
+	};
+
+	// One warm up each, then alternated so clock changes hit both the same
+	record(true);
+	record(false);
+
+	double trampolineTime = 0.0;
+	double dispatchTime = 0.0;
+	for (int ii = 0; ii < repetitions; ii++)
+	{
+		trampolineTime += record(true) / repetitions;
+		dispatchTime += record(false) / repetitions;
+	}
+
+	if (broken)
+	{
+		std::cout << "Failed to record the draw dispatch benchmark's command buffer :/\n";
+		device.freeCommandBuffers(commandPool, commandBuffer);
+		return;
+	}
+
+	std::cout << "Draw dispatch benchmark, " << draws << " draws per recording, " << repetitions << " recordings\n";
+	std::cout << "\tloader trampoline:  " << trampolineTime << " ns per draw\n";
+	std::cout << "\tdevice dispatch:    " << dispatchTime << " ns per draw (" << trampolineTime - dispatchTime << " ns, "
+		<< 100.0 * (trampolineTime - dispatchTime) / trampolineTime << "% less)\n";
+
+	device.freeCommandBuffers(commandPool, commandBuffer);
+}
+
+void Engine::build_frame_graph(const vkUtil::FrameSnapshot& frame)
+{
+	renderGraph.reset();
+
+	// Barriers on combined depth stencil formats have to name both aspects
+	vk::ImageAspectFlags depthAspect = vk::ImageAspectFlagBits::eDepth;
+	if (depthFormat == vk::Format::eD32SfloatS8Uint)
+	{
+		depthAspect |= vk::ImageAspectFlagBits::eStencil;
+	}
+
+	vk::ClearValue clearColor = { std::array<float, 4>{0.2f, 0.1f, 0.9f, 1.0f} };
+
+	// One forward pass per window, they share nothing but the pipelines and the frame's data
+	for (const vkUtil::WindowTarget& target : windows)
+	{
+		if (!target.acquired)
+		{
+			continue;
+		}
+
+		// The acquire semaphore is waited on at color attachment output, the layout transition has to wait there too
+		vkUtil::graphImageInput backbufferInput;
+		backbufferInput.image = target.frames[target.imageIndex].image;
+		backbufferInput.view = target.frames[target.imageIndex].imageView;
+		backbufferInput.format = swapchainFormat;
+		backbufferInput.extent = target.extent;
+		backbufferInput.initial.stages = vk::PipelineStageFlagBits2::eColorAttachmentOutput;
+		backbufferInput.finalLayout = vk::ImageLayout::ePresentSrcKHR;
+		vkUtil::GraphResource backbuffer = renderGraph.import_image("backbuffer", backbufferInput);
+
+		// Last frame's fence has been waited on, nothing left to synchronize with
+		auto import_attachment = [&](const char* name, const vkUtil::Attachment& attachment, vk::ImageAspectFlags aspect)
+		{
+			vkUtil::graphImageInput input;
+			input.image = attachment.image;
+			input.view = attachment.view;
+			input.format = attachment.format;
+			input.extent = target.extent;
+			input.samples = attachment.samples;
+			input.aspect = aspect;
+			return renderGraph.import_image(name, input);
+		};
+
+		vkUtil::GraphResource depth = import_attachment("depth", target.depthTarget, depthAspect);
+
+		vk::Extent2D extent = target.extent;
+		vkUtil::PassBuilder forward = renderGraph.add_pass("forward", [this, &frame, extent](vk::CommandBuffer commandBuffer)
+			{
+				commandBuffer.setViewport(0, vk::Viewport(0.0f, 0.0f, static_cast<float>(extent.width), static_cast<float>(extent.height), 0.0f, 1.0f));
+				commandBuffer.setScissor(0, vk::Rect2D({ 0, 0 }, extent));
+
+				commandBuffer.bindPipeline(vk::PipelineBindPoint::eGraphics, depthPrepass ? prepassPipeline : pipeline);
+				bindless.bind(commandBuffer, vk::PipelineBindPoint::eGraphics, layout, 0);
+				uniformRing.bind(commandBuffer, vk::PipelineBindPoint::eGraphics, layout, 1, cameraOffset);
+				record_draws(commandBuffer, frame);
+
+				// Same draws again, shading only the fragments that survived the prepass. The sets stay bound, same layout.
+				if (depthPrepass)
+				{
+					commandBuffer.bindPipeline(vk::PipelineBindPoint::eGraphics, prepassShadePipeline);
+					record_draws(commandBuffer, frame);
+				}
+			});
+
+		if (target.colorTarget.view)
+		{
+			forward.color(import_attachment("msaa color", target.colorTarget, vk::ImageAspectFlagBits::eColor), clearColor).resolve(backbuffer);
+		}
+		else
+		{
+			forward.color(backbuffer, clearColor);
+		}
+
+		// Reversed-Z clears depth to the far plane, 0
+		forward.depth(depth, vk::ClearValue(vk::ClearDepthStencilValue(0.0f, 0)));
+	}
+}
+
+vkUtil::Expected<void> Engine::record_draw_commands(vk::CommandBuffer commandBuffer, const vkUtil::FrameSnapshot& frame)
+{
+	vk::CommandBufferBeginInfo beginInfo = {};
+
+	vkUtil::Expected<void> begun = vkUtil::vk_call([&]() { return commandBuffer.begin(beginInfo); });
+	if (!begun)
+	{
+		if (debugMode)
+		{
+			std::cout << "Failed to begin recording command buffer :/" << std::endl;
+		}
+		return begun;
+	}
+
+	// Ownership of fresh uploads has to be acquired outside the render pass, and so do the mip blits
+	acquire_uploads(commandBuffer, frame);
+	make_textures_resident(commandBuffer);
+
+	build_frame_graph(frame);
+	renderGraph.compile();
+
+	statistics.begin(commandBuffer);
+	renderGraph.execute(commandBuffer);
+	statistics.end(commandBuffer);
+
+	vkUtil::Expected<void> ended = vkUtil::vk_call([&]() { return commandBuffer.end(); });
+	if (!ended && debugMode)
+	{
+		std::cout << "Failed to finish recording command buffer :/" << std::endl;
+	}
+
+	return ended;
+}
+
+void Engine::record_draws(vk::CommandBuffer commandBuffer, const vkUtil::FrameSnapshot& frame)
+{
+	// firstInstance carries the object's position in the snapshot through to the shaders
+	if (use_indirect_draws(frame))
+	{
+		// The shaders find transforms and materials in the object buffer
+		vkUtil::DrawPushConstants constants = {};
+		constants.materialID = vkUtil::MATERIAL_FROM_OBJECT_BUFFER;
+		drawConstants.push(commandBuffer, layout, constants);
+
+		commandBuffer.drawIndirect(indirectBuffer.buffer.buffer, 0, static_cast<uint32_t>(frame.objects.size()), sizeof(vk::DrawIndirectCommand));
+	}
+	else
+	{
+		for (uint32_t ii = 0; ii < frame.objects.size(); ii++)
+		{
+			const vkUtil::SnapshotObject& object = frame.objects[ii];
+
+			vkUtil::DrawPushConstants constants = {};
+			memcpy(constants.model, object.world.m, sizeof(constants.model));
+			constants.materialID = object.material < materialCount ? object.material : 0;
+			drawConstants.push(commandBuffer, layout, constants);
+
+			commandBuffer.draw(3, 1, 0, ii);
+		}
+	}
+}
+
+bool Engine::bind_benchmark_draw_state(vk::CommandBuffer commandBuffer)
+{
+	// The benchmarks wait for the device before returning, so the next frame can rewind the ring over it
+	vkUtil::CameraConstants camera;
+	memcpy(camera.viewProjection, IDENTITY_VIEW_PROJECTION, sizeof(camera.viewProjection));
+	uint32_t offset = uniformRing.write(camera);
+	if (offset == UINT32_MAX)
+	{
+		return false;
+	}
+
+	bindless.bind(commandBuffer, vk::PipelineBindPoint::eGraphics, layout, 0);
+	uniformRing.bind(commandBuffer, vk::PipelineBindPoint::eGraphics, layout, 1, offset);
+
+	vkUtil::DrawPushConstants constants = {};
+	memcpy(constants.model, Transform::identity().m, sizeof(constants.model));
+	drawConstants.push(commandBuffer, layout, constants);
+
+	return true;
+}
+
+void Engine::simulate()
+{
+	scene.update_world_transforms();
+
+	vkUtil::FrameSnapshot& frame = snapshots.write_slot();
+	frame.simulationFrame = ++simulationFrames;
+
+	memcpy(frame.viewProjection, IDENTITY_VIEW_PROJECTION, sizeof(frame.viewProjection));
+
+	vkUtil::Frustum frustum = vkUtil::extractFrustum(IDENTITY_VIEW_PROJECTION);
+	vkUtil::cullObjects(scene.world_bounds(), frustum, vkUtil::CullingVolume::eSphere, cullingKernel, visibleObjects);
+
+	// Copy out everything drawing needs, the scene keeps changing once this is published
+	const vkUtil::BoundingVolumes& bounds = scene.world_bounds();
+	const Transform* worldTransforms = scene.world_transforms();
+	const uint32_t* meshHandles = scene.mesh_handles();
+	const uint32_t* materialHandles = scene.material_handles();
+
+	frame.objects.resize(visibleObjects.size());
+	for (size_t ii = 0; ii < visibleObjects.size(); ii++)
+	{
+		uint32_t objectIdx = visibleObjects[ii];
+		vkUtil::SnapshotObject& object = frame.objects[ii];
+
+		object.world = worldTransforms[objectIdx];
+		object.center[0] = bounds.centerX[objectIdx];
+		object.center[1] = bounds.centerY[objectIdx];
+		object.center[2] = bounds.centerZ[objectIdx];
+		object.radius = bounds.radius[objectIdx];
+		object.mesh = meshHandles[objectIdx];
+		object.material = materialHandles[objectIdx];
+	}
+
+	snapshots.publish();
+}
+
+void Engine::render()
+{
+	// The first frame counts towards startup
+	std::chrono::steady_clock::time_point frameStart = std::chrono::steady_clock::now();
+
+	// Take the newest snapshot, or draw the last one again if the simulation hasn't published since
+	if (snapshots.acquire())
+	{
+		freshFrames++;
+	}
+	const vkUtil::FrameSnapshot& frame = snapshots.read_slot();
+
+	// attach_window() and detach_window() come from the main thread, and so may the loaders
+	std::lock_guard<std::mutex> lock(windowsMutex);
+	std::lock_guard<std::mutex> resourcesLock(resourcesMutex);
+
+	// A lost device never signals it, there is nothing left to render with
+	if (!vkUtil::vk_call([&]() { return device.waitForFences(1, &inFlightFence, VK_TRUE, UINT64_MAX); }))
+	{
+		return;
+	}
+
+	// Swapchains last frame found out of date, the frame that drew into them has finished
+	for (vkUtil::WindowTarget& target : windows)
+	{
+		if (target.window && target.outOfDate)
+		{
+			recreate_swapchain(target);
+		}
+	}
+
+	// Acquire each window's next image. One that can't get one sits this frame out, the others still draw.
+	std::vector<vk::SwapchainKHR> swapchains;
+	std::vector<uint32_t> imageIndices;
+	std::vector<vkUtil::WindowTarget*> presentedWindows;
+	for (vkUtil::WindowTarget& target : windows)
+	{
+		target.acquired = false;
+		if (!target.window || target.outOfDate)
+		{
+			continue;
+		}
+
+		vkUtil::Expected<uint32_t> image = vkUtil::vk_call([&]()
+			{
+				return device.acquireNextImageKHR(target.swapchain, UINT64_MAX, target.imageAvailable, nullptr);
+			});
+		if (!image)
+		{
+			// Anything else is a lost surface, the window is about to be detached
+			target.outOfDate = image.result() == vk::Result::eErrorOutOfDateKHR;
+			continue;
+		}
+
+		// Suboptimal still presents, the swapchain is recreated after this frame
+		target.outOfDate = image.result() == vk::Result::eSuboptimalKHR;
+		target.acquired = true;
+		target.imageIndex = image.value();
+		swapchains.push_back(target.swapchain);
+		imageIndices.push_back(target.imageIndex);
+		presentedWindows.push_back(&target);
+	}
+
+	// Without a submission the acquired images are never presented and their semaphores stay signalled,
+	// the windows start over with new swapchains
+	auto abandon_frame = [&]()
+	{
+		for (vkUtil::WindowTarget* target : presentedWindows)
+		{
+			target->outOfDate = true;
+		}
+	};
+
+	// Every window is recorded into the one command buffer
+	vk::CommandBuffer commandBuffer = mainCommandBuffer;
+
+	vkUtil::vk_call([&]() { return commandBuffer.reset(); });
+
+	// The previous frame has finished, so have the waits on any uploads it acquired
+	deletionQueue.collect(deletionQueue.frame() - 1);
+	uploader.collect();
+	computeScheduler.collect();
+	frameDescriptors.begin_frame(0);
+	bindless.collect();
+	uniformRing.begin_frame(0);
+	statistics.collect();
+
+	finish_transcodes();
+
+	frameWaitSemaphores.clear();
+	frameWaitStages.clear();
+	for (const vkUtil::WindowTarget& target : windows)
+	{
+		if (target.acquired)
+		{
+			frameWaitSemaphores.push_back(target.imageAvailable);
+			frameWaitStages.push_back(vk::PipelineStageFlagBits::eColorAttachmentOutput);
+		}
+	}
+
+	update_streaming();
+
+	// Nothing past this point reads the scene, only the snapshot
+	vkUtil::CameraConstants camera;
+	memcpy(camera.viewProjection, frame.viewProjection, sizeof(camera.viewProjection));
+	cameraOffset = uniformRing.write(camera);
+
+	request_texture_detail(frame);
+
+	write_object_data(frame);
+	if (!record_draw_commands(commandBuffer, frame))
+	{
+		abandon_frame();
+		return;
+	}
+
+	vk::SubmitInfo submitInfo = {};
+
+	submitInfo.waitSemaphoreCount = static_cast<uint32_t>(frameWaitSemaphores.size());
+	submitInfo.pWaitSemaphores = frameWaitSemaphores.data();
+	submitInfo.pWaitDstStageMask = frameWaitStages.data();
+	submitInfo.commandBufferCount = 1;
+	submitInfo.pCommandBuffers = &commandBuffer;
+
+	// Nothing waits on it without a window to present
+	vk::Semaphore signalSemaphores[] = { renderFinished };
+	submitInfo.signalSemaphoreCount = swapchains.empty() ? 0 : 1;
+	submitInfo.pSignalSemaphores = signalSemaphores;
+
+	// Only reset once there is a submission to signal it again
+	if (!vkUtil::vk_call([&]() { return device.resetFences(1, &inFlightFence); }))
+	{
+		if (debugMode)
+		{
+			std::cout << "Failed to reset the frame fence :/" << std::endl;
+		}
+		abandon_frame();
+		return;
+	}
+
+	// The streamer's worker may be submitting to the same VkQueue
+	vkUtil::Expected<void> submitted = vkUtil::vk_call([&]()
+		{
+			std::lock_guard<std::mutex> lock(*graphicsQueueMutex);
+			return graphicsQueue.submit(submitInfo, inFlightFence);
+		});
+	if (!submitted)
+	{
+		if (debugMode)
+		{
+			std::cout << "Failed to submit draw command buffer :/" << std::endl;
+		}
+		abandon_frame();
+		return;
+	}
+
+	// Every window in one present
+	if (!swapchains.empty())
+	{
+		vk::PresentInfoKHR presentInfo = {};
+		presentInfo.waitSemaphoreCount = 1;
+		presentInfo.pWaitSemaphores = signalSemaphores;
+		presentInfo.swapchainCount = static_cast<uint32_t>(swapchains.size());
+		presentInfo.pSwapchains = swapchains.data();
+		presentInfo.pImageIndices = imageIndices.data();
+
+		// The call's own result is the worst of them, each window gets its own here
+		std::vector<vk::Result> presentResults(swapchains.size(), vk::Result::eSuccess);
+		presentInfo.pResults = presentResults.data();
+
+		vkUtil::Expected<void> presented = vkUtil::vk_call([&]()
+			{
+				std::lock_guard<std::mutex> lock(*presentQueueMutex);
+				return presentQueue.presentKHR(presentInfo);
+			});
+		if (!presented && presented.result() != vk::Result::eErrorOutOfDateKHR && debugMode)
+		{
+			std::cout << "Failed to present :/" << std::endl;
+		}
+		for (size_t ii = 0; ii < presentedWindows.size(); ii++)
+		{
+			if (presentResults[ii] == vk::Result::eErrorOutOfDateKHR || presentResults[ii] == vk::Result::eSuboptimalKHR)
+			{
+				presentedWindows[ii]->outOfDate = true;
+			}
+		}
+	}
+
+	// Ends the startup report, its table is printed in debug mode
+	vkUtil::StartupProfiler& profiler = vkUtil::startup_profiler();
+	if (profiler.is_recording())
+	{
+		profiler.record("first frame", vkUtil::StartupProfiler::Category::eStep, frameStart, std::chrono::steady_clock::now());
+		timeToFirstFrame = profiler.finish(debugMode);
+	}
+
+	deletionQueue.next_frame();
+}
+
+Engine::~Engine()
+{
+	if (debugMode)
+	{
+		std::cout << "Bye!\n";
+	}
+
+	destroy_everything();
+
+	glfwTerminate();
+}
+
+void Engine::destroy_everything()
+{
+	// Without a device only the instance and the first surface can exist
+	if (!device)
+	{
+		if (instance)
+		{
+			for (vkUtil::WindowTarget& target : windows)
+			{
+				instance.destroySurfaceKHR(target.surface);
+			}
+			if (debugMode)
+			{
+				instance.destroyDebugUtilsMessengerEXT(debugMessenger);
+			}
+			instance.destroy();
+		}
+		return;
+	}
+
+	// A lost device is torn down all the same
+	vkUtil::vk_call([&]() { return device.waitIdle(); });
+
+	device.destroySemaphore(renderFinished);
+	device.destroyFence(inFlightFence);
+
+	device.destroyCommandPool(commandPool);
+
+	uploader.destroy();
+	computeScheduler.destroy();
+	uniformRing.destroy();
+	frameDescriptors.destroy();
+	persistentDescriptors.destroy();
+
+	vkUtil::destroyMappedBuffer(device, objectBuffer);
+	vkUtil::destroyMappedBuffer(device, materialBuffer);
+	vkUtil::destroyMappedBuffer(device, indirectBuffer);
+
+	for (vkMesh::MeshBuffers& mesh : meshes)
+	{
+		vkMesh::destroy_mesh(device, mesh);
+	}
+
+	for (vkTexture::Texture& texture : textures)
+	{
+		vkTexture::destroy_texture(device, texture);
+	}
+	textureStreamer.destroy();
+	deletionQueue.destroy();
+	device.destroySampler(textureSampler);
+
+	device.destroyPipeline(mipDownsampler.pipeline);
+	device.destroyPipelineLayout(mipDownsampler.layout);
+	device.destroyDescriptorSetLayout(mipDownsampler.setLayout);
+	device.destroySampler(mipDownsampler.sampler);
+
+	statistics.destroy();
+
+	device.destroyPipeline(pipeline);
+	device.destroyPipeline(prepassPipeline);
+	device.destroyPipeline(prepassShadePipeline);
+	device.destroyPipelineLayout(layout);
+	device.destroyRenderPass(renderPass);
+	device.destroyPipelineCache(pipelineCache);
+	bindless.destroy();
+
+	renderGraph.destroy();
+
+	for (vkUtil::WindowTarget& target : windows)
+	{
+		if (target.window)
+		{
+			destroy_window(target, false);
+		}
+	}
+
+	device.destroy();
+
+	if (debugMode)
+	{
+		instance.destroyDebugUtilsMessengerEXT(debugMessenger);
+	}
+
+	instance.destroy();
 }
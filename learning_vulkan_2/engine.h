@@ -3,78 +3,358 @@
 #include "config.h"
 
 #include "frame.h"
+#include "culling.h"
+#include "scene.h"
+#include "thread_pool.h"
+#include "mesh.h"
+#include "compute.h"
+#include "descriptors.h"
+#include "bindless.h"
+#include "materials.h"
+#include "push_constants.h"
+#include "uniform_ring.h"
+#include "texture.h"
+#include "ktx2.h"
+#include "streaming.h"
+#include "attachment.h"
+#include "statistics.h"
+#include "render_graph.h"
+#include "deletion_queue.h"
+#include "window.h"
+#include "triple_buffer.h"
+#include "frame_snapshot.h"
+#include "task_graph.h"
+#include "startup_profiler.h"
+#include "device_context.h"
+#include "result.h"
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <mutex>
 
 class Engine
 {
 public:
-	Engine(int width, int height, GLFWwindow* window, const char* appName, bool debugMode);
+	// msaaSamples is an upper bound, the device may support fewer.
+	// The device is picked for the first window, it is attached as window 0.
+	// parallelStartup runs the setup steps on the thread pool as their dependencies finish, one after the other otherwise.
+	// devicePreference picks the physical device by index, name or UUID instead of by score (see vkInit::choose_physical_device).
+	Engine(int width, int height, GLFWwindow* window, const char* appName, bool debugMode, uint32_t msaaSamples = 4, bool parallelStartup = true,
+		const std::string& devicePreference = "");
 
 	~Engine();
 
+	// Updates the scene, culls it and publishes what is visible as the next frame's snapshot.
+	// Called from the thread that owns the scene, render() may run on another one.
+	void simulate();
+
+	// Renders the latest snapshot into every attached window and presents them all with one presentKHR.
+	// Draws the previous snapshot again if simulate() hasn't published a new one.
 	void render();
 
+	// Milliseconds from the start of the constructor to the first present, 0 until then.
+	// vkUtil::startup_profiler() has the breakdown.
+	double time_to_first_frame() const
+	{
+		return timeToFirstFrame;
+	}
+
+	// Frames render() has drawn from a new snapshot
+	uint64_t fresh_frames() const
+	{
+		return freshFrames;
+	}
+
+	// Gives the window its own surface, swapchain and attachments, returns its handle (UINT32_MAX on failure).
+	// Its surface has to support the engine's present queue and swapchain format.
+	uint32_t attach_window(GLFWwindow* window);
+
+	// The window's resources are destroyed once the frames using them finish, the GLFW window is the caller's
+	void detach_window(uint32_t handle);
+
+	// The loaders and create_material() may be called from another thread while render() runs,
+	// each waits for the frame being recorded to be submitted.
+
+	// Uploads a converted mesh file, returns its mesh handle (UINT32_MAX on failure)
+	uint32_t load_mesh(const char* filename);
+
+	// Uploads the base level and has the GPU build the mips, returns its texture handle (UINT32_MAX on failure)
+	uint32_t create_texture(const vkTexture::TextureData& data);
+
+	// Loads a KTX2 file, returns its texture handle (UINT32_MAX on failure).
+	// Basis files are transcoded on the thread pool, their materials pick them up a few frames later.
+	uint32_t load_texture(const char* filename);
+
+	// Loads a KTX2 file with a mip chain for streaming: only the mip tail is loaded up front,
+	// finer levels follow as objects using the texture get bigger on screen. Returns its texture handle.
+	uint32_t load_streamed_texture(const char* filename);
+
+	// Device memory held by all textures, mip chains and streamed levels included
+	vk::DeviceSize texture_memory() const;
+
+	// Returns the material ID the scene refers to, albedoTexture is a texture handle or vkUtil::NO_TEXTURE.
+	// Until the texture is resident the material draws with its base color alone.
+	uint32_t create_material(const float baseColor[4], uint32_t albedoTexture);
+
+	// Times the same compute and graphics work on one queue and on two, prints the overlap gain
+	void benchmark_async_compute();
+
+	// Lays down depth for the visible objects before shading them, so only the nearest surface gets shaded
+	void set_depth_prepass(bool enabled);
+
+	// Shader invocations of the last finished frame, all zero if the device can't count them
+	const vkUtil::FrameStatistics& last_frame_statistics() const;
+
+	// Renders a stack of overlapping triangles with and without the depth prepass, prints the shader invocations
+	void benchmark_depth_prepass();
+
+	// Compiles a deferred frame's passes into a graph of intermediates, prints their memory with and without aliasing
+	void benchmark_transient_aliasing();
+
+	// Runs simulation and rendering one after the other on one thread, then on two, prints the frames per second of each
+	void benchmark_render_thread();
+
+	// Records the same vkCmdDraw loop through the loader's exported function and through the device's dispatch table,
+	// prints the time per draw of each
+	void benchmark_draw_dispatch();
+
 private:
 	bool debugMode;
 
-	// glfw window params
+	// size of the first window
 	int width;
 	int height;
-	GLFWwindow* window;
 
 	// Instance related variables
 	// vulkan instance
 	vk::Instance instance{ nullptr };
 
+	// what the instance was created with, the most any device is used at
+	uint32_t apiVersion = 0;
+
 	// Debug Callback
 	vk::DebugUtilsMessengerEXT debugMessenger{ nullptr };
 
-	// Dynamic Instance dispatcher
-	// Loads in "instance procedure address"
-	// basically, we can create a function pointer to getInstanceProcAddr using this
-	// getInstanceProcAddr is used to load in the function to create or destroy the debug messenger
-	// We can create this at any point after the creation of the vulkan instance
-	vk::DispatchLoaderDynamic dldi;
-	vk::SurfaceKHR surface;
-
-
 	// Device related variables
+	std::string devicePreference;
 	vk::PhysicalDevice physicalDevice{ nullptr };
+	// Filled once the device is picked, what every subsystem asks about the device
+	vkUtil::DeviceContext deviceContext;
 	vk::Device device{ nullptr };
 	vk::Queue graphicsQueue{ nullptr };
 	vk::Queue presentQueue{ nullptr };
-	vk::SwapchainKHR swapchain;
-	std::vector<vkUtil::SwapchainFrame> swapchainFrames;
+	vk::Queue transferQueue{ nullptr };
+	vk::Queue computeQueue{ nullptr };
+	uint32_t presentFamily;
+
+	// One per distinct VkQueue, every submit and present holds its queue's. The render thread, the uploader,
+	// the compute scheduler and the streamer's worker submit from different threads, and on devices with few
+	// queues the transfer and compute queues fall back to the graphics queue or to each other.
+	// Queues that are the same VkQueue point at the same mutex.
+	std::array<std::mutex, 4> queueMutexes;
+	std::mutex* graphicsQueueMutex = nullptr;
+	std::mutex* presentQueueMutex = nullptr;
+	std::mutex* transferQueueMutex = nullptr;
+	std::mutex* computeQueueMutex = nullptr;
+
+	// windows by handle, detached ones are left empty so handles stay valid
+	// every swapchain has the first one's format, which the render pass is made for
+	std::vector<vkUtil::WindowTarget> windows;
 	vk::Format swapchainFormat;
-	vk::Extent2D swapchainExtent;
+
+	// each window has a multisampled color target, resolved into its swapchain image at the end of the render pass
+	vk::SampleCountFlagBits msaaSamples;
+
+	// and a reversed-Z depth buffer
+	vk::Format depthFormat;
 
 
 	// general
 	const char *appName;
 
 	// pipeline-related variables
+	// the frame's render passes come from the render graph, renderPass only has to be compatible with them
+	// viewport and scissor are dynamic, so the same pipelines draw into every window
+	vk::PipelineCache pipelineCache;
 	vk::PipelineLayout layout;
 	vk::RenderPass renderPass;
 	vk::Pipeline pipeline;
 
+	// depth prepass variants of the pipeline, same layout and render pass
+	bool depthPrepass = false;
+	vk::Pipeline prepassPipeline;
+	vk::Pipeline prepassShadePipeline;
+
+	// shader invocation counts of the render pass
+	vkUtil::PipelineStatistics statistics;
+
+	// the frame's passes, rebuilt every frame, with the barriers and render passes they need
+	vkUtil::RenderGraph renderGraph;
+
+	// handles freed while running, destroyed once the frames that used them have finished
+	vkUtil::DeletionQueue deletionQueue;
+
 	// command-related variables
 	vk::CommandPool commandPool;
 	vk::CommandBuffer mainCommandBuffer;
 
 	// sync-related variables
-	vk::Semaphore imageAvailable, renderFinished;
+	// one submission renders every window, the one present waits for it with renderFinished
+	vk::Semaphore renderFinished;
 	vk::Fence inFlightFence;
 
+	// upload-related variables
+	vkUtil::AsyncUploader uploader;
+
+	// descriptor-related variables
+	// per-frame sets are reset wholesale when their frame retires, long-lived sets never are
+	vkUtil::FrameDescriptorAllocator frameDescriptors;
+	vkUtil::DescriptorAllocator persistentDescriptors;
+
+	// bindless resources, bound once per frame as set 0
+	vkUtil::BindlessHeap bindless;
+	vkUtil::MappedBuffer objectBuffer;
+	vkUtil::MappedBuffer materialBuffer;
+	uint32_t materialCount = 0;
+
+	// texture handle of each material, so materials pick up their textures once they are resident
+	std::vector<uint32_t> materialTextures;
+
+	// per frame constants at dynamic offsets, bound as set 1
+	vkUtil::UniformRing uniformRing;
+	uint32_t cameraOffset;
+
+	// per draw transform and material, for direct draws
+	vkUtil::PushConstantBlock<vkUtil::DrawPushConstants> drawConstants;
+
+	// one indirect command per visible object, if the device can draw them all in one call
+	// below the threshold direct draws with push constants are cheaper than filling the buffers
+	bool indirectDraws;
+	vkUtil::MappedBuffer indirectBuffer;
+	static constexpr size_t INDIRECT_DRAW_THRESHOLD = 64;
+
+	// compute-related variables
+	vkUtil::ComputeScheduler computeScheduler;
+
+	// semaphores the current frame's submission waits on, with their stages
+	std::vector<vk::Semaphore> frameWaitSemaphores;
+	std::vector<vk::PipelineStageFlags> frameWaitStages;
+
+	// Basis textures being transcoded, declared before the pool so its workers are gone first
+	vkTexture::TranscodeQueue transcodeQueue;
+
+	// scene-related variables
+	ThreadPool threadPool;
+	Scene scene{ &threadPool };
+
+	// geometry, indexed by mesh handle
+	std::vector<vkMesh::MeshBuffers> meshes;
+
+	// textures, indexed by texture handle, and the ones still waiting for their mips
+	std::vector<vkTexture::Texture> textures;
+	std::vector<uint32_t> pendingTextures;
+	vk::DeviceSize textureMemory = 0;
+	vk::Sampler textureSampler;
+	vkTexture::MipDownsampler mipDownsampler;
+
+	// streamed textures, and the texture handle of each streamer handle
+	vkTexture::TextureStreamer textureStreamer;
+	std::vector<uint32_t> streamedTextures;
+
+	// culling-related variables
+	vkUtil::CullingKernel cullingKernel;
+	std::vector<uint32_t> visibleObjects;
+
+	// simulate() publishes, render() takes the latest, neither waits for the other
+	vkUtil::TripleBuffer<vkUtil::FrameSnapshot> snapshots;
+	uint64_t simulationFrames = 0;
+	std::atomic<uint64_t> freshFrames{ 0 };
+
+	// render() walks the windows while the main thread may attach or detach one
+	std::mutex windowsMutex;
+
+	// Held by the loaders and create_material() and by render() for its whole frame: the frame reads the meshes,
+	// textures and materials they add to, and both sides record into the uploader
+	mutable std::mutex resourcesMutex;
+
+	// written by the render thread
+	std::atomic<double> timeToFirstFrame{ 0.0 };
+
 
 	// instance setup
 	void make_instance();
 
+	// destroys whatever the constructor got as far as making, the destructor and a failed startup share it
+	void destroy_everything();
+
+	// window setup
+	vk::SurfaceKHR make_surface(GLFWwindow* window);
+
+	// the swapchain is left null if it can't be made, its format is the engine's if the surface supports it
+	void make_swapchain(vkUtil::WindowTarget& target, int width, int height, vk::SwapchainKHR oldSwapchain);
+
+	// after a resize, the old swapchain and its attachments go to the deletion queue
+	void recreate_swapchain(vkUtil::WindowTarget& target);
+
+	// the window's attachments and acquire semaphore
+	void make_window_targets(vkUtil::WindowTarget& target);
+
+	// hands the window's resources to the deletion queue, or destroys them if the device is idle
+	// callers hold windowsMutex while render() may be running, it touches the render graph
+	void destroy_window(vkUtil::WindowTarget& target, bool deferred);
+
 	// device setup
 	void make_device();
 
-	// pipeline setup
-	void make_pipeline();
+	// the command pool, the main command buffer and the frame's semaphore and fence
+	void make_commands();
+
+	// descriptor allocators, the bindless set and the uniform ring, the pipeline layout is made of their layouts
+	void make_descriptors();
+
+	// pipeline setup, the code was read ahead of time, the files are only read if it is empty
+	void make_pipeline(const std::string& vertexFilepath, const std::vector<char>& vertexCode,
+		const std::string& fragmentFilepath, const std::vector<char>& fragmentCode);
 
 	void finalize_setup();
 
-	void record_draw_commands(vk::CommandBuffer commandBuffer, uint32_t imageIndex);
+	// Compute pipeline for the mips of formats that can't be blitted, left empty if unavailable
+	void make_mip_downsampler(const std::string& computeFilepath, const std::vector<char>& computeCode);
+
+	// Takes ownership of uploads the visible objects use for the first time
+	void acquire_uploads(vk::CommandBuffer commandBuffer, const vkUtil::FrameSnapshot& frame);
+
+	// Creates the Basis textures the workers have finished transcoding
+	void finish_transcodes();
+
+	// Generates mips for textures whose uploads have landed and hands them to their materials
+	void make_textures_resident(vk::CommandBuffer commandBuffer);
+
+	// Points the materials using the texture at its bindless slot
+	void assign_texture_to_materials(uint32_t texture);
+
+	// Swaps in streamed levels that have arrived, evicts over budget and requests more
+	void update_streaming();
+
+	// Tells the streamer how big the visible objects' textures are on screen
+	void request_texture_detail(const vkUtil::FrameSnapshot& frame);
+
+	bool use_indirect_draws(const vkUtil::FrameSnapshot& frame) const;
+
+	// Object data and indirect commands for the visible objects, grows the buffers if needed
+	void write_object_data(const vkUtil::FrameSnapshot& frame);
+
+	// Fails if the command buffer couldn't be begun or ended, the frame isn't submitted then
+	vkUtil::Expected<void> record_draw_commands(vk::CommandBuffer commandBuffer, const vkUtil::FrameSnapshot& frame);
+
+	// Declares this frame's passes, one per attached window, and the attachments they use
+	void build_frame_graph(const vkUtil::FrameSnapshot& frame);
+
+	// The draws of the visible objects with whatever pipeline is bound
+	void record_draws(vk::CommandBuffer commandBuffer, const vkUtil::FrameSnapshot& frame);
+
+	// What the forward pass binds before its draws, for the benchmarks' own triangles: both sets,
+	// a camera written into the uniform ring and an identity model with material 0. False if the ring is full.
+	bool bind_benchmark_draw_state(vk::CommandBuffer commandBuffer);
 };
\ No newline at end of file
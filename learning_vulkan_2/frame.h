@@ -8,7 +8,5 @@ namespace vkUtil
 	{
 		vk::Image image;
 		vk::ImageView imageView;
-		vk::Framebuffer frameBuffer;
-		vk::CommandBuffer commandBuffer;
 	};
 }
\ No newline at end of file
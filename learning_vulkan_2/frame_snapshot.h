@@ -0,0 +1,28 @@
+#pragma once
+
+#include "config.h"
+#include "scene.h"
+
+
+namespace vkUtil
+{
+	// One visible object, with everything drawing it needs
+	struct SnapshotObject
+	{
+		Transform world;
+		float center[3];
+		float radius;
+		uint32_t mesh;
+		uint32_t material;
+	};
+
+	// What the simulation thread hands the render thread: the camera and the objects that survived culling.
+	// Never written once published, the render thread reads it without touching the scene.
+	struct FrameSnapshot
+	{
+		// 0 until the first snapshot is published
+		uint64_t simulationFrame = 0;
+		float viewProjection[16] = {};
+		std::vector<SnapshotObject> objects;
+	};
+}
\ No newline at end of file
@@ -1,5 +1,9 @@
 #pragma once
 #include "config.h"
+#include "startup_profiler.h"
+#include "result.h"
+
+#include <algorithm>
 
 // namespace for creating functions etc.
 namespace vkInit
@@ -8,7 +12,7 @@ namespace vkInit
 	bool supported(std::vector<const char*>& extensions, std::vector<const char*>& layers, bool debug)
 	{
 		// Checking extension support
-		std::vector<vk::ExtensionProperties> supportedExtensions = vk::enumerateInstanceExtensionProperties();
+		std::vector<vk::ExtensionProperties> supportedExtensions = vkUtil::vk_call([]() { return vk::enumerateInstanceExtensionProperties(); }).value_or({});
 
 		if (debug)
 		{
@@ -53,7 +57,7 @@ namespace vkInit
 
 
 		// Checking layer support
-		std::vector<vk::LayerProperties> supportedLayers = vk::enumerateInstanceLayerProperties();
+		std::vector<vk::LayerProperties> supportedLayers = vkUtil::vk_call([]() { return vk::enumerateInstanceLayerProperties(); }).value_or({});
 
 		if (debug)
 		{
@@ -99,15 +103,10 @@ namespace vkInit
 	}
 
 
-	// Function to create Vulkan Instance
-	vk::Instance make_instance(bool debug, const char* appName)
+	// The version the instance is created with: what the loader supports, up to the 1.3 the engine makes use of.
+	// A device is used at the lower of this and its own version, DeviceContext keeps that one.
+	uint32_t choose_api_version(bool debug)
 	{
-		if (debug)
-		{
-			std::cout << "Creating an instance...\n";
-		}
-
-
 		// query our system about what vulkan version it'll support up to
 		uint32_t version{ 0 };
 		vkEnumerateInstanceVersion(&version);
@@ -124,19 +123,32 @@ namespace vkInit
 		// patch is bits 11-0 (hence FFF)
 		version &= ~(0xFFFU);
 
-		// Alternative: Drop down to an earlier version to ensure compatibility with more devices
-		// variant, major, minor, patch
-		version = VK_MAKE_API_VERSION(0, 1, 0, 0);
+		// Nothing past 1.3 is used. Below 1.2 no device qualifies, bindless resources need its descriptor indexing.
+		return std::min(version, VK_API_VERSION_1_3);
+	}
+
+
+	// Function to create Vulkan Instance, apiVersion from choose_api_version
+	vk::Instance make_instance(bool debug, const char* appName, uint32_t apiVersion)
+	{
+		vkUtil::StartupProfiler::Scope timer("make_instance");
+
+		if (debug)
+		{
+			std::cout << "Creating an instance...\n";
+		}
 
+		// Functions that don't need an instance, enumerating extensions and layers among them
+		VULKAN_HPP_DEFAULT_DISPATCHER.init(vkGetInstanceProcAddr);
 
 		// Application Info
 		// app name, app version, engine name, engine version, api version
 		vk::ApplicationInfo appInfo = vk::ApplicationInfo(
 			appName,
-			version,
+			apiVersion,
 			"Hridiza's awesome Vulkan Engine",
-			version,
-			version
+			apiVersion,
+			apiVersion
 		);
 
 
@@ -195,12 +207,14 @@ namespace vkInit
 
 		
 		// Create the instance
-		// Vulkan.hpp allows us to do try/catch instead of checking = VK_SUCCESS (Vulkan.h)
-		try
-		{
-			return vk::createInstance(createInfo);
-		}
-		catch (vk::SystemError err)
+		// vk_call gives back the vk::Result whether or not vulkan.hpp was built to throw
+		vkUtil::Expected<vk::Instance> instance = vkUtil::vk_call([&]()
+			{
+				vkUtil::StartupProfiler::Scope driverTimer("vkCreateInstance", vkUtil::StartupProfiler::Category::eDriver);
+				return vk::createInstance(createInfo);
+			});
+
+		if (!instance)
 		{
 			if (debug)
 			{
@@ -209,5 +223,10 @@ namespace vkInit
 
 			return nullptr;
 		}
+
+		// Instance functions, device functions are loaded again per device in create_logical_device
+		VULKAN_HPP_DEFAULT_DISPATCHER.init(instance.value());
+
+		return instance.value();
 	}
 }
\ No newline at end of file
@@ -0,0 +1,398 @@
+#pragma once
+
+// KTX2 containers: block compressed payloads go straight from the mapped file into staging,
+// Basis Universal payloads are transcoded on the thread pool to whatever the device samples best.
+// Transcoding needs the Basis Universal transcoder, see the CMakeLists for how it gets built in.
+
+#include "config.h"
+#include "texture.h"
+#include "mapped_file.h"
+#include "thread_pool.h"
+
+#include <memory>
+#include <mutex>
+
+#ifdef LEARNING_VULKAN_BASISU
+#include <basisu_transcoder.h>
+#endif
+
+namespace vkTexture
+{
+	constexpr uint8_t KTX2_IDENTIFIER[12] = { 0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n' };
+
+	enum class Ktx2Supercompression : uint32_t
+	{
+		eNone = 0,
+		eBasisLZ = 1,
+		eZstd = 2,
+		eZlib = 3
+	};
+
+	struct Ktx2Header
+	{
+		uint8_t identifier[12];
+		uint32_t vkFormat;
+		uint32_t typeSize;
+		uint32_t pixelWidth;
+		uint32_t pixelHeight;
+		uint32_t pixelDepth;
+		uint32_t layerCount;
+		uint32_t faceCount;
+		uint32_t levelCount;        // 0 asks the loader to generate the mips
+		Ktx2Supercompression supercompressionScheme;
+
+		// byte offsets from the start of the file
+		uint32_t dfdByteOffset;
+		uint32_t dfdByteLength;
+		uint32_t kvdByteOffset;
+		uint32_t kvdByteLength;
+		uint64_t sgdByteOffset;
+		uint64_t sgdByteLength;
+	};
+	static_assert(sizeof(Ktx2Header) == 80, "Ktx2Header must match the file layout");
+
+	// Follows the header, one per level, largest level first
+	struct Ktx2Level
+	{
+		uint64_t byteOffset;
+		uint64_t byteLength;
+		uint64_t uncompressedByteLength;
+	};
+
+	// Data format descriptor values we look at
+	constexpr uint8_t KTX2_DFD_MODEL_UASTC = 166;
+	constexpr uint8_t KTX2_DFD_TRANSFER_SRGB = 2;
+
+
+	// What the loader needs to know about a validated file
+	struct Ktx2Info
+	{
+		vk::Format format;
+		uint32_t width;
+		uint32_t height;
+		uint32_t levelCount;
+		Ktx2Supercompression supercompression;
+		bool basis;
+		bool srgb;
+		std::vector<Ktx2Level> levels;
+	};
+
+	// Formats a Basis payload can become, best first
+	enum class TranscodeTarget
+	{
+		eBc7,
+		eAstc4x4,
+		eEtc2,
+		eBc3,
+		eRgba8
+	};
+
+	// A Basis texture once the worker is done with it
+	struct TranscodedTexture
+	{
+		uint32_t handle;
+		bool succeeded;
+		TextureData data;
+		std::vector<uint8_t> pixels;
+	};
+
+
+	// Returns false if the file isn't a 2D KTX2 texture we can read
+	inline bool read_ktx2(const MappedFile& file, Ktx2Info& info, bool debug)
+	{
+		if (file.size() < sizeof(Ktx2Header) || memcmp(file.data(), KTX2_IDENTIFIER, sizeof(KTX2_IDENTIFIER)) != 0)
+		{
+			if (debug)
+			{
+				std::cout << "Not a KTX2 file\n";
+			}
+			return false;
+		}
+
+		const Ktx2Header* header = reinterpret_cast<const Ktx2Header*>(file.data());
+
+		// No arrays, cube maps or volumes yet
+		if (header->pixelWidth == 0 || header->pixelHeight == 0 || header->pixelDepth > 1 || header->layerCount > 1 || header->faceCount != 1)
+		{
+			if (debug)
+			{
+				std::cout << "Only 2D KTX2 textures are supported\n";
+			}
+			return false;
+		}
+
+		info.format = static_cast<vk::Format>(header->vkFormat);
+		info.width = header->pixelWidth;
+		info.height = header->pixelHeight;
+		info.levelCount = header->levelCount;
+		info.supercompression = header->supercompressionScheme;
+
+		// Written so a corrupt offset or length can't wrap around and pass
+		auto in_file = [&](uint64_t offset, uint64_t length)
+		{
+			return length <= file.size() && offset <= file.size() - length;
+		};
+
+		uint32_t levelEntries = std::max(header->levelCount, 1u);
+		if (!in_file(sizeof(Ktx2Header), static_cast<uint64_t>(levelEntries) * sizeof(Ktx2Level)))
+		{
+			if (debug)
+			{
+				std::cout << "KTX2 file is truncated\n";
+			}
+			return false;
+		}
+
+		const Ktx2Level* levels = reinterpret_cast<const Ktx2Level*>(file.data() + sizeof(Ktx2Header));
+		info.levels.assign(levels, levels + levelEntries);
+
+		for (const Ktx2Level& level : info.levels)
+		{
+			if (level.byteLength == 0 || !in_file(level.byteOffset, level.byteLength))
+			{
+				if (debug)
+				{
+					std::cout << "KTX2 file is truncated or corrupt\n";
+				}
+				return false;
+			}
+		}
+
+		// Colour model and transfer function sit in the first descriptor block, after the total size
+		uint8_t colorModel = 0;
+		uint8_t transferFunction = 0;
+		if (header->dfdByteLength >= 16 && in_file(header->dfdByteOffset, header->dfdByteLength))
+		{
+			const uint8_t* block = file.data() + header->dfdByteOffset + 4;
+			colorModel = block[8];
+			transferFunction = block[10];
+		}
+
+		info.srgb = transferFunction == KTX2_DFD_TRANSFER_SRGB;
+		info.basis = info.format == vk::Format::eUndefined
+			&& (info.supercompression == Ktx2Supercompression::eBasisLZ || colorModel == KTX2_DFD_MODEL_UASTC);
+
+		// Zstd and zlib would need decompressing on the CPU, which is what this format is meant to avoid
+		bool payloadReadable = info.basis ? info.supercompression != Ktx2Supercompression::eZlib
+			: info.supercompression == Ktx2Supercompression::eNone && info.format != vk::Format::eUndefined;
+		if (!payloadReadable)
+		{
+			if (debug)
+			{
+				std::cout << "Unsupported KTX2 payload (format " << header->vkFormat << ", supercompression "
+					<< static_cast<uint32_t>(info.supercompression) << ")\n";
+			}
+			return false;
+		}
+
+		return true;
+	}
+
+
+	// For a plain payload: points data at the levels inside the mapping, the file has to stay open
+	// until the texture was created. Formats the device can't sample are rejected, never decompressed.
+	inline bool ktx2_texture_data(const MappedFile& file, const Ktx2Info& info, const vkUtil::DeviceContext& deviceContext, TextureData& data, bool debug)
+	{
+		if (!(deviceContext.format_properties(info.format).optimalTilingFeatures & vk::FormatFeatureFlagBits::eSampledImage))
+		{
+			if (debug)
+			{
+				std::cout << "This device can't sample " << vk::to_string(info.format) << " textures :/" << std::endl;
+			}
+			return false;
+		}
+
+		// Levels are stored smallest first, so they are one contiguous range of the file
+		uint64_t first = info.levels[0].byteOffset;
+		uint64_t end = 0;
+		for (const Ktx2Level& level : info.levels)
+		{
+			first = std::min(first, level.byteOffset);
+			end = std::max(end, level.byteOffset + level.byteLength);
+		}
+
+		data.pixels = file.data() + first;
+		data.size = end - first;
+		data.width = info.width;
+		data.height = info.height;
+		data.format = info.format;
+		data.generateMips = info.levelCount == 0;
+
+		data.levelOffsets.clear();
+		if (info.levelCount > 0)
+		{
+			for (const Ktx2Level& level : info.levels)
+			{
+				data.levelOffsets.push_back(level.byteOffset - first);
+			}
+		}
+
+		return true;
+	}
+
+
+	inline vk::Format transcode_format(TranscodeTarget target, bool srgb)
+	{
+		switch (target)
+		{
+		case TranscodeTarget::eBc7:
+			return srgb ? vk::Format::eBc7SrgbBlock : vk::Format::eBc7UnormBlock;
+		case TranscodeTarget::eAstc4x4:
+			return srgb ? vk::Format::eAstc4x4SrgbBlock : vk::Format::eAstc4x4UnormBlock;
+		case TranscodeTarget::eEtc2:
+			return srgb ? vk::Format::eEtc2R8G8B8A8SrgbBlock : vk::Format::eEtc2R8G8B8A8UnormBlock;
+		case TranscodeTarget::eBc3:
+			return srgb ? vk::Format::eBc3SrgbBlock : vk::Format::eBc3UnormBlock;
+		default:
+			return srgb ? vk::Format::eR8G8B8A8Srgb : vk::Format::eR8G8B8A8Unorm;
+		}
+	}
+
+
+	// First target the device can sample with linear filtering, RGBA8 is always there
+	inline TranscodeTarget choose_transcode_target(const vkUtil::DeviceContext& deviceContext, bool srgb, bool debug)
+	{
+		const TranscodeTarget targets[] = { TranscodeTarget::eBc7, TranscodeTarget::eAstc4x4, TranscodeTarget::eEtc2, TranscodeTarget::eBc3 };
+		vk::FormatFeatureFlags needed = vk::FormatFeatureFlagBits::eSampledImage | vk::FormatFeatureFlagBits::eSampledImageFilterLinear;
+
+		for (TranscodeTarget target : targets)
+		{
+			vk::FormatFeatureFlags features = deviceContext.format_properties(transcode_format(target, srgb)).optimalTilingFeatures;
+			if ((features & needed) == needed)
+			{
+				return target;
+			}
+		}
+
+		if (debug)
+		{
+			std::cout << "No block compressed format to transcode to, falling back to RGBA8\n";
+		}
+		return TranscodeTarget::eRgba8;
+	}
+
+
+	// Runs on a worker thread, fills result.pixels with every level in the target format
+	inline bool transcode_basis(const MappedFile& file, const Ktx2Info& info, TranscodeTarget target, TranscodedTexture& result, bool debug)
+	{
+#ifdef LEARNING_VULKAN_BASISU
+		static std::once_flag initialised;
+		std::call_once(initialised, []() { basist::basisu_transcoder_init(); });
+
+		const basist::transcoder_texture_format formats[] = {
+			basist::transcoder_texture_format::cTFBC7_RGBA,
+			basist::transcoder_texture_format::cTFASTC_4x4_RGBA,
+			basist::transcoder_texture_format::cTFETC2_RGBA,
+			basist::transcoder_texture_format::cTFBC3_RGBA,
+			basist::transcoder_texture_format::cTFRGBA32
+		};
+		basist::transcoder_texture_format format = formats[static_cast<int>(target)];
+
+		basist::ktx2_transcoder transcoder;
+		if (!transcoder.init(file.data(), static_cast<uint32_t>(file.size())) || !transcoder.start_transcoding())
+		{
+			if (debug)
+			{
+				std::cout << "Failed to start transcoding a Basis texture :/" << std::endl;
+			}
+			return false;
+		}
+
+		bool uncompressed = basist::basis_transcoder_format_is_uncompressed(format);
+		uint32_t unitSize = basist::basis_get_bytes_per_block_or_pixel(format);
+
+		for (uint32_t level = 0; level < transcoder.get_levels(); level++)
+		{
+			basist::ktx2_image_level_info levelInfo;
+			transcoder.get_image_level_info(levelInfo, level, 0, 0);
+
+			uint32_t units = uncompressed ? levelInfo.m_orig_width * levelInfo.m_orig_height : levelInfo.m_total_blocks;
+
+			// Every level starts 16 byte aligned, a multiple of any block size
+			vk::DeviceSize offset = (result.pixels.size() + 15) & ~vk::DeviceSize(15);
+			result.pixels.resize(offset + static_cast<vk::DeviceSize>(units) * unitSize);
+			result.data.levelOffsets.push_back(offset);
+
+			if (!transcoder.transcode_image_level(level, 0, 0, result.pixels.data() + offset, units, format))
+			{
+				if (debug)
+				{
+					std::cout << "Failed to transcode level " << level << " of a Basis texture :/" << std::endl;
+				}
+				return false;
+			}
+		}
+
+		return true;
+#else
+		if (debug)
+		{
+			std::cout << "Built without the Basis Universal transcoder, can't load Basis textures\n";
+		}
+		return false;
+#endif
+	}
+
+
+	// Basis textures transcoding on the thread pool. The render thread takes the finished ones
+	// and creates them, everything Vulkan stays on that thread.
+	class TranscodeQueue
+	{
+	public:
+		~TranscodeQueue()
+		{
+			wait_idle();
+		}
+
+		void submit(ThreadPool& pool, uint32_t handle, std::shared_ptr<MappedFile> file, Ktx2Info info, TranscodeTarget target, bool debug)
+		{
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				outstanding++;
+			}
+
+			pool.submit([this, handle, file, info, target, debug]()
+				{
+					TranscodedTexture result;
+					result.handle = handle;
+					result.succeeded = transcode_basis(*file, info, target, result, debug);
+
+					result.data.pixels = result.pixels.data();
+					result.data.size = result.pixels.size();
+					result.data.width = info.width;
+					result.data.height = info.height;
+					result.data.format = transcode_format(target, info.srgb);
+					result.data.generateMips = info.levelCount == 0;
+
+					std::lock_guard<std::mutex> lock(mutex);
+					finished.push_back(std::move(result));
+					outstanding--;
+					idle.notify_all();
+				});
+		}
+
+
+		// Moving a vector keeps its buffer, so data.pixels still points at pixels
+		std::vector<TranscodedTexture> take_finished()
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+
+			std::vector<TranscodedTexture> taken;
+			taken.swap(finished);
+			return taken;
+		}
+
+
+		void wait_idle()
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			idle.wait(lock, [this]() { return outstanding == 0; });
+		}
+
+	private:
+		std::mutex mutex;
+		std::condition_variable idle;
+		std::vector<TranscodedTexture> finished;
+		uint32_t outstanding = 0;
+	};
+}
\ No newline at end of file
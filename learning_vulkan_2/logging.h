@@ -1,6 +1,8 @@
 #pragma once
 
 #include "config.h"
+#include "startup_profiler.h"
+#include "result.h"
 
 namespace vkInit
 {
@@ -19,7 +21,7 @@ namespace vkInit
 
 
 	// Debug Messenger
-	vk::DebugUtilsMessengerEXT make_debug_messenger(vk::Instance instance, vk::DispatchLoaderDynamic& dldi)
+	vk::DebugUtilsMessengerEXT make_debug_messenger(vk::Instance instance)
 	{
 		// Create info
 		// flags, message severity, message type, user callback function, user data
@@ -31,7 +33,8 @@ namespace vkInit
 			nullptr
 		);
 
-		return instance.createDebugUtilsMessengerEXT(createInfo, nullptr, dldi);
+		vkUtil::StartupProfiler::Scope driverTimer("vkCreateDebugUtilsMessengerEXT", vkUtil::StartupProfiler::Category::eDriver);
+		return vkUtil::vk_call([&]() { return instance.createDebugUtilsMessengerEXT(createInfo); }).value_or(nullptr);
 	}
 
 
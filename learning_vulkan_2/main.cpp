@@ -1,8 +1,111 @@
 #include "app.h"
+#include "culling.h"
+#include "scene.h"
 
 int main(int argc, char** argv)
 {
-	App* hridizaApp = new App(800, 600, true);
+	// --msaa 1 turns multisampling off
+	uint32_t msaaSamples = 4;
+
+	// --windows N opens N windows onto the same scene, one per screen of a wall display
+	int windowCount = 1;
+
+	// --serial-startup runs the engine's setup steps one after the other, to compare its time to first frame
+	bool parallelStartup = true;
+
+	// --device picks the GPU by index, name or UUID, like the LEARNING_VULKAN_DEVICE environment variable
+	std::string devicePreference;
+
+	// Benchmarks run without opening a window
+	for (int ii = 1; ii < argc; ii++)
+	{
+		if (strcmp(argv[ii], "--msaa") == 0 && ii + 1 < argc)
+		{
+			msaaSamples = static_cast<uint32_t>(std::max(1, atoi(argv[++ii])));
+			continue;
+		}
+
+		if (strcmp(argv[ii], "--windows") == 0 && ii + 1 < argc)
+		{
+			windowCount = std::max(1, atoi(argv[++ii]));
+			continue;
+		}
+
+		// Written after the first present
+		if (strcmp(argv[ii], "--startup-report") == 0 && ii + 1 < argc)
+		{
+			vkUtil::startup_profiler().set_report_path(argv[++ii]);
+			continue;
+		}
+
+		if (strcmp(argv[ii], "--device") == 0 && ii + 1 < argc)
+		{
+			devicePreference = argv[++ii];
+			continue;
+		}
+
+		if (strcmp(argv[ii], "--serial-startup") == 0)
+		{
+			parallelStartup = false;
+			continue;
+		}
+
+		if (strcmp(argv[ii], "--bench-culling") == 0)
+		{
+			vkUtil::benchmarkCulling();
+			return 0;
+		}
+
+		if (strcmp(argv[ii], "--bench-scene") == 0)
+		{
+			ThreadPool threadPool;
+			Scene::benchmark(&threadPool);
+			return 0;
+		}
+
+		// Needs a device, so this one does open a window
+		if (strcmp(argv[ii], "--bench-async-compute") == 0)
+		{
+			App* benchmarkApp = new App(800, 600, false, msaaSamples, 1, true, devicePreference);
+			benchmarkApp->benchmark_async_compute();
+			delete benchmarkApp;
+			return 0;
+		}
+
+		if (strcmp(argv[ii], "--bench-depth-prepass") == 0)
+		{
+			App* benchmarkApp = new App(800, 600, false, msaaSamples, 1, true, devicePreference);
+			benchmarkApp->benchmark_depth_prepass();
+			delete benchmarkApp;
+			return 0;
+		}
+
+		if (strcmp(argv[ii], "--bench-transient-aliasing") == 0)
+		{
+			App* benchmarkApp = new App(800, 600, false, msaaSamples, 1, true, devicePreference);
+			benchmarkApp->benchmark_transient_aliasing();
+			delete benchmarkApp;
+			return 0;
+		}
+
+		if (strcmp(argv[ii], "--bench-render-thread") == 0)
+		{
+			App* benchmarkApp = new App(800, 600, false, msaaSamples, 1, true, devicePreference);
+			benchmarkApp->benchmark_render_thread();
+			delete benchmarkApp;
+			return 0;
+		}
+
+		if (strcmp(argv[ii], "--bench-draw-dispatch") == 0)
+		{
+			App* benchmarkApp = new App(800, 600, false, msaaSamples, 1, true, devicePreference);
+			benchmarkApp->benchmark_draw_dispatch();
+			delete benchmarkApp;
+			return 0;
+		}
+	}
+
+	App* hridizaApp = new App(800, 600, true, msaaSamples, windowCount, parallelStartup, devicePreference);
 
 	hridizaApp->run();
 	delete hridizaApp;
@@ -0,0 +1,136 @@
+#include "mapped_file.h"
+
+#include <algorithm>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+
+bool MappedFile::open(const std::string& filename)
+{
+	close();
+
+#if defined(_WIN32)
+	HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+		OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+
+	if (file == INVALID_HANDLE_VALUE)
+	{
+		return false;
+	}
+
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0)
+	{
+		CloseHandle(file);
+		return false;
+	}
+
+	HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (!mapping)
+	{
+		CloseHandle(file);
+		return false;
+	}
+
+	const void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	if (!view)
+	{
+		CloseHandle(mapping);
+		CloseHandle(file);
+		return false;
+	}
+
+	fileHandle = file;
+	mappingHandle = mapping;
+	bytes = static_cast<const uint8_t*>(view);
+	length = static_cast<size_t>(fileSize.QuadPart);
+#else
+	int fd = ::open(filename.c_str(), O_RDONLY);
+	if (fd < 0)
+	{
+		return false;
+	}
+
+	struct stat fileInfo;
+	if (fstat(fd, &fileInfo) != 0 || fileInfo.st_size == 0)
+	{
+		::close(fd);
+		return false;
+	}
+
+	void* view = mmap(nullptr, static_cast<size_t>(fileInfo.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+	if (view == MAP_FAILED)
+	{
+		::close(fd);
+		return false;
+	}
+
+	fileDescriptor = fd;
+	bytes = static_cast<const uint8_t*>(view);
+	length = static_cast<size_t>(fileInfo.st_size);
+#endif
+
+	return true;
+}
+
+
+void MappedFile::prefetch(size_t offset, size_t size)
+{
+	if (!bytes || offset >= length)
+	{
+		return;
+	}
+
+	size = std::min(size, length - offset);
+
+#if defined(_WIN32)
+	WIN32_MEMORY_RANGE_ENTRY range;
+	range.VirtualAddress = const_cast<uint8_t*>(bytes + offset);
+	range.NumberOfBytes = size;
+	PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+#else
+	// madvise wants a page aligned start
+	size_t pageSize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+	size_t alignedOffset = offset & ~(pageSize - 1);
+	madvise(const_cast<uint8_t*>(bytes + alignedOffset), size + (offset - alignedOffset), MADV_WILLNEED);
+#endif
+}
+
+
+void MappedFile::close()
+{
+	if (!bytes)
+	{
+		return;
+	}
+
+#if defined(_WIN32)
+	UnmapViewOfFile(bytes);
+	CloseHandle(static_cast<HANDLE>(mappingHandle));
+	CloseHandle(static_cast<HANDLE>(fileHandle));
+	mappingHandle = nullptr;
+	fileHandle = nullptr;
+#else
+	munmap(const_cast<uint8_t*>(bytes), length);
+	::close(fileDescriptor);
+	fileDescriptor = -1;
+#endif
+
+	bytes = nullptr;
+	length = 0;
+}
+
+
+MappedFile::~MappedFile()
+{
+	close();
+}
\ No newline at end of file
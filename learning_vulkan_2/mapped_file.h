@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+
+// Read-only memory mapping of a whole file.
+// Pages are faulted in by the OS as they are touched, nothing is read up front.
+class MappedFile
+{
+public:
+	MappedFile() = default;
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	~MappedFile();
+
+	bool open(const std::string& filename);
+
+	void close();
+
+	// Tells the OS we are about to read [offset, offset + size) front to back
+	void prefetch(size_t offset, size_t size);
+
+	const uint8_t* data() const
+	{
+		return bytes;
+	}
+
+	size_t size() const
+	{
+		return length;
+	}
+
+private:
+	const uint8_t* bytes = nullptr;
+	size_t length = 0;
+
+#if defined(_WIN32)
+	void* fileHandle = nullptr;
+	void* mappingHandle = nullptr;
+#else
+	int fileDescriptor = -1;
+#endif
+};
\ No newline at end of file
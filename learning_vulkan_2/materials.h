@@ -0,0 +1,40 @@
+#pragma once
+
+#include "config.h"
+
+namespace vkUtil
+{
+	// std430 layouts, mirrored in the shaders
+
+	struct GpuMaterial
+	{
+		float baseColor[4];
+		uint32_t albedoTexture;
+		uint32_t padding[3];
+	};
+
+	// Per object, indexed with gl_InstanceIndex (firstInstance carries the object index)
+	// Only read by indirect draws, direct draws push the same data as push constants
+	struct GpuObject
+	{
+		float model[16];
+		uint32_t materialID;
+		uint32_t padding[3];
+	};
+
+	// Per frame, through the uniform ring (std140)
+	struct CameraConstants
+	{
+		float viewProjection[16];
+	};
+
+	// albedoTexture of a material without one
+	constexpr uint32_t NO_TEXTURE = UINT32_MAX;
+
+	constexpr uint32_t MAX_MATERIALS = 4096;
+
+	// Slots in the bindless storage buffer array, the engine registers these two buffers first
+	// so the shaders can hardcode them
+	constexpr uint32_t OBJECT_BUFFER_INDEX = 0;
+	constexpr uint32_t MATERIAL_BUFFER_INDEX = 1;
+}
\ No newline at end of file
@@ -0,0 +1,121 @@
+#pragma once
+
+#include "config.h"
+#include "device_context.h"
+#include "result.h"
+
+namespace vkUtil
+{
+	struct BufferInputChunk
+	{
+		vk::DeviceSize size;
+		vk::BufferUsageFlags usage;
+		vk::Device logicalDevice;
+		const DeviceContext* deviceContext;
+		vk::MemoryPropertyFlags memoryProperties;
+	};
+
+	struct Buffer
+	{
+		vk::Buffer buffer;
+		vk::DeviceMemory bufferMemory;
+		vk::DeviceSize size;
+	};
+
+	// Host visible, host coherent and mapped for its whole life
+	struct MappedBuffer
+	{
+		Buffer buffer;
+		void* data;
+	};
+
+
+	// Returns UINT32_MAX if no memory type has all the requested properties
+	inline uint32_t findMemoryTypeIndex(const DeviceContext& deviceContext, uint32_t supportedMemoryIndices, vk::MemoryPropertyFlags requestedProperties)
+	{
+		return deviceContext.find_memory_type(supportedMemoryIndices, requestedProperties);
+	}
+
+
+	inline Buffer createBuffer(BufferInputChunk input, bool debug)
+	{
+		Buffer buffer = {};
+		buffer.size = input.size;
+
+		vk::BufferCreateInfo bufferInfo = {};
+		bufferInfo.flags = vk::BufferCreateFlags();
+		bufferInfo.size = input.size;
+		bufferInfo.usage = input.usage;
+		bufferInfo.sharingMode = vk::SharingMode::eExclusive;
+
+		Expected<vk::Buffer> created = vk_call([&]() { return input.logicalDevice.createBuffer(bufferInfo); });
+		if (!created)
+		{
+			if (debug)
+			{
+				std::cout << "Failed to create buffer of " << input.size << " bytes :/" << std::endl;
+			}
+
+			return buffer;
+		}
+		buffer.buffer = created.value();
+
+		vk::MemoryRequirements memoryRequirements = input.logicalDevice.getBufferMemoryRequirements(buffer.buffer);
+
+		vk::MemoryAllocateInfo allocInfo = {};
+		allocInfo.allocationSize = memoryRequirements.size;
+		allocInfo.memoryTypeIndex = findMemoryTypeIndex(*input.deviceContext, memoryRequirements.memoryTypeBits, input.memoryProperties);
+
+		Expected<vk::DeviceMemory> memory = vk_call([&]() { return input.logicalDevice.allocateMemory(allocInfo); });
+		buffer.bufferMemory = memory.value();
+
+		if (!memory || !vk_call([&]() { return input.logicalDevice.bindBufferMemory(buffer.buffer, buffer.bufferMemory, 0); }))
+		{
+			if (debug)
+			{
+				std::cout << "Failed to allocate memory for buffer of " << input.size << " bytes :/" << std::endl;
+			}
+		}
+
+		return buffer;
+	}
+
+
+	inline void destroyBuffer(vk::Device device, Buffer& buffer)
+	{
+		device.destroyBuffer(buffer.buffer);
+		device.freeMemory(buffer.bufferMemory);
+
+		buffer.buffer = nullptr;
+		buffer.bufferMemory = nullptr;
+		buffer.size = 0;
+	}
+
+
+	inline MappedBuffer createMappedBuffer(BufferInputChunk input, bool debug)
+	{
+		input.memoryProperties = vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent;
+
+		MappedBuffer mapped = {};
+		mapped.buffer = createBuffer(input, debug);
+
+		if (mapped.buffer.bufferMemory)
+		{
+			mapped.data = vk_call([&]() { return input.logicalDevice.mapMemory(mapped.buffer.bufferMemory, 0, mapped.buffer.size); }).value_or(nullptr);
+		}
+
+		return mapped;
+	}
+
+
+	inline void destroyMappedBuffer(vk::Device device, MappedBuffer& mapped)
+	{
+		if (mapped.data)
+		{
+			device.unmapMemory(mapped.buffer.bufferMemory);
+			mapped.data = nullptr;
+		}
+
+		destroyBuffer(device, mapped.buffer);
+	}
+}
\ No newline at end of file
@@ -0,0 +1,228 @@
+#pragma once
+
+#include "config.h"
+#include "memory.h"
+#include "mesh_format.h"
+#include "mapped_file.h"
+#include "upload.h"
+
+namespace vkMesh
+{
+	struct MeshBuffers
+	{
+		vkUtil::Buffer vertexBuffer;
+		vkUtil::Buffer indexBuffer;
+		uint32_t vertexCount;
+		uint32_t indexCount;
+		vk::IndexType indexType;
+		std::vector<MeshFileSubmesh> submeshes;
+
+		float aabbMin[3];
+		float aabbMax[3];
+		float sphereCenter[3];
+		float sphereRadius;
+
+		// Acquire before the first draw that reads the buffers
+		vkUtil::UploadBatch uploadBatch;
+	};
+
+	struct meshUploadInput
+	{
+		vk::Device logicalDevice;
+		const vkUtil::DeviceContext* deviceContext;
+		vkUtil::AsyncUploader* uploader;
+	};
+
+	// The blobs are read from the mapping in pieces of this size, prefetching one piece ahead
+	constexpr vk::DeviceSize MESH_STAGING_CHUNK = 16 * 1024 * 1024;
+
+
+	// Returns the header if the mapped file is a mesh file we can read, nullptr otherwise
+	inline const MeshFileHeader* validate_mesh_file(const MappedFile& file, bool debug)
+	{
+		if (file.size() < sizeof(MeshFileHeader))
+		{
+			if (debug)
+			{
+				std::cout << "Mesh file is too small to hold a header\n";
+			}
+			return nullptr;
+		}
+
+		const MeshFileHeader* header = reinterpret_cast<const MeshFileHeader*>(file.data());
+
+		if (memcmp(header->magic, MESH_FILE_MAGIC, sizeof(MESH_FILE_MAGIC)) != 0 || !host_is_little_endian())
+		{
+			if (debug)
+			{
+				std::cout << "Not a mesh file (or not a little-endian host)\n";
+			}
+			return nullptr;
+		}
+
+		if (header->version != MESH_FILE_VERSION || header->headerSize < sizeof(MeshFileHeader)
+			|| header->vertexStride != sizeof(MeshVertex))
+		{
+			if (debug)
+			{
+				std::cout << "Unsupported mesh file version " << header->version << "\n";
+			}
+			return nullptr;
+		}
+
+		// Written so a crafted header can't wrap around and pass: the counts are checked before they are
+		// multiplied, both factors then fit in 32 bits, and ranges are checked without adding to the offset
+		auto in_file = [&](uint64_t offset, uint64_t size)
+		{
+			return size <= file.size() && offset <= file.size() - size;
+		};
+
+		uint64_t indexSize = static_cast<uint64_t>(header->indexType);
+		bool inBounds = header->vertexCount <= UINT32_MAX
+			&& header->indexCount <= UINT32_MAX
+			&& header->vertexSize == header->vertexCount * header->vertexStride
+			&& header->indexSize == header->indexCount * indexSize
+			&& in_file(header->submeshOffset, static_cast<uint64_t>(header->submeshCount) * sizeof(MeshFileSubmesh))
+			&& in_file(header->vertexOffset, header->vertexSize)
+			&& in_file(header->indexOffset, header->indexSize);
+
+		if (!inBounds)
+		{
+			if (debug)
+			{
+				std::cout << "Mesh file is truncated or corrupt\n";
+			}
+			return nullptr;
+		}
+
+		return header;
+	}
+
+
+	// Maps the file and streams its vertex and index blobs into device local buffers.
+	// The blobs are copied as-is from the mapping into staging memory, there is no parsing.
+	// Copies run on the transfer queue, the mesh is ready to draw once mesh.uploadBatch is acquired.
+	inline bool load_mesh(const std::string& filename, meshUploadInput input, MeshBuffers& mesh, bool debug)
+	{
+		MappedFile file;
+
+		if (!file.open(filename))
+		{
+			if (debug)
+			{
+				std::cout << "Failed to map \"" << filename << "\"" << std::endl;
+			}
+			return false;
+		}
+
+		const MeshFileHeader* header = validate_mesh_file(file, debug);
+		if (!header)
+		{
+			return false;
+		}
+
+		mesh.vertexCount = static_cast<uint32_t>(header->vertexCount);
+		mesh.indexCount = static_cast<uint32_t>(header->indexCount);
+		mesh.indexType = header->indexType == MeshIndexType::eUint16 ? vk::IndexType::eUint16 : vk::IndexType::eUint32;
+
+		const MeshFileSubmesh* submeshes = reinterpret_cast<const MeshFileSubmesh*>(file.data() + header->submeshOffset);
+		mesh.submeshes.assign(submeshes, submeshes + header->submeshCount);
+
+		memcpy(mesh.aabbMin, header->aabbMin, sizeof(mesh.aabbMin));
+		memcpy(mesh.aabbMax, header->aabbMax, sizeof(mesh.aabbMax));
+		memcpy(mesh.sphereCenter, header->sphereCenter, sizeof(mesh.sphereCenter));
+		mesh.sphereRadius = header->sphereRadius;
+
+
+		// Destination buffers
+		vkUtil::BufferInputChunk bufferInput;
+		bufferInput.logicalDevice = input.logicalDevice;
+		bufferInput.deviceContext = input.deviceContext;
+		bufferInput.memoryProperties = vk::MemoryPropertyFlagBits::eDeviceLocal;
+
+		bufferInput.size = std::max<vk::DeviceSize>(header->vertexSize, 4);
+		bufferInput.usage = vk::BufferUsageFlagBits::eTransferDst | vk::BufferUsageFlagBits::eVertexBuffer;
+		mesh.vertexBuffer = vkUtil::createBuffer(bufferInput, debug);
+
+		bufferInput.size = std::max<vk::DeviceSize>(header->indexSize, 4);
+		bufferInput.usage = vk::BufferUsageFlagBits::eTransferDst | vk::BufferUsageFlagBits::eIndexBuffer;
+		mesh.indexBuffer = vkUtil::createBuffer(bufferInput, debug);
+
+
+		// Both blobs, cut into staging sized pieces
+		struct Piece
+		{
+			uint64_t fileOffset;
+			vk::DeviceSize size;
+			vk::Buffer destination;
+			vk::DeviceSize destinationOffset;
+			vk::AccessFlags access;
+		};
+
+		std::vector<Piece> pieces;
+		auto cut = [&](uint64_t fileOffset, uint64_t size, vk::Buffer destination, vk::AccessFlags access)
+		{
+			for (uint64_t done = 0; done < size; done += MESH_STAGING_CHUNK)
+			{
+				pieces.push_back({ fileOffset + done, std::min<uint64_t>(MESH_STAGING_CHUNK, size - done), destination, done, access });
+			}
+		};
+		cut(header->vertexOffset, header->vertexSize, mesh.vertexBuffer.buffer, vk::AccessFlagBits::eVertexAttributeRead);
+		cut(header->indexOffset, header->indexSize, mesh.indexBuffer.buffer, vk::AccessFlagBits::eIndexRead);
+
+		// Copies already submitted may still write into the buffers, so they aren't destroyed here
+		auto upload_failed = [&]()
+		{
+			if (debug)
+			{
+				std::cout << "Failed to upload mesh \"" << filename << "\" :/" << std::endl;
+			}
+			return false;
+		};
+
+		if (!pieces.empty())
+		{
+			file.prefetch(pieces[0].fileOffset, pieces[0].size);
+		}
+
+		for (size_t ii = 0; ii < pieces.size(); ii++)
+		{
+			const Piece& piece = pieces[ii];
+
+			// Let the OS start reading the next piece while we copy this one
+			if (ii + 1 < pieces.size())
+			{
+				file.prefetch(pieces[ii + 1].fileOffset, pieces[ii + 1].size);
+			}
+
+			// Straight from the mapping into staging, the transfer queue does the rest
+			if (!input.uploader->upload_buffer(piece.destination, piece.destinationOffset, file.data() + piece.fileOffset, piece.size,
+				vk::PipelineStageFlagBits::eVertexInput, piece.access))
+			{
+				return upload_failed();
+			}
+		}
+
+		// Nothing waits for the copies here, the first frame that draws the mesh acquires the batch
+		mesh.uploadBatch = input.uploader->flush();
+		if (!pieces.empty() && !mesh.uploadBatch)
+		{
+			return upload_failed();
+		}
+
+		if (debug)
+		{
+			std::cout << "Loaded mesh \"" << filename << "\": " << mesh.vertexCount << " vertices, "
+				<< mesh.indexCount << " indices, " << mesh.submeshes.size() << " submesh(es)\n";
+		}
+
+		return true;
+	}
+
+
+	inline void destroy_mesh(vk::Device device, MeshBuffers& mesh)
+	{
+		vkUtil::destroyBuffer(device, mesh.vertexBuffer);
+		vkUtil::destroyBuffer(device, mesh.indexBuffer);
+	}
+}
\ No newline at end of file
@@ -0,0 +1,79 @@
+#pragma once
+
+// Binary mesh file layout, shared by the engine and the offline converter.
+// No Vulkan here so the converter can build without the SDK.
+//
+// [MeshFileHeader][MeshFileSubmesh * submeshCount] pad [vertex blob] pad [index blob]
+//
+// Everything is little-endian and every blob starts on a MESH_FILE_ALIGNMENT boundary,
+// so the loader can copy the blobs straight from the mapped file into staging memory.
+
+#include <cstdint>
+
+namespace vkMesh
+{
+	constexpr char MESH_FILE_MAGIC[4] = { 'H', 'M', 'S', 'H' };
+	constexpr uint32_t MESH_FILE_VERSION = 1;
+	constexpr uint64_t MESH_FILE_ALIGNMENT = 256;
+
+	// position xyz, normal xyz, uv
+	struct MeshVertex
+	{
+		float position[3];
+		float normal[3];
+		float uv[2];
+	};
+	static_assert(sizeof(MeshVertex) == 32, "MeshVertex must stay tightly packed");
+
+	enum class MeshIndexType : uint32_t
+	{
+		eUint16 = 2,
+		eUint32 = 4
+	};
+
+	struct MeshFileHeader
+	{
+		char magic[4];
+		uint32_t version;
+		uint32_t headerSize;        // sizeof(MeshFileHeader), lets newer readers skip fields they don't know
+		uint32_t vertexStride;      // sizeof(MeshVertex)
+		MeshIndexType indexType;
+		uint32_t submeshCount;
+
+		uint64_t vertexCount;
+		uint64_t indexCount;
+
+		// byte offsets from the start of the file
+		uint64_t submeshOffset;
+		uint64_t vertexOffset;
+		uint64_t vertexSize;
+		uint64_t indexOffset;
+		uint64_t indexSize;
+
+		// object space bounds
+		float aabbMin[3];
+		float aabbMax[3];
+		float sphereCenter[3];
+		float sphereRadius;
+	};
+
+	// A range of indices drawn with one material
+	struct MeshFileSubmesh
+	{
+		uint32_t firstIndex;
+		uint32_t indexCount;
+		uint32_t material;
+		uint32_t reserved;
+	};
+
+	inline uint64_t align_mesh_offset(uint64_t offset)
+	{
+		return (offset + MESH_FILE_ALIGNMENT - 1) & ~(MESH_FILE_ALIGNMENT - 1);
+	}
+
+	inline bool host_is_little_endian()
+	{
+		const uint32_t probe = 1;
+		return *reinterpret_cast<const uint8_t*>(&probe) == 1;
+	}
+}
\ No newline at end of file
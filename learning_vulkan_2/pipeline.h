@@ -2,17 +2,44 @@
 
 #include "config.h"
 #include "shaders.h"
+#include "push_constants.h"
+#include "result.h"
 
 
 namespace vkInit
 {
+	// How a graphics pipeline uses the reversed-Z depth buffer
+	enum class DepthPass
+	{
+		eShade,             // test and write, GREATER
+		eDepthOnly,         // the prepass: test and write, no fragment shader, no color writes
+		eShadeAfterPrepass  // only shade the fragments the prepass kept, GREATER_OR_EQUAL without writes
+	};
+
 	struct GraphicsPipelineInBundle
 	{
 		vk::Device device;
 		std::string vertexFilepath;
 		std::string fragmentFilepath;
-		vk::Extent2D swapchainExtent;
+
+		// SPIR-V read ahead of time, the files are only read if these are empty
+		std::vector<char> vertexCode;
+		std::vector<char> fragmentCode;
+
 		vk::Format swapchainImageFormat;
+		vk::Format depthFormat;
+		vk::SampleCountFlagBits samples = vk::SampleCountFlagBits::e1;
+		DepthPass depthPass = DepthPass::eShade;
+		std::vector<vk::DescriptorSetLayout> setLayouts;
+		std::vector<vk::PushConstantRange> pushConstantRanges;
+		uint32_t maxPushConstantsSize;
+
+		// Variants of an existing pipeline pass its render pass and layout, they are created otherwise
+		vk::RenderPass renderpass{ nullptr };
+		vk::PipelineLayout layout{ nullptr };
+
+		// Shared by every pipeline the engine makes, may be null
+		vk::PipelineCache pipelineCache{ nullptr };
 	};
 
 	struct GraphicsPipelineOutBundle
@@ -23,76 +50,162 @@ namespace vkInit
 	};
 
 
-	vk::PipelineLayout make_pipeline_layout(vk::Device device, bool debug)
+	struct ComputePipelineInBundle
 	{
-		vk::PipelineLayoutCreateInfo layoutInfo;
-		layoutInfo.flags = vk::PipelineLayoutCreateFlags();
-		layoutInfo.setLayoutCount = 0;
-		layoutInfo.pushConstantRangeCount = 0;
+		vk::Device device;
+		std::string computeFilepath;
+		std::vector<char> computeCode;
+		std::vector<vk::DescriptorSetLayout> setLayouts;
+		std::vector<vk::PushConstantRange> pushConstantRanges;
+		uint32_t maxPushConstantsSize;
+		vk::PipelineCache pipelineCache{ nullptr };
+	};
 
-		try
+	struct ComputePipelineOutBundle
+	{
+		vk::PipelineLayout layout;
+		vk::Pipeline pipeline;
+	};
+
+
+	vk::PipelineLayout make_pipeline_layout(vk::Device device, const std::vector<vk::DescriptorSetLayout>& setLayouts,
+		const std::vector<vk::PushConstantRange>& pushConstantRanges, uint32_t maxPushConstantsSize, bool debug)
+	{
+		// Ranges past the device limit would only fail later, at pipeline creation or in the driver
+		for (const vk::PushConstantRange& range : pushConstantRanges)
 		{
-			return device.createPipelineLayout(layoutInfo);
+			if (range.offset + range.size > maxPushConstantsSize)
+			{
+				if (debug)
+				{
+					std::cout << "Push constant range of " << range.size << " bytes at offset " << range.offset
+						<< " exceeds the device limit of " << maxPushConstantsSize << " bytes :/" << std::endl;
+				}
+				return nullptr;
+			}
 		}
-		catch (vk::SystemError err)
+
+		vk::PipelineLayoutCreateInfo layoutInfo;
+		layoutInfo.flags = vk::PipelineLayoutCreateFlags();
+		layoutInfo.setLayoutCount = static_cast<uint32_t>(setLayouts.size());
+		layoutInfo.pSetLayouts = setLayouts.data();
+		layoutInfo.pushConstantRangeCount = static_cast<uint32_t>(pushConstantRanges.size());
+		layoutInfo.pPushConstantRanges = pushConstantRanges.data();
+
+		vkUtil::Expected<vk::PipelineLayout> layout = vkUtil::vk_call([&]()
+			{
+				vkUtil::StartupProfiler::Scope driverTimer("vkCreatePipelineLayout", vkUtil::StartupProfiler::Category::eDriver);
+				return device.createPipelineLayout(layoutInfo);
+			});
+
+		if (!layout)
 		{
 			if (debug)
 			{
 				std::cout << "Failed to create pipeline layout :/" << std::endl;
 			}
+			return nullptr;
 		}
+
+		return layout.value();
 	}
 
 
-	vk::RenderPass make_renderpass(vk::Device device, vk::Format swapchainImageFormat, bool debug)
+	// The frame itself runs in render passes the render graph makes, this one has the same attachments
+	// so pipelines made against it are compatible with those.
+	// With more than one sample attachment 0 is the multisampled target and attachment 1 the swapchain image,
+	// resolved into at the end of the subpass so the samples never have to be stored.
+	// finalLayout is the layout the single sampled image is left in.
+	// The depth attachment comes last, it is cleared to 0 for reversed-Z and never stored.
+	vk::RenderPass make_renderpass(vk::Device device, vk::Format swapchainImageFormat, vk::Format depthFormat,
+		vk::SampleCountFlagBits samples, vk::ImageLayout finalLayout, bool debug)
 	{
+		bool multisampled = samples != vk::SampleCountFlagBits::e1;
+		std::vector<vk::AttachmentDescription> attachments;
+
 		vk::AttachmentDescription colorAttachment = {};
 		colorAttachment.flags = vk::AttachmentDescriptionFlags();
 		colorAttachment.format = swapchainImageFormat;
-		colorAttachment.samples = vk::SampleCountFlagBits::e1;
+		colorAttachment.samples = samples;
 		colorAttachment.loadOp = vk::AttachmentLoadOp::eClear;
-		colorAttachment.storeOp = vk::AttachmentStoreOp::eStore;
+		colorAttachment.storeOp = multisampled ? vk::AttachmentStoreOp::eDontCare : vk::AttachmentStoreOp::eStore;
 		colorAttachment.stencilLoadOp = vk::AttachmentLoadOp::eDontCare;
 		colorAttachment.stencilStoreOp = vk::AttachmentStoreOp::eDontCare;
 		colorAttachment.initialLayout = vk::ImageLayout::eUndefined;
-		colorAttachment.finalLayout = vk::ImageLayout::ePresentSrcKHR;
+		colorAttachment.finalLayout = multisampled ? vk::ImageLayout::eColorAttachmentOptimal : finalLayout;
+		attachments.push_back(colorAttachment);
+
+		if (multisampled)
+		{
+			// Every pixel is written by the resolve, nothing to load
+			vk::AttachmentDescription resolveAttachment = colorAttachment;
+			resolveAttachment.samples = vk::SampleCountFlagBits::e1;
+			resolveAttachment.loadOp = vk::AttachmentLoadOp::eDontCare;
+			resolveAttachment.storeOp = vk::AttachmentStoreOp::eStore;
+			resolveAttachment.finalLayout = finalLayout;
+			attachments.push_back(resolveAttachment);
+		}
+
+		vk::AttachmentDescription depthAttachment = {};
+		depthAttachment.flags = vk::AttachmentDescriptionFlags();
+		depthAttachment.format = depthFormat;
+		depthAttachment.samples = samples;
+		depthAttachment.loadOp = vk::AttachmentLoadOp::eClear;
+		depthAttachment.storeOp = vk::AttachmentStoreOp::eDontCare;
+		depthAttachment.stencilLoadOp = vk::AttachmentLoadOp::eDontCare;
+		depthAttachment.stencilStoreOp = vk::AttachmentStoreOp::eDontCare;
+		depthAttachment.initialLayout = vk::ImageLayout::eUndefined;
+		depthAttachment.finalLayout = vk::ImageLayout::eDepthStencilAttachmentOptimal;
+		attachments.push_back(depthAttachment);
 
 
 		vk::AttachmentReference colorAttachmentRef = {};
 		colorAttachmentRef.attachment = 0; // index for color attachment
 		colorAttachmentRef.layout = vk::ImageLayout::eColorAttachmentOptimal;
 
+		vk::AttachmentReference resolveAttachmentRef(1, vk::ImageLayout::eColorAttachmentOptimal);
+		vk::AttachmentReference depthAttachmentRef(static_cast<uint32_t>(attachments.size() - 1), vk::ImageLayout::eDepthStencilAttachmentOptimal);
+
 
 		vk::SubpassDescription subpass = {};
 		subpass.flags = vk::SubpassDescriptionFlags();
 		subpass.pipelineBindPoint = vk::PipelineBindPoint::eGraphics;
 		subpass.colorAttachmentCount = 1;
 		subpass.pColorAttachments = &colorAttachmentRef;
+		subpass.pResolveAttachments = multisampled ? &resolveAttachmentRef : nullptr;
+		subpass.pDepthStencilAttachment = &depthAttachmentRef;
 
 		
 		vk::RenderPassCreateInfo renderpassInfo = {};
 		renderpassInfo.flags = vk::RenderPassCreateFlags();
-		renderpassInfo.attachmentCount = 1;
-		renderpassInfo.pAttachments = &colorAttachment;
+		renderpassInfo.attachmentCount = static_cast<uint32_t>(attachments.size());
+		renderpassInfo.pAttachments = attachments.data();
 		renderpassInfo.subpassCount = 1;
 		renderpassInfo.pSubpasses = &subpass;
 
-		try
-		{
-			return device.createRenderPass(renderpassInfo);
-		}
-		catch (vk::SystemError err)
+		vkUtil::Expected<vk::RenderPass> renderpass = vkUtil::vk_call([&]()
+			{
+				vkUtil::StartupProfiler::Scope driverTimer("vkCreateRenderPass", vkUtil::StartupProfiler::Category::eDriver);
+				return device.createRenderPass(renderpassInfo);
+			});
+
+		if (!renderpass)
 		{
 			if (debug)
 			{
 				std::cout << "Failed to create renderpass!" << std::endl;
 			}
+			return nullptr;
 		}
+
+		return renderpass.value();
 	}
 
 
 	GraphicsPipelineOutBundle make_graphics_pipeline(GraphicsPipelineInBundle specification, bool debug)
 	{
+		vkUtil::StartupProfiler::Scope timer("make_graphics_pipeline");
+
 		vk::GraphicsPipelineCreateInfo pipelineInfo = {};
 		pipelineInfo.flags = vk::PipelineCreateFlags();
 
@@ -119,7 +232,7 @@ namespace vkInit
 			std::cout << "Creating vertex shader module..." << std::endl;
 		}
 
-		vk::ShaderModule vertexShader = vkUtil::createModule(specification.vertexFilepath, specification.device, debug);
+		vk::ShaderModule vertexShader = vkUtil::createModule(specification.vertexFilepath, specification.device, debug, specification.vertexCode);
 		vk::PipelineShaderStageCreateInfo vertexShaderInfo = {};
 		vertexShaderInfo.flags = vk::PipelineShaderStageCreateFlags();
 		vertexShaderInfo.stage = vk::ShaderStageFlagBits::eVertex;
@@ -129,27 +242,20 @@ namespace vkInit
 
 
 		// Viewport and Scissor
-		vk::Viewport viewport = {};
-		viewport.x = 0.0f;
-		viewport.y = 0.0f;
-		viewport.width = specification.swapchainExtent.width;
-		viewport.height = specification.swapchainExtent.height;
-		viewport.minDepth = 0.0f;
-		viewport.maxDepth = 1.0f;
-
-		vk::Rect2D scissor = {};
-		scissor.offset.x = 0.0f;
-		scissor.offset.y = 0.0f;
-		scissor.extent = specification.swapchainExtent;
-
+		// Set when recording, so one pipeline draws into windows of any size
 		vk::PipelineViewportStateCreateInfo viewportState = {};
 		viewportState.flags = vk::PipelineViewportStateCreateFlags();
 		viewportState.viewportCount = 1;
-		viewportState.pViewports = &viewport;
 		viewportState.scissorCount = 1;
-		viewportState.pScissors = &scissor;
 		pipelineInfo.pViewportState = &viewportState;
 
+		std::array<vk::DynamicState, 2> dynamicStates = { vk::DynamicState::eViewport, vk::DynamicState::eScissor };
+		vk::PipelineDynamicStateCreateInfo dynamicState = {};
+		dynamicState.flags = vk::PipelineDynamicStateCreateFlags();
+		dynamicState.dynamicStateCount = static_cast<uint32_t>(dynamicStates.size());
+		dynamicState.pDynamicStates = dynamicStates.data();
+		pipelineInfo.pDynamicState = &dynamicState;
+
 
 		// Rasterizer
 		vk::PipelineRasterizationStateCreateInfo rasterizer = {};
@@ -164,14 +270,19 @@ namespace vkInit
 		pipelineInfo.pRasterizationState = &rasterizer;
 
 
-		// Fragment shader
-		vk::ShaderModule fragmentShader = vkUtil::createModule(specification.fragmentFilepath, specification.device, debug);
-		vk::PipelineShaderStageCreateInfo fragmentShaderInfo = {};
-		fragmentShaderInfo.flags = vk::PipelineShaderStageCreateFlags();
-		fragmentShaderInfo.stage = vk::ShaderStageFlagBits::eFragment;
-		fragmentShaderInfo.module = fragmentShader;
-		fragmentShaderInfo.pName = "main";
-		shaderStages.push_back(fragmentShaderInfo);
+		// Fragment shader, the depth prepass doesn't need one
+		bool depthOnly = specification.depthPass == DepthPass::eDepthOnly;
+		vk::ShaderModule fragmentShader = nullptr;
+		if (!depthOnly)
+		{
+			fragmentShader = vkUtil::createModule(specification.fragmentFilepath, specification.device, debug, specification.fragmentCode);
+			vk::PipelineShaderStageCreateInfo fragmentShaderInfo = {};
+			fragmentShaderInfo.flags = vk::PipelineShaderStageCreateFlags();
+			fragmentShaderInfo.stage = vk::ShaderStageFlagBits::eFragment;
+			fragmentShaderInfo.module = fragmentShader;
+			fragmentShaderInfo.pName = "main";
+			shaderStages.push_back(fragmentShaderInfo);
+		}
 
 		pipelineInfo.stageCount = shaderStages.size();
 		pipelineInfo.pStages = shaderStages.data();
@@ -181,13 +292,29 @@ namespace vkInit
 		vk::PipelineMultisampleStateCreateInfo multisampling = {};
 		multisampling.flags = vk::PipelineMultisampleStateCreateFlags();
 		multisampling.sampleShadingEnable = VK_FALSE;
-		multisampling.rasterizationSamples = vk::SampleCountFlagBits::e1;
+		multisampling.rasterizationSamples = specification.samples;
 		pipelineInfo.pMultisampleState = &multisampling;
 
 
+		// Depth, reversed-Z: near is 1, far is 0
+		bool afterPrepass = specification.depthPass == DepthPass::eShadeAfterPrepass;
+		vk::PipelineDepthStencilStateCreateInfo depthStencil = {};
+		depthStencil.flags = vk::PipelineDepthStencilStateCreateFlags();
+		depthStencil.depthTestEnable = VK_TRUE;
+		depthStencil.depthWriteEnable = afterPrepass ? VK_FALSE : VK_TRUE;
+		depthStencil.depthCompareOp = afterPrepass ? vk::CompareOp::eGreaterOrEqual : vk::CompareOp::eGreater;
+		depthStencil.depthBoundsTestEnable = VK_FALSE;
+		depthStencil.stencilTestEnable = VK_FALSE;
+		pipelineInfo.pDepthStencilState = &depthStencil;
+
+
 		// Color Blend
 		vk::PipelineColorBlendAttachmentState colorBlendAttachment = {};
 		colorBlendAttachment.colorWriteMask = vk::ColorComponentFlagBits::eR | vk::ColorComponentFlagBits::eG | vk::ColorComponentFlagBits::eB | vk::ColorComponentFlagBits::eA;
+		if (depthOnly)
+		{
+			colorBlendAttachment.colorWriteMask = vk::ColorComponentFlags();
+		}
 		colorBlendAttachment.blendEnable = VK_FALSE;
 
 		vk::PipelineColorBlendStateCreateInfo colorBlending = {};
@@ -208,7 +335,12 @@ namespace vkInit
 		{
 			std::cout << "Create Pipeline Layout" << std::endl;
 		}
-		vk::PipelineLayout layout = make_pipeline_layout(specification.device, debug);
+		vk::PipelineLayout layout = specification.layout;
+		if (!layout)
+		{
+			layout = make_pipeline_layout(specification.device, specification.setLayouts,
+				specification.pushConstantRanges, specification.maxPushConstantsSize, debug);
+		}
 		pipelineInfo.layout = layout;
 
 
@@ -218,7 +350,12 @@ namespace vkInit
 			std::cout << "Creating renderpass..." << std::endl;
 		}
 
-		vk::RenderPass renderpass = make_renderpass(specification.device, specification.swapchainImageFormat, debug);
+		vk::RenderPass renderpass = specification.renderpass;
+		if (!renderpass)
+		{
+			renderpass = make_renderpass(specification.device, specification.swapchainImageFormat, specification.depthFormat,
+				specification.samples, vk::ImageLayout::ePresentSrcKHR, debug);
+		}
 		pipelineInfo.renderPass = renderpass;
 
 
@@ -232,30 +369,79 @@ namespace vkInit
 			std::cout << "Creating Graphics Pipeline..." << std::endl;
 		}
 
-		vk::Pipeline graphicsPipeline;
-		try
-		{
-			graphicsPipeline = (specification.device.createGraphicsPipeline(nullptr, pipelineInfo)).value;
-		}
-		catch (vk::SystemError err)
-		{
-			if (debug)
+		vkUtil::Expected<vk::Pipeline> graphicsPipeline = vkUtil::vk_call([&]()
 			{
-				std::cout << "Failed to create Graphics Pipeline :/" << std::endl;
-			}
+				vkUtil::StartupProfiler::Scope driverTimer("vkCreateGraphicsPipelines", vkUtil::StartupProfiler::Category::eDriver);
+				return specification.device.createGraphicsPipeline(specification.pipelineCache, pipelineInfo);
+			});
+
+		if (!graphicsPipeline && debug)
+		{
+			std::cout << "Failed to create Graphics Pipeline :/" << std::endl;
 		}
 
 
 		GraphicsPipelineOutBundle output = {};
 		output.layout = layout;
 		output.renderpass = renderpass;
-		output.pipeline = graphicsPipeline;
+		output.pipeline = graphicsPipeline.value();
 		
 		// cleanup
 		specification.device.destroyShaderModule(vertexShader);
 		specification.device.destroyShaderModule(fragmentShader);
 
 
+		return output;
+	}
+
+
+	ComputePipelineOutBundle make_compute_pipeline(ComputePipelineInBundle specification, bool debug)
+	{
+		vkUtil::StartupProfiler::Scope timer("make_compute_pipeline");
+
+		ComputePipelineOutBundle output = {};
+
+		// Pipeline layout
+		output.layout = make_pipeline_layout(specification.device, specification.setLayouts,
+			specification.pushConstantRanges, specification.maxPushConstantsSize, debug);
+
+		if (!output.layout)
+		{
+			return output;
+		}
+
+
+		// Compute shader
+		if (debug)
+		{
+			std::cout << "Creating compute shader module..." << std::endl;
+		}
+
+		vk::ShaderModule computeShader = vkUtil::createModule(specification.computeFilepath, specification.device, debug, specification.computeCode);
+
+		vk::ComputePipelineCreateInfo pipelineInfo = {};
+		pipelineInfo.flags = vk::PipelineCreateFlags();
+		pipelineInfo.stage.flags = vk::PipelineShaderStageCreateFlags();
+		pipelineInfo.stage.stage = vk::ShaderStageFlagBits::eCompute;
+		pipelineInfo.stage.module = computeShader;
+		pipelineInfo.stage.pName = "main";
+		pipelineInfo.layout = output.layout;
+
+		vkUtil::Expected<vk::Pipeline> computePipeline = vkUtil::vk_call([&]()
+			{
+				vkUtil::StartupProfiler::Scope driverTimer("vkCreateComputePipelines", vkUtil::StartupProfiler::Category::eDriver);
+				return specification.device.createComputePipeline(specification.pipelineCache, pipelineInfo);
+			});
+
+		if (!computePipeline && debug)
+		{
+			std::cout << "Failed to create Compute Pipeline :/" << std::endl;
+		}
+		output.pipeline = computePipeline.value();
+
+		// cleanup
+		specification.device.destroyShaderModule(computeShader);
+
 		return output;
 	}
 }
\ No newline at end of file
@@ -0,0 +1,47 @@
+#pragma once
+
+#include "config.h"
+
+namespace vkUtil
+{
+	// Every device supports at least this much, bigger blocks have to be checked against maxPushConstantsSize
+	constexpr uint32_t GUARANTEED_PUSH_CONSTANTS_SIZE = 128;
+
+
+	// Ties a C++ struct to a push constant range, so the range handed to the pipeline layout
+	// and the bytes pushed while recording can't drift apart. The struct has to match the
+	// shader's push_constant block (std430 rules, offsets in multiples of 4).
+	template <typename T>
+	struct PushConstantBlock
+	{
+		static_assert(sizeof(T) % 4 == 0, "Push constant blocks must be a multiple of 4 bytes");
+
+		vk::ShaderStageFlags stages;
+		uint32_t offset = 0;
+
+		vk::PushConstantRange range() const
+		{
+			return vk::PushConstantRange(stages, offset, sizeof(T));
+		}
+
+		void push(vk::CommandBuffer commandBuffer, vk::PipelineLayout layout, const T& value) const
+		{
+			commandBuffer.pushConstants(layout, stages, offset, sizeof(T), &value);
+		}
+	};
+
+
+	// Per draw: object to world transform and material, mirrored in shader.vert
+	struct DrawPushConstants
+	{
+		float model[16];
+		uint32_t materialID;
+		uint32_t padding[3];
+	};
+
+	// materialID telling the shaders to read the transform and material from the object buffer
+	// instead, for indirect draws where nothing can be pushed per draw
+	constexpr uint32_t MATERIAL_FROM_OBJECT_BUFFER = UINT32_MAX;
+
+	static_assert(sizeof(DrawPushConstants) <= GUARANTEED_PUSH_CONSTANTS_SIZE, "Draw push constants must fit everywhere");
+}
\ No newline at end of file
@@ -1,6 +1,9 @@
 #pragma once
 
 #include "config.h"
+#include "result.h"
+
+#include <algorithm>
 
 namespace vkUtil
 {
@@ -9,6 +12,16 @@ namespace vkUtil
 		std::optional<uint32_t> graphicsFamily;
 		std::optional<uint32_t> presentFamily;
 
+		// Dedicated transfer family if the device has one, otherwise another family
+		// that can do transfers, otherwise a second queue of the graphics family
+		std::optional<uint32_t> transferFamily;
+		uint32_t transferQueueIndex = 0;
+
+		// Compute family without graphics if the device has one (async compute),
+		// otherwise a spare queue of the graphics family, otherwise the graphics queue itself
+		std::optional<uint32_t> computeFamily;
+		uint32_t computeQueueIndex = 0;
+
 		bool isComplete()
 		{
 			return graphicsFamily.has_value() && presentFamily.has_value();
@@ -16,7 +29,7 @@ namespace vkUtil
 	};
 
 
-	QueueFamilyIndices findQueueFamilies(vk::PhysicalDevice device, vk::SurfaceKHR surface, bool debug)
+	inline QueueFamilyIndices findQueueFamilies(vk::PhysicalDevice device, vk::SurfaceKHR surface, bool debug)
 	{
 		QueueFamilyIndices indices;
 
@@ -44,7 +57,8 @@ namespace vkUtil
 				}
 			}
 
-			if (device.getSurfaceSupportKHR(idx, surface))
+			// A surface the family can't be asked about is one it can't present to
+			if (vk_call([&]() { return device.getSurfaceSupportKHR(idx, surface); }).value_or(VK_FALSE))
 			{
 				indices.presentFamily = idx;
 
@@ -65,6 +79,78 @@ namespace vkUtil
 		}
 
 
+		// Transfer
+		// prefer a transfer-only family (usually a DMA engine), then any family other than graphics
+		// graphics and compute families always support transfers, even if they don't report the bit
+		for (uint32_t ii = 0; ii < queueFamilies.size(); ii++)
+		{
+			vk::QueueFlags flags = queueFamilies[ii].queueFlags;
+			bool transfer{ static_cast<bool>(flags & (vk::QueueFlagBits::eTransfer | vk::QueueFlagBits::eGraphics | vk::QueueFlagBits::eCompute)) };
+			bool dedicated = !(flags & (vk::QueueFlagBits::eGraphics | vk::QueueFlagBits::eCompute));
+
+			if (transfer && dedicated)
+			{
+				indices.transferFamily = ii;
+				break;
+			}
+
+			if (transfer && !indices.transferFamily.has_value() && ii != indices.graphicsFamily)
+			{
+				indices.transferFamily = ii;
+			}
+		}
+
+		// Fall back to a spare graphics queue, or share the graphics queue if there is only one
+		if (!indices.transferFamily.has_value() && indices.graphicsFamily.has_value())
+		{
+			indices.transferFamily = indices.graphicsFamily;
+			indices.transferQueueIndex = queueFamilies[indices.graphicsFamily.value()].queueCount > 1 ? 1 : 0;
+		}
+
+		if (debug && indices.transferFamily.has_value())
+		{
+			std::cout << "Queue Family " << indices.transferFamily.value() << " (queue "
+				<< indices.transferQueueIndex << ") will be used for transfers.\n";
+		}
+
+
+		// Compute
+		for (uint32_t ii = 0; ii < queueFamilies.size(); ii++)
+		{
+			vk::QueueFlags flags = queueFamilies[ii].queueFlags;
+
+			if ((flags & vk::QueueFlagBits::eCompute) && !(flags & vk::QueueFlagBits::eGraphics))
+			{
+				indices.computeFamily = ii;
+				break;
+			}
+		}
+
+		if (!indices.computeFamily.has_value() && indices.graphicsFamily.has_value())
+		{
+			indices.computeFamily = indices.graphicsFamily;
+		}
+
+		// Don't share a queue with the transfers if the family has another one to spare
+		if (indices.computeFamily.has_value())
+		{
+			uint32_t family = indices.computeFamily.value();
+			uint32_t taken = family == indices.graphicsFamily ? 1 : 0;
+			if (family == indices.transferFamily)
+			{
+				taken = std::max(taken, indices.transferQueueIndex + 1);
+			}
+
+			indices.computeQueueIndex = queueFamilies[family].queueCount > taken ? taken : 0;
+		}
+
+		if (debug && indices.computeFamily.has_value())
+		{
+			std::cout << "Queue Family " << indices.computeFamily.value() << " (queue "
+				<< indices.computeQueueIndex << ") will be used for compute.\n";
+		}
+
+
 		return indices;
 	}
 }
\ No newline at end of file
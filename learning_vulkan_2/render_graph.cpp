@@ -0,0 +1,1027 @@
+#include "render_graph.h"
+#include "startup_profiler.h"
+
+#include <algorithm>
+
+
+namespace vkUtil
+{
+	namespace
+	{
+		const vk::AccessFlags2 WRITE_ACCESS = vk::AccessFlagBits2::eShaderWrite | vk::AccessFlagBits2::eColorAttachmentWrite
+			| vk::AccessFlagBits2::eDepthStencilAttachmentWrite | vk::AccessFlagBits2::eTransferWrite;
+
+		// Only stages and access bits that exist in the original barriers too, so both paths can record them
+		ResourceState use_state(ResourceUse use, bool write, bool reads)
+		{
+			switch (use)
+			{
+			case ResourceUse::eColorAttachment:
+				return { vk::ImageLayout::eColorAttachmentOptimal, vk::PipelineStageFlagBits2::eColorAttachmentOutput,
+					vk::AccessFlagBits2::eColorAttachmentWrite | (reads ? vk::AccessFlagBits2::eColorAttachmentRead : vk::AccessFlagBits2::eNone) };
+
+			// The depth test reads even a freshly cleared depth buffer
+			case ResourceUse::eDepthAttachment:
+				return { vk::ImageLayout::eDepthStencilAttachmentOptimal,
+					vk::PipelineStageFlagBits2::eEarlyFragmentTests | vk::PipelineStageFlagBits2::eLateFragmentTests,
+					vk::AccessFlagBits2::eDepthStencilAttachmentRead | vk::AccessFlagBits2::eDepthStencilAttachmentWrite };
+
+			case ResourceUse::eResolveAttachment:
+				return { vk::ImageLayout::eColorAttachmentOptimal, vk::PipelineStageFlagBits2::eColorAttachmentOutput,
+					vk::AccessFlagBits2::eColorAttachmentWrite };
+
+			case ResourceUse::eSampledFragment:
+				return { vk::ImageLayout::eShaderReadOnlyOptimal, vk::PipelineStageFlagBits2::eFragmentShader, vk::AccessFlagBits2::eShaderRead };
+
+			case ResourceUse::eSampledCompute:
+				return { vk::ImageLayout::eShaderReadOnlyOptimal, vk::PipelineStageFlagBits2::eComputeShader, vk::AccessFlagBits2::eShaderRead };
+
+			case ResourceUse::eStorage:
+				return { vk::ImageLayout::eGeneral, vk::PipelineStageFlagBits2::eComputeShader,
+					write ? vk::AccessFlagBits2::eShaderWrite : vk::AccessFlagBits2::eShaderRead };
+
+			case ResourceUse::eTransfer:
+				return { write ? vk::ImageLayout::eTransferDstOptimal : vk::ImageLayout::eTransferSrcOptimal, vk::PipelineStageFlagBits2::eAllTransfer,
+					write ? vk::AccessFlagBits2::eTransferWrite : vk::AccessFlagBits2::eTransferRead };
+
+			case ResourceUse::eIndirect:
+				return { vk::ImageLayout::eUndefined, vk::PipelineStageFlagBits2::eDrawIndirect, vk::AccessFlagBits2::eIndirectCommandRead };
+			}
+
+			return {};
+		}
+
+		// Non-dispatchable handles are pointers on 64 bit platforms and integers on 32 bit ones
+		template <typename Handle>
+		uint64_t handle_bits(Handle handle)
+		{
+			return (uint64_t)(typename Handle::CType)(handle);
+		}
+
+		vk::PipelineStageFlags original_stages(vk::PipelineStageFlags2 stages)
+		{
+			return vk::PipelineStageFlags(static_cast<VkPipelineStageFlags>(static_cast<VkPipelineStageFlags2>(stages)));
+		}
+
+		vk::AccessFlags original_access(vk::AccessFlags2 access)
+		{
+			return vk::AccessFlags(static_cast<VkAccessFlags>(static_cast<VkAccessFlags2>(access)));
+		}
+
+		vk::ImageUsageFlags image_usage(ResourceUse use, bool write)
+		{
+			switch (use)
+			{
+			case ResourceUse::eColorAttachment:
+			case ResourceUse::eResolveAttachment:
+				return vk::ImageUsageFlagBits::eColorAttachment;
+
+			case ResourceUse::eDepthAttachment:
+				return vk::ImageUsageFlagBits::eDepthStencilAttachment;
+
+			case ResourceUse::eSampledFragment:
+			case ResourceUse::eSampledCompute:
+				return vk::ImageUsageFlagBits::eSampled;
+
+			case ResourceUse::eStorage:
+				return vk::ImageUsageFlagBits::eStorage;
+
+			case ResourceUse::eTransfer:
+				return write ? vk::ImageUsageFlagBits::eTransferDst : vk::ImageUsageFlagBits::eTransferSrc;
+
+			default:
+				return vk::ImageUsageFlags();
+			}
+		}
+
+		// Shaders read intermediate buffers as storage buffers, whether a pass calls it sampling or not
+		vk::BufferUsageFlags buffer_usage(ResourceUse use, bool write)
+		{
+			switch (use)
+			{
+			case ResourceUse::eSampledFragment:
+			case ResourceUse::eSampledCompute:
+			case ResourceUse::eStorage:
+				return vk::BufferUsageFlagBits::eStorageBuffer;
+
+			case ResourceUse::eTransfer:
+				return write ? vk::BufferUsageFlagBits::eTransferDst : vk::BufferUsageFlagBits::eTransferSrc;
+
+			case ResourceUse::eIndirect:
+				return vk::BufferUsageFlagBits::eIndirectBuffer;
+
+			default:
+				return vk::BufferUsageFlags();
+			}
+		}
+	}
+
+
+	PassBuilder& PassBuilder::color(GraphResource image, std::optional<vk::ClearValue> clear)
+	{
+		graph.add_use(pass, image, ResourceUse::eColorAttachment, true, clear);
+		graph.passes[pass].colors.push_back(image);
+		graph.passes[pass].resolves.push_back(NO_GRAPH_RESOURCE);
+		return *this;
+	}
+
+
+	PassBuilder& PassBuilder::resolve(GraphResource image)
+	{
+		graph.add_use(pass, image, ResourceUse::eResolveAttachment, true, std::nullopt);
+		graph.passes[pass].resolves.back() = image;
+		return *this;
+	}
+
+
+	PassBuilder& PassBuilder::depth(GraphResource image, std::optional<vk::ClearValue> clear)
+	{
+		graph.add_use(pass, image, ResourceUse::eDepthAttachment, true, clear);
+		graph.passes[pass].depth = image;
+		return *this;
+	}
+
+
+	PassBuilder& PassBuilder::read(GraphResource resource, ResourceUse use)
+	{
+		graph.add_use(pass, resource, use, false, std::nullopt);
+		return *this;
+	}
+
+
+	PassBuilder& PassBuilder::write(GraphResource resource, ResourceUse use)
+	{
+		graph.add_use(pass, resource, use, true, std::nullopt);
+		return *this;
+	}
+
+
+	PassBuilder& PassBuilder::side_effects()
+	{
+		graph.passes[pass].sideEffects = true;
+		return *this;
+	}
+
+
+	void RenderGraph::init(vk::Device device, const DeviceContext* deviceContext, DeletionQueue* deletionQueue, bool debug)
+	{
+		this->device = device;
+		this->deletionQueue = deletionQueue;
+		this->synchronization2 = deviceContext->supports_synchronization2();
+		this->debug = debug;
+		transientPool.init(device, deviceContext, deletionQueue, debug);
+
+		if (debug)
+		{
+			std::cout << (synchronization2 ? "Render graph records synchronization2 barriers\n"
+				: "No synchronization2, the render graph records the original barriers\n");
+		}
+	}
+
+
+	void RenderGraph::reset()
+	{
+		resources.clear();
+		passes.clear();
+		order.clear();
+		finalBarriers = BarrierBatch();
+	}
+
+
+	GraphResource RenderGraph::import_image(const char* name, const graphImageInput& input)
+	{
+		Resource resource;
+		resource.name = name;
+		resource.isImage = true;
+		resource.image = input;
+		resource.exported = input.finalLayout != vk::ImageLayout::eUndefined;
+		resource.transient = false;
+		resources.push_back(resource);
+
+		return static_cast<GraphResource>(resources.size() - 1);
+	}
+
+
+	GraphResource RenderGraph::import_buffer(const char* name, const graphBufferInput& input)
+	{
+		Resource resource;
+		resource.name = name;
+		resource.isImage = false;
+		resource.buffer = input;
+		resource.exported = input.exported;
+		resource.transient = false;
+		resources.push_back(resource);
+
+		return static_cast<GraphResource>(resources.size() - 1);
+	}
+
+
+	GraphResource RenderGraph::create_image(const char* name, const transientImageInput& input)
+	{
+		Resource resource;
+		resource.name = name;
+		resource.isImage = true;
+		resource.image.image = nullptr;
+		resource.image.view = nullptr;
+		resource.image.format = input.format;
+		resource.image.extent = input.extent;
+		resource.image.samples = input.samples;
+		resource.image.aspect = input.aspect;
+		resource.exported = false;
+		resource.transient = true;
+		resources.push_back(resource);
+
+		return static_cast<GraphResource>(resources.size() - 1);
+	}
+
+
+	GraphResource RenderGraph::create_buffer(const char* name, vk::DeviceSize size)
+	{
+		Resource resource;
+		resource.name = name;
+		resource.isImage = false;
+		resource.buffer.buffer = nullptr;
+		resource.buffer.size = size;
+		resource.exported = false;
+		resource.transient = true;
+		resources.push_back(resource);
+
+		return static_cast<GraphResource>(resources.size() - 1);
+	}
+
+
+	PassBuilder RenderGraph::add_pass(const char* name, std::function<void(vk::CommandBuffer)> record)
+	{
+		Pass pass;
+		pass.name = name;
+		pass.record = record;
+		passes.push_back(pass);
+
+		return PassBuilder(*this, static_cast<uint32_t>(passes.size() - 1));
+	}
+
+
+	void RenderGraph::add_use(uint32_t pass, GraphResource resource, ResourceUse use, bool write, std::optional<vk::ClearValue> clear)
+	{
+		// Storage and transfer writes may only touch part of the resource, so they keep its contents
+		bool overwrites = clear.has_value() || use == ResourceUse::eResolveAttachment;
+
+		Use passUse;
+		passUse.resource = resource;
+		passUse.use = use;
+		passUse.write = write;
+		passUse.reads = !write || !overwrites;
+		passUse.clear = clear;
+		passUse.state = use_state(use, write, passUse.reads);
+		passes[pass].uses.push_back(passUse);
+	}
+
+
+	std::vector<bool> RenderGraph::find_live_passes() const
+	{
+		// Passes that read what each pass reads, in declaration order
+		std::vector<std::vector<uint32_t>> producers(passes.size());
+		std::vector<uint32_t> lastWriter(resources.size(), UINT32_MAX);
+
+		for (uint32_t ii = 0; ii < passes.size(); ii++)
+		{
+			for (const Use& use : passes[ii].uses)
+			{
+				if (use.reads && lastWriter[use.resource] != UINT32_MAX)
+				{
+					producers[ii].push_back(lastWriter[use.resource]);
+				}
+			}
+
+			for (const Use& use : passes[ii].uses)
+			{
+				if (use.write)
+				{
+					lastWriter[use.resource] = ii;
+				}
+			}
+		}
+
+		// Whatever leaves the graph is needed, and so is everything it was made from
+		std::vector<bool> live(passes.size(), false);
+		for (uint32_t ii = 0; ii < passes.size(); ii++)
+		{
+			live[ii] = passes[ii].sideEffects;
+		}
+
+		for (GraphResource rr = 0; rr < resources.size(); rr++)
+		{
+			if (resources[rr].exported && lastWriter[rr] != UINT32_MAX)
+			{
+				live[lastWriter[rr]] = true;
+			}
+		}
+
+		// Producers are declared before their consumers, so one backwards sweep reaches them all
+		for (size_t ii = passes.size(); ii-- > 0;)
+		{
+			if (live[ii])
+			{
+				for (uint32_t producer : producers[ii])
+				{
+					live[producer] = true;
+				}
+			}
+		}
+
+		return live;
+	}
+
+
+	void RenderGraph::order_passes(const std::vector<bool>& live)
+	{
+		// Read after write, write after write and write after read, between live passes
+		std::vector<std::vector<uint32_t>> dependencies(passes.size());
+		std::vector<uint32_t> lastWriter(resources.size(), UINT32_MAX);
+		std::vector<std::vector<uint32_t>> readers(resources.size());
+		std::vector<uint32_t> remaining;
+
+		for (uint32_t ii = 0; ii < passes.size(); ii++)
+		{
+			if (!live[ii])
+			{
+				continue;
+			}
+			remaining.push_back(ii);
+
+			for (const Use& use : passes[ii].uses)
+			{
+				if (lastWriter[use.resource] != UINT32_MAX && lastWriter[use.resource] != ii)
+				{
+					dependencies[ii].push_back(lastWriter[use.resource]);
+				}
+
+				if (use.write)
+				{
+					for (uint32_t reader : readers[use.resource])
+					{
+						if (reader != ii)
+						{
+							dependencies[ii].push_back(reader);
+						}
+					}
+				}
+			}
+
+			for (const Use& use : passes[ii].uses)
+			{
+				if (use.write)
+				{
+					lastWriter[use.resource] = ii;
+					readers[use.resource].clear();
+				}
+				else
+				{
+					readers[use.resource].push_back(ii);
+				}
+			}
+		}
+
+		// Of the passes whose dependencies have run, the one whose inputs have been ready the longest goes first:
+		// the more work between a producer and its consumer, the less the consumer's barrier stalls.
+		// The earliest declared remaining pass is always ready, its dependencies are declared before it.
+		std::vector<size_t> position(passes.size(), SIZE_MAX);
+		order.clear();
+
+		while (!remaining.empty())
+		{
+			size_t best = SIZE_MAX;
+			size_t bestReadyAt = 0;
+
+			for (size_t rr = 0; rr < remaining.size(); rr++)
+			{
+				bool ready = true;
+				size_t readyAt = 0;
+
+				for (uint32_t dependency : dependencies[remaining[rr]])
+				{
+					if (position[dependency] == SIZE_MAX)
+					{
+						ready = false;
+						break;
+					}
+					readyAt = std::max(readyAt, position[dependency] + 1);
+				}
+
+				if (ready && (best == SIZE_MAX || readyAt < bestReadyAt))
+				{
+					best = rr;
+					bestReadyAt = readyAt;
+				}
+			}
+
+			position[remaining[best]] = order.size();
+			order.push_back(remaining[best]);
+			remaining.erase(remaining.begin() + best);
+		}
+	}
+
+
+	void RenderGraph::realize_transients()
+	{
+		std::vector<TransientRequest> requests;
+		transientIndex.assign(resources.size(), UINT32_MAX);
+
+		for (size_t position = 0; position < order.size(); position++)
+		{
+			for (const Use& use : passes[order[position]].uses)
+			{
+				const Resource& resource = resources[use.resource];
+				if (!resource.transient)
+				{
+					continue;
+				}
+
+				if (transientIndex[use.resource] == UINT32_MAX)
+				{
+					TransientRequest request = {};
+					request.isImage = resource.isImage;
+					request.format = resource.image.format;
+					request.extent = resource.image.extent;
+					request.samples = resource.image.samples;
+					request.aspect = resource.image.aspect;
+					request.size = resource.buffer.size;
+					request.firstUse = static_cast<uint32_t>(position);
+					requests.push_back(request);
+					transientIndex[use.resource] = static_cast<uint32_t>(requests.size() - 1);
+				}
+
+				TransientRequest& request = requests[transientIndex[use.resource]];
+				request.lastUse = static_cast<uint32_t>(position);
+				if (resource.isImage)
+				{
+					request.imageUsage |= image_usage(use.use, use.write);
+				}
+				else
+				{
+					request.bufferUsage |= buffer_usage(use.use, use.write);
+				}
+			}
+		}
+
+		// Framebuffers of the old views go before any are made from the new ones, which may reuse the handles
+		std::vector<vk::ImageView> oldViews = transientPool.views();
+		if (transientPool.realize(requests))
+		{
+			for (vk::ImageView view : oldViews)
+			{
+				forget_view(view);
+			}
+		}
+
+		for (GraphResource rr = 0; rr < resources.size(); rr++)
+		{
+			if (transientIndex[rr] == UINT32_MAX)
+			{
+				continue;
+			}
+
+			if (resources[rr].isImage)
+			{
+				resources[rr].image.image = transientPool.image(transientIndex[rr]);
+				resources[rr].image.view = transientPool.view(transientIndex[rr]);
+			}
+			else
+			{
+				resources[rr].buffer.buffer = transientPool.buffer(transientIndex[rr]);
+			}
+		}
+	}
+
+
+	void RenderGraph::add_barrier(BarrierBatch& batch, GraphResource resource, vk::ImageLayout oldLayout, const ResourceState& to,
+		vk::PipelineStageFlags2 srcStages, vk::AccessFlags2 srcAccess)
+	{
+		const Resource& target = resources[resource];
+
+		if (target.isImage)
+		{
+			vk::ImageMemoryBarrier2 barrier = {};
+			barrier.srcStageMask = srcStages;
+			barrier.srcAccessMask = srcAccess;
+			barrier.dstStageMask = to.stages;
+			barrier.dstAccessMask = to.access;
+			barrier.oldLayout = oldLayout;
+			barrier.newLayout = to.layout;
+			barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			barrier.image = target.image.image;
+			barrier.subresourceRange = vk::ImageSubresourceRange(target.image.aspect, 0, VK_REMAINING_MIP_LEVELS, 0, VK_REMAINING_ARRAY_LAYERS);
+			batch.images.push_back(barrier);
+		}
+		else
+		{
+			vk::BufferMemoryBarrier2 barrier = {};
+			barrier.srcStageMask = srcStages;
+			barrier.srcAccessMask = srcAccess;
+			barrier.dstStageMask = to.stages;
+			barrier.dstAccessMask = to.access;
+			barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			barrier.buffer = target.buffer.buffer;
+			barrier.offset = 0;
+			barrier.size = target.buffer.size;
+			batch.buffers.push_back(barrier);
+		}
+	}
+
+
+	ResourceState RenderGraph::read_run(size_t position, GraphResource resource, const ResourceState& first) const
+	{
+		ResourceState run = first;
+
+		for (size_t pp = position + 1; pp < order.size(); pp++)
+		{
+			for (const Use& use : passes[order[pp]].uses)
+			{
+				if (use.resource != resource)
+				{
+					continue;
+				}
+
+				if (use.write || use.state.layout != first.layout)
+				{
+					return run;
+				}
+
+				run.stages |= use.state.stages;
+				run.access |= use.state.access;
+			}
+		}
+
+		return run;
+	}
+
+
+	const RenderGraph::Use* RenderGraph::next_use(size_t position, GraphResource resource) const
+	{
+		for (size_t pp = position + 1; pp < order.size(); pp++)
+		{
+			for (const Use& use : passes[order[pp]].uses)
+			{
+				if (use.resource == resource)
+				{
+					return &use;
+				}
+			}
+		}
+
+		return nullptr;
+	}
+
+
+	void RenderGraph::make_render_pass(size_t position, const std::vector<Tracked>& tracked)
+	{
+		Pass& pass = passes[order[position]];
+		pass.renderPass = nullptr;
+		pass.framebuffer = nullptr;
+		pass.clearValues.clear();
+
+		if (pass.colors.empty() && pass.depth == NO_GRAPH_RESOURCE)
+		{
+			return;
+		}
+
+		// Colors, then their resolve targets, then depth, the same order as vkInit::make_renderpass
+		// so the pipelines made against that render pass are compatible with this one
+		std::vector<GraphResource> attachments = pass.colors;
+		for (GraphResource resolve : pass.resolves)
+		{
+			if (resolve != NO_GRAPH_RESOURCE)
+			{
+				attachments.push_back(resolve);
+			}
+		}
+		if (pass.depth != NO_GRAPH_RESOURCE)
+		{
+			attachments.push_back(pass.depth);
+		}
+
+		std::vector<vk::AttachmentDescription> descriptions;
+		std::vector<uint32_t> key;
+		for (GraphResource attachment : attachments)
+		{
+			const Use& use = *std::find_if(pass.uses.begin(), pass.uses.end(), [&](const Use& candidate) { return candidate.resource == attachment; });
+			const graphImageInput& image = resources[attachment].image;
+
+			vk::AttachmentDescription description = {};
+			description.flags = vk::AttachmentDescriptionFlags();
+			description.format = image.format;
+			description.samples = image.samples;
+
+			// Load only what is there and wanted, store only what somebody reads later
+			if (use.clear)
+			{
+				description.loadOp = vk::AttachmentLoadOp::eClear;
+			}
+			else if (use.reads && tracked[attachment].hasContents)
+			{
+				description.loadOp = vk::AttachmentLoadOp::eLoad;
+			}
+			else
+			{
+				description.loadOp = vk::AttachmentLoadOp::eDontCare;
+			}
+
+			const Use* next = next_use(position, attachment);
+			bool consumed = next ? next->reads : resources[attachment].exported;
+			description.storeOp = consumed ? vk::AttachmentStoreOp::eStore : vk::AttachmentStoreOp::eDontCare;
+			description.stencilLoadOp = vk::AttachmentLoadOp::eDontCare;
+			description.stencilStoreOp = vk::AttachmentStoreOp::eDontCare;
+
+			// The graph's barriers do the transitions, the render pass leaves the layout alone
+			description.initialLayout = use.state.layout;
+			description.finalLayout = use.state.layout;
+			descriptions.push_back(description);
+
+			key.insert(key.end(), {
+				static_cast<uint32_t>(description.format), static_cast<uint32_t>(description.samples),
+				static_cast<uint32_t>(description.loadOp), static_cast<uint32_t>(description.storeOp),
+				static_cast<uint32_t>(description.initialLayout)
+			});
+
+			pass.clearValues.push_back(use.clear.value_or(vk::ClearValue()));
+		}
+
+		std::vector<vk::AttachmentReference> colorRefs;
+		std::vector<vk::AttachmentReference> resolveRefs;
+		uint32_t nextResolve = static_cast<uint32_t>(pass.colors.size());
+		bool anyResolve = false;
+		for (size_t cc = 0; cc < pass.colors.size(); cc++)
+		{
+			colorRefs.push_back(vk::AttachmentReference(static_cast<uint32_t>(cc), vk::ImageLayout::eColorAttachmentOptimal));
+
+			bool resolved = pass.resolves[cc] != NO_GRAPH_RESOURCE;
+			anyResolve |= resolved;
+			resolveRefs.push_back(vk::AttachmentReference(resolved ? nextResolve++ : VK_ATTACHMENT_UNUSED, vk::ImageLayout::eColorAttachmentOptimal));
+			key.push_back(resolveRefs.back().attachment);
+		}
+		vk::AttachmentReference depthRef(static_cast<uint32_t>(attachments.size() - 1), vk::ImageLayout::eDepthStencilAttachmentOptimal);
+		key.push_back(pass.depth != NO_GRAPH_RESOURCE);
+
+		std::map<std::vector<uint32_t>, vk::RenderPass>::iterator cachedPass = renderPassCache.find(key);
+		if (cachedPass != renderPassCache.end())
+		{
+			pass.renderPass = cachedPass->second;
+		}
+		else
+		{
+			vk::SubpassDescription subpass = {};
+			subpass.flags = vk::SubpassDescriptionFlags();
+			subpass.pipelineBindPoint = vk::PipelineBindPoint::eGraphics;
+			subpass.colorAttachmentCount = static_cast<uint32_t>(colorRefs.size());
+			subpass.pColorAttachments = colorRefs.data();
+			subpass.pResolveAttachments = anyResolve ? resolveRefs.data() : nullptr;
+			subpass.pDepthStencilAttachment = pass.depth != NO_GRAPH_RESOURCE ? &depthRef : nullptr;
+
+			vk::RenderPassCreateInfo renderpassInfo = {};
+			renderpassInfo.flags = vk::RenderPassCreateFlags();
+			renderpassInfo.attachmentCount = static_cast<uint32_t>(descriptions.size());
+			renderpassInfo.pAttachments = descriptions.data();
+			renderpassInfo.subpassCount = 1;
+			renderpassInfo.pSubpasses = &subpass;
+
+			vkUtil::Expected<vk::RenderPass> renderPass = vkUtil::vk_call([&]()
+			{
+				StartupProfiler::Scope driverTimer("vkCreateRenderPass", StartupProfiler::Category::eDriver);
+				return device.createRenderPass(renderpassInfo);
+			});
+			if (!renderPass)
+			{
+				if (debug)
+				{
+					std::cout << "Failed to create render pass for \"" << pass.name << "\" :/" << std::endl;
+				}
+				return;
+			}
+			pass.renderPass = renderPass.value();
+			renderPassCache[key] = pass.renderPass;
+		}
+
+		pass.extent = resources[attachments[0]].image.extent;
+
+		std::vector<uint64_t> framebufferKey = { handle_bits(pass.renderPass), pass.extent.width, pass.extent.height };
+		std::vector<vk::ImageView> views;
+		for (GraphResource attachment : attachments)
+		{
+			views.push_back(resources[attachment].image.view);
+			framebufferKey.push_back(handle_bits(views.back()));
+		}
+
+		std::map<std::vector<uint64_t>, vk::Framebuffer>::iterator cachedFramebuffer = framebufferCache.find(framebufferKey);
+		if (cachedFramebuffer != framebufferCache.end())
+		{
+			pass.framebuffer = cachedFramebuffer->second;
+			return;
+		}
+
+		vk::FramebufferCreateInfo framebufferInfo = {};
+		framebufferInfo.flags = vk::FramebufferCreateFlags();
+		framebufferInfo.renderPass = pass.renderPass;
+		framebufferInfo.attachmentCount = static_cast<uint32_t>(views.size());
+		framebufferInfo.pAttachments = views.data();
+		framebufferInfo.width = pass.extent.width;
+		framebufferInfo.height = pass.extent.height;
+		framebufferInfo.layers = 1;
+
+		vkUtil::Expected<vk::Framebuffer> framebuffer = vkUtil::vk_call([&]()
+		{
+			StartupProfiler::Scope driverTimer("vkCreateFramebuffer", StartupProfiler::Category::eDriver);
+			return device.createFramebuffer(framebufferInfo);
+		});
+		if (!framebuffer)
+		{
+			if (debug)
+			{
+				std::cout << "Failed to create framebuffer for \"" << pass.name << "\" :/" << std::endl;
+			}
+			return;
+		}
+		pass.framebuffer = framebuffer.value();
+		framebufferCache[framebufferKey] = pass.framebuffer;
+	}
+
+
+	void RenderGraph::compile()
+	{
+		std::vector<bool> live = find_live_passes();
+		culledPasses = static_cast<uint32_t>(std::count(live.begin(), live.end(), false));
+		order_passes(live);
+		realize_transients();
+
+		// The resource that had the memory of each intermediate before it, its accesses must finish first
+		std::vector<GraphResource> aliasedAfter(resources.size(), NO_GRAPH_RESOURCE);
+		for (GraphResource rr = 0; rr < resources.size(); rr++)
+		{
+			uint32_t previous = transientIndex[rr] == UINT32_MAX ? UINT32_MAX : transientPool.aliased_after(transientIndex[rr]);
+			if (previous == UINT32_MAX)
+			{
+				continue;
+			}
+
+			for (GraphResource other = 0; other < resources.size(); other++)
+			{
+				if (transientIndex[other] == previous)
+				{
+					aliasedAfter[rr] = other;
+				}
+			}
+		}
+		std::vector<bool> started(resources.size(), false);
+
+		std::vector<Tracked> tracked(resources.size());
+		for (GraphResource rr = 0; rr < resources.size(); rr++)
+		{
+			const ResourceState& initial = resources[rr].isImage ? resources[rr].image.initial : resources[rr].buffer.initial;
+
+			tracked[rr].layout = initial.layout;
+			tracked[rr].writeStages = initial.stages;
+			tracked[rr].writeAccess = initial.access;
+			tracked[rr].readStages = vk::PipelineStageFlagBits2::eNone;
+			tracked[rr].visibleStages = vk::PipelineStageFlagBits2::eNone;
+			tracked[rr].visibleAccess = vk::AccessFlagBits2::eNone;
+			tracked[rr].hasContents = !resources[rr].isImage || initial.layout != vk::ImageLayout::eUndefined;
+		}
+
+		barrierBatches = 0;
+		for (size_t position = 0; position < order.size(); position++)
+		{
+			Pass& pass = passes[order[position]];
+			pass.barriers = BarrierBatch();
+
+			// Load ops depend on the contents before this pass
+			make_render_pass(position, tracked);
+
+			for (const Use& use : pass.uses)
+			{
+				Tracked& state = tracked[use.resource];
+
+				// Aliasing barrier: the first use of an intermediate waits for the last accesses to its memory
+				if (!started[use.resource] && aliasedAfter[use.resource] != NO_GRAPH_RESOURCE)
+				{
+					const Tracked& previous = tracked[aliasedAfter[use.resource]];
+					state.writeStages = previous.writeStages | previous.readStages;
+					state.writeAccess = previous.writeAccess;
+				}
+				started[use.resource] = true;
+
+				bool layoutChange = resources[use.resource].isImage && use.state.layout != state.layout;
+
+				if (use.write)
+				{
+					// Write after write and write after read. Contents the pass overwrites are discarded
+					// with an undefined old layout, which can save the driver a decompression.
+					vk::PipelineStageFlags2 srcStages = state.writeStages | state.readStages;
+					if (srcStages || layoutChange)
+					{
+						add_barrier(pass.barriers, use.resource, use.reads ? state.layout : vk::ImageLayout::eUndefined,
+							use.state, srcStages, state.writeAccess);
+					}
+
+					state.writeStages = use.state.stages;
+					state.writeAccess = use.state.access & WRITE_ACCESS;
+					state.readStages = vk::PipelineStageFlagBits2::eNone;
+					state.visibleStages = use.state.stages;
+					state.visibleAccess = use.state.access;
+					state.hasContents = true;
+				}
+				else
+				{
+					// Read after write, one barrier for this read and the ones after it in the same layout
+					bool visible = (state.visibleStages & use.state.stages) == use.state.stages
+						&& (state.visibleAccess & use.state.access) == use.state.access;
+
+					if ((state.writeAccess && !visible) || layoutChange)
+					{
+						ResourceState run = read_run(position, use.resource, use.state);
+						vk::PipelineStageFlags2 srcStages = state.writeStages | (layoutChange ? state.readStages : vk::PipelineStageFlags2());
+						add_barrier(pass.barriers, use.resource, state.layout, run, srcStages, state.writeAccess);
+
+						state.visibleStages = run.stages;
+						state.visibleAccess = run.access;
+					}
+
+					state.readStages |= use.state.stages;
+				}
+
+				state.layout = use.state.layout;
+			}
+
+			if (!pass.barriers.images.empty() || !pass.barriers.buffers.empty())
+			{
+				barrierBatches++;
+			}
+		}
+
+		// Whoever reads an exported image after the graph synchronizes with a semaphore, only its layout is left to fix
+		finalBarriers = BarrierBatch();
+		for (GraphResource rr = 0; rr < resources.size(); rr++)
+		{
+			if (resources[rr].isImage && resources[rr].exported && tracked[rr].layout != resources[rr].image.finalLayout)
+			{
+				ResourceState after;
+				after.layout = resources[rr].image.finalLayout;
+				add_barrier(finalBarriers, rr, tracked[rr].layout, after, tracked[rr].writeStages | tracked[rr].readStages, tracked[rr].writeAccess);
+			}
+		}
+
+		if (!finalBarriers.images.empty())
+		{
+			barrierBatches++;
+		}
+
+		if (debug && !logged)
+		{
+			std::cout << "Render graph: " << order.size() << " passes, " << culledPasses << " culled, " << barrierBatches << " barrier batches\n";
+			for (uint32_t passIdx : order)
+			{
+				std::cout << "\t" << passes[passIdx].name << "\n";
+			}
+			logged = true;
+		}
+	}
+
+
+	void RenderGraph::record_barriers(vk::CommandBuffer commandBuffer, const BarrierBatch& batch)
+	{
+		if (batch.images.empty() && batch.buffers.empty())
+		{
+			return;
+		}
+
+		if (synchronization2)
+		{
+			vk::DependencyInfo dependencyInfo = {};
+			dependencyInfo.bufferMemoryBarrierCount = static_cast<uint32_t>(batch.buffers.size());
+			dependencyInfo.pBufferMemoryBarriers = batch.buffers.data();
+			dependencyInfo.imageMemoryBarrierCount = static_cast<uint32_t>(batch.images.size());
+			dependencyInfo.pImageMemoryBarriers = batch.images.data();
+			commandBuffer.pipelineBarrier2(dependencyInfo);
+			return;
+		}
+
+		// Same batch through one vkCmdPipelineBarrier, the stage masks are shared by every barrier in it
+		vk::PipelineStageFlags srcStages;
+		vk::PipelineStageFlags dstStages;
+		std::vector<vk::ImageMemoryBarrier> imageBarriers;
+		std::vector<vk::BufferMemoryBarrier> bufferBarriers;
+
+		for (const vk::ImageMemoryBarrier2& barrier : batch.images)
+		{
+			srcStages |= original_stages(barrier.srcStageMask);
+			dstStages |= original_stages(barrier.dstStageMask);
+			imageBarriers.push_back(vk::ImageMemoryBarrier(
+				original_access(barrier.srcAccessMask), original_access(barrier.dstAccessMask), barrier.oldLayout, barrier.newLayout,
+				VK_QUEUE_FAMILY_IGNORED, VK_QUEUE_FAMILY_IGNORED, barrier.image, barrier.subresourceRange
+			));
+		}
+
+		for (const vk::BufferMemoryBarrier2& barrier : batch.buffers)
+		{
+			srcStages |= original_stages(barrier.srcStageMask);
+			dstStages |= original_stages(barrier.dstStageMask);
+			bufferBarriers.push_back(vk::BufferMemoryBarrier(
+				original_access(barrier.srcAccessMask), original_access(barrier.dstAccessMask),
+				VK_QUEUE_FAMILY_IGNORED, VK_QUEUE_FAMILY_IGNORED, barrier.buffer, barrier.offset, barrier.size
+			));
+		}
+
+		// An empty first scope waits for nothing, an empty second scope blocks nothing
+		if (!srcStages)
+		{
+			srcStages = vk::PipelineStageFlagBits::eTopOfPipe;
+		}
+		if (!dstStages)
+		{
+			dstStages = vk::PipelineStageFlagBits::eBottomOfPipe;
+		}
+
+		commandBuffer.pipelineBarrier(srcStages, dstStages, vk::DependencyFlags(),
+			0, nullptr,
+			static_cast<uint32_t>(bufferBarriers.size()), bufferBarriers.data(),
+			static_cast<uint32_t>(imageBarriers.size()), imageBarriers.data());
+	}
+
+
+	void RenderGraph::execute(vk::CommandBuffer commandBuffer)
+	{
+		for (uint32_t passIdx : order)
+		{
+			Pass& pass = passes[passIdx];
+			record_barriers(commandBuffer, pass.barriers);
+
+			if (pass.renderPass)
+			{
+				vk::RenderPassBeginInfo renderPassInfo = {};
+				renderPassInfo.renderPass = pass.renderPass;
+				renderPassInfo.framebuffer = pass.framebuffer;
+				renderPassInfo.renderArea.offset.x = 0;
+				renderPassInfo.renderArea.offset.y = 0;
+				renderPassInfo.renderArea.extent = pass.extent;
+				renderPassInfo.clearValueCount = static_cast<uint32_t>(pass.clearValues.size());
+				renderPassInfo.pClearValues = pass.clearValues.data();
+
+				commandBuffer.beginRenderPass(&renderPassInfo, vk::SubpassContents::eInline);
+				pass.record(commandBuffer);
+				commandBuffer.endRenderPass();
+			}
+			else
+			{
+				pass.record(commandBuffer);
+			}
+		}
+
+		record_barriers(commandBuffer, finalBarriers);
+	}
+
+
+	void RenderGraph::forget_view(vk::ImageView view)
+	{
+		uint64_t bits = handle_bits(view);
+
+		for (std::map<std::vector<uint64_t>, vk::Framebuffer>::iterator it = framebufferCache.begin(); it != framebufferCache.end();)
+		{
+			// the key is the render pass, width, height and then the views
+			if (std::find(it->first.begin() + 3, it->first.end(), bits) != it->first.end())
+			{
+				if (deletionQueue)
+				{
+					deletionQueue->retire(it->second);
+				}
+				else
+				{
+					device.destroyFramebuffer(it->second);
+				}
+				it = framebufferCache.erase(it);
+			}
+			else
+			{
+				it++;
+			}
+		}
+	}
+
+
+	void RenderGraph::destroy()
+	{
+		for (const auto& framebuffer : framebufferCache)
+		{
+			device.destroyFramebuffer(framebuffer.second);
+		}
+		framebufferCache.clear();
+
+		for (const auto& renderPass : renderPassCache)
+		{
+			device.destroyRenderPass(renderPass.second);
+		}
+		renderPassCache.clear();
+
+		transientPool.destroy();
+		reset();
+	}
+}
\ No newline at end of file
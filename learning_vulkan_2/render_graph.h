@@ -0,0 +1,267 @@
+#pragma once
+
+#include "config.h"
+#include "transient_pool.h"
+
+#include <functional>
+#include <map>
+
+namespace vkUtil
+{
+	// Handle of an image or buffer in the render graph, valid until the graph is reset
+	using GraphResource = uint32_t;
+
+	constexpr GraphResource NO_GRAPH_RESOURCE = UINT32_MAX;
+
+
+	// How a pass uses a resource, with whether it reads or writes it this decides
+	// the layout, stages and access of its barriers
+	enum class ResourceUse
+	{
+		eColorAttachment,
+		eDepthAttachment,
+		eResolveAttachment,
+		eSampledFragment,
+		eSampledCompute,
+		eStorage,   // compute shader
+		eTransfer,
+		eIndirect
+	};
+
+
+	// What a resource looks like between two passes
+	struct ResourceState
+	{
+		vk::ImageLayout layout = vk::ImageLayout::eUndefined;
+		vk::PipelineStageFlags2 stages = vk::PipelineStageFlagBits2::eNone;
+		vk::AccessFlags2 access = vk::AccessFlagBits2::eNone;
+	};
+
+	struct graphImageInput
+	{
+		vk::Image image;
+		vk::ImageView view;
+		vk::Format format;
+		vk::Extent2D extent;
+		vk::SampleCountFlagBits samples = vk::SampleCountFlagBits::e1;
+		vk::ImageAspectFlags aspect = vk::ImageAspectFlagBits::eColor;
+
+		// State on entry: the stages and access of the last write before the graph.
+		// An undefined layout means the contents don't matter.
+		ResourceState initial;
+
+		// Layout the graph leaves the image in, undefined if nothing after the graph reads it
+		vk::ImageLayout finalLayout = vk::ImageLayout::eUndefined;
+	};
+
+	// An image only passes of the graph use, created by the graph with the usage its passes need
+	struct transientImageInput
+	{
+		vk::Format format;
+		vk::Extent2D extent;
+		vk::SampleCountFlagBits samples = vk::SampleCountFlagBits::e1;
+		vk::ImageAspectFlags aspect = vk::ImageAspectFlagBits::eColor;
+	};
+
+	struct graphBufferInput
+	{
+		vk::Buffer buffer;
+		vk::DeviceSize size = VK_WHOLE_SIZE;
+		ResourceState initial;
+
+		// Read after the graph, so passes writing it are never culled
+		bool exported = false;
+	};
+
+
+	class RenderGraph;
+
+	// Declares what one pass reads and writes, returned by RenderGraph::add_pass
+	class PassBuilder
+	{
+	public:
+		PassBuilder(RenderGraph& graph, uint32_t pass) : graph(graph), pass(pass) {}
+
+		// Cleared if a clear value is given, loaded if the image has contents, left undefined otherwise
+		PassBuilder& color(GraphResource image, std::optional<vk::ClearValue> clear = std::nullopt);
+
+		// Resolve target of the color attachment declared last
+		PassBuilder& resolve(GraphResource image);
+
+		PassBuilder& depth(GraphResource image, std::optional<vk::ClearValue> clear = std::nullopt);
+
+		PassBuilder& read(GraphResource resource, ResourceUse use);
+
+		PassBuilder& write(GraphResource resource, ResourceUse use);
+
+		// Never culled, for passes whose results leave the graph some other way
+		PassBuilder& side_effects();
+
+	private:
+		RenderGraph& graph;
+		uint32_t pass;
+	};
+
+
+	// Passes declare which named resources they read and write, the graph works out the rest:
+	// it culls passes nothing consumes, orders the rest so producers run well before their consumers,
+	// batches the barriers and layout transitions in front of each pass into one pipelineBarrier2
+	// and picks the load and store ops of the render pass it begins around each pass with attachments.
+	// Intermediates the graph creates itself share memory with the ones they are never alive at the same time as.
+	// Resources and passes are declared again every frame, render passes, framebuffers and intermediates are cached.
+	class RenderGraph
+	{
+	public:
+		// Without synchronization2 the same barriers go through the original vkCmdPipelineBarrier.
+		// Framebuffers and intermediates replaced while running go to the deletion queue, or are destroyed right away without one.
+		void init(vk::Device device, const DeviceContext* deviceContext, DeletionQueue* deletionQueue, bool debug);
+
+		void reset();
+
+		GraphResource import_image(const char* name, const graphImageInput& input);
+
+		GraphResource import_buffer(const char* name, const graphBufferInput& input);
+
+		// Lives from the first to the last pass using it, its contents are undefined before the first
+		GraphResource create_image(const char* name, const transientImageInput& input);
+
+		GraphResource create_buffer(const char* name, vk::DeviceSize size);
+
+		// record runs inside the pass's render pass if it has attachments
+		PassBuilder add_pass(const char* name, std::function<void(vk::CommandBuffer)> record);
+
+		void compile();
+
+		void execute(vk::CommandBuffer commandBuffer);
+
+		// Framebuffers hold image views, the cached ones using this view are retired
+		void forget_view(vk::ImageView view);
+
+		uint32_t culled_passes() const
+		{
+			return culledPasses;
+		}
+
+		// Transition points that needed a barrier in the last compile
+		uint32_t barrier_batches() const
+		{
+			return barrierBatches;
+		}
+
+		// Peak memory of the created intermediates, each with its own allocation and aliased
+		vk::DeviceSize transient_memory_unaliased() const
+		{
+			return transientPool.unaliased_size();
+		}
+
+		vk::DeviceSize transient_memory_aliased() const
+		{
+			return transientPool.aliased_size();
+		}
+
+		void destroy();
+
+	private:
+		friend class PassBuilder;
+
+		struct Resource
+		{
+			std::string name;
+			bool isImage;
+			graphImageInput image;
+			graphBufferInput buffer;
+			bool exported;
+			bool transient;
+		};
+
+		struct Use
+		{
+			GraphResource resource;
+			ResourceUse use;
+			bool write;
+
+			// false if the pass overwrites the whole resource, it is then cleared or resolved into
+			bool reads;
+			std::optional<vk::ClearValue> clear;
+			ResourceState state;
+		};
+
+		struct BarrierBatch
+		{
+			std::vector<vk::ImageMemoryBarrier2> images;
+			std::vector<vk::BufferMemoryBarrier2> buffers;
+		};
+
+		struct Pass
+		{
+			std::string name;
+			std::function<void(vk::CommandBuffer)> record;
+			std::vector<Use> uses;
+			std::vector<GraphResource> colors;
+			std::vector<GraphResource> resolves;
+			GraphResource depth = NO_GRAPH_RESOURCE;
+			bool sideEffects = false;
+
+			// filled in by compile
+			BarrierBatch barriers;
+			vk::RenderPass renderPass{ nullptr };
+			vk::Framebuffer framebuffer{ nullptr };
+			vk::Extent2D extent;
+			std::vector<vk::ClearValue> clearValues;
+		};
+
+		// Stages and access a resource was last written with, and what has seen the write since
+		struct Tracked
+		{
+			vk::ImageLayout layout;
+			vk::PipelineStageFlags2 writeStages;
+			vk::AccessFlags2 writeAccess;
+			vk::PipelineStageFlags2 readStages;
+			vk::PipelineStageFlags2 visibleStages;
+			vk::AccessFlags2 visibleAccess;
+			bool hasContents;
+		};
+
+		vk::Device device{ nullptr };
+		DeletionQueue* deletionQueue = nullptr;
+		bool synchronization2 = false;
+		bool debug = false;
+		bool logged = false;
+
+		std::vector<Resource> resources;
+		std::vector<Pass> passes;
+		std::vector<uint32_t> order;
+		BarrierBatch finalBarriers;
+		uint32_t culledPasses = 0;
+		uint32_t barrierBatches = 0;
+
+		std::map<std::vector<uint32_t>, vk::RenderPass> renderPassCache;
+		std::map<std::vector<uint64_t>, vk::Framebuffer> framebufferCache;
+		TransientPool transientPool;
+
+		// Request index of each resource in the pool, UINT32_MAX for imported ones and unused intermediates
+		std::vector<uint32_t> transientIndex;
+
+		void add_use(uint32_t pass, GraphResource resource, ResourceUse use, bool write, std::optional<vk::ClearValue> clear);
+
+		std::vector<bool> find_live_passes() const;
+
+		void order_passes(const std::vector<bool>& live);
+
+		// Lifetimes over the execution order, then handles for every intermediate a live pass uses
+		void realize_transients();
+
+		void add_barrier(BarrierBatch& batch, GraphResource resource, vk::ImageLayout oldLayout, const ResourceState& to,
+			vk::PipelineStageFlags2 srcStages, vk::AccessFlags2 srcAccess);
+
+		// Stages and access of this read and the ones after it that see the same layout, so one barrier covers them all
+		ResourceState read_run(size_t position, GraphResource resource, const ResourceState& first) const;
+
+		// Next use of the resource after the given position in execution order, nullptr if there is none
+		const Use* next_use(size_t position, GraphResource resource) const;
+
+		void make_render_pass(size_t position, const std::vector<Tracked>& tracked);
+
+		void record_barriers(vk::CommandBuffer commandBuffer, const BarrierBatch& batch);
+	};
+}
\ No newline at end of file
@@ -0,0 +1,165 @@
+#pragma once
+
+#include "config.h"
+
+#include <cassert>
+#include <type_traits>
+
+namespace vkUtil
+{
+	// What a Vulkan call produced: its value, or the vk::Result saying why there is none.
+	// Success codes besides eSuccess (eSuboptimalKHR, eTimeout, eNotReady) still count as a value.
+	template <typename T>
+	class Expected
+	{
+	public:
+		Expected(T value, vk::Result result = vk::Result::eSuccess)
+			: storedValue(std::move(value)), storedResult(result)
+		{
+		}
+
+		Expected(vk::ResultValue<T> resultValue)
+			: storedValue(std::move(resultValue.value)), storedResult(resultValue.result)
+		{
+		}
+
+		static Expected failure(vk::Result result)
+		{
+			return Expected(T{}, result);
+		}
+
+		// Error codes are negative, success codes zero or positive
+		bool has_value() const
+		{
+			return static_cast<int32_t>(storedResult) >= 0;
+		}
+
+		explicit operator bool() const
+		{
+			return has_value();
+		}
+
+		// Only once has_value() says there is one, debug builds assert it
+		T& value()
+		{
+			assert(has_value() && "Expected::value() on a failed call");
+			return storedValue;
+		}
+
+		const T& value() const
+		{
+			assert(has_value() && "Expected::value() on a failed call");
+			return storedValue;
+		}
+
+		// For the callers a failure has a sensible default for, a null handle or an empty list
+		T value_or(T fallback) const
+		{
+			return has_value() ? storedValue : std::move(fallback);
+		}
+
+		vk::Result result() const
+		{
+			return storedResult;
+		}
+
+	private:
+		T storedValue;
+		vk::Result storedResult;
+	};
+
+
+	// Calls with nothing to return but whether they worked
+	template <>
+	class Expected<void>
+	{
+	public:
+		Expected(vk::Result result = vk::Result::eSuccess)
+			: storedResult(result)
+		{
+		}
+
+		static Expected failure(vk::Result result)
+		{
+			return Expected(result);
+		}
+
+		bool has_value() const
+		{
+			return static_cast<int32_t>(storedResult) >= 0;
+		}
+
+		explicit operator bool() const
+		{
+			return has_value();
+		}
+
+		vk::Result result() const
+		{
+			return storedResult;
+		}
+
+	private:
+		vk::Result storedResult;
+	};
+
+
+	// vulkan.hpp returns T or nothing when it throws, ResultValue<T> or vk::Result with VULKAN_HPP_NO_EXCEPTIONS,
+	// and ResultValue<T> or vk::Result either way for calls with several success codes
+	template <typename R>
+	struct ExpectedValue
+	{
+		using type = R;
+	};
+
+	template <typename T>
+	struct ExpectedValue<vk::ResultValue<T>>
+	{
+		using type = T;
+	};
+
+	template <>
+	struct ExpectedValue<vk::Result>
+	{
+		using type = void;
+	};
+
+	template <typename Call>
+	using ExpectedCall = Expected<typename ExpectedValue<std::invoke_result_t<Call&>>::type>;
+
+
+	template <typename Call>
+	inline ExpectedCall<Call> invoke_expected(Call& call)
+	{
+		if constexpr (std::is_void_v<std::invoke_result_t<Call&>>)
+		{
+			call();
+			return ExpectedCall<Call>();
+		}
+		else
+		{
+			return ExpectedCall<Call>(call());
+		}
+	}
+
+
+	// Runs a vulkan.hpp call and hands back what it produced the same way in both builds.
+	// With exceptions vk::SystemError is caught here and nowhere else, with VULKAN_HPP_NO_EXCEPTIONS
+	// the result is passed along and nothing on the way can throw.
+	template <typename Call>
+	inline ExpectedCall<Call> vk_call(Call&& call)
+	{
+#ifdef VULKAN_HPP_NO_EXCEPTIONS
+		return invoke_expected(call);
+#else
+		try
+		{
+			return invoke_expected(call);
+		}
+		catch (const vk::SystemError& err)
+		{
+			return ExpectedCall<Call>::failure(static_cast<vk::Result>(err.code().value()));
+		}
+#endif
+	}
+}
\ No newline at end of file
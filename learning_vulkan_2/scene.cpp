@@ -0,0 +1,576 @@
+#include "scene.h"
+
+#include <chrono>
+#include <cmath>
+#include <random>
+
+#if defined(_M_X64) || defined(__x86_64__) || defined(__SSE2__)
+#define SCENE_SSE 1
+#include <emmintrin.h>
+#endif
+
+
+Transform Transform::identity()
+{
+	return translation(0.0f, 0.0f, 0.0f);
+}
+
+
+Transform Transform::translation(float x, float y, float z)
+{
+	Transform transform = {};
+	transform.m[0] = 1.0f;
+	transform.m[5] = 1.0f;
+	transform.m[10] = 1.0f;
+	transform.m[12] = x;
+	transform.m[13] = y;
+	transform.m[14] = z;
+	transform.m[15] = 1.0f;
+
+	return transform;
+}
+
+
+// result = a * b
+static inline void multiply(const Transform& a, const Transform& b, Transform& result)
+{
+#if defined(SCENE_SSE)
+	// column j of the result is a's columns weighted by column j of b
+	__m128 a0 = _mm_load_ps(&a.m[0]);
+	__m128 a1 = _mm_load_ps(&a.m[4]);
+	__m128 a2 = _mm_load_ps(&a.m[8]);
+	__m128 a3 = _mm_load_ps(&a.m[12]);
+
+	for (int j = 0; j < 4; j++)
+	{
+		__m128 column = _mm_mul_ps(a0, _mm_set1_ps(b.m[j * 4 + 0]));
+		column = _mm_add_ps(column, _mm_mul_ps(a1, _mm_set1_ps(b.m[j * 4 + 1])));
+		column = _mm_add_ps(column, _mm_mul_ps(a2, _mm_set1_ps(b.m[j * 4 + 2])));
+		column = _mm_add_ps(column, _mm_mul_ps(a3, _mm_set1_ps(b.m[j * 4 + 3])));
+		_mm_store_ps(&result.m[j * 4], column);
+	}
+#else
+	for (int j = 0; j < 4; j++)
+	{
+		for (int i = 0; i < 4; i++)
+		{
+			result.m[j * 4 + i] = a.m[i] * b.m[j * 4 + 0]
+				+ a.m[4 + i] * b.m[j * 4 + 1]
+				+ a.m[8 + i] * b.m[j * 4 + 2]
+				+ a.m[12 + i] * b.m[j * 4 + 3];
+		}
+	}
+#endif
+}
+
+
+Scene::Scene(ThreadPool* threadPool)
+{
+	this->threadPool = threadPool;
+}
+
+
+NodeHandle Scene::create_node(NodeHandle parent, const Transform& local)
+{
+	uint32_t parentDense = UINT32_MAX;
+	uint32_t depth = 0;
+
+	if (parent.index != UINT32_MAX)
+	{
+		if (!is_valid(parent))
+		{
+			throw std::runtime_error("Tried to create a scene node under a destroyed parent\n");
+		}
+
+		parentDense = slotToDense[parent.index];
+		depth = depths[parentDense] + 1;
+	}
+
+	NodeHandle node;
+	if (!freeSlots.empty())
+	{
+		node.index = freeSlots.back();
+		freeSlots.pop_back();
+	}
+	else
+	{
+		node.index = static_cast<uint32_t>(slotToDense.size());
+		slotToDense.push_back(UINT32_MAX);
+		slotGenerations.push_back(0);
+	}
+	node.generation = slotGenerations[node.index];
+
+	uint32_t dense = static_cast<uint32_t>(locals.size());
+	slotToDense[node.index] = dense;
+
+	locals.push_back(local);
+	worlds.push_back(local);
+	meshes.push_back(UINT32_MAX);
+	materials.push_back(UINT32_MAX);
+	parents.push_back(parentDense);
+	depths.push_back(depth);
+	denseToSlot.push_back(node.index);
+
+	float origin[3] = { 0.0f, 0.0f, 0.0f };
+	localBounds.add(origin, 0.0f, origin, origin);
+	worldBounds.add(origin, 0.0f, origin, origin);
+
+	// Level ranges are rebuilt on the next update
+	orderDirty = true;
+
+	return node;
+}
+
+
+bool Scene::is_valid(NodeHandle node) const
+{
+	return node.index < slotGenerations.size()
+		&& slotGenerations[node.index] == node.generation
+		&& slotToDense[node.index] != UINT32_MAX;
+}
+
+
+void Scene::destroy_node(NodeHandle node)
+{
+	if (!is_valid(node))
+	{
+		return;
+	}
+
+	// With parents in front of their children, one forward pass finds the whole subtree
+	if (orderDirty)
+	{
+		sort_by_depth();
+	}
+
+	size_t count = locals.size();
+	std::vector<bool> doomed(count, false);
+	doomed[slotToDense[node.index]] = true;
+
+	for (size_t ii = 0; ii < count; ii++)
+	{
+		if (parents[ii] != UINT32_MAX && doomed[parents[ii]])
+		{
+			doomed[ii] = true;
+		}
+	}
+
+	// Stable compaction, so the depth order survives
+	std::vector<uint32_t> oldToNew(count, UINT32_MAX);
+	uint32_t kept = 0;
+
+	for (uint32_t ii = 0; ii < count; ii++)
+	{
+		uint32_t slot = denseToSlot[ii];
+
+		if (doomed[ii])
+		{
+			slotToDense[slot] = UINT32_MAX;
+			slotGenerations[slot]++;
+			freeSlots.push_back(slot);
+			continue;
+		}
+
+		oldToNew[ii] = kept;
+
+		locals[kept] = locals[ii];
+		worlds[kept] = worlds[ii];
+		meshes[kept] = meshes[ii];
+		materials[kept] = materials[ii];
+		parents[kept] = parents[ii] == UINT32_MAX ? UINT32_MAX : oldToNew[parents[ii]];
+		depths[kept] = depths[ii];
+		denseToSlot[kept] = slot;
+		slotToDense[slot] = kept;
+
+		float center[3] = { localBounds.centerX[ii], localBounds.centerY[ii], localBounds.centerZ[ii] };
+		float aabbMin[3] = { localBounds.minX[ii], localBounds.minY[ii], localBounds.minZ[ii] };
+		float aabbMax[3] = { localBounds.maxX[ii], localBounds.maxY[ii], localBounds.maxZ[ii] };
+		localBounds.set(kept, center, localBounds.radius[ii], aabbMin, aabbMax);
+
+		kept++;
+	}
+
+	locals.resize(kept);
+	worlds.resize(kept);
+	meshes.resize(kept);
+	materials.resize(kept);
+	parents.resize(kept);
+	depths.resize(kept);
+	denseToSlot.resize(kept);
+	localBounds.resize(kept);
+	worldBounds.resize(kept);
+
+	// Level ranges have shifted
+	orderDirty = true;
+}
+
+
+void Scene::sort_by_depth()
+{
+	size_t count = locals.size();
+
+	// Breadth first order: depth levels end up contiguous, and within a level
+	// siblings sit next to each other in the same order as their parents,
+	// so the update streams through the parent level instead of jumping around it
+	std::vector<uint32_t> childStarts(count + 1, 0);
+	for (uint32_t parent : parents)
+	{
+		if (parent != UINT32_MAX)
+		{
+			childStarts[parent + 1]++;
+		}
+	}
+	for (size_t ii = 1; ii <= count; ii++)
+	{
+		childStarts[ii] += childStarts[ii - 1];
+	}
+
+	std::vector<uint32_t> children(childStarts[count]);
+	std::vector<uint32_t> cursor(childStarts.begin(), childStarts.end() - 1);
+	std::vector<uint32_t> newToOld;
+	newToOld.reserve(count);
+
+	for (uint32_t ii = 0; ii < count; ii++)
+	{
+		if (parents[ii] == UINT32_MAX)
+		{
+			newToOld.push_back(ii);
+		}
+		else
+		{
+			children[cursor[parents[ii]]++] = ii;
+		}
+	}
+
+	for (size_t next = 0; next < newToOld.size(); next++)
+	{
+		uint32_t node = newToOld[next];
+		newToOld.insert(newToOld.end(), children.begin() + childStarts[node], children.begin() + childStarts[node + 1]);
+	}
+
+	std::vector<uint32_t> oldToNew(count);
+	for (uint32_t ii = 0; ii < count; ii++)
+	{
+		oldToNew[newToOld[ii]] = ii;
+	}
+
+	levelStarts.clear();
+	for (uint32_t ii = 0; ii < count; ii++)
+	{
+		if (depths[newToOld[ii]] >= levelStarts.size())
+		{
+			levelStarts.push_back(ii);
+		}
+	}
+	levelStarts.push_back(static_cast<uint32_t>(count));
+
+	auto permute = [&](auto& values)
+	{
+		auto sorted = values;
+		for (uint32_t ii = 0; ii < count; ii++)
+		{
+			sorted[oldToNew[ii]] = values[ii];
+		}
+		values.swap(sorted);
+	};
+
+	permute(locals);
+	permute(worlds);
+	permute(meshes);
+	permute(materials);
+	permute(depths);
+	permute(denseToSlot);
+
+	for (std::vector<float>* component : {
+		&localBounds.centerX, &localBounds.centerY, &localBounds.centerZ, &localBounds.radius,
+		&localBounds.minX, &localBounds.minY, &localBounds.minZ,
+		&localBounds.maxX, &localBounds.maxY, &localBounds.maxZ })
+	{
+		permute(*component);
+	}
+
+	std::vector<uint32_t> sortedParents(count);
+	for (uint32_t ii = 0; ii < count; ii++)
+	{
+		sortedParents[oldToNew[ii]] = parents[ii] == UINT32_MAX ? UINT32_MAX : oldToNew[parents[ii]];
+	}
+	parents.swap(sortedParents);
+
+	for (uint32_t ii = 0; ii < count; ii++)
+	{
+		slotToDense[denseToSlot[ii]] = ii;
+	}
+
+	orderDirty = false;
+}
+
+
+void Scene::set_local_transform(NodeHandle node, const Transform& local)
+{
+	if (is_valid(node))
+	{
+		locals[slotToDense[node.index]] = local;
+	}
+}
+
+
+const Transform& Scene::get_world_transform(NodeHandle node) const
+{
+	return worlds[slotToDense[node.index]];
+}
+
+
+void Scene::set_local_bounds(NodeHandle node, const float center[3], float radius, const float aabbMin[3], const float aabbMax[3])
+{
+	if (is_valid(node))
+	{
+		localBounds.set(slotToDense[node.index], center, radius, aabbMin, aabbMax);
+	}
+}
+
+
+void Scene::set_mesh(NodeHandle node, uint32_t mesh, uint32_t material)
+{
+	if (is_valid(node))
+	{
+		meshes[slotToDense[node.index]] = mesh;
+		materials[slotToDense[node.index]] = material;
+	}
+}
+
+
+void Scene::update_node(size_t ii)
+{
+	uint32_t parent = parents[ii];
+
+	if (parent == UINT32_MAX)
+	{
+		worlds[ii] = locals[ii];
+	}
+	else
+	{
+		multiply(worlds[parent], locals[ii], worlds[ii]);
+	}
+}
+
+
+void Scene::update_bounds(size_t ii)
+{
+	const float* m = worlds[ii].m;
+
+	// Sphere: transform the center, scale the radius by the largest axis scale
+	float cx = localBounds.centerX[ii];
+	float cy = localBounds.centerY[ii];
+	float cz = localBounds.centerZ[ii];
+
+	worldBounds.centerX[ii] = m[0] * cx + m[4] * cy + m[8] * cz + m[12];
+	worldBounds.centerY[ii] = m[1] * cx + m[5] * cy + m[9] * cz + m[13];
+	worldBounds.centerZ[ii] = m[2] * cx + m[6] * cy + m[10] * cz + m[14];
+
+	float scaleX = m[0] * m[0] + m[1] * m[1] + m[2] * m[2];
+	float scaleY = m[4] * m[4] + m[5] * m[5] + m[6] * m[6];
+	float scaleZ = m[8] * m[8] + m[9] * m[9] + m[10] * m[10];
+	worldBounds.radius[ii] = localBounds.radius[ii] * std::sqrt(std::max(scaleX, std::max(scaleY, scaleZ)));
+
+	// Box (Arvo): start from the translation and grow by each transformed axis
+	const float localMin[3] = { localBounds.minX[ii], localBounds.minY[ii], localBounds.minZ[ii] };
+	const float localMax[3] = { localBounds.maxX[ii], localBounds.maxY[ii], localBounds.maxZ[ii] };
+	float worldMin[3] = { m[12], m[13], m[14] };
+	float worldMax[3] = { m[12], m[13], m[14] };
+
+	for (int i = 0; i < 3; i++)
+	{
+		for (int j = 0; j < 3; j++)
+		{
+			float a = m[j * 4 + i] * localMin[j];
+			float b = m[j * 4 + i] * localMax[j];
+			worldMin[i] += std::min(a, b);
+			worldMax[i] += std::max(a, b);
+		}
+	}
+
+	worldBounds.minX[ii] = worldMin[0];
+	worldBounds.minY[ii] = worldMin[1];
+	worldBounds.minZ[ii] = worldMin[2];
+	worldBounds.maxX[ii] = worldMax[0];
+	worldBounds.maxY[ii] = worldMax[1];
+	worldBounds.maxZ[ii] = worldMax[2];
+}
+
+
+#if defined(SCENE_SSE)
+// Same as update_bounds, for the 4 nodes starting at ii.
+// The 4 world matrices are transposed so that e[k] holds element k of every node,
+// which lines them up with the structure-of-arrays bounds
+void Scene::update_bounds_4(size_t ii)
+{
+	__m128 e[16];
+
+	for (int c = 0; c < 4; c++)
+	{
+		__m128 r0 = _mm_load_ps(&worlds[ii + 0].m[c * 4]);
+		__m128 r1 = _mm_load_ps(&worlds[ii + 1].m[c * 4]);
+		__m128 r2 = _mm_load_ps(&worlds[ii + 2].m[c * 4]);
+		__m128 r3 = _mm_load_ps(&worlds[ii + 3].m[c * 4]);
+		_MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+
+		e[c * 4 + 0] = r0;
+		e[c * 4 + 1] = r1;
+		e[c * 4 + 2] = r2;
+		e[c * 4 + 3] = r3;
+	}
+
+	auto madd = [](__m128 a, __m128 b, __m128 c) { return _mm_add_ps(_mm_mul_ps(a, b), c); };
+
+	__m128 cx = _mm_loadu_ps(&localBounds.centerX[ii]);
+	__m128 cy = _mm_loadu_ps(&localBounds.centerY[ii]);
+	__m128 cz = _mm_loadu_ps(&localBounds.centerZ[ii]);
+
+	_mm_storeu_ps(&worldBounds.centerX[ii], madd(e[0], cx, madd(e[4], cy, madd(e[8], cz, e[12]))));
+	_mm_storeu_ps(&worldBounds.centerY[ii], madd(e[1], cx, madd(e[5], cy, madd(e[9], cz, e[13]))));
+	_mm_storeu_ps(&worldBounds.centerZ[ii], madd(e[2], cx, madd(e[6], cy, madd(e[10], cz, e[14]))));
+
+	__m128 scaleX = madd(e[0], e[0], madd(e[1], e[1], _mm_mul_ps(e[2], e[2])));
+	__m128 scaleY = madd(e[4], e[4], madd(e[5], e[5], _mm_mul_ps(e[6], e[6])));
+	__m128 scaleZ = madd(e[8], e[8], madd(e[9], e[9], _mm_mul_ps(e[10], e[10])));
+	__m128 maxScale = _mm_sqrt_ps(_mm_max_ps(scaleX, _mm_max_ps(scaleY, scaleZ)));
+	_mm_storeu_ps(&worldBounds.radius[ii], _mm_mul_ps(_mm_loadu_ps(&localBounds.radius[ii]), maxScale));
+
+	const __m128 localMin[3] = { _mm_loadu_ps(&localBounds.minX[ii]), _mm_loadu_ps(&localBounds.minY[ii]), _mm_loadu_ps(&localBounds.minZ[ii]) };
+	const __m128 localMax[3] = { _mm_loadu_ps(&localBounds.maxX[ii]), _mm_loadu_ps(&localBounds.maxY[ii]), _mm_loadu_ps(&localBounds.maxZ[ii]) };
+	float* worldMin[3] = { &worldBounds.minX[ii], &worldBounds.minY[ii], &worldBounds.minZ[ii] };
+	float* worldMax[3] = { &worldBounds.maxX[ii], &worldBounds.maxY[ii], &worldBounds.maxZ[ii] };
+
+	for (int i = 0; i < 3; i++)
+	{
+		__m128 lower = e[12 + i];
+		__m128 upper = e[12 + i];
+
+		for (int j = 0; j < 3; j++)
+		{
+			__m128 a = _mm_mul_ps(e[j * 4 + i], localMin[j]);
+			__m128 b = _mm_mul_ps(e[j * 4 + i], localMax[j]);
+			lower = _mm_add_ps(lower, _mm_min_ps(a, b));
+			upper = _mm_add_ps(upper, _mm_max_ps(a, b));
+		}
+
+		_mm_storeu_ps(worldMin[i], lower);
+		_mm_storeu_ps(worldMax[i], upper);
+	}
+}
+#endif
+
+
+void Scene::update_range(size_t begin, size_t end)
+{
+	size_t ii = begin;
+
+#if defined(SCENE_SSE)
+	for (; ii + 4 <= end; ii += 4)
+	{
+		update_node(ii);
+		update_node(ii + 1);
+		update_node(ii + 2);
+		update_node(ii + 3);
+		update_bounds_4(ii);
+	}
+#endif
+
+	for (; ii < end; ii++)
+	{
+		update_node(ii);
+		update_bounds(ii);
+	}
+}
+
+
+void Scene::update_world_transforms()
+{
+	if (orderDirty)
+	{
+		sort_by_depth();
+	}
+
+	// Every node in a level only reads from the level above,
+	// so each level can be split across threads with no further synchronization
+	for (size_t d = 0; d + 1 < levelStarts.size(); d++)
+	{
+		size_t begin = levelStarts[d];
+		size_t end = levelStarts[d + 1];
+
+		if (threadPool)
+		{
+			threadPool->parallel_for(end - begin, 4096, [&](size_t chunkBegin, size_t chunkEnd)
+				{
+					update_range(begin + chunkBegin, begin + chunkEnd);
+				});
+		}
+		else
+		{
+			update_range(begin, end);
+		}
+	}
+}
+
+
+void Scene::benchmark(ThreadPool* threadPool)
+{
+	Scene scene(threadPool);
+
+	// 1000 roots, each level 10x wider than the one above: 1000 + 9000 + 90000 + 900000 nodes
+	std::mt19937 rng(1234);
+	std::vector<NodeHandle> previousLevel;
+	std::vector<NodeHandle> all;
+
+	float center[3] = { 0.0f, 0.0f, 0.0f };
+	float aabbMin[3] = { -0.5f, -0.5f, -0.5f };
+	float aabbMax[3] = { 0.5f, 0.5f, 0.5f };
+
+	for (size_t levelSize : { size_t(1000), size_t(9000), size_t(90000), size_t(900000) })
+	{
+		std::vector<NodeHandle> level;
+		std::uniform_int_distribution<size_t> pickParent(0, previousLevel.empty() ? 0 : previousLevel.size() - 1);
+
+		for (size_t ii = 0; ii < levelSize; ii++)
+		{
+			NodeHandle parent = previousLevel.empty() ? NodeHandle{} : previousLevel[pickParent(rng)];
+			NodeHandle node = scene.create_node(parent, Transform::translation(1.0f, 0.0f, 0.0f));
+			scene.set_local_bounds(node, center, 0.87f, aabbMin, aabbMax);
+
+			level.push_back(node);
+			all.push_back(node);
+		}
+
+		previousLevel.swap(level);
+	}
+
+	const int frames = 30;
+	double animateMs = 0.0;
+	double updateMs = 0.0;
+
+	for (int frame = 0; frame < frames; frame++)
+	{
+		auto start = std::chrono::high_resolution_clock::now();
+
+		// Every node moves every frame
+		float t = 0.01f * frame;
+		for (NodeHandle node : all)
+		{
+			scene.set_local_transform(node, Transform::translation(std::cos(t), std::sin(t), 0.0f));
+		}
+
+		auto animated = std::chrono::high_resolution_clock::now();
+
+		scene.update_world_transforms();
+
+		auto end = std::chrono::high_resolution_clock::now();
+
+		animateMs += std::chrono::duration<double, std::milli>(animated - start).count();
+		updateMs += std::chrono::duration<double, std::milli>(end - animated).count();
+	}
+
+	std::cout << "Scene update benchmark: " << scene.size() << " nodes, "
+		<< (threadPool ? threadPool->size() + 1 : 1) << " thread(s)\n";
+	std::cout << "\tSetting local transforms: " << animateMs / frames << " ms/frame\n";
+	std::cout << "\tWorld transform + bounds propagation: " << updateMs / frames << " ms/frame\n";
+}
\ No newline at end of file
@@ -0,0 +1,120 @@
+#pragma once
+
+#include "config.h"
+#include "culling.h"
+#include "thread_pool.h"
+
+
+// Column major 4x4 matrix
+struct alignas(16) Transform
+{
+	float m[16];
+
+	static Transform identity();
+
+	static Transform translation(float x, float y, float z);
+};
+
+
+// Generational index: stays valid until its node is destroyed,
+// after which the slot may be reused but old handles to it are rejected
+struct NodeHandle
+{
+	uint32_t index = UINT32_MAX;
+	uint32_t generation = 0;
+};
+
+
+// Data oriented scene store.
+// Every component lives in its own dense array, sorted by hierarchy depth so that
+// parents always come before their children and each depth level is one contiguous range.
+class Scene
+{
+public:
+	// Worker threads are optional, without them updates run on the calling thread
+	Scene(ThreadPool* threadPool = nullptr);
+
+	NodeHandle create_node(NodeHandle parent = {}, const Transform& local = Transform::identity());
+
+	// Destroys the node and everything below it
+	void destroy_node(NodeHandle node);
+
+	bool is_valid(NodeHandle node) const;
+
+	void set_local_transform(NodeHandle node, const Transform& local);
+
+	const Transform& get_world_transform(NodeHandle node) const;
+
+	void set_local_bounds(NodeHandle node, const float center[3], float radius, const float aabbMin[3], const float aabbMax[3]);
+
+	void set_mesh(NodeHandle node, uint32_t mesh, uint32_t material);
+
+	// Propagates local transforms down the hierarchy, one depth level at a time,
+	// and refreshes world space bounds
+	void update_world_transforms();
+
+	size_t size() const
+	{
+		return locals.size();
+	}
+
+	// Dense arrays, all indexed by the same dense index.
+	// Only valid until the next create_node/destroy_node
+	const Transform* world_transforms() const
+	{
+		return worlds.data();
+	}
+
+	const vkUtil::BoundingVolumes& world_bounds() const
+	{
+		return worldBounds;
+	}
+
+	const uint32_t* mesh_handles() const
+	{
+		return meshes.data();
+	}
+
+	const uint32_t* material_handles() const
+	{
+		return materials.data();
+	}
+
+	// Builds a ~1M node hierarchy and reports the per-frame update cost
+	static void benchmark(ThreadPool* threadPool);
+
+private:
+	ThreadPool* threadPool;
+
+	// dense component arrays
+	std::vector<Transform> locals;
+	std::vector<Transform> worlds;
+	vkUtil::BoundingVolumes localBounds;
+	vkUtil::BoundingVolumes worldBounds;
+	std::vector<uint32_t> meshes;
+	std::vector<uint32_t> materials;
+	std::vector<uint32_t> parents;     // dense index of the parent, UINT32_MAX for roots
+	std::vector<uint32_t> depths;
+	std::vector<uint32_t> denseToSlot;
+
+	// [levelStarts[d], levelStarts[d + 1]) is depth level d
+	std::vector<uint32_t> levelStarts;
+
+	// sparse slots, indexed by NodeHandle::index
+	std::vector<uint32_t> slotToDense;
+	std::vector<uint32_t> slotGenerations;
+	std::vector<uint32_t> freeSlots;
+
+	// Nodes were added or removed since the arrays were last sorted by depth
+	bool orderDirty = false;
+
+	void sort_by_depth();
+
+	void update_node(size_t ii);
+
+	void update_bounds(size_t ii);
+
+	void update_bounds_4(size_t ii);
+
+	void update_range(size_t begin, size_t end);
+};
\ No newline at end of file
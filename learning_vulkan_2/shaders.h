@@ -1,12 +1,16 @@
 #pragma once
 
 #include "config.h"
+#include "startup_profiler.h"
+#include "result.h"
 #include <filesystem>
 
 namespace vkUtil
 {
 	std::vector<char> readFile(std::string filename, bool debug)
 	{
+		StartupProfiler::Scope timer("readFile");
+
 		// start the stream at end of file, in order to get file size
 		std::ifstream file(filename, std::ios::ate | std::ios::binary);
 
@@ -31,25 +35,34 @@ namespace vkUtil
 	}
 
 
-	vk::ShaderModule createModule(std::string filename, vk::Device device, bool debug)
+	// sourceCode is SPIR-V already read from filename, empty to read it here
+	vk::ShaderModule createModule(std::string filename, vk::Device device, bool debug, std::vector<char> sourceCode = {})
 	{
-		std::vector<char> sourceCode = readFile(filename, debug);
+		if (sourceCode.empty())
+		{
+			sourceCode = readFile(filename, debug);
+		}
 		
 		vk::ShaderModuleCreateInfo moduleInfo = {};
 		moduleInfo.flags = vk::ShaderModuleCreateFlags();
 		moduleInfo.codeSize = sourceCode.size();
 		moduleInfo.pCode = reinterpret_cast<const uint32_t*>(sourceCode.data());
 
-		try
-		{
-			return device.createShaderModule(moduleInfo);
-		}
-		catch (vk::SystemError err)
+		Expected<vk::ShaderModule> shaderModule = vk_call([&]()
+			{
+				StartupProfiler::Scope driverTimer("vkCreateShaderModule", StartupProfiler::Category::eDriver);
+				return device.createShaderModule(moduleInfo);
+			});
+
+		if (!shaderModule)
 		{
 			if (debug)
 			{
 				std::cout << "Failed to create shader module for \"" << filename << "\"" << std::endl;
 			}
+			return nullptr;
 		}
+
+		return shaderModule.value();
 	}
 }
@@ -1,10 +1,39 @@
 #version 450
+#extension GL_EXT_nonuniform_qualifier : require
 
 layout(location = 0) in vec3 fragColor;
+layout(location = 1) flat in uint fragMaterialID;
+layout(location = 2) in vec2 fragUV;
 
 layout(location = 0) out vec4 outColor;
 
+// Bindless resources, see bindless.h and materials.h
+struct MaterialData
+{
+	vec4 baseColor;
+	uint albedoTexture;
+	uint padding0, padding1, padding2;
+};
+
+layout(set = 0, binding = 0) uniform sampler2D textures[];
+
+layout(std430, set = 0, binding = 1) readonly buffer MaterialBuffer
+{
+	MaterialData materials[];
+} materialBuffers[];
+
+const uint MATERIAL_BUFFER_INDEX = 1;
+const uint NO_TEXTURE = 0xFFFFFFFFu;
+
 void main()
 {
-	outColor = vec4(fragColor, 1.0);
+	MaterialData material = materialBuffers[MATERIAL_BUFFER_INDEX].materials[fragMaterialID];
+
+	outColor = vec4(fragColor, 1.0) * material.baseColor;
+
+	// One indirect draw covers many objects, so neighbouring fragments can pick different textures
+	if (material.albedoTexture != NO_TEXTURE)
+	{
+		outColor *= texture(textures[nonuniformEXT(material.albedoTexture)], fragUV);
+	}
 }
\ No newline at end of file
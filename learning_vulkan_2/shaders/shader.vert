@@ -1,4 +1,5 @@
 #version 450
+#extension GL_EXT_nonuniform_qualifier : require
 
 vec2 positions[3] = vec2[](
 	vec2(0.0, -0.5),
@@ -13,10 +14,57 @@ vec3 colors[3] = vec3[](
 	vec3(0.0, 0.0, 1.0)
 );
 
+// Bindless storage buffers, see materials.h
+struct ObjectData
+{
+	mat4 model;
+	uint materialID;
+	uint padding0, padding1, padding2;
+};
+
+layout(std430, set = 0, binding = 1) readonly buffer ObjectBuffer
+{
+	ObjectData objects[];
+} objectBuffers[];
+
+const uint OBJECT_BUFFER_INDEX = 0;
+
+// Per frame, through the uniform ring
+layout(set = 1, binding = 0) uniform Camera
+{
+	mat4 viewProjection;
+} camera;
+
+// Per draw, see push_constants.h
+layout(push_constant) uniform DrawConstants
+{
+	mat4 model;
+	uint materialID;
+} draw;
+
+const uint MATERIAL_FROM_OBJECT_BUFFER = 0xFFFFFFFFu;
+
+// The depth prepass and the shading pass have to compute the exact same depth
+invariant gl_Position;
+
 layout(location = 0) out vec3 fragColor;
+layout(location = 1) flat out uint fragMaterialID;
+layout(location = 2) out vec2 fragUV;
 
 void main()
 {
-	gl_Position = vec4(positions[gl_VertexIndex], 0.0, 1.0);
+	mat4 model = draw.model;
+	fragMaterialID = draw.materialID;
+
+	// Indirect draws can't push per draw, firstInstance is the object index instead
+	if (draw.materialID == MATERIAL_FROM_OBJECT_BUFFER)
+	{
+		ObjectData object = objectBuffers[OBJECT_BUFFER_INDEX].objects[gl_InstanceIndex];
+		model = object.model;
+		fragMaterialID = object.materialID;
+	}
+
+	gl_Position = camera.viewProjection * model * vec4(positions[gl_VertexIndex], 0.0, 1.0);
 	fragColor = colors[gl_VertexIndex];
+	fragUV = positions[gl_VertexIndex] + vec2(0.5);
 }
\ No newline at end of file
@@ -1,2 +1,4 @@
-C:\VulkanSDK\1.3.290.0\Bin\glslc.exe shader.frag -o fragment.spv
-C:\VulkanSDK\1.3.290.0\Bin\glslc.exe shader.vert -o vertex.spv
\ No newline at end of file
+C:\VulkanSDK\1.3.290.0\Bin\glslc.exe shader.frag -o fragment.spv --target-env=vulkan1.2
+C:\VulkanSDK\1.3.290.0\Bin\glslc.exe shader.vert -o vertex.spv --target-env=vulkan1.2
+C:\VulkanSDK\1.3.290.0\Bin\glslc.exe busy.comp -o busy.spv
+C:\VulkanSDK\1.3.290.0\Bin\glslc.exe downsample.comp -o downsample.spv
\ No newline at end of file
@@ -0,0 +1,248 @@
+#pragma once
+
+#include "config.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iomanip>
+#include <mutex>
+#include <thread>
+
+
+namespace vkUtil
+{
+	// Where launch time goes. Scoped timers around init steps and Vulkan object creation record from begin(),
+	// at the start of the engine's constructor, until finish() after the first present.
+	// Recording stops there, so the timers cost one atomic load for the rest of the run.
+	class StartupProfiler
+	{
+	public:
+		enum class Category
+		{
+			eStep,   // an init function
+			eTask,   // a task of the startup graph
+			eDriver  // a single Vulkan or window system call, time spent in the loader, layers and driver
+		};
+
+		struct Entry
+		{
+			const char* name;
+			Category category;
+			uint32_t thread;
+			double start;     // ms since begin()
+			double duration;  // ms
+		};
+
+		void begin()
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			origin = std::chrono::steady_clock::now();
+			entries.clear();
+			threads.clear();
+			timeToFirstPresent = 0.0;
+			recording = true;
+		}
+
+		bool is_recording() const
+		{
+			return recording.load(std::memory_order_relaxed);
+		}
+
+		double elapsed_ms() const
+		{
+			return ms_since_origin(std::chrono::steady_clock::now());
+		}
+
+		void record(const char* name, Category category, std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point end,
+			std::thread::id thread = std::this_thread::get_id())
+		{
+			if (!is_recording())
+			{
+				return;
+			}
+
+			std::lock_guard<std::mutex> lock(mutex);
+
+			// Threads are numbered in the order they first record something, the constructor's thread is 0
+			uint32_t threadIndex = 0;
+			while (threadIndex < threads.size() && threads[threadIndex] != thread)
+			{
+				threadIndex++;
+			}
+			if (threadIndex == threads.size())
+			{
+				threads.push_back(thread);
+			}
+
+			entries.push_back({ name, category, threadIndex, ms_since_origin(start), std::chrono::duration<double, std::milli>(end - start).count() });
+		}
+
+		// Written by finish(), empty for none
+		void set_report_path(const std::string& path)
+		{
+			reportPath = path;
+		}
+
+		// Call after the first present. Stops recording, prints the table in debug mode and writes the JSON report
+		// if there is a path for it. Returns the time to first present in ms.
+		double finish(bool debug)
+		{
+			if (!recording.exchange(false))
+			{
+				return timeToFirstPresent;
+			}
+
+			timeToFirstPresent = elapsed_ms();
+
+			if (debug)
+			{
+				print();
+			}
+
+			if (!reportPath.empty() && !write_json(reportPath) && debug)
+			{
+				std::cout << "Failed to write the startup report to \"" << reportPath << "\" :/" << std::endl;
+			}
+
+			return timeToFirstPresent;
+		}
+
+		// Every entry by start time, then the driver time of instance and device creation
+		void print() const
+		{
+			std::vector<Entry> sorted = sorted_entries();
+
+			std::cout << "Startup profile, " << std::fixed << std::setprecision(2) << timeToFirstPresent << " ms to first present\n";
+			std::cout << std::setw(10) << "start ms" << std::setw(13) << "duration ms" << std::setw(8) << "thread" << "  "
+				<< std::left << std::setw(8) << "kind" << "step\n" << std::right;
+			for (const Entry& entry : sorted)
+			{
+				std::cout << std::setw(10) << entry.start << std::setw(13) << entry.duration << std::setw(8) << entry.thread << "  "
+					<< std::left << std::setw(8) << category_name(entry.category) << entry.name << "\n" << std::right;
+			}
+
+			std::cout << "Driver time: vkCreateInstance " << driver_time("vkCreateInstance") << " ms, vkCreateDevice "
+				<< driver_time("vkCreateDevice") << " ms, all calls " << driver_time(nullptr) << " ms\n";
+			std::cout << std::defaultfloat << std::setprecision(6);
+		}
+
+		// {"timeToFirstPresent": ms, "driverTime": {...}, "traceEvents": [...]}, the events load in chrome://tracing
+		bool write_json(const std::string& path) const
+		{
+			std::ofstream file(path);
+			if (!file.is_open())
+			{
+				return false;
+			}
+
+			file << std::fixed << std::setprecision(3);
+			file << "{\n\t\"timeToFirstPresent\": " << timeToFirstPresent << ",\n";
+			file << "\t\"driverTime\": { \"vkCreateInstance\": " << driver_time("vkCreateInstance")
+				<< ", \"vkCreateDevice\": " << driver_time("vkCreateDevice") << ", \"total\": " << driver_time(nullptr) << " },\n";
+			file << "\t\"traceEvents\": [";
+
+			std::vector<Entry> sorted = sorted_entries();
+			for (size_t ii = 0; ii < sorted.size(); ii++)
+			{
+				const Entry& entry = sorted[ii];
+				file << (ii == 0 ? "\n" : ",\n") << "\t\t{ \"name\": \"" << entry.name << "\", \"cat\": \"" << category_name(entry.category)
+					<< "\", \"ph\": \"X\", \"pid\": 0, \"tid\": " << entry.thread
+					<< ", \"ts\": " << entry.start * 1000.0 << ", \"dur\": " << entry.duration * 1000.0 << " }";
+			}
+
+			file << "\n\t]\n}\n";
+			return file.good();
+		}
+
+		// Times from construction to the end of the scope, if the profiler is recording
+		class Scope
+		{
+		public:
+			Scope(const char* name, Category category = Category::eStep);
+			~Scope();
+
+		private:
+			const char* name;
+			Category category;
+			std::chrono::steady_clock::time_point start;
+		};
+
+	private:
+		std::chrono::steady_clock::time_point origin;
+		std::atomic<bool> recording{ false };
+		double timeToFirstPresent = 0.0;
+		std::string reportPath;
+
+		mutable std::mutex mutex;
+		std::vector<Entry> entries;
+		std::vector<std::thread::id> threads;
+
+		double ms_since_origin(std::chrono::steady_clock::time_point time) const
+		{
+			return std::chrono::duration<double, std::milli>(time - origin).count();
+		}
+
+		static const char* category_name(Category category)
+		{
+			switch (category)
+			{
+			case Category::eTask:
+				return "task";
+			case Category::eDriver:
+				return "driver";
+			default:
+				return "step";
+			}
+		}
+
+		std::vector<Entry> sorted_entries() const
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			std::vector<Entry> sorted = entries;
+			std::stable_sort(sorted.begin(), sorted.end(), [](const Entry& a, const Entry& b) { return a.start < b.start; });
+			return sorted;
+		}
+
+		// Total of the driver calls with this name, of every driver call for null
+		double driver_time(const char* name) const
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			double total = 0.0;
+			for (const Entry& entry : entries)
+			{
+				if (entry.category == Category::eDriver && (!name || strcmp(entry.name, name) == 0))
+				{
+					total += entry.duration;
+				}
+			}
+			return total;
+		}
+	};
+
+
+	// The one profiler, every init function records into it
+	inline StartupProfiler& startup_profiler()
+	{
+		static StartupProfiler profiler;
+		return profiler;
+	}
+
+
+	inline StartupProfiler::Scope::Scope(const char* name, Category category)
+		: name(name), category(category)
+	{
+		if (startup_profiler().is_recording())
+		{
+			start = std::chrono::steady_clock::now();
+		}
+	}
+
+	inline StartupProfiler::Scope::~Scope()
+	{
+		if (startup_profiler().is_recording() && start != std::chrono::steady_clock::time_point())
+		{
+			startup_profiler().record(name, category, start, std::chrono::steady_clock::now());
+		}
+	}
+}
\ No newline at end of file
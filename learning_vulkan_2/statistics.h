@@ -0,0 +1,124 @@
+#pragma once
+
+#include "config.h"
+#include "device_context.h"
+
+
+namespace vkUtil
+{
+	struct FrameStatistics
+	{
+		uint64_t vertexInvocations = 0;
+		uint64_t fragmentInvocations = 0;
+	};
+
+
+	// Counts shader invocations of one frame's render pass, needs the pipelineStatisticsQuery feature.
+	// Results are read back after the frame's fence, so nothing ever waits on the query.
+	class PipelineStatistics
+	{
+	public:
+		void init(vk::Device device, const DeviceContext& deviceContext, bool debug)
+		{
+			this->device = device;
+
+			if (!deviceContext.supported_features().pipelineStatisticsQuery)
+			{
+				if (debug)
+				{
+					std::cout << "Device can't query pipeline statistics\n";
+				}
+				return;
+			}
+
+			vk::QueryPoolCreateInfo poolInfo = {};
+			poolInfo.queryType = vk::QueryType::ePipelineStatistics;
+			poolInfo.queryCount = 1;
+			poolInfo.pipelineStatistics = vk::QueryPipelineStatisticFlagBits::eVertexShaderInvocations
+				| vk::QueryPipelineStatisticFlagBits::eFragmentShaderInvocations;
+
+			vkUtil::Expected<vk::QueryPool> pool = vkUtil::vk_call([&]() { return device.createQueryPool(poolInfo); });
+			if (!pool)
+			{
+				if (debug)
+				{
+					std::cout << "Failed to create pipeline statistics query pool :/" << std::endl;
+				}
+				return;
+			}
+			queryPool = pool.value();
+		}
+
+		bool is_supported() const
+		{
+			return static_cast<bool>(queryPool);
+		}
+
+		// Outside the render pass
+		void begin(vk::CommandBuffer commandBuffer)
+		{
+			if (!queryPool)
+			{
+				return;
+			}
+
+			commandBuffer.resetQueryPool(queryPool, 0, 1);
+			commandBuffer.beginQuery(queryPool, 0, vk::QueryControlFlags());
+		}
+
+		void end(vk::CommandBuffer commandBuffer)
+		{
+			if (!queryPool)
+			{
+				return;
+			}
+
+			commandBuffer.endQuery(queryPool, 0);
+			recorded = true;
+		}
+
+		// Call once the frame that recorded the query has finished
+		void collect()
+		{
+			if (!recorded)
+			{
+				return;
+			}
+
+			// Results come in flag bit order, vertex invocations first
+			uint64_t data[2] = {};
+			// eNotReady leaves the last results in place, so does a lost device
+			vkUtil::Expected<void> result = vkUtil::vk_call([&]() { return device.getQueryPoolResults(queryPool, 0, 1, sizeof(data), data, sizeof(data), vk::QueryResultFlagBits::e64); });
+			if (result.result() == vk::Result::eSuccess)
+			{
+				lastFrame.vertexInvocations = data[0];
+				lastFrame.fragmentInvocations = data[1];
+			}
+
+			recorded = false;
+		}
+
+		const FrameStatistics& last_frame() const
+		{
+			return lastFrame;
+		}
+
+		void destroy()
+		{
+			// Never initialized
+			if (!device)
+			{
+				return;
+			}
+
+			device.destroyQueryPool(queryPool);
+			queryPool = nullptr;
+		}
+
+	private:
+		vk::Device device{ nullptr };
+		vk::QueryPool queryPool{ nullptr };
+		bool recorded = false;
+		FrameStatistics lastFrame;
+	};
+}
\ No newline at end of file
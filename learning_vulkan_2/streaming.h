@@ -0,0 +1,728 @@
+#pragma once
+
+#include "config.h"
+#include "memory.h"
+#include "bindless.h"
+#include "ktx2.h"
+#include "deletion_queue.h"
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <algorithm>
+
+namespace vkTexture
+{
+	struct streamerInput
+	{
+		vk::Device logicalDevice;
+		const vkUtil::DeviceContext* deviceContext;
+		vk::Queue transferQueue;
+		std::mutex* transferQueueMutex;
+		uint32_t transferFamily;
+		uint32_t graphicsFamily;
+
+		vkUtil::BindlessHeap* bindless;
+		vk::Sampler sampler;
+
+		// Replaced images and spent semaphores go here, the frame being recorded may still use them
+		vkUtil::DeletionQueue* deletionQueue;
+
+		// VK_EXT_memory_budget was enabled, otherwise the budget is a share of the heap size
+		bool memoryBudget;
+	};
+
+	// Levels this size and smaller are the mip tail, they stay resident for the texture's whole life
+	constexpr uint32_t STREAMING_TAIL_SIZE = 128;
+
+	// Share of the device local budget left to the streamed levels, everything else the engine allocates needs room too
+	constexpr float STREAMING_BUDGET_FRACTION = 0.8f;
+
+	// Without VK_EXT_memory_budget we only know the heap size
+	constexpr float STREAMING_HEAP_FRACTION = 0.5f;
+
+	constexpr size_t STREAMING_MAX_LOADS_IN_FLIGHT = 4;
+
+
+	// Keeps textures' higher mips in device memory only while something on screen needs them.
+	// Every texture has a permanently resident mip tail. When draws ask for more detail than is resident,
+	// a worker thread reads the levels from the mapped KTX2 file and uploads a new image holding the
+	// finer levels and everything below them on the transfer queue, then the render thread swaps it into
+	// the texture's bindless slot. Over the budget, the least recently used textures drop back to their tails.
+	// Streamed textures need a plain (not Basis) KTX2 payload with a full mip chain.
+	class TextureStreamer
+	{
+	public:
+		void init(streamerInput input, bool debug)
+		{
+			this->input = input;
+			this->debug = debug;
+
+			// Budget comes from the biggest device local heap
+			const vk::PhysicalDeviceMemoryProperties& memoryProperties = input.deviceContext->memory_properties();
+			for (uint32_t heap = 0; heap < memoryProperties.memoryHeapCount; heap++)
+			{
+				bool deviceLocal = static_cast<bool>(memoryProperties.memoryHeaps[heap].flags & vk::MemoryHeapFlagBits::eDeviceLocal);
+				if (deviceLocal && memoryProperties.memoryHeaps[heap].size > memoryProperties.memoryHeaps[deviceHeap].size)
+				{
+					deviceHeap = heap;
+				}
+			}
+
+			vk::CommandPoolCreateInfo poolInfo = {};
+			poolInfo.flags = vk::CommandPoolCreateFlagBits::eTransient | vk::CommandPoolCreateFlagBits::eResetCommandBuffer;
+			poolInfo.queueFamilyIndex = input.transferFamily;
+
+			vkUtil::Expected<vk::CommandPool> pool = vkUtil::vk_call([&]() { return input.logicalDevice.createCommandPool(poolInfo); });
+			if (!pool)
+			{
+				if (debug)
+				{
+					std::cout << "Failed to create streaming Command Pool :/" << std::endl;
+				}
+				return;
+			}
+			commandPool = pool.value();
+
+			worker = std::thread([this]() { worker_loop(); });
+
+			if (debug)
+			{
+				std::cout << "Texture streaming budget " << budget() / (1024 * 1024) << " MiB"
+					<< (input.memoryBudget ? " (VK_EXT_memory_budget)\n" : " (share of the heap size)\n");
+			}
+		}
+
+
+		// Takes over the file, returns the streamed texture's handle (UINT32_MAX if it can't be streamed).
+		// Its bindless slot is valid once update() reports the tail resident.
+		uint32_t add(std::shared_ptr<MappedFile> file, const Ktx2Info& info)
+		{
+			if (info.basis || info.levelCount < 2)
+			{
+				if (debug)
+				{
+					std::cout << "Streaming needs a plain KTX2 payload with a mip chain :/" << std::endl;
+				}
+				return UINT32_MAX;
+			}
+
+			Entry entry;
+			entry.file = file;
+			entry.info = info;
+
+			// First level that fits the tail size, the coarsest level at worst
+			entry.tailLevel = static_cast<uint32_t>(info.levels.size() - 1);
+			for (uint32_t level = 0; level < info.levels.size(); level++)
+			{
+				if (std::max(info.width >> level, info.height >> level) <= STREAMING_TAIL_SIZE)
+				{
+					entry.tailLevel = level;
+					break;
+				}
+			}
+			entry.residentLevel = entry.tailLevel;
+			entry.wantedLevel = entry.tailLevel;
+
+			entries.push_back(entry);
+			uint32_t handle = static_cast<uint32_t>(entries.size() - 1);
+
+			request_load(handle, entry.tailLevel);
+
+			return handle;
+		}
+
+
+		// Records this frame's demand: the texture covers about screenPixels pixels across on screen
+		void request(uint32_t handle, float screenPixels)
+		{
+			Entry& entry = entries[handle];
+
+			// One texel per pixel is enough, each halving of the screen size drops a level
+			float texelsPerPixel = std::max(entry.info.width, entry.info.height) / std::max(screenPixels, 1.0f);
+			uint32_t level = texelsPerPixel <= 1.0f ? 0 : static_cast<uint32_t>(std::floor(std::log2(texelsPerPixel)));
+
+			entry.wantedLevel = std::min({ entry.wantedLevel, level, entry.tailLevel });
+			entry.lastUsed = frame;
+		}
+
+
+		// Call once per frame from the render thread, after the frame's fence wait.
+		// Swaps in finished loads (appending their semaphores for this frame's submission to wait on),
+		// evicts down to the budget and starts loads for last frame's demand.
+		// Returns the handles whose tails became resident, their bindless slots are now valid.
+		std::vector<uint32_t> update(std::vector<vk::Semaphore>& waitSemaphores, std::vector<vk::PipelineStageFlags>& waitStages)
+		{
+			std::vector<uint32_t> newlyResident = swap_in_finished(waitSemaphores, waitStages);
+
+			vk::DeviceSize limit = budget();
+			while (residentBytes > limit && evict_one(UINT32_MAX))
+			{
+			}
+
+			start_loads(limit);
+
+			// Demand is collected afresh every frame
+			for (Entry& entry : entries)
+			{
+				entry.wantedLevel = entry.tailLevel;
+			}
+			frame++;
+
+			return newlyResident;
+		}
+
+
+		uint32_t bindless_index(uint32_t handle) const
+		{
+			return entries[handle].bindlessIndex;
+		}
+
+
+		// Device memory held by streamed textures, tails included
+		vk::DeviceSize resident_memory() const
+		{
+			return residentBytes;
+		}
+
+
+		void destroy()
+		{
+			if (!commandPool)
+			{
+				return;
+			}
+
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				stopping = true;
+			}
+			jobsAvailable.notify_one();
+			worker.join();
+
+			// Caller has waited for the device to go idle
+			for (Load& load : finished)
+			{
+				destroy_image(load.image);
+				input.logicalDevice.destroySemaphore(load.semaphore);
+			}
+			finished.clear();
+
+			for (Entry& entry : entries)
+			{
+				destroy_image(entry.tail);
+				destroy_image(entry.streamed);
+			}
+			entries.clear();
+
+			input.logicalDevice.destroyCommandPool(commandPool);
+			commandPool = nullptr;
+		}
+
+	private:
+		// Levels baseLevel and below of one texture
+		struct StreamedImage
+		{
+			vk::Image image{ nullptr };
+			vk::DeviceMemory memory{ nullptr };
+			vk::ImageView view{ nullptr };
+			vk::DeviceSize size = 0;
+		};
+
+		struct Entry
+		{
+			std::shared_ptr<MappedFile> file;
+			Ktx2Info info;
+			uint32_t tailLevel;
+
+			StreamedImage tail;
+			StreamedImage streamed;
+			uint32_t bindlessIndex = vkUtil::BINDLESS_INVALID_INDEX;
+
+			// Finest level resident and finest level this frame's draws asked for
+			uint32_t residentLevel;
+			uint32_t wantedLevel;
+
+			uint64_t lastUsed = 0;
+			bool loading = false;
+		};
+
+		// Handed to the worker, and back once the image is ready
+		struct Load
+		{
+			uint32_t handle;
+			uint32_t baseLevel;
+			std::shared_ptr<MappedFile> file;
+			Ktx2Info info;
+			vk::DeviceSize estimate;
+
+			StreamedImage image;
+			vk::Semaphore semaphore{ nullptr };
+			bool succeeded = false;
+		};
+
+		streamerInput input;
+		bool debug;
+
+		uint32_t deviceHeap = 0;
+		vk::CommandPool commandPool{ nullptr };
+
+		std::vector<Entry> entries;
+		vk::DeviceSize residentBytes = 0;
+		vk::DeviceSize loadingBytes = 0;
+		size_t loadsInFlight = 0;
+		uint64_t frame = 1;
+
+		// Shared with the worker
+		std::thread worker;
+		std::mutex mutex;
+		std::condition_variable jobsAvailable;
+		std::deque<Load> jobs;
+		std::vector<Load> finished;
+		bool stopping = false;
+
+
+		vk::DeviceSize budget() const
+		{
+			if (input.memoryBudget)
+			{
+				// Changes as other applications allocate, so this one still asks the driver every time
+				vk::StructureChain<vk::PhysicalDeviceMemoryProperties2, vk::PhysicalDeviceMemoryBudgetPropertiesEXT> properties =
+					input.deviceContext->physical_device().getMemoryProperties2<vk::PhysicalDeviceMemoryProperties2, vk::PhysicalDeviceMemoryBudgetPropertiesEXT>();
+				const vk::PhysicalDeviceMemoryBudgetPropertiesEXT& heaps = properties.get<vk::PhysicalDeviceMemoryBudgetPropertiesEXT>();
+
+				// Usage includes our own textures, only what everyone else uses is off limits
+				vk::DeviceSize othersUsage = heaps.heapUsage[deviceHeap] - std::min(heaps.heapUsage[deviceHeap], residentBytes);
+				vk::DeviceSize available = heaps.heapBudget[deviceHeap] - std::min(heaps.heapBudget[deviceHeap], othersUsage);
+
+				return static_cast<vk::DeviceSize>(available * STREAMING_BUDGET_FRACTION);
+			}
+
+			const vk::PhysicalDeviceMemoryProperties& memoryProperties = input.deviceContext->memory_properties();
+			return static_cast<vk::DeviceSize>(memoryProperties.memoryHeaps[deviceHeap].size * STREAMING_HEAP_FRACTION);
+		}
+
+
+		std::vector<uint32_t> swap_in_finished(std::vector<vk::Semaphore>& waitSemaphores, std::vector<vk::PipelineStageFlags>& waitStages)
+		{
+			std::vector<Load> loads;
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				loads.swap(finished);
+			}
+
+			std::vector<uint32_t> newlyResident;
+
+			for (Load& load : loads)
+			{
+				Entry& entry = entries[load.handle];
+				entry.loading = false;
+				loadsInFlight--;
+				loadingBytes -= load.estimate;
+
+				if (!load.succeeded)
+				{
+					continue;
+				}
+
+				// Already signalled, the wait only orders the transfer queue's writes before our reads
+				waitSemaphores.push_back(load.semaphore);
+				waitStages.push_back(vk::PipelineStageFlagBits::eFragmentShader);
+				input.deletionQueue->retire(load.semaphore);
+
+				residentBytes += load.image.size;
+
+				if (load.baseLevel == entry.tailLevel)
+				{
+					entry.tail = load.image;
+					entry.bindlessIndex = input.bindless->add_texture(entry.tail.view, input.sampler);
+					newlyResident.push_back(load.handle);
+					continue;
+				}
+
+				// Frames still in flight may sample the old image
+				retire(entry.streamed);
+				entry.streamed = load.image;
+				entry.residentLevel = load.baseLevel;
+				input.bindless->update_texture(entry.bindlessIndex, entry.streamed.view, input.sampler);
+			}
+
+			return newlyResident;
+		}
+
+
+		// Drops the least recently used texture not drawn last frame back to its tail
+		bool evict_one(uint32_t keep)
+		{
+			Entry* victim = nullptr;
+			for (uint32_t handle = 0; handle < entries.size(); handle++)
+			{
+				Entry& entry = entries[handle];
+				bool evictable = handle != keep && entry.streamed.image && entry.lastUsed < frame;
+				if (evictable && (!victim || entry.lastUsed < victim->lastUsed))
+				{
+					victim = &entry;
+				}
+			}
+
+			if (!victim)
+			{
+				return false;
+			}
+
+			input.bindless->update_texture(victim->bindlessIndex, victim->tail.view, input.sampler);
+			retire(victim->streamed);
+			victim->residentLevel = victim->tailLevel;
+
+			return true;
+		}
+
+
+		void start_loads(vk::DeviceSize limit)
+		{
+			// Textures drawn most recently first, then the ones missing the most detail
+			std::vector<uint32_t> candidates;
+			for (uint32_t handle = 0; handle < entries.size(); handle++)
+			{
+				const Entry& entry = entries[handle];
+				if (!entry.loading && entry.tail.image && entry.wantedLevel < entry.residentLevel)
+				{
+					candidates.push_back(handle);
+				}
+			}
+
+			std::sort(candidates.begin(), candidates.end(), [this](uint32_t a, uint32_t b)
+				{
+					const Entry& first = entries[a];
+					const Entry& second = entries[b];
+					if (first.lastUsed != second.lastUsed)
+					{
+						return first.lastUsed > second.lastUsed;
+					}
+					return first.residentLevel - first.wantedLevel > second.residentLevel - second.wantedLevel;
+				});
+
+			for (uint32_t handle : candidates)
+			{
+				if (loadsInFlight >= STREAMING_MAX_LOADS_IN_FLIGHT)
+				{
+					return;
+				}
+
+				Entry& entry = entries[handle];
+
+				// The new image replaces the streamed one, so only the difference is new memory
+				vk::DeviceSize estimate = level_bytes(entry.info, entry.wantedLevel);
+				while (residentBytes + loadingBytes + estimate > limit + entry.streamed.size && evict_one(handle))
+				{
+				}
+
+				if (residentBytes + loadingBytes + estimate > limit + entry.streamed.size)
+				{
+					continue;
+				}
+
+				request_load(handle, entry.wantedLevel);
+			}
+		}
+
+
+		// Bytes of baseLevel and everything below it in the file, close to what the image will take
+		vk::DeviceSize level_bytes(const Ktx2Info& info, uint32_t baseLevel) const
+		{
+			vk::DeviceSize bytes = 0;
+			for (uint32_t level = baseLevel; level < info.levels.size(); level++)
+			{
+				bytes += info.levels[level].byteLength;
+			}
+			return bytes;
+		}
+
+
+		void request_load(uint32_t handle, uint32_t baseLevel)
+		{
+			Entry& entry = entries[handle];
+			entry.loading = true;
+
+			Load load;
+			load.handle = handle;
+			load.baseLevel = baseLevel;
+			load.file = entry.file;
+			load.info = entry.info;
+			load.estimate = level_bytes(entry.info, baseLevel);
+
+			loadsInFlight++;
+			loadingBytes += load.estimate;
+
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				jobs.push_back(std::move(load));
+			}
+			jobsAvailable.notify_one();
+		}
+
+
+		void retire(StreamedImage& image)
+		{
+			if (image.image)
+			{
+				residentBytes -= image.size;
+				input.deletionQueue->retire(image.view);
+				input.deletionQueue->retire(image.image);
+				input.deletionQueue->retire(image.memory);
+			}
+			image = StreamedImage();
+		}
+
+
+		void destroy_image(StreamedImage& image)
+		{
+			input.logicalDevice.destroyImageView(image.view);
+			input.logicalDevice.destroyImage(image.image);
+			input.logicalDevice.freeMemory(image.memory);
+			image = StreamedImage();
+		}
+
+
+		void worker_loop()
+		{
+			while (true)
+			{
+				Load load;
+
+				{
+					std::unique_lock<std::mutex> lock(mutex);
+					jobsAvailable.wait(lock, [this]() { return stopping || !jobs.empty(); });
+
+					if (stopping)
+					{
+						return;
+					}
+
+					load = std::move(jobs.front());
+					jobs.pop_front();
+				}
+
+				load.succeeded = run_load(load);
+
+				std::lock_guard<std::mutex> lock(mutex);
+				finished.push_back(std::move(load));
+			}
+		}
+
+
+		// Worker thread: reads the levels out of the mapping into staging and copies them into a fresh image.
+		// Blocks until the copy is done, the render thread only ever sees finished images.
+		bool run_load(Load& load)
+		{
+			const Ktx2Info& info = load.info;
+			vk::Device device = input.logicalDevice;
+
+			uint32_t levelCount = static_cast<uint32_t>(info.levels.size()) - load.baseLevel;
+			uint32_t width = std::max(info.width >> load.baseLevel, 1u);
+			uint32_t height = std::max(info.height >> load.baseLevel, 1u);
+
+			// Written by the transfer queue and read by the graphics queue without ownership transfers
+			std::vector<uint32_t> families = { input.graphicsFamily };
+			if (input.transferFamily != input.graphicsFamily)
+			{
+				families.push_back(input.transferFamily);
+			}
+
+			vk::ImageCreateInfo imageInfo = {};
+			imageInfo.imageType = vk::ImageType::e2D;
+			imageInfo.format = info.format;
+			imageInfo.extent = vk::Extent3D(width, height, 1);
+			imageInfo.mipLevels = levelCount;
+			imageInfo.arrayLayers = 1;
+			imageInfo.samples = vk::SampleCountFlagBits::e1;
+			imageInfo.tiling = vk::ImageTiling::eOptimal;
+			imageInfo.usage = vk::ImageUsageFlagBits::eTransferDst | vk::ImageUsageFlagBits::eSampled;
+			imageInfo.sharingMode = families.size() > 1 ? vk::SharingMode::eConcurrent : vk::SharingMode::eExclusive;
+			imageInfo.queueFamilyIndexCount = static_cast<uint32_t>(families.size());
+			imageInfo.pQueueFamilyIndices = families.data();
+			imageInfo.initialLayout = vk::ImageLayout::eUndefined;
+
+			vkUtil::Buffer staging = {};
+			vk::CommandBuffer commandBuffer = nullptr;
+			vk::Fence fence = nullptr;
+
+			auto upload = [&]()
+			{
+				vkUtil::Expected<vk::Image> image = vkUtil::vk_call([&]() { return device.createImage(imageInfo); });
+				if (!image)
+				{
+					return false;
+				}
+				load.image.image = image.value();
+
+				vk::MemoryRequirements memoryRequirements = device.getImageMemoryRequirements(load.image.image);
+				load.image.size = memoryRequirements.size;
+
+				vk::MemoryAllocateInfo allocInfo = {};
+				allocInfo.allocationSize = memoryRequirements.size;
+				allocInfo.memoryTypeIndex = vkUtil::findMemoryTypeIndex(*input.deviceContext, memoryRequirements.memoryTypeBits, vk::MemoryPropertyFlagBits::eDeviceLocal);
+				vkUtil::Expected<vk::DeviceMemory> memory = vkUtil::vk_call([&]() { return device.allocateMemory(allocInfo); });
+				if (!memory)
+				{
+					return false;
+				}
+				load.image.memory = memory.value();
+
+				if (!vkUtil::vk_call([&]() { return device.bindImageMemory(load.image.image, load.image.memory, 0); }))
+				{
+					return false;
+				}
+
+				load.image.view = make_view(device, load.image.image, info.format, 0, levelCount);
+				if (!load.image.view)
+				{
+					return false;
+				}
+
+
+				// The page faults reading the mapping are the file I/O, they happen here rather than on the render thread
+				vkUtil::BufferInputChunk bufferInput;
+				bufferInput.size = level_bytes(info, load.baseLevel) + 16 * levelCount;
+				bufferInput.usage = vk::BufferUsageFlagBits::eTransferSrc;
+				bufferInput.logicalDevice = device;
+				bufferInput.deviceContext = input.deviceContext;
+				bufferInput.memoryProperties = vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent;
+				staging = vkUtil::createBuffer(bufferInput, debug);
+				if (!staging.buffer)
+				{
+					return false;
+				}
+
+				vkUtil::Expected<void*> mapping = vkUtil::vk_call([&]() { return device.mapMemory(staging.bufferMemory, 0, staging.size); });
+				if (!mapping)
+				{
+					return false;
+				}
+				uint8_t* mapped = static_cast<uint8_t*>(mapping.value());
+
+				std::vector<vk::BufferImageCopy> regions;
+				vk::DeviceSize offset = 0;
+				for (uint32_t level = 0; level < levelCount; level++)
+				{
+					const Ktx2Level& source = info.levels[load.baseLevel + level];
+					memcpy(mapped + offset, load.file->data() + source.byteOffset, source.byteLength);
+
+					vk::BufferImageCopy region = {};
+					region.bufferOffset = offset;
+					region.imageSubresource = vk::ImageSubresourceLayers(vk::ImageAspectFlagBits::eColor, level, 0, 1);
+					region.imageExtent = vk::Extent3D(std::max(width >> level, 1u), std::max(height >> level, 1u), 1);
+					regions.push_back(region);
+
+					offset = (offset + source.byteLength + 15) & ~vk::DeviceSize(15);
+				}
+
+				device.unmapMemory(staging.bufferMemory);
+
+
+				vk::CommandBufferAllocateInfo commandBufferInfo(commandPool, vk::CommandBufferLevel::ePrimary, 1);
+				vkUtil::Expected<std::vector<vk::CommandBuffer>> commandBuffers = vkUtil::vk_call([&]() { return device.allocateCommandBuffers(commandBufferInfo); });
+				if (!commandBuffers)
+				{
+					return false;
+				}
+				commandBuffer = commandBuffers.value()[0];
+
+				vk::CommandBufferBeginInfo beginInfo = {};
+				beginInfo.flags = vk::CommandBufferUsageFlagBits::eOneTimeSubmit;
+				if (!vkUtil::vk_call([&]() { return commandBuffer.begin(beginInfo); }))
+				{
+					return false;
+				}
+
+				vk::ImageSubresourceRange range(vk::ImageAspectFlagBits::eColor, 0, levelCount, 0, 1);
+
+				vk::ImageMemoryBarrier toTransfer = {};
+				toTransfer.dstAccessMask = vk::AccessFlagBits::eTransferWrite;
+				toTransfer.oldLayout = vk::ImageLayout::eUndefined;
+				toTransfer.newLayout = vk::ImageLayout::eTransferDstOptimal;
+				toTransfer.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+				toTransfer.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+				toTransfer.image = load.image.image;
+				toTransfer.subresourceRange = range;
+				commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eTopOfPipe, vk::PipelineStageFlagBits::eTransfer,
+					vk::DependencyFlags(), 0, nullptr, 0, nullptr, 1, &toTransfer);
+
+				commandBuffer.copyBufferToImage(staging.buffer, load.image.image, vk::ImageLayout::eTransferDstOptimal,
+					static_cast<uint32_t>(regions.size()), regions.data());
+
+				// Concurrent sharing, so the transfer queue can leave it ready to sample.
+				// The semaphore the render thread waits on makes the writes visible.
+				vk::ImageMemoryBarrier toShader = toTransfer;
+				toShader.srcAccessMask = vk::AccessFlagBits::eTransferWrite;
+				toShader.dstAccessMask = vk::AccessFlags();
+				toShader.oldLayout = vk::ImageLayout::eTransferDstOptimal;
+				toShader.newLayout = vk::ImageLayout::eShaderReadOnlyOptimal;
+				commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eBottomOfPipe,
+					vk::DependencyFlags(), 0, nullptr, 0, nullptr, 1, &toShader);
+
+				if (!vkUtil::vk_call([&]() { return commandBuffer.end(); }))
+				{
+					return false;
+				}
+
+				vkUtil::Expected<vk::Fence> uploaded = vkUtil::vk_call([&]() { return device.createFence(vk::FenceCreateInfo()); });
+				if (!uploaded)
+				{
+					return false;
+				}
+				fence = uploaded.value();
+
+				vkUtil::Expected<vk::Semaphore> semaphore = vkUtil::vk_call([&]() { return device.createSemaphore(vk::SemaphoreCreateInfo()); });
+				if (!semaphore)
+				{
+					return false;
+				}
+				load.semaphore = semaphore.value();
+
+				vk::SubmitInfo submitInfo = {};
+				submitInfo.commandBufferCount = 1;
+				submitInfo.pCommandBuffers = &commandBuffer;
+				submitInfo.signalSemaphoreCount = 1;
+				submitInfo.pSignalSemaphores = &load.semaphore;
+
+				vkUtil::Expected<void> submitted;
+				{
+					std::lock_guard<std::mutex> lock(*input.transferQueueMutex);
+					submitted = vkUtil::vk_call([&]() { return input.transferQueue.submit(submitInfo, fence); });
+				}
+
+				return submitted && vkUtil::vk_call([&]() { return device.waitForFences(1, &fence, VK_TRUE, UINT64_MAX); });
+			};
+
+			if (!upload())
+			{
+				// Usually out of device memory, the texture stays at the detail it has
+				if (debug)
+				{
+					std::cout << "Failed to stream in a " << width << "x" << height << " texture :/" << std::endl;
+				}
+
+				destroy_image(load.image);
+				if (load.semaphore)
+				{
+					device.destroySemaphore(load.semaphore);
+					load.semaphore = nullptr;
+				}
+			}
+
+			if (commandBuffer)
+			{
+				device.freeCommandBuffers(commandPool, 1, &commandBuffer);
+			}
+			device.destroyFence(fence);
+			if (staging.buffer)
+			{
+				vkUtil::destroyBuffer(device, staging);
+			}
+
+			return static_cast<bool>(load.image.image);
+		}
+	};
+}
\ No newline at end of file
@@ -2,7 +2,9 @@
 
 #include "config.h"
 #include "logging.h"
-#include "queue_families.h"
+#include "startup_profiler.h"
+#include "device_context.h"
+#include "result.h"
 #include "frame.h"
 
 
@@ -29,7 +31,13 @@ namespace vkInit
 		SwapchainSupportDetails support;
 
 		// Capabilities
-		support.capabilities = device.getSurfaceCapabilitiesKHR(surface);
+		// A surface that can't be asked (lost, or its window gone) has no formats or present modes either
+		vkUtil::Expected<vk::SurfaceCapabilitiesKHR> capabilities = vkUtil::vk_call([&]() { return device.getSurfaceCapabilitiesKHR(surface); });
+		if (!capabilities)
+		{
+			return support;
+		}
+		support.capabilities = capabilities.value();
 
 		if (debug)
 		{
@@ -84,7 +92,7 @@ namespace vkInit
 
 
 		// Formats
-		support.formats = device.getSurfaceFormatsKHR(surface);
+		support.formats = vkUtil::vk_call([&]() { return device.getSurfaceFormatsKHR(surface); }).value_or({});
 
 		if (debug)
 		{
@@ -97,7 +105,7 @@ namespace vkInit
 
 
 		// Present modes
-		support.presentModes = device.getSurfacePresentModesKHR(surface);
+		support.presentModes = vkUtil::vk_call([&]() { return device.getSurfacePresentModesKHR(surface); }).value_or({});
 
 		for (vk::PresentModeKHR presentMode : support.presentModes)
 		{
@@ -109,8 +117,20 @@ namespace vkInit
 	}
 
 
-	vk::SurfaceFormatKHR choose_swapchain_surface_format(std::vector<vk::SurfaceFormatKHR> formats)
+	vk::SurfaceFormatKHR choose_swapchain_surface_format(std::vector<vk::SurfaceFormatKHR> formats, vk::Format requiredFormat)
 	{
+		// Windows after the first have to match the render pass the pipelines were made for
+		if (requiredFormat != vk::Format::eUndefined)
+		{
+			for (vk::SurfaceFormatKHR format : formats)
+			{
+				if (format.format == requiredFormat)
+				{
+					return format;
+				}
+			}
+		}
+
 		// Check if our preferred format is available
 		for (vk::SurfaceFormatKHR format : formats)
 		{
@@ -121,8 +141,8 @@ namespace vkInit
 			}
 		}
 
-		// Otherwise, just return any format
-		return formats[0];
+		// Otherwise, just return any format, eUndefined if the surface couldn't list any
+		return formats.empty() ? vk::SurfaceFormatKHR() : formats[0];
 	}
 
 
@@ -165,20 +185,35 @@ namespace vkInit
 				capabilities.maxImageExtent.height,
 				std::max(capabilities.minImageExtent.height, height)
 			);
+
+			return extent;
 		}
 	}
 
 
-	SwapchainBundle create_swapchain(vk::Device logicalDevice, vk::PhysicalDevice physicalDevice, vk::SurfaceKHR surface, int width, int height, bool debug)
+	// requiredFormat is undefined if any format will do. oldSwapchain is the one being replaced, if any,
+	// it is retired but still has to be destroyed by the caller. The bundle's swapchain is null if creation failed.
+	SwapchainBundle create_swapchain(vk::Device logicalDevice, const vkUtil::DeviceContext& deviceContext, vk::SurfaceKHR surface, int width, int height,
+		vk::Format requiredFormat, vk::SwapchainKHR oldSwapchain, bool debug)
 	{
+		vkUtil::StartupProfiler::Scope timer("create_swapchain");
+
 		if (debug)
 		{
 			std::cout << "Creating Swapchain...\n";
 		}
 
-		SwapchainSupportDetails support = query_swapchain_support(physicalDevice, surface, debug);
+		SwapchainSupportDetails support = query_swapchain_support(deviceContext.physical_device(), surface, debug);
+		if (support.formats.empty() || support.presentModes.empty())
+		{
+			if (debug)
+			{
+				std::cout << "Failed to query the surface for a swapchain :/\n";
+			}
+			return SwapchainBundle{};
+		}
 
-		vk::SurfaceFormatKHR format = choose_swapchain_surface_format(support.formats);
+		vk::SurfaceFormatKHR format = choose_swapchain_surface_format(support.formats, requiredFormat);
 
 		vk::PresentModeKHR presentMode = choose_swapchain_present_mode(support.presentModes);
 
@@ -198,7 +233,7 @@ namespace vkInit
 			format.colorSpace, extent, 1, vk::ImageUsageFlagBits::eColorAttachment
 		);
 
-		vkUtil::QueueFamilyIndices indices = vkUtil::findQueueFamilies(physicalDevice, surface, debug);
+		const vkUtil::QueueFamilyIndices& indices = deviceContext.queue_families();
 		uint32_t queueFamilyIndices[] = { indices.graphicsFamily.value(), indices.presentFamily.value() };
 
 		if (queueFamilyIndices[0] != queueFamilyIndices[1])
@@ -217,28 +252,56 @@ namespace vkInit
 		createInfo.presentMode = presentMode;
 		createInfo.clipped = VK_TRUE;
 
-		createInfo.oldSwapchain = vk::SwapchainKHR(nullptr);
+		createInfo.oldSwapchain = oldSwapchain;
 
 
 		SwapchainBundle bundle{};
 
-		try
-		{
-			bundle.swapchain = logicalDevice.createSwapchainKHR(createInfo);
+		vkUtil::Expected<vk::SwapchainKHR> swapchain = vkUtil::vk_call([&]()
+			{
+				vkUtil::StartupProfiler::Scope driverTimer("vkCreateSwapchainKHR", vkUtil::StartupProfiler::Category::eDriver);
+				return logicalDevice.createSwapchainKHR(createInfo);
+			});
 
+		if (!swapchain)
+		{
 			if (debug)
 			{
-				std::cout << "Successfully created swapchain!\n";
+				std::cout << "Failed to create swapchain :/\n";
 			}
+			return bundle;
 		}
-		catch (vk::SystemError err)
+
+		bundle.swapchain = swapchain.value();
+
+		if (debug)
 		{
-			throw std::runtime_error("Failed to create swapchain :/\n");
+			std::cout << "Successfully created swapchain!\n";
 		}
 
 
+		// Without its images or their views the swapchain is no use, it goes and the bundle says it failed
+		auto failed = [&]()
+		{
+			if (debug)
+			{
+				std::cout << "Failed to create swapchain image views :/\n";
+			}
+			for (const vkUtil::SwapchainFrame& frame : bundle.frames)
+			{
+				logicalDevice.destroyImageView(frame.imageView);
+			}
+			logicalDevice.destroySwapchainKHR(bundle.swapchain);
+			return SwapchainBundle{};
+		};
+
 		// Create imageviews for the swapchain
-		std::vector<vk::Image> images = logicalDevice.getSwapchainImagesKHR(bundle.swapchain);
+		vkUtil::Expected<std::vector<vk::Image>> swapchainImages = vkUtil::vk_call([&]() { return logicalDevice.getSwapchainImagesKHR(bundle.swapchain); });
+		if (!swapchainImages)
+		{
+			return failed();
+		}
+		const std::vector<vk::Image>& images = swapchainImages.value();
 		
 		bundle.frames.resize(images.size());
 
@@ -267,7 +330,16 @@ namespace vkInit
 
 
 			bundle.frames[ii].image = images[ii];
-			bundle.frames[ii].imageView = logicalDevice.createImageView(createInfo);
+			vkUtil::Expected<vk::ImageView> view = vkUtil::vk_call([&]()
+				{
+					vkUtil::StartupProfiler::Scope driverTimer("vkCreateImageView", vkUtil::StartupProfiler::Category::eDriver);
+					return logicalDevice.createImageView(createInfo);
+				});
+			if (!view)
+			{
+				return failed();
+			}
+			bundle.frames[ii].imageView = view.value();
 		}
 
 		bundle.format = format.format;
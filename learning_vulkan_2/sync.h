@@ -1,6 +1,8 @@
 #pragma once
 
 #include "config.h"
+#include "startup_profiler.h"
+#include "result.h"
 
 namespace vkInit
 {
@@ -9,11 +11,13 @@ namespace vkInit
 		vk::SemaphoreCreateInfo semaphoreInfo = {};
 		semaphoreInfo.flags = vk::SemaphoreCreateFlags();
 
-		try
-		{
-			return device.createSemaphore(semaphoreInfo);
-		}
-		catch (vk::SystemError err)
+		vkUtil::Expected<vk::Semaphore> semaphore = vkUtil::vk_call([&]()
+			{
+				vkUtil::StartupProfiler::Scope driverTimer("vkCreateSemaphore", vkUtil::StartupProfiler::Category::eDriver);
+				return device.createSemaphore(semaphoreInfo);
+			});
+
+		if (!semaphore)
 		{
 			if (debug)
 			{
@@ -21,6 +25,8 @@ namespace vkInit
 			}
 			return nullptr;
 		}
+
+		return semaphore.value();
 	}
 
 
@@ -29,11 +35,13 @@ namespace vkInit
 		vk::FenceCreateInfo fenceInfo = {};
 		fenceInfo.flags = vk::FenceCreateFlags() | vk::FenceCreateFlagBits::eSignaled;
 
-		try
-		{
-			return device.createFence(fenceInfo);
-		}
-		catch (vk::SystemError err)
+		vkUtil::Expected<vk::Fence> fence = vkUtil::vk_call([&]()
+			{
+				vkUtil::StartupProfiler::Scope driverTimer("vkCreateFence", vkUtil::StartupProfiler::Category::eDriver);
+				return device.createFence(fenceInfo);
+			});
+
+		if (!fence)
 		{
 			if (debug)
 			{
@@ -41,5 +49,7 @@ namespace vkInit
 			}
 			return nullptr;
 		}
+
+		return fence.value();
 	}
 }
\ No newline at end of file
@@ -0,0 +1,216 @@
+#include "task_graph.h"
+
+#include <deque>
+
+
+struct TaskGraph::State : std::enable_shared_from_this<TaskGraph::State>
+{
+	struct Node
+	{
+		const char* name;
+		std::function<void()> job;
+		std::vector<Task> dependents;
+		uint32_t dependencies = 0;
+
+		// Dependencies still running, and whether one of them failed
+		uint32_t pending = 0;
+		bool skipped = false;
+
+		std::chrono::steady_clock::time_point started;
+		std::chrono::steady_clock::time_point finished;
+		std::thread::id thread;
+	};
+
+	std::vector<Node> nodes;
+
+	// Null when running serially
+	ThreadPool* threadPool = nullptr;
+
+	std::mutex mutex;
+	std::condition_variable changed;
+	std::deque<Task> ready;
+	size_t finished = 0;
+	std::exception_ptr error;
+
+	// Runs the task (unless a dependency failed) and releases its dependents
+	void execute(Task task);
+
+	// Takes one ready task and executes it, returns false if none was ready
+	bool execute_ready();
+};
+
+
+TaskGraph::TaskGraph()
+	: state(std::make_shared<State>())
+{
+}
+
+
+TaskGraph::Task TaskGraph::add(const char* name, std::function<void()> job, std::initializer_list<Task> dependencies)
+{
+	Task task = static_cast<Task>(state->nodes.size());
+
+	State::Node node;
+	node.name = name;
+	node.job = std::move(job);
+	for (Task dependency : dependencies)
+	{
+		state->nodes[dependency].dependents.push_back(task);
+		node.dependencies++;
+	}
+
+	state->nodes.push_back(std::move(node));
+	return task;
+}
+
+
+size_t TaskGraph::size() const
+{
+	return state->nodes.size();
+}
+
+
+void TaskGraph::State::execute(Task task)
+{
+	// Nobody writes skipped once the task is ready
+	bool failed = nodes[task].skipped;
+	nodes[task].thread = std::this_thread::get_id();
+	nodes[task].started = std::chrono::steady_clock::now();
+	if (!failed)
+	{
+		try
+		{
+			nodes[task].job();
+		}
+		catch (...)
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (!error)
+			{
+				error = std::current_exception();
+			}
+			failed = true;
+		}
+	}
+	nodes[task].finished = std::chrono::steady_clock::now();
+
+	size_t released = 0;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		for (Task dependent : nodes[task].dependents)
+		{
+			Node& node = nodes[dependent];
+			node.skipped = node.skipped || failed;
+			if (--node.pending == 0 && threadPool)
+			{
+				ready.push_back(dependent);
+				released++;
+			}
+		}
+		finished++;
+	}
+	changed.notify_all();
+
+	// One job per released task, whoever gets there first runs it
+	for (size_t ii = 0; ii < released; ii++)
+	{
+		std::shared_ptr<State> shared = shared_from_this();
+		threadPool->submit([shared]() { shared->execute_ready(); });
+	}
+}
+
+
+std::vector<TaskGraph::Timing> TaskGraph::timings() const
+{
+	std::vector<Timing> timings;
+	for (const State::Node& node : state->nodes)
+	{
+		timings.push_back({ node.name, node.started, node.finished, node.thread });
+	}
+	return timings;
+}
+
+
+bool TaskGraph::State::execute_ready()
+{
+	Task task;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (ready.empty())
+		{
+			return false;
+		}
+
+		task = ready.front();
+		ready.pop_front();
+	}
+
+	execute(task);
+	return true;
+}
+
+
+void TaskGraph::run(ThreadPool* threadPool)
+{
+	state->threadPool = threadPool && threadPool->size() > 0 ? threadPool : nullptr;
+	state->ready.clear();
+	state->finished = 0;
+	state->error = nullptr;
+	for (State::Node& node : state->nodes)
+	{
+		node.pending = node.dependencies;
+		node.skipped = false;
+	}
+
+	// Dependencies always come first, so adding order never reaches a task before its dependencies
+	if (!state->threadPool)
+	{
+		for (Task task = 0; task < state->nodes.size(); task++)
+		{
+			state->execute(task);
+		}
+	}
+	else
+	{
+		size_t roots = 0;
+		{
+			std::lock_guard<std::mutex> lock(state->mutex);
+			for (Task task = 0; task < state->nodes.size(); task++)
+			{
+				if (state->nodes[task].dependencies == 0)
+				{
+					state->ready.push_back(task);
+					roots++;
+				}
+			}
+		}
+
+		std::shared_ptr<State> shared = state;
+		for (size_t ii = 0; ii < roots; ii++)
+		{
+			state->threadPool->submit([shared]() { shared->execute_ready(); });
+		}
+
+		// The calling thread takes ready tasks too, and sleeps while there are none
+		size_t total = state->nodes.size();
+		while (true)
+		{
+			if (state->execute_ready())
+			{
+				continue;
+			}
+
+			std::unique_lock<std::mutex> lock(state->mutex);
+			state->changed.wait(lock, [&]() { return state->finished == total || !state->ready.empty(); });
+			if (state->finished == total)
+			{
+				break;
+			}
+		}
+	}
+
+	if (state->error)
+	{
+		std::rethrow_exception(state->error);
+	}
+}
\ No newline at end of file
@@ -0,0 +1,45 @@
+#pragma once
+
+#include "config.h"
+#include "thread_pool.h"
+
+#include <chrono>
+#include <exception>
+#include <initializer_list>
+#include <memory>
+
+
+// Jobs and the jobs they wait for, each one runs as soon as everything it depends on has finished.
+// Dependencies have to be added before the tasks depending on them, so adding order is always a valid serial order.
+class TaskGraph
+{
+public:
+	using Task = uint32_t;
+
+	struct Timing
+	{
+		const char* name;
+		std::chrono::steady_clock::time_point start;
+		std::chrono::steady_clock::time_point end;
+		std::thread::id thread;
+	};
+
+	TaskGraph();
+
+	Task add(const char* name, std::function<void()> job, std::initializer_list<Task> dependencies = {});
+
+	// Runs every task on the pool's workers and the calling thread, returns once all of them are done.
+	// Without a pool they run one after the other on the calling thread, in the order they were added.
+	// If a task throws, the tasks depending on it are skipped and the first exception is rethrown here.
+	void run(ThreadPool* threadPool);
+
+	size_t size() const;
+
+	// When and on which thread each task of the last run() ran, in adding order. Skipped tasks start and end together.
+	std::vector<Timing> timings() const;
+
+private:
+	// Shared with the pool's jobs, which may wake up after run() has returned
+	struct State;
+	std::shared_ptr<State> state;
+};
\ No newline at end of file
@@ -0,0 +1,480 @@
+#pragma once
+
+#include "config.h"
+#include "memory.h"
+#include "upload.h"
+#include "descriptors.h"
+#include "bindless.h"
+#include "push_constants.h"
+
+#include <cmath>
+
+namespace vkTexture
+{
+	// Tightly packed levels, largest first. With a single level the mip chain can be built from it on the GPU.
+	struct TextureData
+	{
+		const void* pixels;
+		vk::DeviceSize size;
+		uint32_t width;
+		uint32_t height;
+		vk::Format format;
+		bool generateMips = true;
+
+		// Where each level starts in pixels, empty if pixels only holds the base level
+		std::vector<vk::DeviceSize> levelOffsets;
+	};
+
+	// How a texture's mip chain gets built
+	enum class MipGeneration
+	{
+		eNone,
+		eBlit,
+		eCompute
+	};
+
+	struct Texture
+	{
+		vk::Image image;
+		vk::DeviceMemory memory;
+		vk::ImageView view;
+		vk::Format format;
+		vk::Extent2D extent;
+		uint32_t mipLevels;
+		MipGeneration mipGeneration;
+
+		// One view per level, only the compute downsampler needs them
+		std::vector<vk::ImageView> levelViews;
+
+		// Size of the image's allocation, mip chain included
+		vk::DeviceSize memorySize;
+
+		// Mips are generated by the frame that acquires the upload, from then on the texture can be sampled
+		vkUtil::UploadBatch uploadBatch;
+		bool resident = false;
+		uint32_t bindlessIndex = vkUtil::BINDLESS_INVALID_INDEX;
+
+		// Set if a TextureStreamer owns the images, the handles above stay empty then
+		uint32_t streamedHandle = UINT32_MAX;
+	};
+
+	struct textureUploadInput
+	{
+		vk::Device logicalDevice;
+		const vkUtil::DeviceContext* deviceContext;
+		vkUtil::AsyncUploader* uploader;
+
+		// Whether the compute downsampler exists, for formats that can't be blitted
+		bool computeMips;
+	};
+
+	// Mirrored in downsample.comp
+	struct DownsampleConstants
+	{
+		uint32_t sourceSize[2];
+		uint32_t destinationSize[2];
+	};
+
+	// 2x2 box filter from one level into the next, for formats without linear filtering
+	struct MipDownsampler
+	{
+		vk::DescriptorSetLayout setLayout{ nullptr };
+		vk::PipelineLayout layout{ nullptr };
+		vk::Pipeline pipeline{ nullptr };
+
+		// texelFetch ignores filtering, but a linear sampler on such a format isn't allowed at all
+		vk::Sampler sampler{ nullptr };
+
+		vkUtil::PushConstantBlock<DownsampleConstants> constants;
+	};
+
+
+	inline uint32_t mip_level_count(uint32_t width, uint32_t height)
+	{
+		return static_cast<uint32_t>(std::floor(std::log2(std::max(width, height)))) + 1;
+	}
+
+
+	// Blit where the format can be linearly filtered, the compute downsampler where it can at least be
+	// sampled and written as a storage image, no mips otherwise
+	inline MipGeneration choose_mip_generation(const vkUtil::DeviceContext& deviceContext, vk::Format format, bool computeMips, bool debug)
+	{
+		vk::FormatFeatureFlags features = deviceContext.format_properties(format).optimalTilingFeatures;
+
+		vk::FormatFeatureFlags blitFeatures = vk::FormatFeatureFlagBits::eBlitSrc | vk::FormatFeatureFlagBits::eBlitDst
+			| vk::FormatFeatureFlagBits::eSampledImageFilterLinear;
+		if ((features & blitFeatures) == blitFeatures)
+		{
+			return MipGeneration::eBlit;
+		}
+
+		// The downsampler averages floats, integer formats would need their own shader
+		std::string numericFormat = vk::componentNumericFormat(format, 0);
+		bool integer = numericFormat == "UINT" || numericFormat == "SINT";
+
+		vk::FormatFeatureFlags computeFeatures = vk::FormatFeatureFlagBits::eSampledImage | vk::FormatFeatureFlagBits::eStorageImage;
+		if (computeMips && !integer && (features & computeFeatures) == computeFeatures)
+		{
+			return MipGeneration::eCompute;
+		}
+
+		if (debug)
+		{
+			std::cout << "Can't generate mips for " << vk::to_string(format) << ", using the base level only\n";
+		}
+		return MipGeneration::eNone;
+	}
+
+
+	// Null if the view couldn't be created
+	inline vk::ImageView make_view(vk::Device device, vk::Image image, vk::Format format, uint32_t baseLevel, uint32_t levelCount)
+	{
+		vk::ImageViewCreateInfo viewInfo = {};
+		viewInfo.image = image;
+		viewInfo.viewType = vk::ImageViewType::e2D;
+		viewInfo.format = format;
+		viewInfo.subresourceRange = vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, baseLevel, levelCount, 0, 1);
+
+		return vkUtil::vk_call([&]() { return device.createImageView(viewInfo); }).value_or(nullptr);
+	}
+
+
+	// Creates the image and queues the given levels on the transfer queue.
+	// Nothing is sampleable yet: once texture.uploadBatch has completed, acquire it and record_mip_generation().
+	inline bool create_texture(const TextureData& data, textureUploadInput input, Texture& texture, bool debug)
+	{
+		vk::FormatFeatureFlags features = input.deviceContext->format_properties(data.format).optimalTilingFeatures;
+		if (!(features & vk::FormatFeatureFlagBits::eSampledImage))
+		{
+			if (debug)
+			{
+				std::cout << vk::to_string(data.format) << " can't be sampled on this device :/" << std::endl;
+			}
+			return false;
+		}
+
+		texture.format = data.format;
+		texture.extent = vk::Extent2D(data.width, data.height);
+		uint32_t levelsGiven = std::max(static_cast<uint32_t>(data.levelOffsets.size()), 1u);
+		bool generate = data.generateMips && levelsGiven == 1;
+
+		texture.mipGeneration = generate ? choose_mip_generation(*input.deviceContext, data.format, input.computeMips, debug) : MipGeneration::eNone;
+		texture.mipLevels = texture.mipGeneration == MipGeneration::eNone ? levelsGiven : mip_level_count(data.width, data.height);
+
+		// Blits read each level as a transfer source, the downsampler writes every level but the first as a storage image
+		vk::ImageUsageFlags usage = vk::ImageUsageFlagBits::eTransferDst | vk::ImageUsageFlagBits::eSampled;
+		if (texture.mipGeneration == MipGeneration::eBlit)
+		{
+			usage |= vk::ImageUsageFlagBits::eTransferSrc;
+		}
+		else if (texture.mipGeneration == MipGeneration::eCompute)
+		{
+			usage |= vk::ImageUsageFlagBits::eStorage;
+		}
+
+		vk::ImageCreateInfo imageInfo = {};
+		imageInfo.imageType = vk::ImageType::e2D;
+		imageInfo.format = data.format;
+		imageInfo.extent = vk::Extent3D(data.width, data.height, 1);
+		imageInfo.mipLevels = texture.mipLevels;
+		imageInfo.arrayLayers = 1;
+		imageInfo.samples = vk::SampleCountFlagBits::e1;
+		imageInfo.tiling = vk::ImageTiling::eOptimal;
+		imageInfo.usage = usage;
+		imageInfo.sharingMode = vk::SharingMode::eExclusive;
+		imageInfo.initialLayout = vk::ImageLayout::eUndefined;
+
+		auto failed = [&]()
+		{
+			if (debug)
+			{
+				std::cout << "Failed to create a " << data.width << "x" << data.height << " texture :/" << std::endl;
+			}
+			return false;
+		};
+
+		vkUtil::Expected<vk::Image> image = vkUtil::vk_call([&]() { return input.logicalDevice.createImage(imageInfo); });
+		if (!image)
+		{
+			return failed();
+		}
+		texture.image = image.value();
+
+		vk::MemoryRequirements memoryRequirements = input.logicalDevice.getImageMemoryRequirements(texture.image);
+		texture.memorySize = memoryRequirements.size;
+
+		vk::MemoryAllocateInfo allocInfo = {};
+		allocInfo.allocationSize = memoryRequirements.size;
+		allocInfo.memoryTypeIndex = vkUtil::findMemoryTypeIndex(*input.deviceContext, memoryRequirements.memoryTypeBits, vk::MemoryPropertyFlagBits::eDeviceLocal);
+		vkUtil::Expected<vk::DeviceMemory> memory = vkUtil::vk_call([&]() { return input.logicalDevice.allocateMemory(allocInfo); });
+		if (!memory)
+		{
+			return failed();
+		}
+		texture.memory = memory.value();
+
+		if (!vkUtil::vk_call([&]() { return input.logicalDevice.bindImageMemory(texture.image, texture.memory, 0); }))
+		{
+			return failed();
+		}
+
+		texture.view = make_view(input.logicalDevice, texture.image, data.format, 0, texture.mipLevels);
+		if (!texture.view)
+		{
+			return failed();
+		}
+
+		if (texture.mipGeneration == MipGeneration::eCompute)
+		{
+			for (uint32_t level = 0; level < texture.mipLevels; level++)
+			{
+				texture.levelViews.push_back(make_view(input.logicalDevice, texture.image, data.format, level, 1));
+				if (!texture.levelViews.back())
+				{
+					return failed();
+				}
+			}
+		}
+
+
+		// Every level given, left in whatever layout the mip generation starts from
+		std::vector<vk::BufferImageCopy> regions;
+		for (uint32_t level = 0; level < levelsGiven; level++)
+		{
+			vk::BufferImageCopy region = {};
+			region.bufferOffset = data.levelOffsets.empty() ? 0 : data.levelOffsets[level];
+			region.imageSubresource = vk::ImageSubresourceLayers(vk::ImageAspectFlagBits::eColor, level, 0, 1);
+			region.imageExtent = vk::Extent3D(std::max(data.width >> level, 1u), std::max(data.height >> level, 1u), 1);
+			regions.push_back(region);
+		}
+
+		vk::ImageLayout uploadLayout = vk::ImageLayout::eShaderReadOnlyOptimal;
+		vk::PipelineStageFlags uploadStage = vk::PipelineStageFlagBits::eFragmentShader;
+		vk::AccessFlags uploadAccess = vk::AccessFlagBits::eShaderRead;
+
+		if (texture.mipGeneration == MipGeneration::eBlit)
+		{
+			uploadLayout = vk::ImageLayout::eTransferSrcOptimal;
+			uploadStage = vk::PipelineStageFlagBits::eTransfer;
+			uploadAccess = vk::AccessFlagBits::eTransferRead;
+		}
+		else if (texture.mipGeneration == MipGeneration::eCompute)
+		{
+			uploadStage = vk::PipelineStageFlagBits::eComputeShader;
+		}
+
+		if (!input.uploader->upload_image(texture.image, data.pixels, data.size, regions,
+			vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, levelsGiven, 0, 1), uploadLayout, uploadStage, uploadAccess))
+		{
+			return failed();
+		}
+
+		texture.uploadBatch = input.uploader->flush();
+		if (!texture.uploadBatch)
+		{
+			return failed();
+		}
+
+		if (debug)
+		{
+			const char* generation[] = { "no mips", "blitted mips", "compute mips" };
+			std::cout << "Created " << data.width << "x" << data.height << " " << vk::to_string(data.format) << " texture, "
+				<< texture.mipLevels << " level(s), " << generation[static_cast<int>(texture.mipGeneration)] << ", "
+				<< texture.memorySize / 1024 << " KiB\n";
+
+			// What the same levels would cost uncompressed
+			if (vk::isCompressed(data.format))
+			{
+				vk::DeviceSize rgba8Size = 0;
+				for (uint32_t level = 0; level < texture.mipLevels; level++)
+				{
+					rgba8Size += static_cast<vk::DeviceSize>(std::max(data.width >> level, 1u)) * std::max(data.height >> level, 1u) * 4;
+				}
+				std::cout << "\tas RGBA8 it would take " << rgba8Size / 1024 << " KiB\n";
+			}
+		}
+
+		return true;
+	}
+
+
+	inline vk::ImageMemoryBarrier level_barrier(const Texture& texture, uint32_t baseLevel, uint32_t levelCount,
+		vk::ImageLayout oldLayout, vk::ImageLayout newLayout, vk::AccessFlags srcAccess, vk::AccessFlags dstAccess)
+	{
+		vk::ImageMemoryBarrier barrier = {};
+		barrier.srcAccessMask = srcAccess;
+		barrier.dstAccessMask = dstAccess;
+		barrier.oldLayout = oldLayout;
+		barrier.newLayout = newLayout;
+		barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.image = texture.image;
+		barrier.subresourceRange = vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, baseLevel, levelCount, 0, 1);
+
+		return barrier;
+	}
+
+
+	inline void record_blit_mips(vk::CommandBuffer commandBuffer, const Texture& texture)
+	{
+		// Every level but the base goes to transfer dst in one barrier
+		vk::ImageMemoryBarrier toTransfer = level_barrier(texture, 1, texture.mipLevels - 1,
+			vk::ImageLayout::eUndefined, vk::ImageLayout::eTransferDstOptimal, vk::AccessFlags(), vk::AccessFlagBits::eTransferWrite);
+		commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eTopOfPipe, vk::PipelineStageFlagBits::eTransfer,
+			vk::DependencyFlags(), 0, nullptr, 0, nullptr, 1, &toTransfer);
+
+		int32_t width = static_cast<int32_t>(texture.extent.width);
+		int32_t height = static_cast<int32_t>(texture.extent.height);
+
+		for (uint32_t level = 1; level < texture.mipLevels; level++)
+		{
+			int32_t nextWidth = std::max(width / 2, 1);
+			int32_t nextHeight = std::max(height / 2, 1);
+
+			vk::ImageBlit blit = {};
+			blit.srcSubresource = vk::ImageSubresourceLayers(vk::ImageAspectFlagBits::eColor, level - 1, 0, 1);
+			blit.srcOffsets[1] = vk::Offset3D(width, height, 1);
+			blit.dstSubresource = vk::ImageSubresourceLayers(vk::ImageAspectFlagBits::eColor, level, 0, 1);
+			blit.dstOffsets[1] = vk::Offset3D(nextWidth, nextHeight, 1);
+
+			commandBuffer.blitImage(texture.image, vk::ImageLayout::eTransferSrcOptimal,
+				texture.image, vk::ImageLayout::eTransferDstOptimal, 1, &blit, vk::Filter::eLinear);
+
+			// The level just written is the next blit's source
+			vk::ImageMemoryBarrier toSource = level_barrier(texture, level, 1,
+				vk::ImageLayout::eTransferDstOptimal, vk::ImageLayout::eTransferSrcOptimal,
+				vk::AccessFlagBits::eTransferWrite, vk::AccessFlagBits::eTransferRead);
+			commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eTransfer,
+				vk::DependencyFlags(), 0, nullptr, 0, nullptr, 1, &toSource);
+
+			width = nextWidth;
+			height = nextHeight;
+		}
+
+		vk::ImageMemoryBarrier toShader = level_barrier(texture, 0, texture.mipLevels,
+			vk::ImageLayout::eTransferSrcOptimal, vk::ImageLayout::eShaderReadOnlyOptimal,
+			vk::AccessFlagBits::eTransferWrite, vk::AccessFlagBits::eShaderRead);
+		commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer,
+			vk::PipelineStageFlagBits::eFragmentShader | vk::PipelineStageFlagBits::eComputeShader,
+			vk::DependencyFlags(), 0, nullptr, 0, nullptr, 1, &toShader);
+	}
+
+
+	// The sets only live until the frame retires, so they come from the per-frame allocator
+	inline void record_compute_mips(vk::CommandBuffer commandBuffer, const Texture& texture, vk::Device device,
+		const MipDownsampler& downsampler, vkUtil::FrameDescriptorAllocator& descriptors)
+	{
+		// The base level arrives in shader read only, the rest are written in general
+		vk::ImageMemoryBarrier toGeneral = level_barrier(texture, 1, texture.mipLevels - 1,
+			vk::ImageLayout::eUndefined, vk::ImageLayout::eGeneral, vk::AccessFlags(), vk::AccessFlagBits::eShaderWrite);
+		commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eTopOfPipe, vk::PipelineStageFlagBits::eComputeShader,
+			vk::DependencyFlags(), 0, nullptr, 0, nullptr, 1, &toGeneral);
+
+		commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute, downsampler.pipeline);
+
+		uint32_t width = texture.extent.width;
+		uint32_t height = texture.extent.height;
+
+		for (uint32_t level = 1; level < texture.mipLevels; level++)
+		{
+			DownsampleConstants constants = {};
+			constants.sourceSize[0] = width;
+			constants.sourceSize[1] = height;
+			constants.destinationSize[0] = std::max(width / 2, 1u);
+			constants.destinationSize[1] = std::max(height / 2, 1u);
+
+			vk::DescriptorSet set = descriptors.allocate(downsampler.setLayout);
+
+			vk::DescriptorImageInfo source(downsampler.sampler, texture.levelViews[level - 1],
+				level == 1 ? vk::ImageLayout::eShaderReadOnlyOptimal : vk::ImageLayout::eGeneral);
+			vk::DescriptorImageInfo destination(nullptr, texture.levelViews[level], vk::ImageLayout::eGeneral);
+
+			std::array<vk::WriteDescriptorSet, 2> writes = {
+				vk::WriteDescriptorSet(set, 0, 0, 1, vk::DescriptorType::eCombinedImageSampler, &source),
+				vk::WriteDescriptorSet(set, 1, 0, 1, vk::DescriptorType::eStorageImage, &destination)
+			};
+			device.updateDescriptorSets(static_cast<uint32_t>(writes.size()), writes.data(), 0, nullptr);
+
+			commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute, downsampler.layout, 0, 1, &set, 0, nullptr);
+			downsampler.constants.push(commandBuffer, downsampler.layout, constants);
+			commandBuffer.dispatch((constants.destinationSize[0] + 7) / 8, (constants.destinationSize[1] + 7) / 8, 1);
+
+			// The level just written is the next dispatch's source
+			vk::ImageMemoryBarrier written = level_barrier(texture, level, 1,
+				vk::ImageLayout::eGeneral, vk::ImageLayout::eGeneral, vk::AccessFlagBits::eShaderWrite, vk::AccessFlagBits::eShaderRead);
+			commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eComputeShader,
+				vk::DependencyFlags(), 0, nullptr, 0, nullptr, 1, &written);
+
+			width = constants.destinationSize[0];
+			height = constants.destinationSize[1];
+		}
+
+		vk::ImageMemoryBarrier toShader = level_barrier(texture, 1, texture.mipLevels - 1,
+			vk::ImageLayout::eGeneral, vk::ImageLayout::eShaderReadOnlyOptimal,
+			vk::AccessFlagBits::eShaderWrite, vk::AccessFlagBits::eShaderRead);
+		commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader,
+			vk::PipelineStageFlagBits::eFragmentShader | vk::PipelineStageFlagBits::eComputeShader,
+			vk::DependencyFlags(), 0, nullptr, 0, nullptr, 1, &toShader);
+	}
+
+
+	// Record outside a render pass, after the upload was acquired in the same command buffer.
+	// Leaves every level in shader read only, visible to fragment and compute shaders.
+	inline void record_mip_generation(vk::CommandBuffer commandBuffer, const Texture& texture, vk::Device device,
+		const MipDownsampler& downsampler, vkUtil::FrameDescriptorAllocator& descriptors)
+	{
+		if (texture.mipLevels < 2)
+		{
+			return;
+		}
+
+		if (texture.mipGeneration == MipGeneration::eBlit)
+		{
+			record_blit_mips(commandBuffer, texture);
+		}
+		else if (texture.mipGeneration == MipGeneration::eCompute)
+		{
+			record_compute_mips(commandBuffer, texture, device, downsampler, descriptors);
+		}
+	}
+
+
+	inline vk::Sampler make_sampler(vk::Device device, vk::Filter filter, bool debug)
+	{
+		vk::SamplerCreateInfo samplerInfo = {};
+		samplerInfo.magFilter = filter;
+		samplerInfo.minFilter = filter;
+		samplerInfo.mipmapMode = filter == vk::Filter::eLinear ? vk::SamplerMipmapMode::eLinear : vk::SamplerMipmapMode::eNearest;
+		samplerInfo.addressModeU = vk::SamplerAddressMode::eRepeat;
+		samplerInfo.addressModeV = vk::SamplerAddressMode::eRepeat;
+		samplerInfo.addressModeW = vk::SamplerAddressMode::eRepeat;
+		samplerInfo.minLod = 0.0f;
+		samplerInfo.maxLod = VK_LOD_CLAMP_NONE;
+
+		vkUtil::Expected<vk::Sampler> sampler = vkUtil::vk_call([&]() { return device.createSampler(samplerInfo); });
+		if (!sampler)
+		{
+			if (debug)
+			{
+				std::cout << "Failed to create sampler :/" << std::endl;
+			}
+			return nullptr;
+		}
+
+		return sampler.value();
+	}
+
+
+	inline void destroy_texture(vk::Device device, Texture& texture)
+	{
+		for (vk::ImageView view : texture.levelViews)
+		{
+			device.destroyImageView(view);
+		}
+		texture.levelViews.clear();
+
+		device.destroyImageView(texture.view);
+		device.destroyImage(texture.image);
+		device.freeMemory(texture.memory);
+	}
+}
\ No newline at end of file
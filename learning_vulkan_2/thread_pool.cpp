@@ -0,0 +1,134 @@
+#include "thread_pool.h"
+
+#include <atomic>
+#include <memory>
+
+
+ThreadPool::ThreadPool(unsigned threadCount)
+{
+	if (threadCount == 0)
+	{
+		unsigned hardwareThreads = std::thread::hardware_concurrency();
+		threadCount = hardwareThreads > 1 ? hardwareThreads - 1 : 1;
+	}
+
+	for (unsigned ii = 0; ii < threadCount; ii++)
+	{
+		workers.emplace_back([this]() { worker_loop(); });
+	}
+}
+
+
+void ThreadPool::worker_loop()
+{
+	while (true)
+	{
+		std::function<void()> job;
+
+		{
+			std::unique_lock<std::mutex> lock(jobsMutex);
+			jobsAvailable.wait(lock, [this]() { return stopping || !jobs.empty(); });
+
+			if (stopping && jobs.empty())
+			{
+				return;
+			}
+
+			job = std::move(jobs.front());
+			jobs.pop_front();
+		}
+
+		job();
+	}
+}
+
+
+void ThreadPool::submit(std::function<void()> job)
+{
+	{
+		std::lock_guard<std::mutex> lock(jobsMutex);
+		jobs.push_back(std::move(job));
+	}
+
+	jobsAvailable.notify_one();
+}
+
+
+void ThreadPool::parallel_for(size_t count, size_t grainSize, const std::function<void(size_t, size_t)>& fn)
+{
+	if (count == 0)
+	{
+		return;
+	}
+
+	grainSize = std::max(size_t(1), grainSize);
+	size_t chunkCount = (count + grainSize - 1) / grainSize;
+
+	// Not worth waking anyone up
+	if (chunkCount == 1 || workers.empty())
+	{
+		fn(0, count);
+		return;
+	}
+
+	// Shared so that helpers which wake up after all the work is done don't touch a dead stack frame
+	struct Batch
+	{
+		std::atomic<size_t> nextChunk{ 0 };
+		std::atomic<size_t> chunksDone{ 0 };
+		std::mutex doneMutex;
+		std::condition_variable allDone;
+	};
+	std::shared_ptr<Batch> batch = std::make_shared<Batch>();
+
+	// fn is only touched while chunks remain, and we don't return before they are all done
+	const std::function<void(size_t, size_t)>* work = &fn;
+
+	auto runChunks = [batch, work, count, grainSize, chunkCount]()
+	{
+		size_t chunk;
+		while ((chunk = batch->nextChunk.fetch_add(1)) < chunkCount)
+		{
+			size_t begin = chunk * grainSize;
+			(*work)(begin, std::min(count, begin + grainSize));
+
+			if (batch->chunksDone.fetch_add(1) + 1 == chunkCount)
+			{
+				std::lock_guard<std::mutex> lock(batch->doneMutex);
+				batch->allDone.notify_all();
+			}
+		}
+	};
+
+	size_t helpers = std::min(chunkCount - 1, workers.size());
+	{
+		std::lock_guard<std::mutex> lock(jobsMutex);
+
+		for (size_t ii = 0; ii < helpers; ii++)
+		{
+			jobs.push_back(runChunks);
+		}
+	}
+	jobsAvailable.notify_all();
+
+	runChunks();
+
+	std::unique_lock<std::mutex> lock(batch->doneMutex);
+	batch->allDone.wait(lock, [&]() { return batch->chunksDone.load() == chunkCount; });
+}
+
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(jobsMutex);
+		stopping = true;
+	}
+
+	jobsAvailable.notify_all();
+
+	for (std::thread& worker : workers)
+	{
+		worker.join();
+	}
+}
\ No newline at end of file
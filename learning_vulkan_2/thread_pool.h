@@ -0,0 +1,40 @@
+#pragma once
+
+#include "config.h"
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <deque>
+
+
+// Fixed set of worker threads, created once and reused for the lifetime of the pool
+class ThreadPool
+{
+public:
+	// 0 => one worker per hardware thread, minus the calling thread
+	ThreadPool(unsigned threadCount = 0);
+
+	~ThreadPool();
+
+	void submit(std::function<void()> job);
+
+	// Splits [0, count) into chunks of grainSize and runs fn(begin, end) on each chunk.
+	// The calling thread helps out and only returns once every chunk is done.
+	void parallel_for(size_t count, size_t grainSize, const std::function<void(size_t, size_t)>& fn);
+
+	unsigned size() const
+	{
+		return static_cast<unsigned>(workers.size());
+	}
+
+private:
+	std::vector<std::thread> workers;
+	std::deque<std::function<void()>> jobs;
+	std::mutex jobsMutex;
+	std::condition_variable jobsAvailable;
+	bool stopping = false;
+
+	void worker_loop();
+};
\ No newline at end of file
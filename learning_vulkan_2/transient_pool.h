@@ -0,0 +1,378 @@
+#pragma once
+
+#include "config.h"
+#include "memory.h"
+#include "deletion_queue.h"
+
+#include <algorithm>
+
+
+namespace vkUtil
+{
+	// An image or buffer that only lives for part of a frame, between two passes of the render graph
+	struct TransientRequest
+	{
+		bool isImage;
+		vk::Format format;
+		vk::Extent2D extent;
+		vk::SampleCountFlagBits samples;
+		vk::ImageAspectFlags aspect;
+		vk::ImageUsageFlags imageUsage;
+		vk::DeviceSize size;
+		vk::BufferUsageFlags bufferUsage;
+
+		// positions of the first and last pass using it, in execution order
+		uint32_t firstUse;
+		uint32_t lastUse;
+	};
+
+
+	// Owns the render graph's transient resources. Resources whose lifetimes don't overlap are bound
+	// to the same memory block, so a frame's intermediates only take as much memory as the ones alive
+	// at the same time. Blocks are rebuilt only when the set of requests changes.
+	class TransientPool
+	{
+	public:
+		// Without a deletion queue, replaced resources are destroyed right away and the GPU must be done with them
+		void init(vk::Device device, const DeviceContext* deviceContext, DeletionQueue* deletionQueue, bool debug)
+		{
+			this->device = device;
+			this->deviceContext = deviceContext;
+			this->deletionQueue = deletionQueue;
+			this->debug = debug;
+		}
+
+		// Returns true if the resources were recreated, the previous ones are retired
+		bool realize(const std::vector<TransientRequest>& requests)
+		{
+			if (same_requests(requests))
+			{
+				return false;
+			}
+
+			release(deletionQueue);
+			realized = requests;
+			entries.resize(requests.size());
+
+			std::vector<vk::MemoryRequirements> requirements(requests.size());
+			for (size_t ii = 0; ii < requests.size(); ii++)
+			{
+				requirements[ii] = create_resource(requests[ii], entries[ii]);
+				unaliasedSize += requirements[ii].size;
+			}
+
+			place(requirements);
+			bind();
+
+			if (debug)
+			{
+				std::cout << "Transient resources: " << requests.size() << ", " << unaliasedSize / (1024.0 * 1024.0) << " MB without aliasing, "
+					<< aliasedSize / (1024.0 * 1024.0) << " MB in " << blocks.size() << " aliased blocks\n";
+			}
+
+			return true;
+		}
+
+		vk::Image image(uint32_t transient) const
+		{
+			return entries[transient].image;
+		}
+
+		vk::ImageView view(uint32_t transient) const
+		{
+			return entries[transient].view;
+		}
+
+		vk::Buffer buffer(uint32_t transient) const
+		{
+			return entries[transient].buffer;
+		}
+
+		// The resource that used the same memory before this one during the frame, UINT32_MAX if it is the first
+		uint32_t aliased_after(uint32_t transient) const
+		{
+			return entries[transient].previous;
+		}
+
+		std::vector<vk::ImageView> views() const
+		{
+			std::vector<vk::ImageView> result;
+			for (const Entry& entry : entries)
+			{
+				if (entry.view)
+				{
+					result.push_back(entry.view);
+				}
+			}
+			return result;
+		}
+
+		// Peak memory of the intermediates with a block each, and aliased
+		vk::DeviceSize unaliased_size() const
+		{
+			return unaliasedSize;
+		}
+
+		vk::DeviceSize aliased_size() const
+		{
+			return aliasedSize;
+		}
+
+		// Caller has waited for the device to go idle
+		void destroy()
+		{
+			release(nullptr);
+			realized.clear();
+		}
+
+	private:
+		struct Entry
+		{
+			vk::Image image{ nullptr };
+			vk::ImageView view{ nullptr };
+			vk::Buffer buffer{ nullptr };
+			uint32_t block = UINT32_MAX;
+			uint32_t previous = UINT32_MAX;
+		};
+
+		// Everything in a block sits at offset 0, their lifetimes never overlap
+		struct Block
+		{
+			vk::DeviceMemory memory{ nullptr };
+			vk::DeviceSize size = 0;
+			vk::DeviceSize alignment = 1;
+			uint32_t memoryTypeBits = ~0u;
+			bool holdsImages;
+			std::vector<uint32_t> members;
+		};
+
+		vk::Device device{ nullptr };
+		const DeviceContext* deviceContext = nullptr;
+		DeletionQueue* deletionQueue = nullptr;
+		bool debug = false;
+
+		std::vector<TransientRequest> realized;
+		std::vector<Entry> entries;
+		std::vector<Block> blocks;
+		vk::DeviceSize unaliasedSize = 0;
+		vk::DeviceSize aliasedSize = 0;
+
+		// No requests match an empty pool, a graph without intermediates doesn't rebuild every frame
+		bool same_requests(const std::vector<TransientRequest>& requests) const
+		{
+			if (requests.size() != realized.size())
+			{
+				return false;
+			}
+
+			for (size_t ii = 0; ii < requests.size(); ii++)
+			{
+				const TransientRequest& a = requests[ii];
+				const TransientRequest& b = realized[ii];
+				bool same = a.isImage == b.isImage && a.firstUse == b.firstUse && a.lastUse == b.lastUse
+					&& (a.isImage
+						? a.format == b.format && a.extent == b.extent && a.samples == b.samples && a.aspect == b.aspect && a.imageUsage == b.imageUsage
+						: a.size == b.size && a.bufferUsage == b.bufferUsage);
+
+				if (!same)
+				{
+					return false;
+				}
+			}
+
+			return true;
+		}
+
+		vk::MemoryRequirements create_resource(const TransientRequest& request, Entry& entry)
+		{
+			auto failed = [&]()
+			{
+				if (debug)
+				{
+					std::cout << "Failed to create transient resource :/" << std::endl;
+				}
+				return vk::MemoryRequirements();
+			};
+
+			if (!request.isImage)
+			{
+				vk::BufferCreateInfo bufferInfo = {};
+				bufferInfo.size = request.size;
+				bufferInfo.usage = request.bufferUsage;
+				bufferInfo.sharingMode = vk::SharingMode::eExclusive;
+				vkUtil::Expected<vk::Buffer> buffer = vkUtil::vk_call([&]() { return device.createBuffer(bufferInfo); });
+				if (!buffer)
+				{
+					return failed();
+				}
+				entry.buffer = buffer.value();
+
+				return device.getBufferMemoryRequirements(entry.buffer);
+			}
+
+			vk::ImageCreateInfo imageInfo = {};
+			imageInfo.imageType = vk::ImageType::e2D;
+			imageInfo.format = request.format;
+			imageInfo.extent = vk::Extent3D(request.extent.width, request.extent.height, 1);
+			imageInfo.mipLevels = 1;
+			imageInfo.arrayLayers = 1;
+			imageInfo.samples = request.samples;
+			imageInfo.tiling = vk::ImageTiling::eOptimal;
+			imageInfo.usage = request.imageUsage;
+			imageInfo.sharingMode = vk::SharingMode::eExclusive;
+			imageInfo.initialLayout = vk::ImageLayout::eUndefined;
+			vkUtil::Expected<vk::Image> image = vkUtil::vk_call([&]() { return device.createImage(imageInfo); });
+			if (!image)
+			{
+				return failed();
+			}
+			entry.image = image.value();
+
+			return device.getImageMemoryRequirements(entry.image);
+		}
+
+		// Biggest first, each into the first block of its kind it fits in time-wise, so the big ones set the block sizes
+		void place(const std::vector<vk::MemoryRequirements>& requirements)
+		{
+			std::vector<uint32_t> bySize(realized.size());
+			for (uint32_t ii = 0; ii < bySize.size(); ii++)
+			{
+				bySize[ii] = ii;
+			}
+			std::stable_sort(bySize.begin(), bySize.end(), [&](uint32_t a, uint32_t b) { return requirements[a].size > requirements[b].size; });
+
+			for (uint32_t ii : bySize)
+			{
+				if (requirements[ii].size == 0)
+				{
+					continue;
+				}
+
+				// Linear and optimal resources never share, so bufferImageGranularity can't bite
+				uint32_t chosen = UINT32_MAX;
+				for (uint32_t bb = 0; bb < blocks.size() && chosen == UINT32_MAX; bb++)
+				{
+					const Block& block = blocks[bb];
+					if (block.holdsImages != realized[ii].isImage || !(block.memoryTypeBits & requirements[ii].memoryTypeBits))
+					{
+						continue;
+					}
+
+					bool overlaps = false;
+					for (uint32_t member : block.members)
+					{
+						overlaps |= realized[member].firstUse <= realized[ii].lastUse && realized[ii].firstUse <= realized[member].lastUse;
+					}
+
+					if (!overlaps)
+					{
+						chosen = bb;
+					}
+				}
+
+				if (chosen == UINT32_MAX)
+				{
+					Block block;
+					block.holdsImages = realized[ii].isImage;
+					blocks.push_back(block);
+					chosen = static_cast<uint32_t>(blocks.size() - 1);
+				}
+
+				Block& block = blocks[chosen];
+				block.size = std::max(block.size, requirements[ii].size);
+				block.alignment = std::max(block.alignment, requirements[ii].alignment);
+				block.memoryTypeBits &= requirements[ii].memoryTypeBits;
+				block.members.push_back(ii);
+				entries[ii].block = chosen;
+			}
+
+			// Within a block, each resource follows the one whose lifetime ended before it started
+			for (Block& block : blocks)
+			{
+				std::sort(block.members.begin(), block.members.end(), [&](uint32_t a, uint32_t b) { return realized[a].firstUse < realized[b].firstUse; });
+				for (size_t mm = 1; mm < block.members.size(); mm++)
+				{
+					entries[block.members[mm]].previous = block.members[mm - 1];
+				}
+			}
+		}
+
+		void bind()
+		{
+			for (Block& block : blocks)
+			{
+				vk::MemoryAllocateInfo allocInfo = {};
+				allocInfo.allocationSize = block.size;
+				allocInfo.memoryTypeIndex = findMemoryTypeIndex(*deviceContext, block.memoryTypeBits, vk::MemoryPropertyFlagBits::eDeviceLocal);
+				aliasedSize += block.size;
+
+				vkUtil::Expected<vk::DeviceMemory> memory = vkUtil::vk_call([&]() { return device.allocateMemory(allocInfo); });
+				if (!memory)
+				{
+					if (debug)
+					{
+						std::cout << "Failed to allocate transient memory block of " << block.size << " bytes :/" << std::endl;
+					}
+					continue;
+				}
+				block.memory = memory.value();
+
+				for (uint32_t member : block.members)
+				{
+					Entry& entry = entries[member];
+					if (entry.buffer)
+					{
+						vkUtil::vk_call([&]() { return device.bindBufferMemory(entry.buffer, block.memory, 0); });
+						continue;
+					}
+
+					if (!vkUtil::vk_call([&]() { return device.bindImageMemory(entry.image, block.memory, 0); }))
+					{
+						continue;
+					}
+
+					vk::ImageViewCreateInfo viewInfo = {};
+					viewInfo.image = entry.image;
+					viewInfo.viewType = vk::ImageViewType::e2D;
+					viewInfo.format = realized[member].format;
+					viewInfo.subresourceRange = vk::ImageSubresourceRange(realized[member].aspect, 0, 1, 0, 1);
+					entry.view = vkUtil::vk_call([&]() { return device.createImageView(viewInfo); }).value_or(nullptr);
+				}
+			}
+		}
+
+		void release(DeletionQueue* queue)
+		{
+			for (Entry& entry : entries)
+			{
+				if (queue)
+				{
+					queue->retire(entry.view);
+					queue->retire(entry.image);
+					queue->retire(entry.buffer);
+					continue;
+				}
+
+				device.destroyImageView(entry.view);
+				device.destroyImage(entry.image);
+				device.destroyBuffer(entry.buffer);
+			}
+			entries.clear();
+
+			for (Block& block : blocks)
+			{
+				if (queue)
+				{
+					queue->retire(block.memory);
+					continue;
+				}
+
+				device.freeMemory(block.memory);
+			}
+			blocks.clear();
+
+			unaliasedSize = 0;
+			aliasedSize = 0;
+		}
+	};
+}
\ No newline at end of file
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <atomic>
+
+
+namespace vkUtil
+{
+	// Hands values from one producer thread to one consumer thread without locks or waiting.
+	// Three slots: the producer owns one, the consumer owns one, the third holds the latest published value.
+	// Publishing and taking are a single atomic exchange of slot indices, so the producer never waits for the
+	// consumer and the consumer always gets the newest value, older unread ones are dropped.
+	// Slots are reused, so values holding vectors keep their capacity from one round to the next.
+	template <typename T>
+	class TripleBuffer
+	{
+	public:
+		// Producer: fill this slot, then publish it. It may hold an old value.
+		T& write_slot()
+		{
+			return slots[back];
+		}
+
+		void publish()
+		{
+			uint32_t previous = middle.exchange(back | FRESH, std::memory_order_acq_rel);
+			back = previous & INDEX;
+		}
+
+		// Consumer: swaps in the latest value if one was published since the last call, returns false otherwise
+		bool acquire()
+		{
+			if (!(middle.load(std::memory_order_relaxed) & FRESH))
+			{
+				return false;
+			}
+
+			uint32_t previous = middle.exchange(front, std::memory_order_acq_rel);
+			front = previous & INDEX;
+			return true;
+		}
+
+		// The value acquire() last swapped in, the consumer may keep reading it until the next acquire()
+		const T& read_slot() const
+		{
+			return slots[front];
+		}
+
+	private:
+		static constexpr uint32_t INDEX = 3;
+		static constexpr uint32_t FRESH = 4;
+
+		T slots[3];
+
+		// Each side's index on its own cache line, away from the shared one
+		alignas(64) uint32_t back = 0;
+		alignas(64) std::atomic<uint32_t> middle{ 1 };
+		alignas(64) uint32_t front = 2;
+	};
+}
\ No newline at end of file
@@ -0,0 +1,158 @@
+#pragma once
+
+#include "config.h"
+#include "memory.h"
+#include "descriptors.h"
+
+namespace vkUtil
+{
+	struct uniformRingInput
+	{
+		vk::Device logicalDevice;
+		const DeviceContext* deviceContext;
+		uint32_t framesInFlight;
+
+		// Bytes of constants one frame can write
+		vk::DeviceSize frameSize;
+
+		// Largest block a shader reads through the ring, the descriptor's range
+		vk::DeviceSize maxBlockSize;
+
+		// Where the ring's one descriptor set comes from
+		DescriptorAllocator* descriptors;
+	};
+
+
+	// One persistently mapped uniform buffer, split into a region per frame in flight.
+	// Constants are written at the next aligned offset of the current frame's region and selected
+	// with a dynamic offset on a UNIFORM_BUFFER_DYNAMIC descriptor, so each block costs a memcpy:
+	// no buffer creation, no descriptor writes. begin_frame() rewinds the region once its frame retired.
+	class UniformRing
+	{
+	public:
+		void init(uniformRingInput input, bool debug)
+		{
+			this->device = input.logicalDevice;
+			this->debug = debug;
+
+			const vk::PhysicalDeviceLimits& limits = input.deviceContext->limits();
+			alignment = limits.minUniformBufferOffsetAlignment;
+			maxBlockSize = std::min<vk::DeviceSize>(input.maxBlockSize, limits.maxUniformBufferRange);
+
+			// Each region is a whole number of alignments, so region starts are aligned too
+			frameSize = align(input.frameSize);
+
+			BufferInputChunk bufferInput;
+			bufferInput.size = frameSize * input.framesInFlight;
+			bufferInput.usage = vk::BufferUsageFlagBits::eUniformBuffer;
+			bufferInput.logicalDevice = input.logicalDevice;
+			bufferInput.deviceContext = input.deviceContext;
+			buffer = createMappedBuffer(bufferInput, debug);
+
+
+			// One dynamic descriptor covering maxBlockSize bytes from wherever the offset points
+			vkInit::descriptorSetLayoutData layoutData;
+			layoutData.bindings.push_back(vk::DescriptorSetLayoutBinding(0, vk::DescriptorType::eUniformBufferDynamic, 1,
+				vk::ShaderStageFlagBits::eAllGraphics | vk::ShaderStageFlagBits::eCompute));
+			setLayout = vkInit::make_descriptor_set_layout(device, layoutData, debug);
+
+			set = input.descriptors->allocate(setLayout);
+
+			vk::DescriptorBufferInfo bufferInfo(buffer.buffer.buffer, 0, maxBlockSize);
+			vk::WriteDescriptorSet write(set, 0, 0, 1, vk::DescriptorType::eUniformBufferDynamic, nullptr, &bufferInfo);
+			device.updateDescriptorSets(1, &write, 0, nullptr);
+		}
+
+
+		vk::DescriptorSetLayout layout() const
+		{
+			return setLayout;
+		}
+
+
+		// Call after waiting on the fence of the frame that last used this slot
+		void begin_frame(uint32_t frameIndex)
+		{
+			frameStart = frameIndex * frameSize;
+			head = frameStart;
+		}
+
+
+		// Copies value into the ring, returns the dynamic offset to bind it with (UINT32_MAX if the frame is full)
+		template <typename T>
+		uint32_t write(const T& value)
+		{
+			static_assert(sizeof(T) > 0, "Nothing to write");
+
+			if (sizeof(T) > maxBlockSize)
+			{
+				if (debug)
+				{
+					std::cout << "Uniform block of " << sizeof(T) << " bytes is bigger than the ring's range :/" << std::endl;
+				}
+				return UINT32_MAX;
+			}
+
+			// The whole descriptor range has to fit behind the offset, not just the block
+			if (head + maxBlockSize > frameStart + frameSize)
+			{
+				if (debug && !warnedFull)
+				{
+					std::cout << "Uniform ring is full for this frame :/" << std::endl;
+					warnedFull = true;
+				}
+				return UINT32_MAX;
+			}
+
+			vk::DeviceSize offset = head;
+			memcpy(static_cast<uint8_t*>(buffer.data) + offset, &value, sizeof(T));
+			head = align(head + sizeof(T));
+
+			return static_cast<uint32_t>(offset);
+		}
+
+
+		// Binds the ring's set with the given dynamic offset, once per draw that needs different constants
+		void bind(vk::CommandBuffer commandBuffer, vk::PipelineBindPoint bindPoint, vk::PipelineLayout pipelineLayout, uint32_t setIndex, uint32_t offset) const
+		{
+			commandBuffer.bindDescriptorSets(bindPoint, pipelineLayout, setIndex, 1, &set, 1, &offset);
+		}
+
+
+		void destroy()
+		{
+			// Never initialized
+			if (!device)
+			{
+				return;
+			}
+
+			// The set goes back with its allocator's pools
+			destroyMappedBuffer(device, buffer);
+			device.destroyDescriptorSetLayout(setLayout);
+		}
+
+	private:
+		vk::Device device;
+		bool debug;
+
+		MappedBuffer buffer;
+		vk::DescriptorSetLayout setLayout{ nullptr };
+		vk::DescriptorSet set{ nullptr };
+
+		vk::DeviceSize alignment;
+		vk::DeviceSize maxBlockSize;
+		vk::DeviceSize frameSize;
+
+		vk::DeviceSize frameStart = 0;
+		vk::DeviceSize head = 0;
+		bool warnedFull = false;
+
+
+		vk::DeviceSize align(vk::DeviceSize size) const
+		{
+			// minUniformBufferOffsetAlignment is always a power of two
+			return (size + alignment - 1) & ~(alignment - 1);
+		}
+	};
+}
\ No newline at end of file
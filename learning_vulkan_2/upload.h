@@ -0,0 +1,618 @@
+#pragma once
+
+#include "config.h"
+#include "memory.h"
+
+#include <deque>
+#include <algorithm>
+#include <mutex>
+
+namespace vkUtil
+{
+	struct uploaderInput
+	{
+		vk::Device logicalDevice;
+		const DeviceContext* deviceContext;
+		vk::Queue transferQueue;
+		uint32_t transferFamily;
+		uint32_t graphicsFamily;
+
+		// Held around submits when other threads submit to the same transfer queue
+		std::mutex* transferQueueMutex = nullptr;
+	};
+
+	// Identifies a submitted group of uploads, 0 is never a valid batch
+	using UploadBatch = uint64_t;
+
+	// Staging memory is handed out in blocks of this size, bigger uploads get a block of their own
+	constexpr vk::DeviceSize UPLOAD_STAGING_BLOCK = 16 * 1024 * 1024;
+
+	// A batch is submitted automatically once it has this much staging memory,
+	// and writers block while more than this many of those are still being copied
+	constexpr vk::DeviceSize UPLOAD_BATCH_LIMIT = 64 * 1024 * 1024;
+	constexpr size_t UPLOAD_MAX_BATCHES_IN_FLIGHT = 4;
+
+	// Staging offset handed back when no staging memory could be had
+	constexpr vk::DeviceSize UPLOAD_NO_STAGING = ~vk::DeviceSize(0);
+
+
+	// Copies data into device local resources on the transfer queue.
+	// Writes are recorded into the current batch, flush() submits it and signals a semaphore.
+	// The render side calls acquire() when it first uses something from a batch: that records
+	// the queue family ownership acquire barriers and hands back the semaphore to wait on.
+	// Batches nobody uses never make the graphics queue wait.
+	class AsyncUploader
+	{
+	public:
+		void init(uploaderInput input, bool debug)
+		{
+			this->input = input;
+			this->debug = debug;
+
+			vk::CommandPoolCreateInfo poolInfo = {};
+			poolInfo.flags = vk::CommandPoolCreateFlagBits::eTransient | vk::CommandPoolCreateFlagBits::eResetCommandBuffer;
+			poolInfo.queueFamilyIndex = input.transferFamily;
+
+			vkUtil::Expected<vk::CommandPool> pool = vkUtil::vk_call([&]() { return input.logicalDevice.createCommandPool(poolInfo); });
+			if (!pool)
+			{
+				if (debug)
+				{
+					std::cout << "Failed to create transfer Command Pool :/" << std::endl;
+				}
+				return;
+			}
+			commandPool = pool.value();
+		}
+
+
+		// Queues a copy of size bytes from data into buffer at offset.
+		// data is copied into staging memory straight away, the caller can reuse it on return.
+		// dstStage/dstAccess describe how the render side will first read the buffer.
+		// Returns false if the copy was dropped, staging or the batch couldn't be had or its submit failed.
+		bool upload_buffer(vk::Buffer buffer, vk::DeviceSize offset, const void* data, vk::DeviceSize size,
+			vk::PipelineStageFlags dstStage, vk::AccessFlags dstAccess)
+		{
+			const uint8_t* bytes = static_cast<const uint8_t*>(data);
+
+			// Split across blocks so one huge upload doesn't need one huge staging buffer
+			while (size > 0)
+			{
+				Batch* batch = recording_batch();
+				if (!batch)
+				{
+					return false;
+				}
+
+				vk::DeviceSize piece = std::min(size, UPLOAD_STAGING_BLOCK);
+				vk::DeviceSize stagingOffset = allocate_staging(*batch, piece);
+				if (stagingOffset == UPLOAD_NO_STAGING)
+				{
+					return false;
+				}
+				StagingBlock& block = batch->staging.back();
+
+				memcpy(block.mapped + stagingOffset, bytes, piece);
+
+				vk::BufferCopy copyRegion = {};
+				copyRegion.srcOffset = stagingOffset;
+				copyRegion.dstOffset = offset;
+				copyRegion.size = piece;
+				batch->commandBuffer.copyBuffer(block.buffer.buffer, buffer, 1, &copyRegion);
+
+				add_buffer_barrier(*batch, buffer, offset, piece, dstStage, dstAccess);
+
+				bytes += piece;
+				offset += piece;
+				size -= piece;
+
+				if (batch->stagingUsed >= UPLOAD_BATCH_LIMIT && !flush())
+				{
+					return false;
+				}
+			}
+
+			return true;
+		}
+
+
+		// Queues a copy of data into image. Region bufferOffsets are relative to data, and the regions
+		// must all lie inside range. The image goes undefined -> transfer dst -> finalLayout, and is
+		// handed over to the graphics family in finalLayout.
+		// The whole image goes into one staging allocation, it isn't split like buffers are.
+		// Returns false if the copy was dropped, like upload_buffer().
+		bool upload_image(vk::Image image, const void* data, vk::DeviceSize size, std::vector<vk::BufferImageCopy> regions,
+			vk::ImageSubresourceRange range, vk::ImageLayout finalLayout, vk::PipelineStageFlags dstStage, vk::AccessFlags dstAccess)
+		{
+			Batch* batch = recording_batch();
+			if (!batch)
+			{
+				return false;
+			}
+
+			vk::DeviceSize stagingOffset = allocate_staging(*batch, size);
+			if (stagingOffset == UPLOAD_NO_STAGING)
+			{
+				return false;
+			}
+			StagingBlock& block = batch->staging.back();
+
+			memcpy(block.mapped + stagingOffset, data, size);
+
+			for (vk::BufferImageCopy& region : regions)
+			{
+				region.bufferOffset += stagingOffset;
+			}
+
+			vk::ImageMemoryBarrier toTransfer = {};
+			toTransfer.srcAccessMask = vk::AccessFlags();
+			toTransfer.dstAccessMask = vk::AccessFlagBits::eTransferWrite;
+			toTransfer.oldLayout = vk::ImageLayout::eUndefined;
+			toTransfer.newLayout = vk::ImageLayout::eTransferDstOptimal;
+			toTransfer.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			toTransfer.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			toTransfer.image = image;
+			toTransfer.subresourceRange = range;
+
+			batch->commandBuffer.pipelineBarrier(
+				vk::PipelineStageFlagBits::eTopOfPipe, vk::PipelineStageFlagBits::eTransfer,
+				vk::DependencyFlags(), 0, nullptr, 0, nullptr, 1, &toTransfer
+			);
+
+			batch->commandBuffer.copyBufferToImage(block.buffer.buffer, image, vk::ImageLayout::eTransferDstOptimal,
+				static_cast<uint32_t>(regions.size()), regions.data());
+
+			add_image_barrier(*batch, image, range, finalLayout, dstStage, dstAccess);
+
+			if (batch->stagingUsed >= UPLOAD_BATCH_LIMIT && !flush())
+			{
+				return false;
+			}
+
+			return true;
+		}
+
+
+		// Submits everything recorded so far, returns the batch to acquire before using it.
+		// Returns the last submitted batch if there was nothing new to submit, and 0 if the submit failed:
+		// everything recorded since the last flush is dropped then.
+		UploadBatch flush()
+		{
+			if (batches.empty() || batches.back().submitted)
+			{
+				return lastSubmitted;
+			}
+
+			Batch& batch = batches.back();
+
+			// Release barriers hand the resources over to the graphics family
+			if (ownershipTransfer())
+			{
+				batch.commandBuffer.pipelineBarrier(
+					vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eBottomOfPipe,
+					vk::DependencyFlags(), 0, nullptr,
+					static_cast<uint32_t>(batch.releaseBarriers.size()), batch.releaseBarriers.data(),
+					static_cast<uint32_t>(batch.releaseImageBarriers.size()), batch.releaseImageBarriers.data()
+				);
+			}
+
+			vk::SubmitInfo submitInfo = {};
+			submitInfo.commandBufferCount = 1;
+			submitInfo.pCommandBuffers = &batch.commandBuffer;
+			submitInfo.signalSemaphoreCount = 1;
+			submitInfo.pSignalSemaphores = &batch.semaphore;
+
+			vkUtil::Expected<void> submitted = vkUtil::vk_call([&]() { return batch.commandBuffer.end(); });
+			if (submitted)
+			{
+				std::unique_lock<std::mutex> lock;
+				if (input.transferQueueMutex)
+				{
+					lock = std::unique_lock<std::mutex>(*input.transferQueueMutex);
+				}
+
+				submitted = vkUtil::vk_call([&]() { return input.transferQueue.submit(submitInfo, batch.fence); });
+			}
+
+			// Its fence and semaphore would never signal, nothing may wait on them
+			if (!submitted)
+			{
+				if (debug)
+				{
+					std::cout << "Failed to submit upload batch :/" << std::endl;
+				}
+				release_staging(batch);
+				destroy_batch(batch);
+				batches.pop_back();
+				return 0;
+			}
+
+			batch.submitted = true;
+			lastSubmitted = batch.id;
+
+			return batch.id;
+		}
+
+
+		// Call while recording the first command buffer that uses resources from the batch.
+		// Records the acquire barriers into commandBuffer and appends the semaphore the submit has to wait on.
+		// Does nothing if the batch was already acquired, so it is safe to call every frame.
+		void acquire(UploadBatch id, vk::CommandBuffer commandBuffer,
+			std::vector<vk::Semaphore>& waitSemaphores, std::vector<vk::PipelineStageFlags>& waitStages)
+		{
+			Batch* batch = find_batch(id);
+			if (!batch || batch->acquired)
+			{
+				return;
+			}
+
+			// Still recording, submit it now rather than waiting for the next flush
+			if (!batch->submitted)
+			{
+				flush();
+			}
+
+			// The semaphore wait covers the transfer stage, the barrier chains it on to the real consumers
+			commandBuffer.pipelineBarrier(
+				vk::PipelineStageFlagBits::eTransfer, batch->acquireStages,
+				vk::DependencyFlags(), 0, nullptr,
+				static_cast<uint32_t>(batch->acquireBarriers.size()), batch->acquireBarriers.data(),
+				static_cast<uint32_t>(batch->acquireImageBarriers.size()), batch->acquireImageBarriers.data()
+			);
+
+			waitSemaphores.push_back(batch->semaphore);
+			waitStages.push_back(vk::PipelineStageFlagBits::eTransfer);
+
+			batch->acquired = true;
+		}
+
+
+		bool is_complete(UploadBatch id)
+		{
+			Batch* batch = find_batch(id);
+			return !batch || (batch->submitted && fence_signalled(batch->fence));
+		}
+
+
+		// Call once per frame, after the frame's fence wait: every graphics submission that waited
+		// on an acquired batch has finished by then, so its semaphore can go too.
+		// Staging is recycled as soon as the copies finish, whether or not the batch was acquired.
+		void collect()
+		{
+			for (Batch& batch : batches)
+			{
+				if (batch.submitted && !batch.staging.empty() && fence_signalled(batch.fence))
+				{
+					release_staging(batch);
+				}
+			}
+
+			for (auto batch = batches.begin(); batch != batches.end();)
+			{
+				if (batch->acquired && batch->staging.empty())
+				{
+					destroy_batch(*batch);
+					batch = batches.erase(batch);
+				}
+				else
+				{
+					batch++;
+				}
+			}
+		}
+
+
+		void destroy()
+		{
+			if (!commandPool)
+			{
+				return;
+			}
+
+			// Caller has waited for the device to go idle
+			for (Batch& batch : batches)
+			{
+				release_staging(batch);
+				destroy_batch(batch);
+			}
+			batches.clear();
+
+			for (StagingBlock& block : freeBlocks)
+			{
+				input.logicalDevice.unmapMemory(block.buffer.bufferMemory);
+				destroyBuffer(input.logicalDevice, block.buffer);
+			}
+			freeBlocks.clear();
+
+			input.logicalDevice.destroyCommandPool(commandPool);
+			commandPool = nullptr;
+		}
+
+	private:
+		struct StagingBlock
+		{
+			Buffer buffer;
+			uint8_t* mapped;
+		};
+
+		struct Batch
+		{
+			UploadBatch id;
+			vk::CommandBuffer commandBuffer;
+			vk::Fence fence;
+			vk::Semaphore semaphore;
+
+			std::vector<StagingBlock> staging;
+			vk::DeviceSize stagingUsed = 0;
+			vk::DeviceSize blockUsed = 0;
+
+			std::vector<vk::BufferMemoryBarrier> releaseBarriers;
+			std::vector<vk::BufferMemoryBarrier> acquireBarriers;
+			std::vector<vk::ImageMemoryBarrier> releaseImageBarriers;
+			std::vector<vk::ImageMemoryBarrier> acquireImageBarriers;
+			vk::PipelineStageFlags acquireStages;
+
+			bool submitted = false;
+			bool acquired = false;
+		};
+
+		uploaderInput input;
+		bool debug;
+
+		vk::CommandPool commandPool{ nullptr };
+		std::deque<Batch> batches;
+		std::vector<StagingBlock> freeBlocks;
+
+		UploadBatch nextBatch = 1;
+		UploadBatch lastSubmitted = 0;
+
+
+		bool ownershipTransfer() const
+		{
+			return input.transferFamily != input.graphicsFamily;
+		}
+
+
+		// A lost device reports an error rather than throwing, and never counts as signalled
+		bool fence_signalled(vk::Fence fence) const
+		{
+			return vkUtil::vk_call([&]() { return input.logicalDevice.getFenceStatus(fence); }).result() == vk::Result::eSuccess;
+		}
+
+
+		Batch* find_batch(UploadBatch id)
+		{
+			for (Batch& batch : batches)
+			{
+				if (batch.id == id)
+				{
+					return &batch;
+				}
+			}
+
+			return nullptr;
+		}
+
+
+		// Current batch, starting a new one if the last one was already submitted.
+		// nullptr if a new one couldn't be started, the upload is dropped then.
+		Batch* recording_batch()
+		{
+			if (!batches.empty() && !batches.back().submitted)
+			{
+				return &batches.back();
+			}
+
+			// Writers get back-pressure here rather than the render loop
+			size_t inFlight = 0;
+			for (Batch& batch : batches)
+			{
+				inFlight += batch.staging.empty() ? 0 : 1;
+			}
+			if (inFlight >= UPLOAD_MAX_BATCHES_IN_FLIGHT)
+			{
+				for (Batch& batch : batches)
+				{
+					if (!batch.staging.empty())
+					{
+						if (!vkUtil::vk_call([&]() { return input.logicalDevice.waitForFences(1, &batch.fence, VK_TRUE, UINT64_MAX); }))
+						{
+							if (debug)
+							{
+								std::cout << "Failed to wait for an upload batch :/" << std::endl;
+							}
+							return nullptr;
+						}
+						break;
+					}
+				}
+				collect();
+			}
+
+			Batch batch;
+			batch.id = nextBatch++;
+
+			vk::CommandBufferAllocateInfo allocInfo = {};
+			allocInfo.commandPool = commandPool;
+			allocInfo.level = vk::CommandBufferLevel::ePrimary;
+			allocInfo.commandBufferCount = 1;
+			vkUtil::Expected<std::vector<vk::CommandBuffer>> commandBuffers = vkUtil::vk_call([&]() { return input.logicalDevice.allocateCommandBuffers(allocInfo); });
+			batch.commandBuffer = commandBuffers ? commandBuffers.value()[0] : nullptr;
+
+			vkUtil::Expected<vk::Fence> fence = vkUtil::vk_call([&]() { return input.logicalDevice.createFence(vk::FenceCreateInfo()); });
+			vkUtil::Expected<vk::Semaphore> semaphore = vkUtil::vk_call([&]() { return input.logicalDevice.createSemaphore(vk::SemaphoreCreateInfo()); });
+			batch.fence = fence.value_or(nullptr);
+			batch.semaphore = semaphore.value_or(nullptr);
+
+			vk::CommandBufferBeginInfo beginInfo = {};
+			beginInfo.flags = vk::CommandBufferUsageFlagBits::eOneTimeSubmit;
+
+			if (!commandBuffers || !fence || !semaphore
+				|| !vkUtil::vk_call([&]() { return batch.commandBuffer.begin(beginInfo); }))
+			{
+				if (debug)
+				{
+					std::cout << "Failed to start an upload batch :/" << std::endl;
+				}
+				destroy_batch(batch);
+				return nullptr;
+			}
+
+			batches.push_back(std::move(batch));
+			return &batches.back();
+		}
+
+
+		// Returns the offset of size free bytes in the batch's last staging block,
+		// or UPLOAD_NO_STAGING if that needed a new block and one couldn't be made
+		vk::DeviceSize allocate_staging(Batch& batch, vk::DeviceSize size)
+		{
+			// Keep copies 16 byte aligned, that satisfies optimalBufferCopyOffsetAlignment everywhere
+			vk::DeviceSize offset = (batch.blockUsed + 15) & ~vk::DeviceSize(15);
+
+			if (batch.staging.empty() || offset + size > batch.staging.back().buffer.size)
+			{
+				StagingBlock block = take_block(size);
+				if (!block.mapped)
+				{
+					if (debug)
+					{
+						std::cout << "Failed to allocate upload staging memory :/" << std::endl;
+					}
+					return UPLOAD_NO_STAGING;
+				}
+				batch.staging.push_back(block);
+				offset = 0;
+			}
+
+			batch.blockUsed = offset + size;
+			batch.stagingUsed += size;
+
+			return offset;
+		}
+
+
+		// mapped is null if the block couldn't be made
+		StagingBlock take_block(vk::DeviceSize size)
+		{
+			if (size <= UPLOAD_STAGING_BLOCK && !freeBlocks.empty())
+			{
+				StagingBlock block = freeBlocks.back();
+				freeBlocks.pop_back();
+				return block;
+			}
+
+			BufferInputChunk bufferInput;
+			bufferInput.size = std::max(size, UPLOAD_STAGING_BLOCK);
+			bufferInput.usage = vk::BufferUsageFlagBits::eTransferSrc;
+			bufferInput.logicalDevice = input.logicalDevice;
+			bufferInput.deviceContext = input.deviceContext;
+			bufferInput.memoryProperties = vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent;
+
+			StagingBlock block;
+			block.buffer = createBuffer(bufferInput, debug);
+			block.mapped = nullptr;
+			if (block.buffer.bufferMemory)
+			{
+				block.mapped = static_cast<uint8_t*>(vkUtil::vk_call([&]() { return input.logicalDevice.mapMemory(block.buffer.bufferMemory, 0, block.buffer.size); }).value_or(nullptr));
+			}
+			if (!block.mapped)
+			{
+				destroyBuffer(input.logicalDevice, block.buffer);
+			}
+
+			return block;
+		}
+
+
+		void add_buffer_barrier(Batch& batch, vk::Buffer buffer, vk::DeviceSize offset, vk::DeviceSize size,
+			vk::PipelineStageFlags dstStage, vk::AccessFlags dstAccess)
+		{
+			vk::BufferMemoryBarrier barrier = {};
+			barrier.buffer = buffer;
+			barrier.offset = offset;
+			barrier.size = size;
+
+			if (ownershipTransfer())
+			{
+				// Release: source half of the ownership transfer, the destination access is ignored
+				barrier.srcAccessMask = vk::AccessFlagBits::eTransferWrite;
+				barrier.srcQueueFamilyIndex = input.transferFamily;
+				barrier.dstQueueFamilyIndex = input.graphicsFamily;
+				batch.releaseBarriers.push_back(barrier);
+
+				// Acquire: the release already made the writes available
+				barrier.srcAccessMask = vk::AccessFlags();
+			}
+			else
+			{
+				barrier.srcAccessMask = vk::AccessFlagBits::eTransferWrite;
+				barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+				barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			}
+
+			barrier.dstAccessMask = dstAccess;
+			batch.acquireBarriers.push_back(barrier);
+			batch.acquireStages |= dstStage;
+		}
+
+
+		// Same as add_buffer_barrier, the layout transition is spelled out identically in release and acquire
+		void add_image_barrier(Batch& batch, vk::Image image, vk::ImageSubresourceRange range, vk::ImageLayout finalLayout,
+			vk::PipelineStageFlags dstStage, vk::AccessFlags dstAccess)
+		{
+			vk::ImageMemoryBarrier barrier = {};
+			barrier.oldLayout = vk::ImageLayout::eTransferDstOptimal;
+			barrier.newLayout = finalLayout;
+			barrier.image = image;
+			barrier.subresourceRange = range;
+
+			if (ownershipTransfer())
+			{
+				barrier.srcAccessMask = vk::AccessFlagBits::eTransferWrite;
+				barrier.srcQueueFamilyIndex = input.transferFamily;
+				barrier.dstQueueFamilyIndex = input.graphicsFamily;
+				batch.releaseImageBarriers.push_back(barrier);
+
+				barrier.srcAccessMask = vk::AccessFlags();
+			}
+			else
+			{
+				barrier.srcAccessMask = vk::AccessFlagBits::eTransferWrite;
+				barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+				barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			}
+
+			barrier.dstAccessMask = dstAccess;
+			batch.acquireImageBarriers.push_back(barrier);
+			batch.acquireStages |= dstStage;
+		}
+
+
+		void release_staging(Batch& batch)
+		{
+			for (StagingBlock& block : batch.staging)
+			{
+				// Oversized blocks aren't worth keeping around
+				if (block.buffer.size == UPLOAD_STAGING_BLOCK)
+				{
+					freeBlocks.push_back(block);
+				}
+				else
+				{
+					input.logicalDevice.unmapMemory(block.buffer.bufferMemory);
+					destroyBuffer(input.logicalDevice, block.buffer);
+				}
+			}
+
+			batch.staging.clear();
+		}
+
+
+		void destroy_batch(Batch& batch)
+		{
+			input.logicalDevice.freeCommandBuffers(commandPool, 1, &batch.commandBuffer);
+			input.logicalDevice.destroyFence(batch.fence);
+			input.logicalDevice.destroySemaphore(batch.semaphore);
+		}
+	};
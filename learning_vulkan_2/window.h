@@ -0,0 +1,33 @@
+#pragma once
+
+#include "config.h"
+#include "frame.h"
+#include "attachment.h"
+
+namespace vkUtil
+{
+	// What one window presents from. The device, pipelines and per-frame data are the engine's and shared by all of them.
+	struct WindowTarget
+	{
+		GLFWwindow* window = nullptr;
+		vk::SurfaceKHR surface{ nullptr };
+		vk::SwapchainKHR swapchain{ nullptr };
+		std::vector<SwapchainFrame> frames;
+		vk::Format format;
+		vk::Extent2D extent;
+
+		// sized like the swapchain, so every window has its own
+		Attachment colorTarget;
+		Attachment depthTarget;
+
+		// signalled when this frame's swapchain image is ready, the frame's submission waits on it
+		vk::Semaphore imageAvailable{ nullptr };
+		uint32_t imageIndex = 0;
+
+		// whether this frame got an image to draw into, a window being resized or minimized may not
+		bool acquired = false;
+
+		// acquire or present said the swapchain no longer matches the surface, it is recreated before the next acquire
+		bool outOfDate = false;
+	};
+}
\ No newline at end of file
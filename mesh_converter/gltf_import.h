@@ -0,0 +1,581 @@
+#pragma once
+
+#include "imported_mesh.h"
+#include "json.h"
+
+#include <filesystem>
+
+namespace meshConverter
+{
+	constexpr int GLTF_UNSIGNED_BYTE = 5121;
+	constexpr int GLTF_UNSIGNED_SHORT = 5123;
+	constexpr int GLTF_UNSIGNED_INT = 5125;
+	constexpr int GLTF_FLOAT = 5126;
+	constexpr int GLTF_TRIANGLES = 4;
+
+	struct GltfDocument
+	{
+		JsonValue json;
+		std::vector<std::vector<uint8_t>> buffers;
+	};
+
+
+	std::vector<uint8_t> decode_base64(const std::string& text)
+	{
+		auto value_of = [](char c) -> int
+		{
+			if (c >= 'A' && c <= 'Z') return c - 'A';
+			if (c >= 'a' && c <= 'z') return c - 'a' + 26;
+			if (c >= '0' && c <= '9') return c - '0' + 52;
+			if (c == '+') return 62;
+			if (c == '/') return 63;
+			return -1;
+		};
+
+		std::vector<uint8_t> bytes;
+		unsigned accumulator = 0;
+		int bits = 0;
+
+		for (char c : text)
+		{
+			int value = value_of(c);
+			if (value < 0)
+			{
+				continue;
+			}
+
+			accumulator = (accumulator << 6) | static_cast<unsigned>(value);
+			bits += 6;
+
+			if (bits >= 8)
+			{
+				bits -= 8;
+				bytes.push_back(static_cast<uint8_t>((accumulator >> bits) & 0xFF));
+			}
+		}
+
+		return bytes;
+	}
+
+
+	std::vector<uint8_t> read_binary_file(const std::filesystem::path& path)
+	{
+		std::ifstream file(path, std::ios::ate | std::ios::binary);
+		if (!file.is_open())
+		{
+			return {};
+		}
+
+		std::vector<uint8_t> bytes(static_cast<size_t>(file.tellg()));
+		file.seekg(0);
+		file.read(reinterpret_cast<char*>(bytes.data()), bytes.size());
+
+		return bytes;
+	}
+
+
+	// .gltf (JSON, external or data: URI buffers) or .glb (binary container)
+	bool read_gltf_document(const std::string& filename, GltfDocument& document)
+	{
+		std::vector<uint8_t> bytes = read_binary_file(filename);
+		if (bytes.empty())
+		{
+			std::cout << "Failed to open \"" << filename << "\"\n";
+			return false;
+		}
+
+		const char* jsonBegin = reinterpret_cast<const char*>(bytes.data());
+		const char* jsonEnd = jsonBegin + bytes.size();
+		std::vector<uint8_t> embeddedBuffer;
+
+		// GLB: 12 byte header, then a JSON chunk and an optional BIN chunk
+		if (bytes.size() >= 20 && memcmp(bytes.data(), "glTF", 4) == 0)
+		{
+			uint32_t jsonLength;
+			memcpy(&jsonLength, bytes.data() + 12, 4);
+
+			if (20 + static_cast<size_t>(jsonLength) > bytes.size())
+			{
+				std::cout << "Truncated GLB file\n";
+				return false;
+			}
+
+			jsonBegin = reinterpret_cast<const char*>(bytes.data() + 20);
+			jsonEnd = jsonBegin + jsonLength;
+
+			size_t binHeader = 20 + jsonLength;
+			if (binHeader + 8 <= bytes.size())
+			{
+				uint32_t binLength;
+				memcpy(&binLength, bytes.data() + binHeader, 4);
+
+				if (binHeader + 8 + binLength <= bytes.size())
+				{
+					embeddedBuffer.assign(bytes.begin() + binHeader + 8, bytes.begin() + binHeader + 8 + binLength);
+				}
+			}
+		}
+
+		if (!parse_json(jsonBegin, jsonEnd, document.json))
+		{
+			std::cout << "Failed to parse glTF JSON\n";
+			return false;
+		}
+
+		const JsonValue* buffers = document.json.find("buffers");
+		if (!buffers)
+		{
+			return true;
+		}
+
+		std::filesystem::path directory = std::filesystem::path(filename).parent_path();
+
+		for (const JsonValue& buffer : buffers->array)
+		{
+			std::string uri = buffer.string_or("uri", "");
+
+			if (uri.empty())
+			{
+				// GLB BIN chunk
+				document.buffers.push_back(embeddedBuffer);
+			}
+			else if (uri.rfind("data:", 0) == 0)
+			{
+				size_t comma = uri.find(',');
+				document.buffers.push_back(decode_base64(comma == std::string::npos ? "" : uri.substr(comma + 1)));
+			}
+			else
+			{
+				document.buffers.push_back(read_binary_file(directory / uri));
+			}
+
+			if (document.buffers.back().size() < buffer.index_or("byteLength", 0))
+			{
+				std::cout << "glTF buffer \"" << uri << "\" is missing or truncated\n";
+				return false;
+			}
+		}
+
+		return true;
+	}
+
+
+	// Reads an accessor as floats, componentCount per element.
+	// Normalized integer components are mapped to [0, 1]
+	bool read_gltf_floats(const GltfDocument& document, size_t accessorIdx, int componentCount, std::vector<float>& out)
+	{
+		const JsonValue* accessors = document.json.find("accessors");
+		const JsonValue* bufferViews = document.json.find("bufferViews");
+		if (!accessors || !bufferViews || accessorIdx >= accessors->array.size())
+		{
+			return false;
+		}
+
+		const JsonValue& accessor = accessors->array[accessorIdx];
+		size_t count = accessor.index_or("count", 0);
+		int componentType = static_cast<int>(accessor.number_or("componentType", 0));
+
+		size_t viewIdx = accessor.index_or("bufferView", SIZE_MAX);
+		if (viewIdx >= bufferViews->array.size())
+		{
+			// No buffer view means all zeros
+			out.assign(count * componentCount, 0.0f);
+			return true;
+		}
+
+		const JsonValue& view = bufferViews->array[viewIdx];
+		size_t bufferIdx = view.index_or("buffer", 0);
+		if (bufferIdx >= document.buffers.size())
+		{
+			return false;
+		}
+
+		size_t componentSize = componentType == GLTF_FLOAT || componentType == GLTF_UNSIGNED_INT ? 4
+			: (componentType == GLTF_UNSIGNED_SHORT ? 2 : 1);
+		size_t stride = view.index_or("byteStride", 0);
+		if (stride == 0)
+		{
+			stride = componentSize * componentCount;
+		}
+
+		size_t offset = static_cast<size_t>(view.number_or("byteOffset", 0) + accessor.number_or("byteOffset", 0));
+		const std::vector<uint8_t>& buffer = document.buffers[bufferIdx];
+
+		if (count > 0 && offset + (count - 1) * stride + componentSize * componentCount > buffer.size())
+		{
+			return false;
+		}
+
+		out.resize(count * componentCount);
+
+		for (size_t ii = 0; ii < count; ii++)
+		{
+			const uint8_t* element = buffer.data() + offset + ii * stride;
+
+			for (int k = 0; k < componentCount; k++)
+			{
+				float value = 0.0f;
+
+				switch (componentType)
+				{
+				case (GLTF_FLOAT):
+					memcpy(&value, element + 4 * k, 4);
+					break;
+
+				case (GLTF_UNSIGNED_SHORT):
+				{
+					uint16_t raw;
+					memcpy(&raw, element + 2 * k, 2);
+					value = raw / 65535.0f;
+					break;
+				}
+
+				case (GLTF_UNSIGNED_BYTE):
+					value = element[k] / 255.0f;
+					break;
+
+				default:
+					return false;
+				}
+
+				out[ii * componentCount + k] = value;
+			}
+		}
+
+		return true;
+	}
+
+
+	bool read_gltf_indices(const GltfDocument& document, size_t accessorIdx, std::vector<uint32_t>& out)
+	{
+		const JsonValue* accessors = document.json.find("accessors");
+		const JsonValue* bufferViews = document.json.find("bufferViews");
+		if (!accessors || !bufferViews || accessorIdx >= accessors->array.size())
+		{
+			return false;
+		}
+
+		const JsonValue& accessor = accessors->array[accessorIdx];
+		size_t viewIdx = accessor.index_or("bufferView", SIZE_MAX);
+		if (viewIdx >= bufferViews->array.size())
+		{
+			return false;
+		}
+
+		const JsonValue& view = bufferViews->array[viewIdx];
+		size_t bufferIdx = view.index_or("buffer", 0);
+		if (bufferIdx >= document.buffers.size())
+		{
+			return false;
+		}
+
+		const std::vector<uint8_t>& buffer = document.buffers[bufferIdx];
+
+		size_t count = accessor.index_or("count", 0);
+		int componentType = static_cast<int>(accessor.number_or("componentType", 0));
+		size_t size = componentType == GLTF_UNSIGNED_INT ? 4 : (componentType == GLTF_UNSIGNED_SHORT ? 2 : 1);
+		size_t offset = static_cast<size_t>(view.number_or("byteOffset", 0) + accessor.number_or("byteOffset", 0));
+
+		if (offset + count * size > buffer.size())
+		{
+			return false;
+		}
+
+		out.resize(count);
+		for (size_t ii = 0; ii < count; ii++)
+		{
+			const uint8_t* element = buffer.data() + offset + ii * size;
+
+			if (size == 4)
+			{
+				memcpy(&out[ii], element, 4);
+			}
+			else if (size == 2)
+			{
+				uint16_t value;
+				memcpy(&value, element, 2);
+				out[ii] = value;
+			}
+			else
+			{
+				out[ii] = element[0];
+			}
+		}
+
+		return true;
+	}
+
+
+	// Column major 4x4, result = a * b
+	void multiply_gltf_matrices(const float a[16], const float b[16], float result[16])
+	{
+		float product[16];
+
+		for (int j = 0; j < 4; j++)
+		{
+			for (int i = 0; i < 4; i++)
+			{
+				product[j * 4 + i] = a[i] * b[j * 4] + a[4 + i] * b[j * 4 + 1] + a[8 + i] * b[j * 4 + 2] + a[12 + i] * b[j * 4 + 3];
+			}
+		}
+
+		memcpy(result, product, sizeof(product));
+	}
+
+
+	// Either "matrix" or translation * rotation * scale
+	void gltf_node_matrix(const JsonValue& node, float matrix[16])
+	{
+		const JsonValue* explicitMatrix = node.find("matrix");
+		if (explicitMatrix && explicitMatrix->array.size() == 16)
+		{
+			for (int ii = 0; ii < 16; ii++)
+			{
+				matrix[ii] = static_cast<float>(explicitMatrix->array[ii].number);
+			}
+			return;
+		}
+
+		float t[3] = { 0.0f, 0.0f, 0.0f };
+		float q[4] = { 0.0f, 0.0f, 0.0f, 1.0f };
+		float s[3] = { 1.0f, 1.0f, 1.0f };
+
+		auto read = [&](const char* key, float* target, size_t count)
+		{
+			const JsonValue* value = node.find(key);
+			if (value && value->array.size() == count)
+			{
+				for (size_t ii = 0; ii < count; ii++)
+				{
+					target[ii] = static_cast<float>(value->array[ii].number);
+				}
+			}
+		};
+		read("translation", t, 3);
+		read("rotation", q, 4);
+		read("scale", s, 3);
+
+		float x = q[0], y = q[1], z = q[2], w = q[3];
+		float rotation[9] = {
+			1 - 2 * (y * y + z * z), 2 * (x * y + z * w),     2 * (x * z - y * w),
+			2 * (x * y - z * w),     1 - 2 * (x * x + z * z), 2 * (y * z + x * w),
+			2 * (x * z + y * w),     2 * (y * z - x * w),     1 - 2 * (x * x + y * y)
+		};
+
+		for (int j = 0; j < 3; j++)
+		{
+			for (int i = 0; i < 3; i++)
+			{
+				matrix[j * 4 + i] = rotation[j * 3 + i] * s[j];
+			}
+			matrix[j * 4 + 3] = 0.0f;
+		}
+
+		matrix[12] = t[0];
+		matrix[13] = t[1];
+		matrix[14] = t[2];
+		matrix[15] = 1.0f;
+	}
+
+
+	bool import_gltf_mesh(const GltfDocument& document, const JsonValue& gltfMesh, const float transform[16], ImportedMesh& mesh)
+	{
+		const JsonValue* primitives = gltfMesh.find("primitives");
+		if (!primitives)
+		{
+			return true;
+		}
+
+		for (const JsonValue& primitive : primitives->array)
+		{
+			if (primitive.number_or("mode", GLTF_TRIANGLES) != GLTF_TRIANGLES)
+			{
+				std::cout << "Skipping a non triangle list primitive\n";
+				continue;
+			}
+
+			const JsonValue* attributes = primitive.find("attributes");
+			if (!attributes || !attributes->find("POSITION"))
+			{
+				continue;
+			}
+
+			std::vector<float> positions, normals, uvs;
+			if (!read_gltf_floats(document, attributes->index_or("POSITION", 0), 3, positions))
+			{
+				std::cout << "Failed to read primitive positions\n";
+				return false;
+			}
+
+			if (attributes->find("NORMAL"))
+			{
+				read_gltf_floats(document, attributes->index_or("NORMAL", 0), 3, normals);
+			}
+
+			if (attributes->find("TEXCOORD_0"))
+			{
+				read_gltf_floats(document, attributes->index_or("TEXCOORD_0", 0), 2, uvs);
+			}
+
+			uint32_t baseVertex = static_cast<uint32_t>(mesh.vertices.size());
+			size_t vertexCount = positions.size() / 3;
+
+			for (size_t ii = 0; ii < vertexCount; ii++)
+			{
+				vkMesh::MeshVertex vertex = {};
+				const float* p = &positions[3 * ii];
+
+				for (int k = 0; k < 3; k++)
+				{
+					vertex.position[k] = transform[k] * p[0] + transform[4 + k] * p[1] + transform[8 + k] * p[2] + transform[12 + k];
+				}
+
+				// Upper 3x3 then renormalize, exact for rotations and uniform scale
+				if (normals.size() == positions.size())
+				{
+					const float* n = &normals[3 * ii];
+					float length = 0.0f;
+
+					for (int k = 0; k < 3; k++)
+					{
+						vertex.normal[k] = transform[k] * n[0] + transform[4 + k] * n[1] + transform[8 + k] * n[2];
+						length += vertex.normal[k] * vertex.normal[k];
+					}
+
+					length = std::sqrt(length);
+					for (int k = 0; k < 3 && length > 0.0f; k++)
+					{
+						vertex.normal[k] /= length;
+					}
+				}
+
+				if (uvs.size() / 2 == vertexCount)
+				{
+					vertex.uv[0] = uvs[2 * ii];
+					vertex.uv[1] = uvs[2 * ii + 1];
+				}
+
+				mesh.vertices.push_back(vertex);
+			}
+
+			vkMesh::MeshFileSubmesh submesh = {};
+			submesh.firstIndex = static_cast<uint32_t>(mesh.indices.size());
+			submesh.material = static_cast<uint32_t>(primitive.number_or("material", 0));
+
+			std::vector<uint32_t> indices;
+			if (primitive.find("indices"))
+			{
+				if (!read_gltf_indices(document, primitive.index_or("indices", 0), indices))
+				{
+					std::cout << "Failed to read primitive indices\n";
+					return false;
+				}
+			}
+			else
+			{
+				for (uint32_t ii = 0; ii < vertexCount; ii++)
+				{
+					indices.push_back(ii);
+				}
+			}
+
+			for (uint32_t index : indices)
+			{
+				mesh.indices.push_back(baseVertex + index);
+			}
+
+			submesh.indexCount = static_cast<uint32_t>(indices.size());
+			if (submesh.indexCount > 0)
+			{
+				mesh.submeshes.push_back(submesh);
+			}
+		}
+
+		return true;
+	}
+
+
+	bool import_gltf_node(const GltfDocument& document, size_t nodeIdx, const float parentTransform[16], int depth, ImportedMesh& mesh)
+	{
+		const JsonValue* nodes = document.json.find("nodes");
+		if (!nodes || nodeIdx >= nodes->array.size() || depth > 64)
+		{
+			return false;
+		}
+
+		const JsonValue& node = nodes->array[nodeIdx];
+
+		float local[16];
+		float world[16];
+		gltf_node_matrix(node, local);
+		multiply_gltf_matrices(parentTransform, local, world);
+
+		const JsonValue* meshes = document.json.find("meshes");
+		size_t meshIdx = node.index_or("mesh", SIZE_MAX);
+		if (meshes && meshIdx < meshes->array.size())
+		{
+			if (!import_gltf_mesh(document, meshes->array[meshIdx], world, mesh))
+			{
+				return false;
+			}
+		}
+
+		if (const JsonValue* children = node.find("children"))
+		{
+			for (const JsonValue& child : children->array)
+			{
+				if (!import_gltf_node(document, static_cast<size_t>(child.number), world, depth + 1, mesh))
+				{
+					return false;
+				}
+			}
+		}
+
+		return true;
+	}
+
+
+	// Flattens the default scene (node transforms baked into the vertices) into one mesh.
+	// Files without a scene have every mesh converted as-is.
+	bool import_gltf(const std::string& filename, ImportedMesh& mesh)
+	{
+		GltfDocument document;
+		if (!read_gltf_document(filename, document))
+		{
+			return false;
+		}
+
+		const float identity[16] = { 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1 };
+
+		const JsonValue* scenes = document.json.find("scenes");
+		size_t sceneIdx = document.json.index_or("scene", 0);
+
+		if (scenes && sceneIdx < scenes->array.size())
+		{
+			if (const JsonValue* roots = scenes->array[sceneIdx].find("nodes"))
+			{
+				for (const JsonValue& root : roots->array)
+				{
+					if (!import_gltf_node(document, static_cast<size_t>(root.number), identity, 0, mesh))
+					{
+						return false;
+					}
+				}
+			}
+		}
+		else if (const JsonValue* meshes = document.json.find("meshes"))
+		{
+			for (const JsonValue& gltfMesh : meshes->array)
+			{
+				if (!import_gltf_mesh(document, gltfMesh, identity, mesh))
+				{
+					return false;
+				}
+			}
+		}
+
+		generate_missing_normals(mesh);
+
+		return !mesh.indices.empty();
+	}
+}
\ No newline at end of file
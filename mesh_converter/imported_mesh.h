@@ -0,0 +1,188 @@
+#pragma once
+
+#include "mesh_format.h"
+
+#include <iostream>
+#include <vector>
+#include <string>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+#include <fstream>
+
+namespace meshConverter
+{
+	// Geometry as read from a source file, before it is written out
+	struct ImportedMesh
+	{
+		std::vector<vkMesh::MeshVertex> vertices;
+		std::vector<uint32_t> indices;
+		std::vector<vkMesh::MeshFileSubmesh> submeshes;
+	};
+
+
+	// Smooth normals for vertices the source file left without one (all zero)
+	void generate_missing_normals(ImportedMesh& mesh)
+	{
+		std::vector<bool> missing(mesh.vertices.size());
+		bool anyMissing = false;
+
+		for (size_t ii = 0; ii < mesh.vertices.size(); ii++)
+		{
+			const float* n = mesh.vertices[ii].normal;
+			missing[ii] = n[0] == 0.0f && n[1] == 0.0f && n[2] == 0.0f;
+			anyMissing = anyMissing || missing[ii];
+		}
+
+		if (!anyMissing)
+		{
+			return;
+		}
+
+		// Area weighted face normals, accumulated on each corner
+		for (size_t ii = 0; ii + 2 < mesh.indices.size(); ii += 3)
+		{
+			vkMesh::MeshVertex& a = mesh.vertices[mesh.indices[ii]];
+			vkMesh::MeshVertex& b = mesh.vertices[mesh.indices[ii + 1]];
+			vkMesh::MeshVertex& c = mesh.vertices[mesh.indices[ii + 2]];
+
+			float ab[3] = { b.position[0] - a.position[0], b.position[1] - a.position[1], b.position[2] - a.position[2] };
+			float ac[3] = { c.position[0] - a.position[0], c.position[1] - a.position[1], c.position[2] - a.position[2] };
+			float faceNormal[3] = {
+				ab[1] * ac[2] - ab[2] * ac[1],
+				ab[2] * ac[0] - ab[0] * ac[2],
+				ab[0] * ac[1] - ab[1] * ac[0]
+			};
+
+			for (size_t corner = 0; corner < 3; corner++)
+			{
+				uint32_t idx = mesh.indices[ii + corner];
+				if (missing[idx])
+				{
+					for (int k = 0; k < 3; k++)
+					{
+						mesh.vertices[idx].normal[k] += faceNormal[k];
+					}
+				}
+			}
+		}
+
+		for (size_t ii = 0; ii < mesh.vertices.size(); ii++)
+		{
+			if (!missing[ii])
+			{
+				continue;
+			}
+
+			float* n = mesh.vertices[ii].normal;
+			float length = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+
+			if (length > 0.0f)
+			{
+				n[0] /= length;
+				n[1] /= length;
+				n[2] /= length;
+			}
+		}
+	}
+
+
+	bool write_mesh_file(const ImportedMesh& mesh, const std::string& filename)
+	{
+		if (!vkMesh::host_is_little_endian())
+		{
+			std::cout << "Mesh files are little-endian, converting on a big-endian host is not supported\n";
+			return false;
+		}
+
+		vkMesh::MeshFileHeader header = {};
+		memcpy(header.magic, vkMesh::MESH_FILE_MAGIC, sizeof(header.magic));
+		header.version = vkMesh::MESH_FILE_VERSION;
+		header.headerSize = sizeof(vkMesh::MeshFileHeader);
+		header.vertexStride = sizeof(vkMesh::MeshVertex);
+		header.submeshCount = static_cast<uint32_t>(mesh.submeshes.size());
+		header.vertexCount = mesh.vertices.size();
+		header.indexCount = mesh.indices.size();
+
+		// 16 bit indices whenever they are enough, half the index bandwidth
+		bool shortIndices = mesh.vertices.size() <= UINT16_MAX;
+		header.indexType = shortIndices ? vkMesh::MeshIndexType::eUint16 : vkMesh::MeshIndexType::eUint32;
+
+		header.submeshOffset = sizeof(vkMesh::MeshFileHeader);
+		header.vertexOffset = vkMesh::align_mesh_offset(header.submeshOffset + mesh.submeshes.size() * sizeof(vkMesh::MeshFileSubmesh));
+		header.vertexSize = mesh.vertices.size() * sizeof(vkMesh::MeshVertex);
+		header.indexOffset = vkMesh::align_mesh_offset(header.vertexOffset + header.vertexSize);
+		header.indexSize = mesh.indices.size() * static_cast<uint64_t>(header.indexType);
+
+		// Bounds: box from the positions, sphere around the box center
+		for (int k = 0; k < 3; k++)
+		{
+			header.aabbMin[k] = mesh.vertices.empty() ? 0.0f : mesh.vertices[0].position[k];
+			header.aabbMax[k] = header.aabbMin[k];
+		}
+		for (const vkMesh::MeshVertex& vertex : mesh.vertices)
+		{
+			for (int k = 0; k < 3; k++)
+			{
+				header.aabbMin[k] = std::min(header.aabbMin[k], vertex.position[k]);
+				header.aabbMax[k] = std::max(header.aabbMax[k], vertex.position[k]);
+			}
+		}
+		for (int k = 0; k < 3; k++)
+		{
+			header.sphereCenter[k] = 0.5f * (header.aabbMin[k] + header.aabbMax[k]);
+		}
+		float radiusSquared = 0.0f;
+		for (const vkMesh::MeshVertex& vertex : mesh.vertices)
+		{
+			float dx = vertex.position[0] - header.sphereCenter[0];
+			float dy = vertex.position[1] - header.sphereCenter[1];
+			float dz = vertex.position[2] - header.sphereCenter[2];
+			radiusSquared = std::max(radiusSquared, dx * dx + dy * dy + dz * dz);
+		}
+		header.sphereRadius = std::sqrt(radiusSquared);
+
+
+		std::ofstream file(filename, std::ios::binary | std::ios::trunc);
+		if (!file.is_open())
+		{
+			std::cout << "Failed to open \"" << filename << "\" for writing\n";
+			return false;
+		}
+
+		auto pad_to = [&](uint64_t offset)
+		{
+			static const char zeros[vkMesh::MESH_FILE_ALIGNMENT] = {};
+			uint64_t position = static_cast<uint64_t>(file.tellp());
+			file.write(zeros, static_cast<std::streamsize>(offset - position));
+		};
+
+		file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		file.write(reinterpret_cast<const char*>(mesh.submeshes.data()), mesh.submeshes.size() * sizeof(vkMesh::MeshFileSubmesh));
+
+		pad_to(header.vertexOffset);
+		file.write(reinterpret_cast<const char*>(mesh.vertices.data()), header.vertexSize);
+
+		pad_to(header.indexOffset);
+		if (shortIndices)
+		{
+			std::vector<uint16_t> shortened(mesh.indices.begin(), mesh.indices.end());
+			file.write(reinterpret_cast<const char*>(shortened.data()), header.indexSize);
+		}
+		else
+		{
+			file.write(reinterpret_cast<const char*>(mesh.indices.data()), header.indexSize);
+		}
+
+		if (!file.good())
+		{
+			std::cout << "Failed while writing \"" << filename << "\"\n";
+			return false;
+		}
+
+		std::cout << "Wrote \"" << filename << "\": " << header.vertexCount << " vertices, "
+			<< header.indexCount << " indices, " << header.submeshCount << " submesh(es)\n";
+
+		return true;
+	}
+}
\ No newline at end of file
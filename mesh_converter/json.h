@@ -0,0 +1,310 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <utility>
+#include <cstdlib>
+#include <cctype>
+
+namespace meshConverter
+{
+	// Just enough JSON to read glTF documents
+	struct JsonValue
+	{
+		enum class Type
+		{
+			eNull,
+			eBool,
+			eNumber,
+			eString,
+			eArray,
+			eObject
+		};
+
+		Type type = Type::eNull;
+		bool boolean = false;
+		double number = 0.0;
+		std::string string;
+		std::vector<JsonValue> array;
+		std::vector<std::pair<std::string, JsonValue>> members;
+
+		const JsonValue* find(const std::string& key) const
+		{
+			for (const auto& member : members)
+			{
+				if (member.first == key)
+				{
+					return &member.second;
+				}
+			}
+
+			return nullptr;
+		}
+
+		double number_or(const std::string& key, double fallback) const
+		{
+			const JsonValue* value = find(key);
+			return value && value->type == Type::eNumber ? value->number : fallback;
+		}
+
+		// Array indices: fallback if the key is missing or not a valid index
+		size_t index_or(const std::string& key, size_t fallback) const
+		{
+			const JsonValue* value = find(key);
+			return value && value->type == Type::eNumber && value->number >= 0.0 ? static_cast<size_t>(value->number) : fallback;
+		}
+
+		std::string string_or(const std::string& key, const std::string& fallback) const
+		{
+			const JsonValue* value = find(key);
+			return value && value->type == Type::eString ? value->string : fallback;
+		}
+	};
+
+
+	void skip_json_whitespace(const char*& text, const char* end)
+	{
+		while (text < end && (*text == ' ' || *text == '\t' || *text == '\n' || *text == '\r'))
+		{
+			text++;
+		}
+	}
+
+
+	void append_utf8(std::string& out, unsigned codepoint)
+	{
+		if (codepoint < 0x80)
+		{
+			out += static_cast<char>(codepoint);
+		}
+		else if (codepoint < 0x800)
+		{
+			out += static_cast<char>(0xC0 | (codepoint >> 6));
+			out += static_cast<char>(0x80 | (codepoint & 0x3F));
+		}
+		else
+		{
+			out += static_cast<char>(0xE0 | (codepoint >> 12));
+			out += static_cast<char>(0x80 | ((codepoint >> 6) & 0x3F));
+			out += static_cast<char>(0x80 | (codepoint & 0x3F));
+		}
+	}
+
+
+	bool parse_json_string(const char*& text, const char* end, std::string& out)
+	{
+		// opening quote
+		text++;
+
+		while (text < end && *text != '"')
+		{
+			if (*text != '\\')
+			{
+				out += *text++;
+				continue;
+			}
+
+			text++;
+			if (text >= end)
+			{
+				return false;
+			}
+
+			switch (*text)
+			{
+			case ('n'):
+				out += '\n';
+				break;
+
+			case ('t'):
+				out += '\t';
+				break;
+
+			case ('r'):
+				out += '\r';
+				break;
+
+			case ('b'):
+				out += '\b';
+				break;
+
+			case ('f'):
+				out += '\f';
+				break;
+
+			case ('u'):
+			{
+				if (end - text < 5)
+				{
+					return false;
+				}
+				std::string hex(text + 1, text + 5);
+				append_utf8(out, static_cast<unsigned>(std::strtoul(hex.c_str(), nullptr, 16)));
+				text += 4;
+				break;
+			}
+
+			default:
+				out += *text;
+			}
+
+			text++;
+		}
+
+		if (text >= end)
+		{
+			return false;
+		}
+
+		// closing quote
+		text++;
+		return true;
+	}
+
+
+	bool parse_json(const char*& text, const char* end, JsonValue& value)
+	{
+		skip_json_whitespace(text, end);
+
+		if (text >= end)
+		{
+			return false;
+		}
+
+		if (*text == '{')
+		{
+			value.type = JsonValue::Type::eObject;
+			text++;
+			skip_json_whitespace(text, end);
+
+			if (text < end && *text == '}')
+			{
+				text++;
+				return true;
+			}
+
+			while (text < end)
+			{
+				skip_json_whitespace(text, end);
+
+				std::pair<std::string, JsonValue> member;
+				if (text >= end || *text != '"' || !parse_json_string(text, end, member.first))
+				{
+					return false;
+				}
+
+				skip_json_whitespace(text, end);
+				if (text >= end || *text != ':')
+				{
+					return false;
+				}
+				text++;
+
+				if (!parse_json(text, end, member.second))
+				{
+					return false;
+				}
+				value.members.push_back(std::move(member));
+
+				skip_json_whitespace(text, end);
+				if (text < end && *text == ',')
+				{
+					text++;
+				}
+				else if (text < end && *text == '}')
+				{
+					text++;
+					return true;
+				}
+				else
+				{
+					return false;
+				}
+			}
+
+			return false;
+		}
+
+		if (*text == '[')
+		{
+			value.type = JsonValue::Type::eArray;
+			text++;
+			skip_json_whitespace(text, end);
+
+			if (text < end && *text == ']')
+			{
+				text++;
+				return true;
+			}
+
+			while (text < end)
+			{
+				value.array.emplace_back();
+				if (!parse_json(text, end, value.array.back()))
+				{
+					return false;
+				}
+
+				skip_json_whitespace(text, end);
+				if (text < end && *text == ',')
+				{
+					text++;
+				}
+				else if (text < end && *text == ']')
+				{
+					text++;
+					return true;
+				}
+				else
+				{
+					return false;
+				}
+			}
+
+			return false;
+		}
+
+		if (*text == '"')
+		{
+			value.type = JsonValue::Type::eString;
+			return parse_json_string(text, end, value.string);
+		}
+
+		if (end - text >= 4 && std::string(text, 4) == "true")
+		{
+			value.type = JsonValue::Type::eBool;
+			value.boolean = true;
+			text += 4;
+			return true;
+		}
+
+		if (end - text >= 5 && std::string(text, 5) == "false")
+		{
+			value.type = JsonValue::Type::eBool;
+			text += 5;
+			return true;
+		}
+
+		if (end - text >= 4 && std::string(text, 4) == "null")
+		{
+			text += 4;
+			return true;
+		}
+
+		// number
+		std::string digits;
+		while (text < end && (isdigit(static_cast<unsigned char>(*text)) || *text == '-' || *text == '+' || *text == '.' || *text == 'e' || *text == 'E'))
+		{
+			digits += *text++;
+		}
+
+		if (digits.empty())
+		{
+			return false;
+		}
+
+		value.type = JsonValue::Type::eNumber;
+		value.number = std::strtod(digits.c_str(), nullptr);
+		return true;
+	}
+}
\ No newline at end of file
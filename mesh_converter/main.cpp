@@ -0,0 +1,43 @@
+#include "obj_import.h"
+#include "gltf_import.h"
+
+// Offline converter: OBJ / glTF / GLB -> binary mesh file the engine can map and upload directly
+int main(int argc, char** argv)
+{
+	if (argc != 3)
+	{
+		std::cout << "Usage: mesh_converter <input.obj|input.gltf|input.glb> <output.mesh>\n";
+		return 1;
+	}
+
+	std::string input = argv[1];
+	std::string output = argv[2];
+
+	std::string extension = std::filesystem::path(input).extension().string();
+	std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+
+	meshConverter::ImportedMesh mesh;
+	bool imported = false;
+
+	if (extension == ".obj")
+	{
+		imported = meshConverter::import_obj(input, mesh);
+	}
+	else if (extension == ".gltf" || extension == ".glb")
+	{
+		imported = meshConverter::import_gltf(input, mesh);
+	}
+	else
+	{
+		std::cout << "Unsupported input format \"" << extension << "\"\n";
+		return 1;
+	}
+
+	if (!imported)
+	{
+		std::cout << "Failed to import \"" << input << "\"\n";
+		return 1;
+	}
+
+	return meshConverter::write_mesh_file(mesh, output) ? 0 : 1;
+}
\ No newline at end of file
@@ -0,0 +1,229 @@
+#pragma once
+
+#include "imported_mesh.h"
+
+#include <unordered_map>
+#include <sstream>
+
+namespace meshConverter
+{
+	// Parses an integer index at text, advancing text past it. Returns 0 if there is none
+	long parse_obj_index(const char*& text)
+	{
+		char* end = nullptr;
+		long value = std::strtol(text, &end, 10);
+
+		if (end == text)
+		{
+			return 0;
+		}
+
+		text = end;
+		return value;
+	}
+
+
+	// OBJ indices are 1 based, negative ones count back from the end
+	long resolve_obj_index(long index, size_t count)
+	{
+		if (index > 0)
+		{
+			return index - 1;
+		}
+
+		if (index < 0)
+		{
+			return static_cast<long>(count) + index;
+		}
+
+		return -1;
+	}
+
+
+	bool import_obj(const std::string& filename, ImportedMesh& mesh)
+	{
+		std::ifstream file(filename);
+		if (!file.is_open())
+		{
+			std::cout << "Failed to open \"" << filename << "\"\n";
+			return false;
+		}
+
+		std::vector<float> positions;
+		std::vector<float> normals;
+		std::vector<float> uvs;
+
+		// position/uv/normal triplet -> output vertex
+		struct Corner
+		{
+			long position, uv, normal;
+
+			bool operator==(const Corner& other) const
+			{
+				return position == other.position && uv == other.uv && normal == other.normal;
+			}
+		};
+
+		struct CornerHash
+		{
+			size_t operator()(const Corner& corner) const
+			{
+				size_t hash = std::hash<long>()(corner.position);
+				hash ^= std::hash<long>()(corner.uv) + 0x9e3779b97f4a7c15ULL + (hash << 6) + (hash >> 2);
+				hash ^= std::hash<long>()(corner.normal) + 0x9e3779b97f4a7c15ULL + (hash << 6) + (hash >> 2);
+				return hash;
+			}
+		};
+
+		std::unordered_map<Corner, uint32_t, CornerHash> uniqueCorners;
+		std::unordered_map<std::string, uint32_t> materials;
+
+		vkMesh::MeshFileSubmesh submesh = {};
+
+		auto close_submesh = [&]()
+		{
+			submesh.indexCount = static_cast<uint32_t>(mesh.indices.size()) - submesh.firstIndex;
+
+			if (submesh.indexCount > 0)
+			{
+				mesh.submeshes.push_back(submesh);
+			}
+
+			submesh.firstIndex = static_cast<uint32_t>(mesh.indices.size());
+		};
+
+		std::string line;
+		std::vector<uint32_t> polygon;
+
+		while (std::getline(file, line))
+		{
+			const char* text = line.c_str();
+
+			while (*text == ' ' || *text == '\t')
+			{
+				text++;
+			}
+
+			if (strncmp(text, "v ", 2) == 0 || strncmp(text, "vn ", 3) == 0 || strncmp(text, "vt ", 3) == 0)
+			{
+				std::vector<float>& target = text[1] == 'n' ? normals : (text[1] == 't' ? uvs : positions);
+				int components = text[1] == 't' ? 2 : 3;
+				text += text[1] == ' ' ? 2 : 3;
+
+				for (int k = 0; k < components; k++)
+				{
+					char* end = nullptr;
+					target.push_back(std::strtof(text, &end));
+					text = end;
+				}
+			}
+			else if (strncmp(text, "f ", 2) == 0)
+			{
+				text += 2;
+				polygon.clear();
+
+				while (true)
+				{
+					while (*text == ' ' || *text == '\t')
+					{
+						text++;
+					}
+
+					if (*text == '\0' || *text == '\r')
+					{
+						break;
+					}
+
+					// v, v/vt, v//vn or v/vt/vn
+					Corner corner = { 0, 0, 0 };
+					corner.position = parse_obj_index(text);
+					if (*text == '/')
+					{
+						text++;
+						corner.uv = parse_obj_index(text);
+
+						if (*text == '/')
+						{
+							text++;
+							corner.normal = parse_obj_index(text);
+						}
+					}
+
+					// Skip anything unparsable up to the next corner
+					while (*text != '\0' && *text != ' ' && *text != '\t' && *text != '\r')
+					{
+						text++;
+					}
+
+					corner.position = resolve_obj_index(corner.position, positions.size() / 3);
+					corner.uv = resolve_obj_index(corner.uv, uvs.size() / 2);
+					corner.normal = resolve_obj_index(corner.normal, normals.size() / 3);
+
+					if (corner.position < 0 || static_cast<size_t>(corner.position) >= positions.size() / 3)
+					{
+						std::cout << "Face references a missing position, skipping it\n";
+						continue;
+					}
+
+					auto found = uniqueCorners.find(corner);
+					if (found != uniqueCorners.end())
+					{
+						polygon.push_back(found->second);
+						continue;
+					}
+
+					vkMesh::MeshVertex vertex = {};
+					memcpy(vertex.position, &positions[3 * corner.position], sizeof(vertex.position));
+
+					if (corner.normal >= 0 && static_cast<size_t>(corner.normal) < normals.size() / 3)
+					{
+						memcpy(vertex.normal, &normals[3 * corner.normal], sizeof(vertex.normal));
+					}
+
+					if (corner.uv >= 0 && static_cast<size_t>(corner.uv) < uvs.size() / 2)
+					{
+						// OBJ puts v = 0 at the bottom, Vulkan samples with v = 0 at the top
+						vertex.uv[0] = uvs[2 * corner.uv];
+						vertex.uv[1] = 1.0f - uvs[2 * corner.uv + 1];
+					}
+
+					uint32_t idx = static_cast<uint32_t>(mesh.vertices.size());
+					mesh.vertices.push_back(vertex);
+					uniqueCorners.emplace(corner, idx);
+					polygon.push_back(idx);
+				}
+
+				// Triangle fan
+				for (size_t ii = 2; ii < polygon.size(); ii++)
+				{
+					mesh.indices.push_back(polygon[0]);
+					mesh.indices.push_back(polygon[ii - 1]);
+					mesh.indices.push_back(polygon[ii]);
+				}
+			}
+			else if (strncmp(text, "usemtl", 6) == 0)
+			{
+				close_submesh();
+
+				std::string name = text + 6;
+				name.erase(0, name.find_first_not_of(" \t"));
+				name.erase(name.find_last_not_of(" \t\r") + 1);
+
+				auto found = materials.find(name);
+				if (found == materials.end())
+				{
+					found = materials.emplace(name, static_cast<uint32_t>(materials.size())).first;
+				}
+				submesh.material = found->second;
+			}
+		}
+
+		close_submesh();
+		generate_missing_normals(mesh);
+
+		std::cout << "Read \"" << filename << "\": " << positions.size() / 3 << " positions, "
+			<< materials.size() << " material(s)\n";
+
+		return !mesh.indices.empty();
+	}
+}
\ No newline at end of file